@@ -4,8 +4,16 @@ uniform vec4 color_modulate = vec4(1.0);
 
 out vec2 tc;
 
+#ifdef USE_CUSTOM_XFORM
+layout(location = 12) in mat4 inst_xform_matrix; // per-instance model transform; fixed location so that the vertex attributes keep their usual locations
+#endif
+
 void main() {
 	tc          = fg_TexCoord;
-	gl_Position = fg_ModelViewProjectionMatrix * (vec4(xlate, 0.0) + (vec4(scale, 1.0) * fg_Vertex));
+	vec4 vertex = vec4(xlate, 0.0) + (vec4(scale, 1.0) * fg_Vertex);
+#ifdef USE_CUSTOM_XFORM
+	vertex      = inst_xform_matrix * vertex;
+#endif
+	gl_Position = fg_ModelViewProjectionMatrix * vertex;
 	fg_Color_vf = fg_Color * color_modulate;
 } 
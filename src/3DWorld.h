@@ -640,6 +640,31 @@ struct vector_point_norm {
 };
 
 
+// SoA object arrays and result bitmask for batched view frustum culling
+struct vfc_sphere_batch_t {
+	vector<float> x, y, z, r;
+
+	unsigned size() const {return x.size();}
+	void clear() {x.clear(); y.clear(); z.clear(); r.clear();}
+	void add(point const &pos, float radius) {x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z); r.push_back(radius);}
+};
+
+struct vfc_cube_batch_t {
+	vector<float> x1, y1, z1, x2, y2, z2;
+
+	unsigned size() const {return x1.size();}
+	void clear() {x1.clear(); y1.clear(); z1.clear(); x2.clear(); y2.clear(); z2.clear();}
+	void add(cube_t const &c) {x1.push_back(c.x1()); y1.push_back(c.y1()); z1.push_back(c.z1()); x2.push_back(c.x2()); y2.push_back(c.y2()); z2.push_back(c.z2());}
+};
+
+struct vis_mask_t {
+	vector<unsigned long long> bits; // one bit per object
+
+	void resize(unsigned num) {bits.resize((num + 63)/64);}
+	bool is_visible(unsigned ix) const {return ((bits[ix >> 6] >> (ix & 63)) & 1);}
+};
+
+
 struct pos_dir_up { // defines a view frustum
 
 	point pos;
@@ -658,6 +683,8 @@ struct pos_dir_up { // defines a view frustum
 	bool sphere_completely_visible_test(point const &pos_, float radius) const {return sphere_visible_test(pos_, -radius);}
 	template<unsigned N> bool pt_set_visible(point const *const pts) const;
 	bool cube_visible(cube_t const &cube) const;
+	void spheres_visible_test(vfc_sphere_batch_t const &spheres, vis_mask_t &vis) const; // batched sphere_visible_test()
+	void cubes_visible(vfc_cube_batch_t const &cubes, vis_mask_t &vis) const; // batched cube_visible()
 	bool cube_visible_likely(cube_t const &c) const {return (!valid || point_visible_test(c.get_cube_center()) || cube_visible(c));}
 	bool cube_visible_for_light_cone(cube_t const &c) const;
 	bool projected_cube_visible(cube_t const &cube, point const &proj_pt) const;
@@ -1227,11 +1254,14 @@ colorRGBA const BACKGROUND_NIGHT(BLACK);
 
 
 void register_timing_value(const char *str, int delta_time);
+void register_timing_value_ms(const char *str, double delta_time);
 void toggle_timing_profiler();
 void timing_profiler_stats();
+bool write_timing_profiler_json(std::string const &fn, unsigned num_frames);
+int get_elapsed_time_ms();
 
 // macros
-#define GET_TIME_MS()    glutGet(GLUT_ELAPSED_TIME)
+#define GET_TIME_MS()    get_elapsed_time_ms()
 #define RESET_TIME       int const timer1(GET_TIME_MS());
 #define GET_DELTA_TIME   (GET_TIME_MS() - timer1)
 #define PRINT_TIME(str) {register_timing_value(str, GET_DELTA_TIME);}
@@ -1603,31 +1603,89 @@ bool physics_particle_manager::is_pos_valid(point const &pos) const {
 	return (pos.z > mesh_height[ypos][xpos] && pos.z > water_matrix[ypos][xpos]); // above mesh and water
 }
 
-void physics_particle_manager::apply_physics(float gravity, float terminal_velocity, bool emissive) {
+void physics_particle_manager::part_soa_t::clear() {
+	px.clear(); py.clear(); pz.clear(); vx.clear(); vy.clear(); vz.clear(); age.clear(); c.clear();
+}
+void physics_particle_manager::part_soa_t::reserve(size_t sz) {
+	px.reserve(sz); py.reserve(sz); pz.reserve(sz); vx.reserve(sz); vy.reserve(sz); vz.reserve(sz); age.reserve(sz); c.reserve(sz);
+}
+void physics_particle_manager::part_soa_t::resize(size_t sz) {
+	px.resize(sz); py.resize(sz); pz.resize(sz); vx.resize(sz); vy.resize(sz); vz.resize(sz); age.resize(sz); c.resize(sz);
+}
+void physics_particle_manager::part_soa_t::push_back(point const &p, vector3d const &v, colorRGBA const &color) {
+	px.push_back(p.x); py.push_back(p.y); pz.push_back(p.z); vx.push_back(v.x); vy.push_back(v.y); vz.push_back(v.z); age.push_back(0.0); c.push_back(color_wrapper(color));
+}
+void physics_particle_manager::part_soa_t::move_elem(size_t from, size_t to) {
+	px[to] = px[from]; py[to] = py[from]; pz[to] = pz[from]; vx[to] = vx[from]; vy[to] = vy[from]; vz[to] = vz[from]; age[to] = age[from]; c[to] = c[from];
+}
 
-	if (parts.empty()) return;
-	//RESET_TIME;
+void physics_particle_manager::integrate(float g_acc, float xy_damp, float terminal_velocity, bool emissive) {
+
+	int const num((int)parts.size());
+	float *const __restrict px(parts.px.data()), *const __restrict py(parts.py.data()), *const __restrict pz(parts.pz.data());
+	float *const __restrict vx(parts.vx.data()), *const __restrict vy(parts.vy.data()), *const __restrict vz(parts.vz.data()), *const __restrict age(parts.age.data());
+	float const ts(tstep), ft(fticks);
+
+#pragma omp parallel for schedule(static,4096) if (num > 65536)
+	for (int i = 0; i < num; ++i) { // branch-free, vectorizable
+		vz [i]  = max(-terminal_velocity, (vz[i] - g_acc)); // apply gravity + terminal velocity
+		vx [i] *= xy_damp;
+		vy [i] *= xy_damp;
+		px [i] += ts*vx[i]; // add velocity to position
+		py [i] += ts*vy[i];
+		pz [i] += ts*vz[i];
+		age[i] += ft;
+	}
+	if (emissive) { // varies from yellow to red-orange based on vz/vt
+		for (int i = 0; i < num; ++i) {parts.c[i].set_c3(colorRGBA(1.0, 1.0-0.75*max(0.0f, -vz[i]/terminal_velocity), 0.0));}
+	}
+}
+
+void physics_particle_manager::add_wind_forces() {
+
+	if (wind_scale == 0.0) return;
+	int const num((int)parts.size());
+	float const wscale(wind_scale*tstep);
+
+#pragma omp parallel for schedule(static,1024) if (num > 16384)
+	for (int i = 0; i < num; ++i) { // Note: get_local_wind() is read-only and thread safe
+		vector3d const local_wind(get_local_wind(parts.get_pos(i)));
+		parts.vx[i] += wscale*local_wind.x;
+		parts.vy[i] += wscale*local_wind.y;
+		parts.vz[i] += wscale*local_wind.z;
+	}
+}
+
+void physics_particle_manager::cull_invalid() {
+
+	int const num((int)parts.size());
+	keep.resize(num);
+
+#pragma omp parallel for schedule(static,1024) if (num > 16384)
+	for (int i = 0; i < num; ++i) {
+		point const pos(parts.get_pos(i));
+		int cindex(-1);
+		// destroy particles that are too old, inside a cobj (don't bounce), or under the water/mesh
+		keep[i] = ((lifetime == 0.0 || parts.age[i] < lifetime) && !check_point_contained_tree(pos, cindex, 0) && is_pos_valid(pos)); // skip dynamic
+	}
 	unsigned o(0);
-	float const g_acc(base_gravity*GRAVITY*tstep*gravity), xy_damp(pow(0.98f, fticks));
 
-	for (unsigned i = 0; i < parts.size(); ++i) {
-		part_t &part(parts[i]);
-		part.v.z  = max(-terminal_velocity, (part.v.z - g_acc)); // apply gravity + terminal velocity
-		part.v.x *= xy_damp;
-		part.v.y *= xy_damp;
-		//point const p0(part.p);
-		part.p   += tstep*part.v; // add velocity to position
-		if (emissive) {part.c.set_c3(colorRGBA(1.0, 1.0-0.75*max(0.0f, -part.v.z/terminal_velocity), 0.0));} // varies from yellow to red-orange based on vz/vt
-		int cindex;
-		
-		//if (check_coll_line(p0, part.p, cindex, -1, 1, 0)) { // skip dynamic
-		if (check_point_contained_tree(part.p, cindex, 0)) { // skip dynamic
-			continue; // destroy particle, don't bounce
-			//part.p = cpos; vector3d bounce_v; calc_reflection_angle(part.v.get_norm(), bounce_v, cnorm); part.v = 0.9*part.v.mag()*bounce_v;
-		}
-		if (is_pos_valid(part.p)) {parts[o++] = part;} // above water and mesh - copy/compact
+	for (int i = 0; i < num; ++i) { // serial, order preserving compaction
+		if (!keep[i]) continue;
+		if (o != unsigned(i)) {parts.move_elem(i, o);}
+		++o;
 	}
 	parts.resize(o);
+}
+
+void physics_particle_manager::apply_physics(float gravity, float terminal_velocity, bool emissive) {
+
+	if (parts.empty()) return;
+	//RESET_TIME;
+	float const g_acc(base_gravity*GRAVITY*tstep*gravity), xy_damp(pow(0.98f, fticks));
+	add_wind_forces();
+	integrate(g_acc, xy_damp, terminal_velocity, emissive);
+	cull_invalid();
 	//PRINT_TIME("Particle Physics"); // 0.07ms average / 0.24ms with collisions
 }
 
@@ -199,7 +199,7 @@ float def_tex_aniso(2.0);
 unsigned char *landscape0 = NULL;
 
 
-extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps;
+extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps, headless_mode;
 extern unsigned smoke_tid, dl_tid, elem_tid, gb_tid, reflection_tid, depth_tid, empty_smap_tid, frame_buffer_RGB_tid, skybox_tid, skybox_cube_tid, univ_reflection_tid;
 extern int world_mode, read_landscape, default_ground_tex, xoff2, yoff2, DISABLE_WATER;
 extern int scrolling, dx_scroll, dy_scroll, display_mode, iticks, universe_only, window_width, window_height;
@@ -1403,7 +1403,7 @@ void clear_cached_ls_colors() {
 void create_landscape_texture() {
 
 	RESET_TIME;
-	if (using_custom_landscape_texture() || world_mode == WMODE_INF_TERRAIN) return;
+	if (using_custom_landscape_texture() || world_mode == WMODE_INF_TERRAIN || headless_mode) return; // no textures are loaded in headless mode
 	clear_cached_ls_colors();
 	int tox0(0), toy0(0), scroll(0);
 	texture_t &tex(textures[LANDSCAPE_TEX]);
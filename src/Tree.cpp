@@ -13,6 +13,8 @@
 #include "cobj_bsp_tree.h"
 #include "draw_utils.h"
 
+using std::cerr;
+
 float const BURN_RADIUS      = 0.2;
 float const BURN_DAMAGE      = 80.0;
 float const BEAM_DAMAGE      = 0.06;
@@ -30,6 +32,8 @@ int const TREE_4TH_LEAVES    = 1;
 int const DISABLE_LEAVES     = 0;
 int const ENABLE_CLIP_LEAVES = 1;
 int const TLEAF_START_TUID   = 8; // trees use texture units 8-12
+float const LEAF_BEND_EPS    = 0.002; // min change in leaf wind bend angle, in radians, for the leaf to be updated
+unsigned const LEAF_UPLOAD_MERGE_GAP = 32; // dirty leaf ranges separated by fewer than this many leaves are uploaded together
 bool const FORCE_TREE_TYPE   = 1;
 unsigned const CYLINS_PER_ROOT     = 3;
 unsigned const TREE_BILLBOARD_SIZE = 256;
@@ -44,14 +48,14 @@ tree_type tree_types[NUM_TREE_TYPES] = { // not const - config file can override
 	tree_type(BARK6_TEX, PAPAYA_TEX,   1.0, 1.0, 1.0, 1.00, 2.0, 2.0, 0.5, 0.1,  0.0, colorRGBA(0.7, 0.6,  0.5,  1.0), WHITE)
 };
 
-vector<tree_cylin >   tree_builder_t::cylin_cache;
-vector<tree_branch>   tree_builder_t::branch_cache;
-vector<tree_branch *> tree_builder_t::branch_ptr_cache;
+thread_local vector<tree_cylin >   tree_builder_t::cylin_cache;
+thread_local vector<tree_branch>   tree_builder_t::branch_cache;
+thread_local vector<tree_branch *> tree_builder_t::branch_ptr_cache;
 
 
 // tree_mode: 0 = no trees, 1 = large only, 2 = small only, 3 = both large and small
 bool has_any_billboard_coll(0), next_has_any_billboard_coll(0), tree_4th_branches(0);
-unsigned max_unique_trees(0);
+unsigned max_unique_trees(0), tree_cache_hits(0), tree_cache_misses(0);
 int tree_mode(1), tree_coll_level(2);
 float leaf_color_coherence(0.5), tree_color_coherence(0.2), tree_deadness(-1.0), tree_dead_prob(0.0), nleaves_scale(1.0), branch_radius_scale(1.0), tree_height_scale(1.0);
 float tree_lod_scales[4] = {0, 0, 0, 0}; // branch_start, branch_end, leaf_start, leaf_end
@@ -60,12 +64,13 @@ tree_data_manager_t tree_data_manager;
 tree_cont_t t_trees(tree_data_manager);
 tree_cont_t *cur_tile_trees(nullptr);
 tree_placer_t tree_placer;
+string tree_cache_dir; // empty = disabled
 
 
 extern bool has_snow, no_sun_lpos_update, has_dl_sources, gen_tree_roots, tt_lightning_enabled, tree_indir_lighting, begin_motion, enable_grass_fire;
 extern int num_trees, do_zoom, display_mode, animate2, iticks, draw_model, frame_counter;
 extern int xoff2, yoff2, rand_gen_index, game_mode, leaf_color_changed, scrolling, dx_scroll, dy_scroll, window_width, window_height;
-extern unsigned smoke_tid;
+extern unsigned smoke_tid, static_smap_gen;
 extern float zmin, zmax, zmax_est, zbottom, water_plane_z, tree_scale, temperature, fticks, vegetation, tree_density_thresh, tree_slope_thresh;
 extern double sim_ticks;
 extern vector3d wind;
@@ -324,13 +329,20 @@ void tree_cont_t::draw_branches_and_leaves(shader_t &s, tree_lod_render_t &lod_r
 		int const tex0_loc(s.get_uniform_loc("tex0"));
 		tree_data_t::pre_leaf_draw(s);
 		sorted.clear();
-		
+		static vfc_sphere_batch_t tree_spheres; // reused across calls
+		static vis_mask_t trees_in_view;
+
+		if (tt_shadow_mode) {
+			// still need VFC in tiled terrain mode since the shadow volume doesn't include the entire scene (especially for local city light shadows)
+			tree_spheres.clear();
+			for (unsigned i = 0; i < size(); ++i) {tree_spheres.add((operator[](i).sphere_center() + xlate), 1.1*operator[](i).get_radius());}
+			camera_pdu.spheres_visible_test(tree_spheres, trees_in_view); // batch VFC
+		}
 		for (unsigned i = 0; i < size(); ++i) {
 			tree const &t(operator[](i));
 			point const center(t.sphere_center() + xlate);
-			// still need VFC in tiled terrain mode since the shadow volume doesn't include the entire scene (especially for local city light shadows)
-			if (tt_shadow_mode && !dist_less_than(center, camera_pdu.pos, camera_pdu.far_))    continue; // Note: intentionally excludes tree radius
-			if (tt_shadow_mode && !camera_pdu.sphere_visible_test(center, 1.1*t.get_radius())) continue;
+			if (tt_shadow_mode && !dist_less_than(center, camera_pdu.pos, camera_pdu.far_)) continue; // Note: intentionally excludes tree radius
+			if (tt_shadow_mode && !trees_in_view.is_visible(i)) continue;
 			sorted.emplace_back(distance_to_camera_sq(center), i);
 		}
 		if (!tt_shadow_mode) {sort(sorted.begin(), sorted.end());} // sort front to back for better early z culling
@@ -343,7 +355,7 @@ void tree_cont_t::draw_branches_and_leaves(shader_t &s, tree_lod_render_t &lod_r
 
 		if (!tt_shadow_mode) {
 			int const num_to_update(to_update_leaves.size());
-	#pragma omp parallel for num_threads(max(1, min(4, num_to_update))) schedule(static) if (num_to_update > 1)
+	#pragma omp parallel for num_threads(max(1, min(4, num_to_update))) schedule(dynamic) if (num_to_update > 1) // dynamic because leaf counts vary
 			for (int i = 0; i < num_to_update; ++i) {to_update_leaves[i]->update_leaf_orients_wind();}
 		}
 	}
@@ -535,8 +547,7 @@ coll_obj &tree::get_leaf_cobj(unsigned i) const {
 void tree_data_t::mark_leaf_changed(unsigned ix) {
 
 	assert(ix < leaves.size());
-	leaf_change_start = min(ix,   leaf_change_start);
-	leaf_change_end   = max(ix+1, leaf_change_end);
+	leaf_dirty.add(ix);
 }
 
 
@@ -592,6 +603,7 @@ void tree_data_t::remove_leaf_ix(unsigned i, bool update_data) {
 	assert(i < leaves.size());
 	leaves[i] = leaves.back();
 	leaves.pop_back();
+	if (leaf_bend.size() > i) {leaf_bend.remove(i);}
 	if (!update_data) return;
 	unsigned const i4(i << 2), tnl4((unsigned)leaves.size() << 2);
 	assert(4*leaves.size() <= leaf_data.size());
@@ -612,6 +624,7 @@ void tree::remove_leaf(unsigned i, bool update_data) {
 	make_private_tdata_copy();
 	update_data &= has_leaf_data();
 	tdata().remove_leaf_ix(i, update_data);
+	++static_smap_gen; // also covers leaves removed by burn_leaves() and damage_leaf()
 }
 
 
@@ -810,6 +823,7 @@ void tree::drop_leaves() {
 		if (td_is_private()) { // create a new leaf with a different color (and orient?)
 			leaves[i].create_init_color(rgen);
 			copy_color(i, 1); // don't call td.mark_leaf_changed(i) (too slow)
+			++static_smap_gen;
 		}
 	}
 }
@@ -844,7 +858,12 @@ unsigned tree_data_t::get_gpu_mem() const {
 
 bool tree::is_visible_to_camera(vector3d const &xlate) const {
 	int const level((get_camera_pos().z > max(ztop, czmax)) ? 0 : 2); // test cobjs and mesh unless camera is in the air
-	return sphere_in_camera_view((sphere_center() + xlate), 1.1*tdata().sphere_radius, level);
+	if (!sphere_in_camera_view((sphere_center() + xlate), 1.1*tdata().sphere_radius, level)) return 0;
+	if (level >= 2) return 1; // occlusion buffer was already checked in sphere_cobj_occluded()
+	tree_data_t const &td(tdata());
+	cube_t bcube(td.branches_bcube);
+	if (!td.get_leaves().empty()) {bcube.union_with_cube(td.leaves_bcube);}
+	return !cube_hiz_occluded(camera_pdu.pos, (bcube + tree_center + xlate));
 }
 void tree::add_bounds_to_bcube(cube_t &bcube) const {
 	bcube.assign_or_union_with_cube(tdata().branches_bcube + tree_center);
@@ -1135,25 +1154,41 @@ void tree_data_t::reset_leaf_pos_norm() {
 		UNROLL_4X(leaf_data[i_+(i<<2)].v = leaves[i].pts[i_];)
 		update_normal_for_leaf(i);
 	}
+	if (leaf_bend.size() == leaves.size()) {std::fill(leaf_bend.v[leaf_bend_soa_t::ANGLE].begin(), leaf_bend.v[leaf_bend_soa_t::ANGLE].end(), 0.0f);} // unbent
 	reset_leaves = 0;
 }
 
 
 void tree_data_t::ensure_leaf_vbo() {
 
-	leaf_change_end = min(leaf_change_end, (unsigned)leaves.size()); // in case a leaf was removed after a previous update this frame
-
 	if (leaf_vbo == 0) {
 		create_vbo_and_upload(leaf_vbo, leaf_data, 0, 0, 1); // dynamic draw, due to wind updates, collision, burn damage, etc.
 	}
-	else if (leaf_change_start < leaf_change_end) {
-		assert(leaf_change_end <= leaves.size());
-		bind_vbo(leaf_vbo);
+	else if (!leaf_dirty.empty()) { // upload only the changed leaf ranges
+		static vector<pair<unsigned, unsigned>> ranges; // reused across calls; only called from the drawing thread
+		leaf_dirty.get_merged(leaves.size(), LEAF_UPLOAD_MERGE_GAP, ranges); // clamped to leaves.size() in case a leaf was removed after a previous update this frame
+		if (!ranges.empty()) {bind_vbo(leaf_vbo);}
 		unsigned const per_leaf_stride(4*sizeof(leaf_vert_type_t));
-		upload_vbo_sub_data((&leaf_data.front() + 4*leaf_change_start), leaf_change_start*per_leaf_stride, (leaf_change_end - leaf_change_start)*per_leaf_stride);
+
+		for (auto const &r : ranges) {
+			upload_vbo_sub_data((&leaf_data.front() + 4*r.first), r.first*per_leaf_stride, (r.second - r.first)*per_leaf_stride);
+		}
+	}
+	leaf_dirty.clear();
+}
+
+
+void leaf_dirty_ranges_t::get_merged(unsigned max_ix, unsigned max_gap, vector<pair<unsigned, unsigned>> &merged) {
+
+	merged.clear();
+	sort(ranges.begin(), ranges.end());
+
+	for (auto r : ranges) {
+		r.second = min(r.second, max_ix);
+		if (r.first >= r.second) continue; // empty or past the end
+		if (!merged.empty() && r.first <= merged.back().second + max_gap) {merged.back().second = max(merged.back().second, r.second);}
+		else {merged.push_back(r);}
 	}
-	leaf_change_start = leaves.size();
-	leaf_change_end   = 0;
 }
 
 
@@ -1192,6 +1227,103 @@ void tree_data_t::bend_leaf(unsigned i, float angle) { // Note: slow
 	UNROLL_4X(leaf_data[i_+ix].set_norm(nc);) // similar to update_normal_for_leaf()
 	mark_leaf_changed(i);
 	reset_leaves = 1; // do we want to update the normals as well?
+	if (leaf_bend.size() == leaves.size()) {leaf_bend.v[leaf_bend_soa_t::ANGLE][i] = angle;}
+}
+
+
+void leaf_bend_soa_t::init(vector<tree_leaf> const &leaves) {
+
+	unsigned const n(leaves.size());
+	for (unsigned a = 0; a < NUM_ARRAYS; ++a) {v[a].resize(n);}
+
+	for (unsigned i = 0; i < n; ++i) {
+		tree_leaf const &l(leaves[i]);
+		vector3d const dir(l.pts[1] - l.pts[0]), side(l.pts[3] - l.pts[0]);
+		UNROLL_3X(v[DX+i_][i] = dir[i_]; v[NX+i_][i] = l.norm[i_]; v[SX+i_][i] = side[i_];)
+		v[DMAG ][i] = dir.mag();
+		v[ANGLE][i] = 0.0; // Note: assumes leaves are unbent, which may not be true after bend_leaf() calls; they'll be updated on the next angle change
+	}
+	changed.clear();
+}
+
+void leaf_bend_soa_t::remove(unsigned i) { // swap with the last leaf, to match tree_data_t::remove_leaf_ix()
+
+	assert(i < size());
+	for (unsigned a = 0; a < NUM_ARRAYS; ++a) {v[a][i] = v[a].back(); v[a].pop_back();}
+	changed.clear();
+}
+
+void leaf_bend_soa_t::clear() {
+	for (unsigned a = 0; a < NUM_ARRAYS; ++a) {clear_cont(v[a]);}
+	for (unsigned a = 0; a < NUM_KERNEL_ARRAYS; ++a) {clear_cont(k[a]);}
+	changed.clear();
+}
+
+bool leaf_bend_soa_t::set_angle(unsigned i, float angle) { // returns true if the leaf will be updated
+
+	assert(i < size());
+	if (fabs(angle - v[ANGLE][i]) < LEAF_BEND_EPS) return 0; // small change, not worth updating
+	v[ANGLE][i] = angle;
+	changed.push_back(i);
+	return 1;
+}
+
+// new_dir = orig_dir*cos(angle) + norm*(|orig_dir|*sin(angle)); new_norm = cross(new_dir, side), normalized by the caller;
+// has no branches or libm calls, and takes __restrict parameters (gcc ignores __restrict on locals here), so that gcc -O3 vectorizes it
+void leaf_bend_kernel(int n, float const *__restrict dx, float const *__restrict dy, float const *__restrict dz,
+	float const *__restrict nx, float const *__restrict ny, float const *__restrict nz, float const *__restrict sx, float const *__restrict sy,
+	float const *__restrict sz, float const *__restrict ca, float const *__restrict sa, float *__restrict ddx, float *__restrict ddy,
+	float *__restrict ddz, float *__restrict cx, float *__restrict cy, float *__restrict cz)
+{
+	for (int j = 0; j < n; ++j) {
+		float const c(ca[j]), s(sa[j]), odx(dx[j]), ody(dy[j]), odz(dz[j]), sdx(sx[j]), sdy(sy[j]), sdz(sz[j]);
+		float const ndx(odx*c + nx[j]*s), ndy(ody*c + ny[j]*s), ndz(odz*c + nz[j]*s);
+		ddx[j] = ndx - odx; ddy[j] = ndy - ody; ddz[j] = ndz - odz;
+		cx[j] = ndy*sdz - ndz*sdy; cy[j] = ndz*sdx - ndx*sdz; cz[j] = ndx*sdy - ndy*sdx;
+	}
+}
+
+void leaf_bend_soa_t::calc_bends() { // only the changed leaves, which are gathered into contiguous arrays for leaf_bend_kernel()
+
+	unsigned const n(changed.size());
+	for (unsigned a = 0; a < NUM_KERNEL_ARRAYS; ++a) {k[a].resize(n);}
+
+	for (unsigned j = 0; j < n; ++j) { // gather the inputs of the changed leaves
+		unsigned const i(changed[j]);
+		for (unsigned a = DX; a <= SZ; ++a) {k[a][j] = v[a][i];}
+		k[COS_A][j] = COSF(v[ANGLE][i]);
+		k[SIN_A][j] = SINF(v[ANGLE][i])*v[DMAG][i]; // scaled by |orig_dir|
+	}
+	leaf_bend_kernel(n, k[DX].data(), k[DY].data(), k[DZ].data(), k[NX].data(), k[NY].data(), k[NZ].data(), k[SX].data(), k[SY].data(), k[SZ].data(),
+		k[COS_A].data(), k[SIN_A].data(), k[DDX].data(), k[DDY].data(), k[DDZ].data(), k[CX].data(), k[CY].data(), k[CZ].data());
+}
+
+
+leaf_bend_soa_t &tree_data_t::get_leaf_bend_data() {
+	if (leaf_bend.size() != leaves.size()) {leaf_bend.init(leaves);}
+	return leaf_bend;
+}
+
+void tree_data_t::apply_leaf_bends() { // writes the leaves set with leaf_bend.set_angle() to leaf_data
+
+	if (leaf_bend.changed.empty()) return;
+	assert(leaf_bend.size() == leaves.size());
+	leaf_bend.calc_bends();
+	typedef leaf_bend_soa_t lb;
+
+	for (unsigned j = 0; j < leaf_bend.changed.size(); ++j) {
+		unsigned const i(leaf_bend.changed[j]);
+		tree_leaf const &l(leaves[i]);
+		vector3d const delta(leaf_bend.k[lb::DDX][j], leaf_bend.k[lb::DDY][j], leaf_bend.k[lb::DDZ][j]);
+		unsigned const ix(i<<2);
+		leaf_data[ix+1].v = l.pts[1] + delta;
+		leaf_data[ix+2].v = l.pts[2] + delta;
+		norm_comp nc; nc.set_norm_no_clamp(vector3d(leaf_bend.k[lb::CX][j], leaf_bend.k[lb::CY][j], leaf_bend.k[lb::CZ][j]).get_norm());
+		UNROLL_4X(leaf_data[i_+ix].set_norm(nc);)
+		mark_leaf_changed(i);
+	}
+	leaf_bend.changed.clear();
+	reset_leaves = 1; // same as bend_leaf()
 }
 
 
@@ -1213,6 +1345,7 @@ void tree::update_leaf_orients_wind() { // leaves move in wind (somewhat slow)
 	bool const heal_pass(priv_data && LEAF_HEAL_RATE > 0 && world_mode == WMODE_GROUND && (rgen.rand()&7) == 0); // only update healed color every 8 frames
 	int last_xpos(0), last_ypos(0);
 	vector3d local_wind(zero_vector);
+	leaf_bend_soa_t &leaf_bend(td.get_leaf_bend_data());
 
 	for (unsigned i = 0; i < leaves.size(); ++i) { // process leaf wind and collisions
 		point p0(leaves[i].pts[0]);
@@ -1227,7 +1360,7 @@ void tree::update_leaf_orients_wind() { // leaves move in wind (somewhat slow)
 		}
 		if (local_wind != zero_vector) {
 			float const angle(PI_TWO*max(-1.0f, min(1.0f, dot_product(local_wind, leaves[i].norm)))); // not physically correct, but it looks good
-			td.bend_leaf(i, angle);
+			leaf_bend.set_angle(i, angle); // bend is applied to all leaves below
 		}
 		if (heal_pass && (rgen.rand()&63) == 0) { // leaf heals every 64 frames
 			short &lcolor(td.get_leaves()[i].lcolor); // non-const, can't use <leaves>
@@ -1238,6 +1371,7 @@ void tree::update_leaf_orients_wind() { // leaves move in wind (somewhat slow)
 			}
 		}
 	} // for i
+	td.apply_leaf_bends();
 	leaf_orients_valid = 1;
 }
 
@@ -1315,6 +1449,8 @@ void tree_data_t::clear_data() {
 	clear_cont(all_cylins);
 	clear_cont(leaf_data);
 	clear_cont(leaves); // Note: not present in original delete_trees()
+	leaf_bend.clear();
+	leaf_dirty.clear();
 }
 
 
@@ -1528,6 +1664,110 @@ void tree::gen_tree(point const &pos, int size, int ttype, int calc_z, bool add_
 }
 
 
+// ********** tree data disk cache **********
+
+
+unsigned const TREE_CACHE_MAGIC   = 0x45455254; // "TREE"
+unsigned const TREE_CACHE_VERSION = 1; // increment when tree generation changes
+
+struct tree_cache_header_t { // size = 64
+	unsigned magic, version, num_cylins, num_leaves;
+	uint64_t key;
+	int64_t rseed1, rseed2; // rgen state after generation, so that the caller's rgen sequence is unchanged on a cache hit
+	colorRGBA base_color;
+	float base_radius;
+	unsigned pad;
+	tree_cache_header_t() : magic(TREE_CACHE_MAGIC), version(TREE_CACHE_VERSION), num_cylins(0), num_leaves(0), key(0), rseed1(0), rseed2(0), base_color(WHITE), base_radius(0.0), pad(0) {}
+};
+
+// hash of everything that affects the generated branches and leaves: tree params, rgen state, and global tree config
+uint64_t get_tree_cache_key(int tree_type, int size, float tree_depth, float height_scale, float br_scale_mult, float nl_scale,
+	float bbo_scale, bool has_4th_branches, cube_t const *clip_cube, bool create_bush, rand_gen_t const &rgen)
+{
+	uint64_t hash(14695981039346656037ULL); // FNV-1a
+	auto add = [&hash](void const *data, size_t sz) {
+		for (size_t i = 0; i < sz; ++i) {hash ^= ((unsigned char const *)data)[i]; hash *= 1099511628211ULL;}
+	};
+	int const iparams[6] = {(int)TREE_CACHE_VERSION, tree_type, size, has_4th_branches, create_bush, gen_tree_roots};
+	float const fparams[12] = {tree_depth, height_scale, br_scale_mult, nl_scale, bbo_scale, tree_deadness, tree_dead_prob, branch_radius_scale,
+		tree_height_scale, nleaves_scale, tree_scale, (clip_cube ? 1.0f : 0.0f)};
+	int64_t const seeds[2] = {rgen.rseed1, rgen.rseed2}; // Note: long is 32-bit on Windows, so convert to a fixed size
+	add(iparams, sizeof(iparams));
+	add(fparams, sizeof(fparams));
+	add(seeds,   sizeof(seeds));
+	add(&tree_types[tree_type].branch_size, 9*sizeof(float)); // branch_size through bush_prob
+	if (clip_cube) {add(clip_cube->d, sizeof(clip_cube->d));}
+	return hash;
+}
+
+string get_tree_cache_fn(uint64_t key) {
+	char buf[32] = {0};
+	snprintf(buf, sizeof(buf), "tree_%016llx.bin", (unsigned long long)key);
+	return tree_cache_dir + "/" + buf;
+}
+
+bool tree_data_t::read_from_cache(uint64_t key, rand_gen_t &rgen) {
+
+	FILE *fp(fopen(get_tree_cache_fn(key).c_str(), "rb"));
+	tree_cache_header_t header;
+	bool ok(fp != nullptr && fread(&header, sizeof(header), 1, fp) == 1 && header.magic == TREE_CACHE_MAGIC &&
+		header.version == TREE_CACHE_VERSION && header.key == key && header.num_cylins > 0);
+
+	if (ok) {
+		all_cylins.resize(header.num_cylins);
+		leaves.resize(header.num_leaves);
+		ok = (fread(all_cylins.data(), sizeof(draw_cylin), all_cylins.size(), fp) == all_cylins.size() &&
+			  fread(leaves.data(), sizeof(tree_leaf), leaves.size(), fp) == leaves.size());
+	}
+	if (fp) {checked_fclose(fp);}
+
+	if (!ok) { // missing, invalid, or truncated; generate the tree and overwrite the file
+		all_cylins.clear();
+		leaves.clear();
+#pragma omp atomic
+		++tree_cache_misses;
+		return 0;
+	}
+	base_color  = header.base_color;
+	base_radius = header.base_radius;
+	rgen.set_state((long)header.rseed1, (long)header.rseed2);
+#pragma omp atomic
+	++tree_cache_hits;
+	return 1;
+}
+
+void tree_data_t::write_to_cache(uint64_t key, rand_gen_t const &rgen) const {
+
+	string const fn(get_tree_cache_fn(key));
+	FILE *fp(fopen(fn.c_str(), "wb"));
+
+	if (fp == nullptr) {
+		static bool had_error(0);
+#pragma omp critical(tree_cache_error)
+		if (!had_error) {cerr << "Error: Failed to open tree cache file " << fn << " for writing; does the tree_cache_dir exist?" << endl; had_error = 1;}
+		return;
+	}
+	tree_cache_header_t header;
+	header.num_cylins  = all_cylins.size();
+	header.num_leaves  = leaves.size();
+	header.key         = key;
+	header.rseed1      = rgen.rseed1;
+	header.rseed2      = rgen.rseed2;
+	header.base_color  = base_color;
+	header.base_radius = base_radius;
+	bool const ok(fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(all_cylins.data(), sizeof(draw_cylin), all_cylins.size(), fp) == all_cylins.size() &&
+		fwrite(leaves.data(), sizeof(tree_leaf), leaves.size(), fp) == leaves.size());
+	checked_fclose(fp);
+	if (!ok) {cerr << "Error writing tree cache file " << fn << endl; remove(fn.c_str());}
+}
+
+void print_tree_cache_stats() {
+	if (tree_cache_dir.empty() || (tree_cache_hits + tree_cache_misses) == 0) return;
+	cout << "Tree cache: " << tree_cache_hits << " hits, " << tree_cache_misses << " misses" << endl;
+	tree_cache_hits = tree_cache_misses = 0;
+}
+
+
 void tree_data_t::gen_tree_data(int tree_type_, int size, float tree_depth, float height_scale, float br_scale_mult,
 	float nl_scale, float bbo_scale, bool has_4th_branches_, cube_t const *clip_cube, bool create_bush, rand_gen_t &rgen)
 {
@@ -1536,7 +1776,17 @@ void tree_data_t::gen_tree_data(int tree_type_, int size, float tree_depth, floa
 	has_4th_branches = has_4th_branches_;
 	assert(tree_type < NUM_TREE_TYPES);
 	leaf_data.clear();
+	leaf_bend.clear();
+	leaf_dirty.clear();
 	clear_vbo_ixs();
+	br_scale    = br_scale_mult*branch_radius_scale;
+	b_tex_scale = tree_types[tree_type].branch_tscale*height_scale/br_scale;
+	uint64_t cache_key(0);
+
+	if (!tree_cache_dir.empty()) {
+		cache_key = get_tree_cache_key(tree_type, size, tree_depth, height_scale, br_scale_mult, nl_scale, bbo_scale, has_4th_branches, clip_cube, create_bush, rgen);
+		if (read_from_cache(cache_key, rgen)) {calc_bounds(); return;}
+	}
 	float deadness(DISABLE_LEAVES ? 1.0 : tree_deadness);
 
 	if (deadness < 0.0) {
@@ -1547,10 +1797,16 @@ void tree_data_t::gen_tree_data(int tree_type_, int size, float tree_depth, floa
 	tree_builder_t builder(clip_cube, rgen);
 	
 	// create leaves and all_cylins
-	br_scale    = br_scale_mult*branch_radius_scale;
-	b_tex_scale = tree_types[tree_type].branch_tscale*height_scale/br_scale;
 	base_radius = builder.create_tree_branches(tree_type, size, tree_depth, base_color, height_scale, br_scale, nl_scale, bbo_scale, has_4th_branches, create_bush);
 	builder.create_all_cylins_and_leaves(all_cylins, leaves, tree_type, deadness, br_scale, nl_scale, has_4th_branches, size);
+	reverse(leaves.begin(), leaves.end()); // order leaves so that LOD removes from the center first, which is less noticeable
+	calc_bounds();
+	if (!tree_cache_dir.empty()) {write_to_cache(cache_key, rgen);}
+	//PRINT_TIME("Gen Tree");
+}
+
+
+void tree_data_t::calc_bounds() { // from all_cylins and leaves
 
 	// set the bounding sphere center
 	assert(!all_cylins.empty());
@@ -1580,8 +1836,6 @@ void tree_data_t::gen_tree_data(int tree_type_, int size, float tree_depth, floa
 	sphere_radius = sqrt(sphere_radius);
 	lr_z_cent     = 0.5f*(lr_z1 + lr_z2);
 	lr_z          = 0.5f*(lr_z2 - lr_z1);
-	reverse(leaves.begin(), leaves.end()); // order leaves so that LOD removes from the center first, which is less noticeable
-	//PRINT_TIME("Gen Tree");
 }
 
 
@@ -2197,6 +2451,8 @@ void tree_cont_t::gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, poi
 	unsigned const skip_val(max(1, int(1.0/tree_scale))); // similar to deterministic gen in scenery.cpp
 	shared_tree_data.ensure_init();
 	mesh_xy_grid_cache_t density_gen[NUM_TREE_TYPES+1];
+	vector<tree_gen_job_t> jobs; // trees are placed serially and generated in parallel
+	unsigned const start_ix(size());
 
 	if (NONUNIFORM_TREE_DEN) { // i==0 is the coverage density map, i>0 are the per-tree type coverage maps
 #pragma omp parallel for schedule(dynamic) num_threads(2)
@@ -2252,9 +2508,43 @@ void tree_cont_t::gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, poi
 				if (!adjust_tree_zval(pos, 0, ttype, 0, cur_tile)) continue; // create_bush=0
 			}
 			add_new_tree(rgen, ttype);
-			back().gen_tree(pos, 0, ttype, 0, 1, 0, rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1); // allow bushes
+			jobs.emplace_back(pos, ttype, rgen); // rgen is reseeded for the next tree, so each tree can use its own copy
 		} // for j
 	} // for i
+	gen_trees_parallel(jobs, start_ix);
+}
+
+// generates the trees added by gen_trees_tt_within_radius(); each tree uses its own rgen, so the results are the same as serial generation
+void tree_cont_t::gen_trees_parallel(vector<tree_gen_job_t> const &jobs, unsigned start_ix) {
+
+	assert(start_ix + jobs.size() == size());
+	if (jobs.empty()) return;
+	// shared tree data is generated by the first tree that uses it; later trees read it, so they must wait until it's been generated
+	vector<unsigned char> deferred(jobs.size(), 0);
+	set<tree_data_t const *> first_users;
+
+	for (unsigned i = 0; i < jobs.size(); ++i) {
+		tree_data_t const *const td(at(start_ix + i).get_shared_tree_data());
+		if (td != nullptr && !td->is_created() && !first_users.insert(td).second) {deferred[i] = 1;}
+	}
+#pragma omp parallel for schedule(dynamic) if (jobs.size() > 1)
+	for (int i = 0; i < (int)jobs.size(); ++i) {
+		if (deferred[i]) continue;
+		rand_gen_t rgen(jobs[i].rgen);
+		at(start_ix + i).gen_tree(jobs[i].pos, 0, jobs[i].ttype, 0, 0, 0, rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1); // allow bushes; cobjs are added below
+	}
+	for (unsigned i = 0; i < jobs.size(); ++i) {
+		if (deferred[i]) {
+			// the shared tree data was created by an earlier tree in this batch, possibly with a different type (bush or missing type);
+			// add_new_tree() corrects the type in this case for serial generation, but it was called before the tree data was created
+			tree &t(at(start_ix + i));
+			tree_data_t const *const td(t.get_shared_tree_data());
+			assert(td != nullptr && td->is_created());
+			rand_gen_t rgen(jobs[i].rgen);
+			t.gen_tree(jobs[i].pos, 0, td->get_tree_type(), 0, 0, 0, rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1);
+		}
+		at(start_ix + i).add_tree_collision_objects(); // serial, in the same order as before
+	}
 }
 
 
@@ -2276,7 +2566,7 @@ void regen_trees(bool keep_old) {
 		if (scrolling && t_trees.scroll_trees(ext_x1, ext_x2, ext_y1, ext_y2)) {t_trees.post_scroll_remove();}
 		else {t_trees.resize(0);}
 		t_trees.gen_deterministic(ext_x1, ext_y1, ext_x2, ext_y2, vegetation, /*(zmax - zmin)*/-1.0); // don't use mesh_dz (may cause problems with scrolling)
-		if (!scrolling) {cout << "Num trees = " << t_trees.size() << endl;}
+		if (!scrolling) {cout << "Num trees = " << t_trees.size() << endl; print_tree_cache_stats();}
 		last_rgi   = rand_gen_index;
 		last_xoff2 = xoff2;
 		last_yoff2 = yoff2;
@@ -8,12 +8,14 @@
 #include "openal_wrap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
+#include <climits> // for INT_MAX
 
 
 float    const RIPPLE_DAMP1        = 0.95;
 float    const RIPPLE_DAMP2        = 0.02;
 float    const RIPPLE_MAT_ATTEN    = 0.965;
 float    const MAX_RIPPLE_HEIGHT   = 1.0;
+float    const RIPPLE_ACT_THRESH   = 1.0E-5; // cells with smaller ripple heights are removed from the active region
 float    const MAX_SPLASH_SIZE     = 80.0;
 float    const SMALL_DZ            = 0.001;
 float    const WATER_WIND_EFF2     = 0.0005;
@@ -81,6 +83,30 @@ struct water_section {
 };
 
 
+// rectangular range of mesh cells {x1,y1} to {x2,y2} (exclusive) used to limit water updates to regions that have changed
+struct water_region_t {
+	int x1, y1, x2, y2;
+
+	water_region_t() {clear();}
+	void clear() {x1 = y1 = INT_MAX; x2 = y2 = 0;}
+	void set_full() {x1 = y1 = 0; x2 = MESH_X_SIZE; y2 = MESH_Y_SIZE;}
+	bool empty() const {return (x1 >= x2 || y1 >= y2);}
+	unsigned get_area() const {return (empty() ? 0 : (x2 - x1)*(y2 - y1));}
+	void add_pt(int x, int y) {x1 = min(x1, x); y1 = min(y1, y); x2 = max(x2, x+1); y2 = max(y2, y+1);}
+	void add_region(water_region_t const &r) {if (!r.empty()) {x1 = min(x1, r.x1); y1 = min(y1, r.y1); x2 = max(x2, r.x2); y2 = max(y2, r.y2);}}
+
+	void expand_and_clip(int d) {
+		if (empty()) return;
+		x1 = max(0, x1-d); y1 = max(0, y1-d); x2 = min(MESH_X_SIZE, x2+d); y2 = min(MESH_Y_SIZE, y2+d);
+	}
+};
+
+struct water_sim_stats_t {
+	unsigned ripple_cells, settle_cells, normal_cells, spill_cells; // number of cells processed in the last frame
+	water_sim_stats_t() : ripple_cells(0), settle_cells(0), normal_cells(0), spill_cells(0) {}
+	void print() const {cout << "water cells: ripple: " << ripple_cells << ", settle: " << settle_cells << ", normal: " << normal_cells << ", spill: " << spill_cells << endl;}
+};
+
 
 // Global Variables
 bool water_is_lava(0);
@@ -90,6 +116,10 @@ vector<valley> valleys;
 vector<water_spring> water_springs;
 vector<water_section> wsections;
 spillover spill;
+water_region_t ripple_region, normal_region; // cells with active ripples, cells whose water height has changed
+water_sim_stats_t water_stats;
+vector<unsigned> spill_check_cells; // dynamic water cells on valley borders, as y*MESH_X_SIZE + x
+bool spill_cells_valid(0), water_levels_changed(1);
 
 extern bool using_lightmap, has_snow, fast_water_reflect, enable_clip_plane_z, begin_motion;
 extern int display_mode, frame_counter, game_mode, TIMESCALE2, I_TIMESCALE2, world_mode, rand_gen_index, animate, animate2, blood_spilled;
@@ -105,6 +135,7 @@ extern water_params_t water_params;
 
 void calc_water_normals();
 void compute_ripples();
+void invalidate_water_regions();
 void update_valleys_and_draw_spillover();
 void update_water_volumes();
 void draw_spillover(vector<vert_norm_color> &verts, int i, int j, int si, int sj, int index, int vol_over, float blood_mix, float mud_mix);
@@ -641,38 +672,58 @@ void draw_water(bool no_update, bool draw_fast) {
 }
 
 
+// water simulation without any drawing, for headless mode; valley spillover is skipped because it's computed while drawing
+void update_water_no_draw() {
+
+	process_water_springs();
+	add_waves();
+	if (DISABLE_WATER) return;
+
+	if (animate2) {
+		compute_ripples();
+		calc_water_normals();
+	}
+	update_water_volumes();
+	first_water_run = 0;
+}
+
+
 void calc_water_normals() {
 
 	if (DISABLE_WATER) return;
+	// a water height change at (x,y) affects the face normals at x-1..x and y-1..y, which affect the vertex normals at x-1..x+1 and y-1..y+1;
+	// start one row and column earlier so that the face normals used by the first written vertex normals are valid
+	water_region_t r(normal_region);
+	normal_region.clear();
+	r.expand_and_clip(2);
+	water_stats.normal_cells = r.get_area();
+	if (r.empty()) return;
 	vector3d *wsn0(wat_surf_normals[0]), *wsn1(wat_surf_normals[1]);
 
-	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+	for (int i = r.y1; i < r.y2; ++i) {
 		// if we have ice, the normals can't change and don't need to be updated;
 		// however, if they were never calculated, they do need to be update on the first frame;
 		// since we can't tell if the normals are valid, it's safest to always just update them
 		// *** but it's certainly not right to always set them to plus_z ***
-#if 0
-		if (temperature <= W_FREEZE_POINT) { // ice
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!point_interior_to_mesh(j, i) || wminside[i][j]) {wsn1[j] = wat_vert_normals[i][j] = plus_z;}
+		bool const write_row(i > r.y1 || i == 0);
+
+		for (int j = r.x1; j < r.x2; ++j) {
+			bool const write(write_row && (j > r.x1 || j == 0));
+
+			if (point_interior_to_mesh(j, i) && wminside[i][j] && water_matrix[i][j] >= z_min_matrix[i][j]) { // inside
+				wsn1[j] = get_matrix_surf_norm(water_matrix, NULL, MESH_X_SIZE, MESH_Y_SIZE, j, i);
+				if (!write) continue;
+				vector3d nv(wsn1[j]);
+				if (i > 0)          {nv += wsn0[j];}
+				if (i > 0 && j > 0) {nv += wsn0[j-1];}
+				if (j > 0)          {nv += wsn1[j-1];}
+				wat_vert_normals[i][j] = nv.get_norm();
 			}
-		} else
-#endif
-		{ // water
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (point_interior_to_mesh(j, i) && wminside[i][j] && water_matrix[i][j] >= z_min_matrix[i][j]) { // inside
-					wsn1[j] = get_matrix_surf_norm(water_matrix, NULL, MESH_X_SIZE, MESH_Y_SIZE, j, i);
-					vector3d nv(wsn1[j]);
-					if (i > 0)          {nv += wsn0[j];}
-					if (i > 0 && j > 0) {nv += wsn0[j-1];}
-					if (j > 0)          {nv += wsn1[j-1];}
-					wat_vert_normals[i][j] = nv.get_norm();
-				}
-				else {
-					wsn1[j] = wat_vert_normals[i][j] = plus_z;
-				}
-			} // for j
-		}
+			else {
+				wsn1[j] = plus_z;
+				if (write) {wat_vert_normals[i][j] = plus_z;}
+			}
+		} // for j
 		swap(wsn0, wsn1);
 	} // for i
 }
@@ -692,164 +743,226 @@ inline void update_water_edges(int i, int j) {
 }
 
 
+inline void update_ripple_acc(int i, int j, float rm_atten, water_region_t &active) {
+
+	if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) return;
+	short const i8(watershed_matrix[i][j].inside8);
+	fix_fp_mag(ripples[i][j].rval);
+	float const rmij(ripples[i][j].rval);
+	float &acc(ripples[i][j].acc);
+	fix_fp_mag(acc);
+	acc *= rm_atten;
+	if (fabs(acc) > 1.0E-6 || fabs(rmij) > RIPPLE_ACT_THRESH) {active.add_pt(j, i);}
+
+	// 00 0- -0 0+ +0 -- +- ++ -+  22  11
+	// 01 02 04 08 10 20 40 80 100 200 400
+	if (point_interior_to_mesh(j, i)) { // fast mode
+		float const d0( rmij - ripples[i  ][j-1].rval);
+		if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
+		float const d2( rmij - ripples[i  ][j+1].rval);
+		if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
+		float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
+		if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
+		float const d1( rmij - ripples[i-1][j  ].rval);
+		if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
+		float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
+		if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
+		float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
+		if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
+		float const d3( rmij - ripples[i+1][j  ].rval);
+		if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
+		float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
+		if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
+		acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
+		fix_fp_mag(acc);
+		return;
+	}
+	if (j > 0) {
+		float const dz(rmij - ripples[i][j-1].rval);
+		if (i8 & 0x02) ripples[i][j-1].acc += dz;
+		acc -= dz;
+
+		if (i > 0) {
+			float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
+			if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
+			acc -= dz;
+		}
+		if (i < MESH_Y_SIZE-1) {
+			float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
+			if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
+			acc -= dz;
+		}
+	}
+	if (i > 0) {
+		float const dz(rmij - ripples[i-1][j].rval);
+		if (i8 & 0x04) ripples[i-1][j].acc += dz;
+		acc -= dz;
+	}
+	if (j < MESH_X_SIZE-1) {
+		float const dz(rmij - ripples[i][j+1].rval);
+		if (i8 & 0x08) ripples[i][j+1].acc += dz;
+		acc -= dz;
+
+		if (i < MESH_Y_SIZE-1) {
+			float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
+			if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
+			acc -= dz;
+		}
+		if (i > 0) {
+			float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
+			if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
+			acc -= dz;
+		}
+	}
+	if (i < MESH_Y_SIZE-1) {
+		float const dz(rmij - ripples[i+1][j].rval);
+		if (i8 & 0x10) ripples[i+1][j].acc += dz;
+		acc -= dz;
+	}
+	fix_fp_mag(acc);
+}
+
+inline void update_ripple_height(int i, int j, float rm_atten, float rdamp1, float rdamp2) {
+
+	float ripple_zval(0.0);
+
+	if (wminside[i][j]) {
+		float const zval(rdamp1*(ripples[i][j].rval + rdamp2*ripples[i][j].acc)); // ripple wave height
+		ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
+	}
+	if (wminside[i][j] == 1) { // dynamic water
+		int const wsi(watershed_matrix[i][j].wsi);
+		assert(size_t(wsi) < valleys.size());
+
+		if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(ripples[i][j].rval) < 1.0E-4 && fabs(ripples[i][j].acc) < 1.0E-4) { // under ground - no ripple
+			water_matrix[i][j] = valleys[wsi].zval;
+			return;
+		}
+		float const depth(valleys[wsi].depth);
+
+		if (depth < 0) {
+			ripples[i][j].rval *= rm_atten;
+			water_matrix[i][j] = valleys[wsi].zval;
+			return;
+		}
+		float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
+		ripples[i][j].rval = rm_atten*zval;
+		water_matrix[i][j] = valleys[wsi].zval + zval;
+	}
+	else if (wminside[i][j] == 2) { // fixed water
+		ripples[i][j].rval = rm_atten*ripple_zval;
+		water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
+		water_matrix[i][j] = max(water_matrix[i][j], zbottom);
+	}
+	else if (get_water_enabled(j, i)) {
+		update_water_edges(i, j);
+	}
+	else {
+		ripples[i][j].rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
+	}
+}
+
+// set water heights to the valley/water plane levels for cells without ripples; only needed when the water levels change;
+// no_ripple selects the update used when ripples are disabled, which sets all cells other than dynamic water to the edge level
+void settle_water_levels(water_region_t const &skip, bool no_ripple) {
+
+	static vector<float> last_zvals;
+	static float last_water_plane_z(0.0), last_def_water_level(0.0);
+	static bool last_no_ripple(0);
+	bool changed(water_levels_changed || last_zvals.size() != valleys.size() || water_plane_z != last_water_plane_z || def_water_level != last_def_water_level || no_ripple != last_no_ripple);
+
+	for (unsigned i = 0; i < valleys.size() && !changed; ++i) {changed |= (valleys[i].zval != last_zvals[i]);}
+	water_stats.settle_cells = 0;
+	if (!changed) return;
+	last_zvals.resize(valleys.size());
+	for (unsigned i = 0; i < valleys.size(); ++i) {last_zvals[i] = valleys[i].zval;}
+	last_water_plane_z   = water_plane_z;
+	last_def_water_level = def_water_level;
+	last_no_ripple       = no_ripple;
+	water_levels_changed = 0;
+	water_stats.settle_cells = XY_MULT_SIZE - skip.get_area();
+	normal_region.set_full();
+
+#pragma omp parallel for schedule(static,16)
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		bool const skip_row(i >= skip.y1 && i < skip.y2);
+
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			if (skip_row && j >= skip.x1 && j < skip.x2) continue; // handled by ripple update
+			if (wminside[i][j] == 1) {water_matrix[i][j] = valleys[watershed_matrix[i][j].wsi].zval;}
+			else if (no_ripple) {update_water_edges(i, j);} // includes fixed water and cells where water is disabled
+			else if (wminside[i][j] == 2) {water_matrix[i][j] = max(water_plane_z, zbottom);} // fixed water with zero ripple height
+			else if (get_water_enabled(j, i)) {update_water_edges(i, j);}
+			else {ripples[i][j].rval = 0.0;}
+		}
+	}
+}
+
 void compute_ripples() {
 
 	if (DISABLE_WATER) return;
 	static unsigned dtime1(0), dtime2(0), counter(0);
+	static bool ripples_cleared(0);
 	bool const update_iter((counter%UPDATE_STEP) == 0);
 	RESET_TIME;
+	if (first_water_run || counter == 0) {ripple_region.set_full(); water_levels_changed = 1;}
+	water_stats.ripple_cells = 0;
 
 	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
 		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
 		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
-		start_ripple = 0;
-
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
-				short const i8(watershed_matrix[i][j].inside8);
-				fix_fp_mag(ripples[i][j].rval);
-				float const rmij(ripples[i][j].rval);
-				float &acc(ripples[i][j].acc);
-				fix_fp_mag(acc);
-				acc *= rm_atten;
-				if (!start_ripple && fabs(acc) > 1.0E-6) start_ripple = 1;
-
-				// 00 0- -0 0+ +0 -- +- ++ -+  22  11
-				// 01 02 04 08 10 20 40 80 100 200 400
-				if (point_interior_to_mesh(j, i)) { // fast mode
-					float const d0( rmij - ripples[i  ][j-1].rval);
-					if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
-					float const d2( rmij - ripples[i  ][j+1].rval);
-					if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
-					float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
-					float const d1( rmij - ripples[i-1][j  ].rval);
-					if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
-					float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
-					float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
-					float const d3( rmij - ripples[i+1][j  ].rval);
-					if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
-					float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
-					acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
-					fix_fp_mag(acc);
-					continue;
-				}
-				if (j > 0) {
-					float const dz(rmij - ripples[i][j-1].rval);
-					if (i8 & 0x02) ripples[i][j-1].acc += dz;
-					acc -= dz;
-
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
-						acc -= dz;
-					}
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
-						acc -= dz;
+		// only simulate the region with active ripples, plus a border of one cell that ripples can propagate into
+		water_region_t r(ripple_region);
+		r.expand_and_clip(1);
+		ripple_region.clear(); // will be recomputed below
+		start_ripple    = 0;
+		ripples_cleared = 0;
+		water_stats.ripple_cells = r.get_area();
+
+		if (!r.empty()) {
+			// the stencil adds to the neighbors in the rows above and below, so rows are split into slabs of at least two rows,
+			// and even and odd slabs are processed in separate passes so that no two threads write to the same row
+			int const slab_sz(4), num_slabs((r.y2 - r.y1 + slab_sz - 1)/slab_sz);
+			vector<water_region_t> tregions(omp_get_max_threads_3dw());
+
+			for (int pass = 0; pass < 2; ++pass) {
+#pragma omp parallel for schedule(dynamic,1) if (num_slabs > 2)
+				for (int sl = pass; sl < num_slabs; sl += 2) {
+					water_region_t &active(tregions[omp_get_thread_num_3dw()]);
+
+					for (int i = r.y1 + sl*slab_sz; i < min(r.y2, r.y1 + (sl+1)*slab_sz); ++i) {
+						for (int j = r.x1; j < r.x2; ++j) {update_ripple_acc(i, j, rm_atten, active);}
 					}
 				}
-				if (i > 0) {
-					float const dz(rmij - ripples[i-1][j].rval);
-					if (i8 & 0x04) ripples[i-1][j].acc += dz;
-					acc -= dz;
-				}
-				if (j < MESH_X_SIZE-1) {
-					float const dz(rmij - ripples[i][j+1].rval);
-					if (i8 & 0x08) ripples[i][j+1].acc += dz;
-					acc -= dz;
-
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
-						acc -= dz;
-					}
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i < MESH_Y_SIZE-1) {
-					float const dz(rmij - ripples[i+1][j].rval);
-					if (i8 & 0x10) ripples[i+1][j].acc += dz;
-					acc -= dz;
-				}
-				fix_fp_mag(acc);
-			} // for j
-		} // for i
-		if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
-		
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				float ripple_zval(0.0);
-
-				if (wminside[i][j]) {
-					float const zval(rdamp1*(ripples[i][j].rval + rdamp2*ripples[i][j].acc)); // ripple wave height
-					ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
-				}
-				if (wminside[i][j] == 1) { // dynamic water
-					int const wsi(watershed_matrix[i][j].wsi);
-					assert(size_t(wsi) < valleys.size());
-
-					if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(ripples[i][j].rval) < 1.0E-4 && fabs(ripples[i][j].acc) < 1.0E-4) { // under ground - no ripple
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const depth(valleys[wsi].depth);
+			}
+			for (auto i = tregions.begin(); i != tregions.end(); ++i) {ripple_region.add_region(*i);}
+			start_ripple = !ripple_region.empty();
+			if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
 
-					if (depth < 0) {
-						ripples[i][j].rval *= rm_atten;
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
-					ripples[i][j].rval = rm_atten*zval;
-					water_matrix[i][j] = valleys[wsi].zval + zval;
-				}
-				else if (wminside[i][j] == 2) { // fixed water
-					ripples[i][j].rval = rm_atten*ripple_zval;
-					water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
-					water_matrix[i][j] = max(water_matrix[i][j], zbottom);
-				}
-				else if (update_iter) {
-					if (get_water_enabled(j, i)) {
-						update_water_edges(i, j);
-					}
-					else {
-						ripples[i][j].rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
-					}
-				}
-			} // for j
-		} // for i
-		if (DEBUG_RIPPLE_TIME) dtime2 += GET_DELTA_TIME;
+#pragma omp parallel for schedule(static,4)
+			for (int i = r.y1; i < r.y2; ++i) { // each cell only writes to itself
+				for (int j = r.x1; j < r.x2; ++j) {update_ripple_height(i, j, rm_atten, rdamp1, rdamp2);}
+			}
+			normal_region.add_region(r);
+			if (DEBUG_RIPPLE_TIME) dtime2 += GET_DELTA_TIME;
+		}
+		if (update_iter) {settle_water_levels(r, 0);}
 	}
 	else { // no ripple
-		matrix_clear_2d(ripples);
-
 		// must clear ripples at least once at the beginning
+		if (!ripples_cleared) {matrix_clear_2d(ripples); ripples_cleared = 1;}
+		ripple_region.clear();
+
 		if (NO_ICE_RIPPLES || counter == 0 || temperature > W_FREEZE_POINT) {
-			for (int i = 0; i < MESH_Y_SIZE; ++i) {
-				for (int j = 0; j < MESH_X_SIZE; ++j) {
-					if (wminside[i][j] == 1) {
-						water_matrix[i][j] = valleys[watershed_matrix[i][j].wsi].zval;
-					}
-					else {
-						update_water_edges(i, j);
-					}
-				} // for j
-			} // for i
+			if (counter == 0) {water_levels_changed = 1;}
+			settle_water_levels(water_region_t(), 1);
 		}
 	} // ripple
 	++counter;
 
 	if (DEBUG_RIPPLE_TIME && (counter%20) == 0) {
 		cout << "times = " << dtime1 << ", " << dtime2 << endl; // cumulative
+		water_stats.print();
 		dtime1 = dtime2 = 0;
 	}
 }
@@ -917,7 +1030,7 @@ void add_splash(point const &pos, int xpos, int ypos, float energy, float radius
 
 	for (int i = y1; i <= y2; i++) {
 		for (int j = x1; j <= x2; j++) {
-			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples[i][j].rval += splash_size;}
+			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples[i][j].rval += splash_size; ripple_region.add_pt(j, i);}
 		}
 	}
 	start_ripple = 1;
@@ -937,9 +1050,12 @@ void add_waves() { // add waves due to wind
 	static float wave_time(0.0);
 	wave_time += fticks_clamped;
 	if (wave_time > 4000.0) {wave_time = 0.0;} // reset at 4000 ticks (2 min. or so) to avoid FP error
+	water_region_t tregions[2]; // one per thread
 	
 #pragma omp parallel for schedule(static,8) num_threads(2)
 	for (int y = 0; y < MESH_Y_SIZE; ++y) {
+		water_region_t &wr(tregions[omp_get_thread_num_3dw() & 1]);
+
 		for (int x = 0; x < MESH_X_SIZE; ++x) {
 			if (!wminside[y][x] || !get_water_enabled(x, y)) continue; // only in water
 			float const wh(water_matrix[y][x]), depth(wh - mesh_height[y][x]);
@@ -957,9 +1073,11 @@ void add_waves() { // add waves due to wind
 			else if (fabs(ripples[y][x].rval) < 0.1*wval) { // don't add wind if already rippling to prevent instability
 				ripples[y][x].rval += wval;
 			}
+			wr.add_pt(x, y);
 			start_ripple = 1;
 		}
 	}
+	for (unsigned i = 0; i < 2; ++i) {ripple_region.add_region(tregions[i]);}
 	//PRINT_TIME("Add Waves");
 }
 
@@ -967,6 +1085,14 @@ void add_waves() { // add waves due to wind
 // *** BEGIN VALLEYS/SPILLOVER ***
 
 
+void invalidate_water_regions() { // called when the watershed changes
+	spill_cells_valid    = 0;
+	water_levels_changed = 1;
+	ripple_region.set_full();
+	normal_region.set_full();
+}
+
+
 void check_spillover(int i, int j, int ii, int jj, int si, int sj, float zval, int wsi) { // does wsi overflow?
 
 	float const z_over(zval - mesh_height[ii][jj]);
@@ -1076,18 +1202,36 @@ void update_valleys_and_draw_spillover() {
 
 	// check for spillover offscreen or into another pool
 	int const ijd[4][4] = {{0,1,0,1}, {0,-1,0,0}, {1,0,1,0}, {-1,0,0,0}};
+	
+	if (!spill_cells_valid) { // only cells next to a different valley or non-dynamic water can spill, so cache them
+		spill_check_cells.clear();
 
-	for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
-		for (int j = 1; j < MESH_X_SIZE-1; ++j) {
-			if (wminside[i][j] != 1) continue;
-			int const wsi(watershed_matrix[i][j].wsi);
-			float const zval(valleys[wsi].zval);
-			if (zval < z_min_matrix[i][j]) continue;
+		for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
+			for (int j = 1; j < MESH_X_SIZE-1; ++j) {
+				if (wminside[i][j] != 1) continue;
+				int const wsi(watershed_matrix[i][j].wsi);
+				bool border(0);
 
-			for (unsigned k = 0; k < 4; ++k) {
-				check_spillover(i+ijd[k][0], j+ijd[k][1], i+ijd[k][2], j+ijd[k][3], i, j, zval, wsi);
+				for (unsigned k = 0; k < 4 && !border; ++k) {
+					int const ii(i+ijd[k][0]), jj(j+ijd[k][1]);
+					border = (wminside[ii][jj] != 1 || watershed_matrix[ii][jj].wsi != wsi);
+				}
+				if (border) {spill_check_cells.push_back(i*MESH_X_SIZE + j);}
 			}
 		}
+		spill_cells_valid = 1;
+	}
+	water_stats.spill_cells = (unsigned)spill_check_cells.size();
+
+	for (auto c = spill_check_cells.begin(); c != spill_check_cells.end(); ++c) { // in the same order as the original full mesh iteration
+		int const i(*c/MESH_X_SIZE), j(*c%MESH_X_SIZE);
+		int const wsi(watershed_matrix[i][j].wsi);
+		float const zval(valleys[wsi].zval);
+		if (zval < z_min_matrix[i][j]) continue;
+
+		for (unsigned k = 0; k < 4; ++k) {
+			check_spillover(i+ijd[k][0], j+ijd[k][1], i+ijd[k][2], j+ijd[k][3], i, j, zval, wsi);
+		}
 	}
 	vector<vert_norm_color> verts;
 
@@ -1547,6 +1691,7 @@ void calc_water_flow() {
 		valleys[i].fvol = wsections[i].wvol;
 		valleys[i].lwv  = valleys[i].fvol;
 	}
+	invalidate_water_regions();
 }
 
 
@@ -1628,6 +1773,9 @@ void make_outside_water(int x, int y) {
 	wminside[y][x] = 2; // make outside water (anything else we need to update? what if all of a valley disappears?)
 	watershed_matrix[y][x].wsi = -1; // invalid
 	water_matrix[y][x] = water_plane_z; // may be unnecessary
+	spill_cells_valid = 0;
+	ripple_region.add_pt(x, y);
+	normal_region.add_pt(x, y);
 }
 
 
@@ -1635,6 +1783,8 @@ void update_water_zval(int x, int y, float old_mh) {
 
 	assert(!point_outside_mesh(x, y));
 	if (!get_water_enabled(x, y)) return; // ???
+	ripple_region.add_pt(x, y); // recompute water height and normals
+	normal_region.add_pt(x, y);
 
 	if (mesh_height[y][x] < water_plane_z) { // check if this pos is under the mesh
 		make_outside_water(x, y); // previously above the mesh
@@ -7,6 +7,7 @@
 #include "gl_ext_arb.h"
 #include "model3d.h"
 #include "tiled_mesh.h"
+#include <chrono>
 
 float const FISH_RADIUS = 0.05;
 float const BIRD_RADIUS = 0.1;
@@ -184,47 +185,116 @@ void bird_t::apply_force_xy_const_vel(vector3d const &force) {
 	flocking = 1;
 }
 
-void vect_bird_t::flock(tile_t const *const tile) { // boids, called per-tile
+// boids flocking; see https://www.blog.drewcutchins.com/blog/2018-8-16-flocking
+float const BIRD_SEP_DIST_SCALE  = 0.2; // squared distances, relative to neighbor_dist^2
+float const BIRD_COH_DIST_SCALE  = 0.3;
+float const BIRD_ALIGN_DIST_SCALE= 0.25;
+unsigned const MAX_FLOCK_GRID_DIM= 4096; // cells per dim; cell size is increased for birds spread over larger areas
 
-	// see https://www.blog.drewcutchins.com/blog/2018-8-16-flocking
-	if (!animate2 || this->empty()) return;
-	float const neighbor_dist(0.5*get_tile_width()), nd_sq(neighbor_dist*neighbor_dist);
-	float const sep_dist_sq(0.2*nd_sq), cohesion_dist_sq(0.3*nd_sq), align_dist_sq(0.25*nd_sq);
-	float const mass(100.0), sep_strength(0.05), cohesion_strength(0.05), align_strength(0.5);
-	tile_xy_pair const tp(tile->get_tile_xy_pair());
-	tile_t *adj_tiles[9] = {0};
-	unsigned ix(0);
+void bird_flock_grid_t::build(vector<vect_bird_t *> const &groups, float max_dist) {
+
+	assert(max_dist > 0.0);
+	unsorted.clear();
+	cube_t bcube;
 
-	for (int dy = -1; dy <= 1; ++dy) {
-		for (int dx = -1; dx <= 1; ++dx) {adj_tiles[ix++] = get_tile_from_xy(tile_xy_pair(tp.x + dx, tp.y + dy));}
+	for (vect_bird_t const *g : groups) {
+		for (bird_t const &b : *g) {
+			if (!b.is_enabled()) continue;
+			if (unsorted.empty()) {bcube.set_from_point(b.pos);} else {bcube.union_with_pt(b.pos);}
+			unsorted.emplace_back(b.pos, b.velocity);
+		}
 	}
-	for (auto i = this->begin(); i != this->end(); ++i) {
-		if (!i->is_enabled()) continue;
+	entries.clear();
+	nx = ny = 0;
+	if (unsorted.empty()) return;
+	cell_sz = max(max_dist, max(bcube.dx(), bcube.dy())/MAX_FLOCK_GRID_DIM); // at least max_dist, so that only adjacent cells need to be checked
+	x0 = bcube.x1();
+	y0 = bcube.y1();
+	nx = unsigned(bcube.dx()/cell_sz) + 1;
+	ny = unsigned(bcube.dy()/cell_sz) + 1;
+	// counting sort of entries by cell
+	cell_start.clear();
+	cell_start.resize(nx*ny+1, 0);
+	cell_ixs.resize(unsorted.size());
+
+	for (unsigned i = 0; i < unsorted.size(); ++i) {
+		cell_ixs[i] = get_cell_y(unsorted[i].pos.y)*nx + get_cell_x(unsorted[i].pos.x);
+		++cell_start[cell_ixs[i]+1];
+	}
+	for (unsigned c = 0; c < nx*ny; ++c) {cell_start[c+1] += cell_start[c];}
+	entries.resize(unsorted.size());
+	vector<unsigned> next(cell_start.begin(), cell_start.end()-1); // next insert position per cell
+	for (unsigned i = 0; i < unsorted.size(); ++i) {entries[next[cell_ixs[i]]++] = unsorted[i];}
+}
+
+void bird_flock_grid_t::flock(vect_bird_t &birds, float neighbor_dist) const { // reads the grid snapshot, writes bird velocities
+
+	if (entries.empty()) return;
+	float const nd_sq(neighbor_dist*neighbor_dist);
+	float const sep_dist_sq(BIRD_SEP_DIST_SCALE*nd_sq), cohesion_dist_sq(BIRD_COH_DIST_SCALE*nd_sq), align_dist_sq(BIRD_ALIGN_DIST_SCALE*nd_sq);
+	float const mass(100.0), sep_strength(0.05), cohesion_strength(0.05), align_strength(0.5);
+
+	for (bird_t &b : birds) {
+		if (!b.is_enabled()) continue;
 		vector3d avg_pos(zero_vector), avg_vel(zero_vector), tot_force(zero_vector);
 		unsigned pcount(0), vcount(0);
-
-		for (unsigned adj_ix = 0; adj_ix < 9; ++adj_ix) {
-			tile_t *const adj_tile(adj_tiles[adj_ix]);
-			if (!adj_tile) continue;
-			vect_bird_t &birds(adj_tile->get_birds());
-
-			for (auto j = birds.begin(); j != birds.end(); ++j) {
-				if (!j->is_enabled()) continue;
-				if (i == j) continue; // skip self
-				float const dxy_sq(p2p_dist_xy_sq(i->pos, j->pos)); // Note: ignores zval
-
-				if (dxy_sq < sep_dist_sq) { // separation
-					vector3d const delta(i->pos - j->pos), sep_force(delta/dxy_sq); // force decreases with distance
-					tot_force += sep_force*sep_strength;
-				}
-				if (dxy_sq < cohesion_dist_sq) {avg_pos += j->pos;      ++pcount;}
-				if (dxy_sq < align_dist_sq   ) {avg_vel += j->velocity; ++vcount;}
-			} // for j
-		} // for adj_ix
-		if (pcount > 0) {tot_force += (avg_pos/pcount - i->pos)*cohesion_strength;} // cohesion
+		unsigned const cx(get_cell_x(b.pos.x)), cy(get_cell_y(b.pos.y));
+
+		for (unsigned y = max(cy, 1U)-1; y <= min(cy+1, ny-1); ++y) {
+			for (unsigned x = max(cx, 1U)-1; x <= min(cx+1, nx-1); ++x) {
+				unsigned const cell(y*nx + x);
+
+				for (unsigned e = cell_start[cell]; e < cell_start[cell+1]; ++e) {
+					entry_t const &j(entries[e]);
+					float const dxy_sq(p2p_dist_xy_sq(b.pos, j.pos)); // Note: ignores zval
+					if (dxy_sq == 0.0) continue; // skip self (and any coincident bird, which would have infinite separation force)
+
+					if (dxy_sq < sep_dist_sq) { // separation
+						vector3d const delta(b.pos - j.pos), sep_force(delta/dxy_sq); // force decreases with distance
+						tot_force += sep_force*sep_strength;
+					}
+					if (dxy_sq < cohesion_dist_sq) {avg_pos += j.pos; ++pcount;}
+					if (dxy_sq < align_dist_sq   ) {avg_vel += j.vel; ++vcount;}
+				} // for e
+			} // for x
+		} // for y
+		if (pcount > 0) {tot_force += (avg_pos/pcount - b.pos)*cohesion_strength;} // cohesion
 		if (vcount > 0) {tot_force += avg_vel*(align_strength/vcount);} // alignment
-		if (tot_force != zero_vector) {i->apply_force_xy_const_vel(tot_force/mass);}
-	} // for i
+		if (tot_force != zero_vector) {b.apply_force_xy_const_vel(tot_force/mass);}
+	} // for b
+}
+
+// flocks birds across all groups (tiles); forces are computed from a snapshot of last frame's positions and velocities
+void flock_bird_groups(vector<vect_bird_t *> const &groups, float neighbor_dist) {
+
+	static bird_flock_grid_t grid; // reused across frames
+	grid.build(groups, neighbor_dist*sqrt(max(BIRD_SEP_DIST_SCALE, max(BIRD_COH_DIST_SCALE, BIRD_ALIGN_DIST_SCALE))));
+	if (grid.size() == 0) return;
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)groups.size(); ++i) {grid.flock(*groups[i], neighbor_dist);}
+}
+
+void run_bird_flock_benchmark(unsigned num_birds) { // CPU only; birds are spread over a 10x10 grid of tile-sized groups
+
+	unsigned const groups_per_dim = 10, num_iters = 10;
+	float const tile_width(get_tile_width());
+	vector<vect_bird_t> groups(groups_per_dim*groups_per_dim);
+	vector<vect_bird_t *> group_ptrs;
+	rand_gen_t rgen;
+
+	for (unsigned i = 0; i < groups.size(); ++i) {
+		cube_t range(0.0, tile_width, 0.0, tile_width, 0.0, 0.1*tile_width);
+		range += vector3d((i%groups_per_dim)*tile_width, (i/groups_per_dim)*tile_width, 0.0);
+		unsigned const num((num_birds + i)/groups.size()); // distribute the remainder
+		groups[i].resize(num);
+		for (bird_t &b : groups[i]) {b.gen(rgen, range, nullptr);}
+		group_ptrs.push_back(&groups[i]);
+	}
+	auto const start(std::chrono::steady_clock::now());
+	for (unsigned n = 0; n < num_iters; ++n) {flock_bird_groups(group_ptrs, 0.5*tile_width);}
+	double const time_ms(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/num_iters);
+	register_timing_value_ms("Bird Flocking Benchmark", time_ms);
+	cout << "Bird flocking benchmark: " << num_birds << " birds in " << groups.size() << " groups, " << time_ms << " ms per frame" << endl;
 }
 
 
@@ -98,8 +98,34 @@ struct vect_fish_t : public animal_group_t<fish_t> {
 	void draw() const;
 };
 
+struct vect_bird_t;
+
+class bird_flock_grid_t { // uniform xy grid of all birds across tiles, rebuilt each frame for boids neighbor queries
+
+	struct entry_t { // snapshot of a bird's state, so that velocity updates don't affect other birds in the same frame
+		point pos;
+		vector3d vel;
+		entry_t() {}
+		entry_t(point const &p, vector3d const &v) : pos(p), vel(v) {}
+	};
+	vector<entry_t> entries, unsorted; // sorted by grid cell
+	vector<unsigned> cell_start, cell_ixs; // CSR offsets (nx*ny+1) and per-entry cell index
+	float cell_sz, x0, y0;
+	unsigned nx, ny;
+
+	unsigned get_cell_x(float x) const {return min(nx-1, unsigned(max(0.0f, (x - x0)/cell_sz)));}
+	unsigned get_cell_y(float y) const {return min(ny-1, unsigned(max(0.0f, (y - y0)/cell_sz)));}
+public:
+	bird_flock_grid_t() : cell_sz(1.0), x0(0.0), y0(0.0), nx(0), ny(0) {}
+	void build(vector<vect_bird_t *> const &groups, float max_dist);
+	void flock(vect_bird_t &birds, float neighbor_dist) const;
+	unsigned size() const {return entries.size();}
+};
+
+void flock_bird_groups(vector<vect_bird_t *> const &groups, float neighbor_dist);
+void run_bird_flock_benchmark(unsigned num_birds);
+
 struct vect_bird_t : public animal_group_t<bird_t> {
-	void flock(tile_t const *const tile);
 	static void begin_draw(shader_t &s);
 	static void end_draw(shader_t &s);
 	void draw() const;
@@ -15,6 +15,7 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include <fstream>
+#include <chrono>
 
 
 bool const MORE_COLL_TSTEPS       = 1; // slow
@@ -1198,11 +1199,144 @@ bool read_block_comment(FILE *fp) {
 }
 
 
-int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor) {
+// Include files are read into memory concurrently before parsing, one level of include nesting at a time, since scenes can include hundreds of files.
+// Parsing is still serial and in declaration order because each command modifies global scene state (cobjs, lights, models, textures, triggers),
+// so results are identical to reading the files directly. Files that aren't found by the include scan are simply opened by the parser as before.
+class scene_file_prefetcher_t {
+	map<string, string> file_data; // filename => contents
+
+	static bool read_file(string const &fn, string &data) {
+		FILE *fp(fopen(fn.c_str(), "rb"));
+		if (fp == nullptr) return 0; // not an error here; the parser will report it
+		fseek(fp, 0, SEEK_END);
+		long const sz(ftell(fp));
+		fseek(fp, 0, SEEK_SET);
+		bool ok(sz >= 0);
+		if (ok) {data.resize(sz); ok = (sz == 0 || fread(&data.front(), 1, sz, fp) == size_t(sz));}
+		checked_fclose(fp);
+		return ok;
+	}
+	// finds 'i <filename>' include commands, skipping comments; this is conservative, so misses and false positives only affect prefetching
+	static void find_includes(string const &data, vector<string> &fns) {
+		size_t pos(0);
+		bool at_cmd_start(1); // only match includes at the start of a command, which follows whitespace
+
+		while (pos < data.size()) {
+			char const c(data[pos]);
+			if (isspace((unsigned char)c)) {at_cmd_start = 1; ++pos; continue;}
+			if (c == '#') {pos = data.find('\n', pos); if (pos == string::npos) break; continue;} // line comment
+			if (c == '/' && pos+1 < data.size() && data[pos+1] == '*') {pos = data.find("*/", pos+2); if (pos == string::npos) break; pos += 2; continue;} // block comment
+
+			if (c == 'i' && at_cmd_start && pos+1 < data.size() && isspace((unsigned char)data[pos+1])) { // include command
+				pos += 1;
+				while (pos < data.size() && isspace((unsigned char)data[pos])) {++pos;}
+				string fn;
+				bool in_quote(0);
+
+				for (; pos < data.size(); ++pos) { // same rules as read_quoted_string()
+					char const c2(data[pos]);
+					if (c2 == '"') {in_quote ^= 1;}
+					else if (isspace((unsigned char)c2) && !in_quote) break;
+					else {fn.push_back(c2);}
+				}
+				if (!fn.empty()) {fns.push_back(fn);}
+				continue;
+			}
+			at_cmd_start = 0;
+			++pos;
+		}
+	}
+public:
+	void prefetch(char const *const root_fn) {
+		timer_t timer("Scene File Prefetch");
+		vector<string> level(1, root_fn), next_level;
+		unsigned num_levels(0);
+
+		while (!level.empty()) {
+			vector<string> data(level.size());
+			vector<unsigned char> valid(level.size(), 0);
+#pragma omp parallel for schedule(dynamic,1)
+			for (int i = 0; i < (int)level.size(); ++i) {valid[i] = read_file(level[i], data[i]);}
+			next_level.clear();
+
+			for (unsigned i = 0; i < level.size(); ++i) {
+				if (!valid[i]) continue;
+				vector<string> fns;
+				find_includes(data[i], fns);
+
+				for (auto f = fns.begin(); f != fns.end(); ++f) {
+					if (file_data.find(*f) == file_data.end() && find(next_level.begin(), next_level.end(), *f) == next_level.end()) {next_level.push_back(*f);}
+				}
+				file_data[level[i]].swap(data[i]);
+			}
+			for (auto f = next_level.begin(); f != next_level.end(); ++f) { // remove files already read at a previous level (recursive includes)
+				if (file_data.find(*f) != file_data.end()) {*f = "";}
+			}
+			next_level.erase(std::remove(next_level.begin(), next_level.end(), ""), next_level.end());
+			level.swap(next_level);
+			++num_levels;
+		}
+		cout << "Prefetched " << file_data.size() << " scene files with " << num_levels << " levels of includes" << endl;
+	}
+	FILE *open(char const *const fn) const { // returns nullptr if the file was not prefetched
+#ifdef _WIN32
+		return nullptr; // fmemopen() is not available; the prefetch still brings the files into the OS file cache
+#else
+		auto it(file_data.find(fn));
+		if (it == file_data.end() || it->second.empty()) return nullptr;
+		return fmemopen((void *)it->second.data(), it->second.size(), "r"); // Note: data must remain valid until the file is closed
+#endif
+	}
+	void clear() {file_data.clear();}
+};
+
+scene_file_prefetcher_t scene_file_prefetcher;
+
+
+// per-file parse time breakdown, including time spent loading models; self time excludes nested includes
+class scene_file_timing_t {
+	struct entry_t {
+		string fn;
+		double total_ms, self_ms;
+		unsigned num_cobjs;
+		entry_t(string const &fn_, double t, double s, unsigned n) : fn(fn_), total_ms(t), self_ms(s), num_cobjs(n) {}
+		bool operator<(entry_t const &e) const {return (self_ms > e.self_ms);} // sort largest first
+	};
+	vector<entry_t> entries;
+	vector<double> child_ms; // stack of time spent in nested includes
+public:
+	void push() {child_ms.push_back(0.0);}
+	void pop(char const *const fn, double total_ms, unsigned num_cobjs) {
+		assert(!child_ms.empty());
+		double const self_ms(total_ms - child_ms.back());
+		child_ms.pop_back();
+		if (!child_ms.empty()) {child_ms.back() += total_ms;}
+		entries.emplace_back(fn, total_ms, self_ms, num_cobjs);
+	}
+	void print_and_clear(unsigned max_print=20) {
+		if (entries.size() > 1) {
+			sort(entries.begin(), entries.end());
+			cout << "Scene file parse times for " << entries.size() << " files (self/total ms, cobjs):" << endl;
+
+			for (unsigned i = 0; i < min(max_print, (unsigned)entries.size()); ++i) {
+				entry_t const &e(entries[i]);
+				cout << "  " << e.self_ms << " / " << e.total_ms << " ms, " << e.num_cobjs << " cobjs: " << e.fn << endl;
+			}
+		}
+		entries.clear();
+	}
+};
+
+scene_file_timing_t scene_file_timing;
+
+
+int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor);
+
+int read_coll_obj_file_body(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor) {
 
 	assert(coll_obj_file != NULL);
-	FILE *fp;
-	if (!open_file(fp, coll_obj_file, "collision object")) return 0;
+	FILE *fp(scene_file_prefetcher.open(coll_obj_file));
+	if (fp == nullptr && !open_file(fp, coll_obj_file, "collision object")) return 0;
 	char str[MAX_CHARS] = {0};
 	unsigned line_num(1), npoints(0), indir_dlight_ix(0), prev_light_ix_start(0);
 	int end(0), use_z(0), use_vel(0), ivals[3];
@@ -2079,6 +2213,16 @@ int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj
 	return 1;
 }
 
+int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor) {
+
+	auto const start(std::chrono::steady_clock::now());
+	unsigned const start_cobjs(fixed_cobjs.size());
+	scene_file_timing.push();
+	int const ret(read_coll_obj_file_body(coll_obj_file, xf, cobj, has_layer, lcolor));
+	scene_file_timing.pop(coll_obj_file, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), (fixed_cobjs.size() - start_cobjs));
+	return ret;
+}
+
 int read_coll_objects(const char *filename) {
 
 	geom_xform_t xf;
@@ -2088,7 +2232,11 @@ int read_coll_objects(const char *filename) {
 	cobj.cp.draw    = 1;   // default
 	if (EXPLODE_EVERYTHING) {cobj.destroy = EXPLODEABLE;}
 	if (use_voxel_cobjs) {cobj.cp.cobj_type = COBJ_TYPE_VOX_TERRAIN;}
-	if (!read_coll_obj_file(filename, xf, cobj, 0, WHITE)) return 0;
+	scene_file_prefetcher.prefetch(filename);
+	bool const read_ok(read_coll_obj_file(filename, xf, cobj, 0, WHITE) != 0);
+	scene_file_prefetcher.clear(); // free the memory
+	scene_file_timing.print_and_clear();
+	if (!read_ok) return 0;
 	if (num_keycards > 0) {obj_groups[coll_id[KEYCARD]].enable();}
 	if (has_scenery2) {gen_scenery();} // need to call post_gen_setup() for leafy plants
 	cube_t const model_bcube(calc_and_return_all_models_bcube()); // calculate even if not using; will force internal transform bcubes to be calculated
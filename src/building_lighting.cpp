@@ -6,7 +6,11 @@
 #include "buildings.h"
 #include "lightmap.h" // for light_source
 #include "cobj_bsp_tree.h"
+#include "mesh.h"
 #include <thread>
+#include <atomic>
+#include <queue>
+#include <cfloat> // for FLT_MAX
 
 bool const USE_BKG_THREAD = 1;
 
@@ -155,37 +159,172 @@ void building_t::gather_interior_cubes(vect_colored_cube_t &cc) const {
 }
 
 
+unsigned const MAX_LIGHT_JOBS       = 2;  // number of lights that can be ray traced concurrently, possibly from different buildings
+unsigned const MAX_CACHED_BUILDINGS = 16; // number of buildings to keep per-light lighting results for
+unsigned const MAX_JOB_LMAP_MEM_MB  = 512; // memory limit for the scratch lightmaps of all jobs, each of which is a full dense lightmap
+
+// the contribution of one light to local lighting, stored as a dense volume within the grid bounds of the cells that its rays touched
+class building_light_vol_t {
+	int bnds[3][2]; // {x, y, z} x {lo, hi}, where hi is exclusive
+	vector<float> lc; // 3 floats per cell
+
+	unsigned get_num_cells() const {return (bnds[0][1] - bnds[0][0])*(bnds[1][1] - bnds[1][0])*(bnds[2][1] - bnds[2][0]);}
+public:
+	building_light_vol_t() {for (unsigned d = 0; d < 3; ++d) {bnds[d][0] = bnds[d][1] = 0;}}
+
+	// moves the local lighting values within bcube (in scene space) out of lmgr, leaving zeros behind so that lmgr can be reused for the next light
+	void extract_from(lmap_manager_t &lmgr, cube_t const &bcube) {
+		lc.clear();
+		if (bcube.x1() > bcube.x2()) return; // no rays were added
+		bnds[0][0] = max(0, get_xpos_round_down(bcube.x1())); bnds[0][1] = min(MESH_X_SIZE,  get_xpos_round_down(bcube.x2())+1);
+		bnds[1][0] = max(0, get_ypos_round_down(bcube.y1())); bnds[1][1] = min(MESH_Y_SIZE,  get_ypos_round_down(bcube.y2())+1);
+		bnds[2][0] = max(0, get_zpos           (bcube.z1())); bnds[2][1] = min(MESH_SIZE[2], get_zpos           (bcube.z2())+1);
+		for (unsigned d = 0; d < 3; ++d) {if (bnds[d][0] >= bnds[d][1]) return;} // empty
+		lc.resize(3*get_num_cells());
+		unsigned ix(0);
+
+		for (int y = bnds[1][0]; y < bnds[1][1]; ++y) {
+			for (int x = bnds[0][0]; x < bnds[0][1]; ++x) {
+				lmcell *const col(lmgr.get_column(x, y));
+				assert(col != nullptr); // lmgr is dense
+
+				for (int z = bnds[2][0]; z < bnds[2][1]; ++z) {
+					float *const c(col[z].get_offset(LIGHTING_LOCAL));
+					UNROLL_3X(lc[ix++] = c[i_]; c[i_] = 0.0;)
+				}
+			}
+		}
+		assert(ix == lc.size());
+	}
+	void add_to(lmap_manager_t &lmgr) const {
+		if (lc.empty()) return;
+		unsigned ix(0);
+
+		for (int y = bnds[1][0]; y < bnds[1][1]; ++y) {
+			for (int x = bnds[0][0]; x < bnds[0][1]; ++x) {
+				lmcell *const col(lmgr.get_column(x, y));
+				assert(col != nullptr); // lmgr is dense
+
+				for (int z = bnds[2][0]; z < bnds[2][1]; ++z) {
+					float *const c(col[z].get_offset(LIGHTING_LOCAL));
+					UNROLL_3X(c[i_] += lc[ix++];)
+				}
+			}
+		}
+	}
+};
+
+// per-building state: a copy of the building (which shares its interior), the BVH used for ray casting, and the results of each completed light
+struct building_light_cache_t {
+	building_t building;
+	cube_bvh_t bvh;
+	map<unsigned, building_light_vol_t> lights; // indexed by light room object index
+	unsigned last_used, num_jobs_running;
+
+	building_light_cache_t(building_t const &b) : building(b), last_used(0), num_jobs_running(0) {}
+	bool is_same_building(building_t const &b) const {return (b.bcube == building.bcube);} // in case a building index is reused
+};
+
+struct building_light_job_t {
+	std::atomic<bool> is_running;
+	bool needs_to_join;
+	int bix, light;
+	building_light_cache_t *cache;
+	lmap_manager_t lmgr; // scratch lightmap for this job; only nonzero while a light is being traced
+	room_object_t light_obj; // copied because room geom may be cleared while the job is running
+	cube_t rays_bcube; // bounds of all ray segments, in scene space
+	std::thread rt_thread;
+
+	building_light_job_t() : is_running(0), needs_to_join(0), bix(-1), light(-1), cache(nullptr) {}
+	bool is_active() const {return (light >= 0);}
+};
+
+struct light_job_cand_t {
+	float priority; // lower is higher priority
+	unsigned bix, light;
+	light_job_cand_t(float p, unsigned b, unsigned l) : priority(p), bix(b), light(l) {}
+	bool operator<(light_job_cand_t const &c) const {return (priority > c.priority);} // for std::priority_queue, which pops the max element
+};
+
 class building_indir_light_mgr_t {
-	bool is_running, is_done, kill_thread, lighting_updated, needs_to_join;
-	int cur_bix, cur_light;
-	unsigned cur_tid;
+	bool kill_thread, lighting_updated, is_done;
+	int cur_bix;
+	unsigned cur_tid, frame_id;
 	vector<unsigned char> tex_data;
 	vector<unsigned> light_ids;
-	set<unsigned> lights_complete;
-	cube_bvh_t bvh;
-	lmap_manager_t lmgr;
-	std::thread rt_thread;
+	map<unsigned, building_light_cache_t> cache; // indexed by building index
+	building_light_job_t jobs[MAX_LIGHT_JOBS];
+	cube_bvh_t bvh; // only used for ray_cast_camera_dir()
+	lmap_manager_t lmgr; // sum of all cached lights of the current building
 
-	void init_lmgr(bool clear_lighting) {
-		if (clear_lighting) {lmgr.reset_all();}
-		if (lmgr.is_allocated()) return; // already setup
+	static void init_lmgr(lmap_manager_t &lm) {
+		if (lm.is_allocated()) return; // already setup
 		unsigned const tot_sz(XY_MULT_SIZE*MESH_SIZE[2]); // Note: MESH_SIZE[2], not MESH_Z_SIZE; want clipped size that lmap uses rather than user-specified size
 		lmcell init_lmcell;
-		lmgr.alloc(tot_sz, MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2], (unsigned char **)nullptr, init_lmcell);
+		lm.alloc(tot_sz, MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2], (unsigned char **)nullptr, init_lmcell);
 	}
-	void start_lighting_compute(building_t const &b) {
-		assert(cur_light >= 0);
-		init_lmgr(0); // clear_lighting=0
-		is_running = 1;
-		lighting_updated = 1;
+	static unsigned get_max_jobs() { // limit the number of concurrent jobs so that their scratch lightmaps fit in MAX_JOB_LMAP_MEM_MB
+		size_t const lmap_bytes(size_t(XY_MULT_SIZE)*MESH_SIZE[2]*sizeof(lmcell));
+		return max(1U, min(MAX_LIGHT_JOBS, unsigned((size_t(MAX_JOB_LMAP_MEM_MB) << 20)/max(lmap_bytes, size_t(1)))));
+	}
+	void free_job_lmaps() { // called when there's no more work; the scratch lightmaps will be reallocated when new jobs are started
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {
+			if (!jobs[i].is_active() && jobs[i].lmgr.is_allocated()) {jobs[i].lmgr.free_cells();}
+		}
+	}
+	building_light_cache_t &get_cache_entry(building_t const &b, unsigned bix) {
+		auto it(cache.find(bix));
+
+		if (it != cache.end() && !it->second.is_same_building(b)) { // stale entry for a different building
+			if (it->second.num_jobs_running > 0) {end_rt_job();}
+			cache.erase(it);
+			it = cache.end();
+		}
+		if (it == cache.end()) {
+			evict_old_entries();
+			it = cache.emplace(std::piecewise_construct, std::forward_as_tuple(bix), std::forward_as_tuple(b)).first;
+			build_bvh(b, it->second.bvh);
+			is_done = 0; // new building has lights to compute
+			if ((int)bix == cur_bix) {cur_bix = -1;} // building index was reused; force a rebuild of the lighting
+		}
+		it->second.last_used = frame_id;
+		return it->second;
+	}
+	void evict_old_entries() {
+		while (cache.size() >= MAX_CACHED_BUILDINGS) { // evict the least recently used building that has no running jobs
+			auto oldest(cache.end());
 
-		if (USE_BKG_THREAD) { // start a thread to compute cur_light for building b
-			rt_thread = std::thread(&building_indir_light_mgr_t::cast_light_ray, this, b);
-			needs_to_join = 1;
+			for (auto i = cache.begin(); i != cache.end(); ++i) {
+				if ((int)i->first == cur_bix || i->second.num_jobs_running > 0) continue;
+				if (oldest == cache.end() || i->second.last_used < oldest->second.last_used) {oldest = i;}
+			}
+			if (oldest == cache.end()) break; // nothing can be evicted
+			cache.erase(oldest);
+		}
+	}
+	void start_lighting_compute(unsigned bix, unsigned light, unsigned num_rt_threads) {
+		building_light_job_t *job(nullptr);
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS && !job; ++i) {if (!jobs[i].is_active()) {job = jobs + i;}}
+		assert(job != nullptr);
+		auto it(cache.find(bix));
+		assert(it != cache.end());
+		building_t const &b(it->second.building);
+		assert(b.has_room_geom() && light < b.interior->room_geom->objs.size());
+		init_lmgr(job->lmgr);
+		job->light_obj = b.interior->room_geom->objs[light];
+		job->bix   = bix;
+		job->light = light;
+		job->cache = &it->second;
+		job->is_running = 1;
+		++it->second.num_jobs_running;
+
+		if (USE_BKG_THREAD) { // start a thread to compute this light
+			job->rt_thread = std::thread(&building_indir_light_mgr_t::cast_light_ray, this, job, num_rt_threads);
+			job->needs_to_join = 1;
 		}
 		else {
 			timer_t timer("Ray Cast Building Light");
-			cast_light_ray(b);
+			cast_light_ray(job, num_rt_threads);
 		}
 	}
 	void calc_reflect_ray(point &pos, point const &cpos, vector3d &dir, vector3d const &cnorm, rand_gen_t &rgen, float tolerance) const {
@@ -197,12 +336,12 @@ class building_indir_light_mgr_t {
 		if (dot_product(dir, cnorm) < 0.0) {dir.negate();} // make sure it points away from the surface (is this needed?)
 		pos = cpos + tolerance*dir; // move slightly away from the surface
 	}
-	void cast_light_ray(building_t const &b) {
-		// Note: modifies lmgr, but otherwise thread safe
-		unsigned const num_rt_threads(NUM_THREADS - (USE_BKG_THREAD ? 1 : 0)); // reserve a thread for the main thread if running in the background
-		vector<room_object_t> const &objs(b.interior->room_geom->objs);
-		assert((unsigned)cur_light < objs.size());
-		room_object_t const &ro(objs[cur_light]);
+	void cast_light_ray(building_light_job_t *job, unsigned num_rt_threads) {
+		// Note: modifies job->lmgr, but otherwise thread safe
+		building_t const &b(job->cache->building);
+		cube_bvh_t const &bvh(job->cache->bvh);
+		int const cur_light(job->light);
+		room_object_t const &ro(job->light_obj);
 		colorRGBA const lcolor(ro.get_color());
 		cube_t const scene_bounds(get_scene_bounds_bcube()); // expected by lmap update code
 		point const ray_scale(scene_bounds.get_size()/b.bcube.get_size()), llc_shift(scene_bounds.get_llc() - b.bcube.get_llc()*ray_scale);
@@ -213,10 +352,13 @@ class building_indir_light_mgr_t {
 		if (b.is_house) {weight *= 2.0;} // houses have dimmer lights and seem to work better with more indir
 		unsigned const NUM_PRI_SPLITS = 16;
 		int const num_rays(LOCAL_RAYS/NUM_PRI_SPLITS);
+		cube_t const empty_bcube(FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX);
+		vector<cube_t> thread_bcubes(max(1U, num_rt_threads), empty_bcube); // bounds of ray segments added by each thread
 
 #pragma omp parallel for schedule(dynamic) num_threads(num_rt_threads)
 		for (int n = 0; n < num_rays; ++n) {
 			if (kill_thread) continue;
+			cube_t &rays_bcube(thread_bcubes[omp_get_thread_num_3dw()]);
 			rand_gen_t rgen;
 			rgen.set_state(n+1, cur_light);
 			vector3d pri_dir(rgen.signed_rand_vector_spherical(1.0).get_norm());
@@ -244,7 +386,9 @@ class building_indir_light_mgr_t {
 
 					if (cpos != pos) { // accumulate light along the ray from pos to cpos (which is always valid) with color cur_color
 						point const p1(pos*ray_scale + llc_shift), p2(cpos*ray_scale + llc_shift); // transform building space to global scene space
-						add_path_to_lmcs(&lmgr, nullptr, p1, p2, weight, cur_color, LIGHTING_LOCAL, 0); // local light, no bcube
+						add_path_to_lmcs(&job->lmgr, nullptr, p1, p2, weight, cur_color, LIGHTING_LOCAL, 0); // local light, no bcube
+						rays_bcube.union_with_pt(p1);
+						rays_bcube.union_with_pt(p2);
 					}
 					if (!hit) break; // done
 					cur_color = cur_color.modulate_with(ccolor);
@@ -253,78 +397,147 @@ class building_indir_light_mgr_t {
 				} // for bounce
 			} // for splits
 		} // for n
-		is_running = 0;
+		job->rays_bcube = empty_bcube;
+		for (auto i = thread_bcubes.begin(); i != thread_bcubes.end(); ++i) {job->rays_bcube.union_with_cube(*i);}
+		job->is_running = 0;
 	}
-	void wait_for_finish(bool force_kill) {
-		// Note: for now the time taken to process a light should be pretty fast so we just block until finished; set kill_thread=1 to be faster
-		if (force_kill) {kill_thread = 1;}
-		while (is_running) {alut_sleep(0.01);}
-		kill_thread = 0;
+	void finish_job(building_light_job_t &job, bool discard) {
+		if (job.needs_to_join) {job.rt_thread.join(); job.needs_to_join = 0;}
+		assert(job.cache != nullptr && job.cache->num_jobs_running > 0);
+		--job.cache->num_jobs_running;
+		building_light_vol_t vol;
+		vol.extract_from(job.lmgr, job.rays_bcube); // always extract, which clears the scratch lmgr
+
+		if (!discard) {
+			if ((int)job.bix == cur_bix) { // add to the current building's lighting
+				vol.add_to(lmgr);
+				lighting_updated = 1;
+			}
+			job.cache->lights[job.light] = std::move(vol);
+		}
+		job.bix   = job.light = -1;
+		job.cache = nullptr;
+	}
+	void check_for_finished_jobs() {
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {
+			if (jobs[i].is_active() && !jobs[i].is_running) {finish_job(jobs[i], 0);} // discard=0
+		}
+	}
+	bool is_light_queued(unsigned bix, unsigned light) const {
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {
+			if (jobs[i].is_active() && jobs[i].bix == (int)bix && jobs[i].light == (int)light) return 1;
+		}
+		return 0;
+	}
+	void add_pending_lights(std::priority_queue<light_job_cand_t> &queue, unsigned bix, vector<unsigned> const &lights, float priority, unsigned max_add) const {
+		auto it(cache.find(bix));
+		assert(it != cache.end());
+		unsigned num_added(0);
+
+		for (auto i = lights.begin(); i != lights.end() && num_added < max_add; ++i) {
+			if (it->second.lights.find(*i) != it->second.lights.end() || is_light_queued(bix, *i)) continue; // done or in progress
+			queue.emplace(priority, bix, *i);
+			priority += 1.0E-6; // keep the light order within this building
+			++num_added;
+		}
+	}
+	// fills free job slots with the highest priority lights: first the lights in the current building in order,
+	// then lights from other recently visited buildings that have incomplete lighting, ordered by distance from the target
+	unsigned schedule_jobs(point const &target) {
+		unsigned const max_jobs(get_max_jobs());
+		unsigned num_active(0);
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {num_active += jobs[i].is_active();}
+		if (num_active >= max_jobs) return 0;
+		unsigned const num_free(max_jobs - num_active);
+		std::priority_queue<light_job_cand_t> queue;
+		vector<unsigned> other_light_ids;
+		if (cur_bix >= 0) {add_pending_lights(queue, cur_bix, light_ids, -1.0, num_free);} // negative priority is always first
+
+		for (auto i = cache.begin(); i != cache.end(); ++i) {
+			if ((int)i->first == cur_bix) continue; // already added
+			building_t const &b(i->second.building);
+			if (!b.has_room_geom()) continue; // room geom was removed
+			b.order_lights_by_priority(target, other_light_ids);
+			add_pending_lights(queue, i->first, other_light_ids, p2p_dist(target, b.bcube.closest_pt(target)), num_free);
+		}
+		unsigned const num_start(min(num_free, (unsigned)queue.size()));
+		if (num_start == 0) return 0;
+		num_active += num_start;
+		unsigned const num_rt_threads(max(1U, (NUM_THREADS - (USE_BKG_THREAD ? 1 : 0))/num_active)); // reserve a thread for the main thread if running in the background
+
+		for (unsigned n = 0; n < num_start; ++n) {
+			light_job_cand_t const cand(queue.top());
+			queue.pop();
+			start_lighting_compute(cand.bix, cand.light, num_rt_threads);
+		}
+		return num_start;
+	}
+	void rebuild_lighting_from_cache(building_light_cache_t const &bc) {
+		init_lmgr(lmgr);
+		lmgr.reset_all(); // clear lighting values back to 0
+
+		for (auto i = light_ids.begin(); i != light_ids.end(); ++i) { // only add lights that are on
+			auto it(bc.lights.find(*i));
+			if (it != bc.lights.end()) {it->second.add_to(lmgr);}
+		}
+		lighting_updated = 1; // even if nothing was added, since the texture may contain lighting from the previous building
+	}
+	unsigned get_num_lights_complete(building_light_cache_t const &bc) const {
+		unsigned num(0);
+		for (auto i = light_ids.begin(); i != light_ids.end(); ++i) {num += (bc.lights.find(*i) != bc.lights.end());}
+		return num;
 	}
 	void update_volume_light_texture() { // full update, 6.6ms for z=128
 		//timer_t timer("Lighting Tex Create");
 		indir_light_tex_from_lmap(cur_tid, lmgr, tex_data, MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[2], indir_light_exp, 1); // local_only=1
 	}
-	void maybe_join_thread() {
-		if (needs_to_join) {rt_thread.join(); needs_to_join = 0;}
-	}
 public:
-	building_indir_light_mgr_t() : is_running(0), is_done(0), kill_thread(0), lighting_updated(0), needs_to_join(0), cur_bix(-1), cur_light(-1), cur_tid(0) {}
-
-	void clear() {
-		is_done = lighting_updated = 0;
-		cur_bix = cur_light = -1;
-		tex_data.clear();
-		light_ids.clear();
-		lights_complete.clear();
-		end_rt_job();
-		lmgr.reset_all(); // clear lighting values back to 0
-		bvh.clear();
-	}
-	void end_rt_job() {
-		wait_for_finish(1); // force_kill=1
-		maybe_join_thread();
+	building_indir_light_mgr_t() : kill_thread(0), lighting_updated(0), is_done(0), cur_bix(-1), cur_tid(0), frame_id(0) {}
+
+	void end_rt_job() { // kill all running jobs; any partial results are discarded, but completed results remain cached
+		kill_thread = 1;
+
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {
+			if (!jobs[i].is_active()) continue;
+			while (jobs[i].is_running) {alut_sleep(0.01);}
+			finish_job(jobs[i], 1); // discard=1
+		}
+		kill_thread = 0;
 	}
 	void free_indir_texture() {free_texture(cur_tid);}
 
 	void register_cur_building(building_t const &b, unsigned bix, point const &target, unsigned &tid) { // target is in building space
-		if ((int)bix != cur_bix) { // change to a different building
-			clear();
-			cur_bix = bix;
-			assert(!is_running);
-			build_bvh(b);
-		}
-		if (cur_tid > 0 && is_done) return; // nothing else to do
-
-		if (display_framerate && (is_running || lighting_updated)) { // show progress to the user
-			std::ostringstream oss;
-			oss << "Lights: " << lights_complete.size() << " / " << light_ids.size();
-			lighting_update_text = oss.str();
-		}
-		if (is_running) return; // still running, let it continue
+		++frame_id;
+		building_light_cache_t &bc(get_cache_entry(b, bix)); // clears is_done if this is a new building
+		if (cur_tid > 0 && is_done && (int)bix == cur_bix) {tid = cur_tid; return;} // nothing else to do
+		b.order_lights_by_priority(target, light_ids);
+		if ((int)bix != cur_bix) {cur_bix = bix; is_done = 0; rebuild_lighting_from_cache(bc);} // change to a different building, reuse any cached lights
+		check_for_finished_jobs();
 
 		if (lighting_updated) { // update lighting texture based on incremental progress
-			maybe_join_thread();
 			update_volume_light_texture();
 			lighting_updated = 0;
 		}
-		// nothing is running and there is more work to do, find the nearest light to the target and process it
-		if (cur_light >= 0) {lights_complete.insert(cur_light); cur_light = -1;} // mark the most recent light as complete
-		b.order_lights_by_priority(target, light_ids);
+		schedule_jobs(target);
+		unsigned num_running(0);
+		for (unsigned i = 0; i < MAX_LIGHT_JOBS; ++i) {num_running += jobs[i].is_active();}
+		is_done = (num_running == 0); // all lights of all cached buildings are complete
+		if (is_done) {free_job_lmaps();}
 
-		for (auto i = light_ids.begin(); i != light_ids.end(); ++i) {
-			if (lights_complete.find(*i) == lights_complete.end()) {cur_light = *i; break;} // find an incomplete light
+		if (display_framerate && num_running > 0) { // show progress to the user
+			std::ostringstream oss;
+			oss << "Lights: " << get_num_lights_complete(bc) << " / " << light_ids.size();
+			if (num_running > 1) {oss << " (" << num_running << " running)";}
+			lighting_update_text = oss.str();
 		}
-		if (cur_light >= 0) {start_lighting_compute(b);} // this light is next
-		else {is_done = 1;} // no more lights to process
-		//cout << "Process light " << lights_complete.size() << " of " << light_ids.size() << endl;
 		tid = cur_tid;
 	}
-	void build_bvh(building_t const &b) {
+	static void build_bvh(building_t const &b, cube_bvh_t &bvh) {
 		bvh.clear();
 		b.gather_interior_cubes(bvh.get_objs());
 		bvh.build_tree_top(0); // verbose=0
 	}
+	void build_bvh(building_t const &b) {build_bvh(b, bvh);}
 	cube_bvh_t const &get_bvh() const {return bvh;}
 };
 
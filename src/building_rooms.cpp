@@ -5,6 +5,7 @@
 #include "function_registry.h"
 #include "buildings.h"
 #include "city.h" // for object_model_loader_t
+#include "vertex_opt.h"
 #pragma warning(disable : 26812) // prefer enum class over enum
 
 bool const ADD_BOOK_COVERS = 1;
@@ -14,9 +15,12 @@ colorRGBA const book_colors[NUM_BOOK_COLORS] = {GRAY_BLACK, WHITE, LT_GRAY, GRAY
 
 object_model_loader_t building_obj_model_loader;
 
+extern bool vert_opt_flags[3];
 extern int display_mode;
 extern pos_dir_up camera_pdu;
 
+vert_opt_stats_t building_vert_opt_stats; // accumulated across the materials of the current building_materials_t
+
 int get_rand_screenshot_texture(unsigned rand_ix);
 unsigned get_num_screenshot_tids();
 
@@ -962,6 +966,8 @@ void rgeom_mat_t::clear() {
 }
 
 void rgeom_mat_t::create_vbo() {
+	// non-indexed quads are drawn in order, but indexed triangles can be reordered for the vertex cache, overdraw, and vertex fetch
+	if (vert_opt_flags[0] && !indices.empty()) {optimize_indexed_tris_and_verts(itri_verts, indices, &building_vert_opt_stats);}
 	num_qverts  = quad_verts.size();
 	num_itverts = itri_verts.size();
 	num_ixs     = indices.size();
@@ -1025,6 +1031,8 @@ rgeom_mat_t &building_materials_t::get_material(tid_nm_pair_t const &tex, bool i
 }
 void building_materials_t::create_vbos() {
 	for (iterator m = begin(); m != end(); ++m) {m->create_vbo();}
+	if (vert_opt_flags[2] && building_vert_opt_stats.num_tris > 0) {building_vert_opt_stats.print("Building interior vertex optimization");}
+	building_vert_opt_stats = vert_opt_stats_t(); // reset
 }
 void building_materials_t::draw(shader_t &s, bool shadow_only) {
 	for (iterator m = begin(); m != end(); ++m) {m->draw(s, shadow_only);}
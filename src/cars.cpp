@@ -243,6 +243,7 @@ void ao_draw_state_t::occlusion_checker_t::set_camera(pos_dir_up const &pdu) {
 }
 
 bool ao_draw_state_t::occlusion_checker_t::is_occluded(cube_t const &c) {
+	if (cube_hiz_occluded(state.pos, c)) return 1;
 	if (state.building_ids.empty()) return 0;
 	float const z(c.z2()); // top edge
 	point const corners[4] = {point(c.x1(), c.y1(), z), point(c.x2(), c.y1(), z), point(c.x2(), c.y2(), z), point(c.x1(), c.y2(), z)};
@@ -306,35 +307,51 @@ bool sphere_in_light_cone_approx(pos_dir_up const &pdu, point const &center, flo
 	return pt_line_dist_less_than(center, pdu.pos, (pdu.pos + pdu.dir), rmod);
 }
 
-void car_draw_state_t::draw_car(car_t const &car, bool is_dlight_shadows) { // Note: all quads
-	if (car.destroyed) return;
+// returns false if the car is culled; if draw_model is set, inst is filled in; called in parallel, so must not modify any state
+bool car_draw_state_t::setup_car_draw(car_t const &car, bool is_dlight_shadows, bool &draw_model, city_model_inst_t &inst) const {
+	if (car.destroyed) return 0;
 	point const center(car.get_center());
 
 	if (is_dlight_shadows) { // dynamic spotlight shadow
-		if (!dist_less_than(camera_pdu.pos, center, 0.6*camera_pdu.far_)) return; // optimization
+		if (!dist_less_than(camera_pdu.pos, center, 0.6*camera_pdu.far_)) return 0; // optimization
 		// since we know the dlight is a spotlight with a cone shape rather than a frustum, we can do a tighter visibility test
-		if (!sphere_in_light_cone_approx(camera_pdu, center, car.bcube.get_xy_bsphere_radius())) return;
+		if (!sphere_in_light_cone_approx(camera_pdu, center, car.bcube.get_xy_bsphere_radius())) return 0;
 		cube_t bcube(car.bcube);
 		bcube.expand_by(0.1*car.height);
-		if (bcube.contains_pt(camera_pdu.pos)) return; // don't self-shadow
+		if (bcube.contains_pt(camera_pdu.pos)) return 0; // don't self-shadow
+	}
+	if (!check_cube_visible(car.bcube, (shadow_only ? 0.0 : 0.75))) return 0; // dist_scale=0.75
+	float const tile_draw_dist(get_draw_tile_dist()), dist_val(p2p_dist(camera_pdu.pos, (center + xlate))/tile_draw_dist);
+	draw_model = (car_model_loader.num_models() > 0 &&
+		(is_dlight_shadows ? dist_less_than(pre_smap_player_pos, center, 0.05*tile_draw_dist) : (shadow_only || dist_val < 0.05)));
+	if (draw_model) {draw_model = car_model_loader.is_model_valid(car.model_id);} // models must already be loaded
+	if (!draw_model) return 1;
+	point pb[8], pt[8]; // bottom and top sections; only the bottom is used
+	gen_car_pts(car, 0, pb, pt);
+	vector3d const front_n(cross_product((pb[5] - pb[1]), (pb[0] - pb[1])).get_norm()*((car.dim^car.dir) ? -1.0 : 1.0));
+	car_model_loader.setup_model_inst(inst, center, car.bcube, front_n, car.get_color(), car.model_id, (dist_val > 0.035));
+	return 1;
+}
+
+void car_draw_state_t::draw_car(car_t const &car, city_model_inst_t const *inst) { // Note: all quads
+	point const center(car.get_center());
+
+	if (use_smap) { // batched car models must be drawn with the shadow map of their tile, so flush the batch when moving to a new tile
+		uint64_t const tile_id(get_tile_id_containing_point(center + xlate));
+		if (tile_id != model_tile_id) {draw_model_batch(); model_tile_id = tile_id;}
 	}
-	if (!camera_pdu.sphere_visible_test((center + xlate), 0.5f*(car.bcube.dx() + car.bcube.dy() + car.bcube.dz()))) return; // use fast upper bound approx for radius
-	if (!check_cube_visible(car.bcube, (shadow_only ? 0.0 : 0.75))) return; // dist_scale=0.75
 	begin_tile(center); // enable shadows
 	colorRGBA const &color(car.get_color());
 	float const tile_draw_dist(get_draw_tile_dist()), dist_val(p2p_dist(camera_pdu.pos, (center + xlate))/tile_draw_dist);
 	bool const is_truck(car.height > 1.2*city_params.get_nom_car_size().z); // hack - truck has a larger than average size
 	bool const draw_top(dist_val < 0.25 && !is_truck), dim(car.dim), dir(car.dir);
-	bool const draw_model(car_model_loader.num_models() > 0 &&
-		(is_dlight_shadows ? dist_less_than(pre_smap_player_pos, center, 0.05*tile_draw_dist) : (shadow_only || dist_val < 0.05)));
 	float const sign((dim^dir) ? -1.0 : 1.0);
 	point pb[8], pt[8]; // bottom and top sections
 	gen_car_pts(car, draw_top, pb, pt);
 
-	if (draw_model && car_model_loader.is_model_valid(car.model_id)) {
+	if (inst != nullptr) {
 		if (is_occluded(car.bcube)) return; // only check occlusion for expensive car models
-		vector3d const front_n(cross_product((pb[5] - pb[1]), (pb[0] - pb[1])).get_norm()*sign);
-		car_model_loader.draw_model(s, center, car.bcube, front_n, color, xlate, car.model_id, shadow_only, (dist_val > 0.035));
+		model_batch.add(*inst); // drawn grouped by model on the next tile change or at the end of the pass
 	}
 	else { // draw simple 1-2 cube model
 		quad_batch_draw &qbd(qbds[emit_now]);
@@ -828,6 +845,27 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 	//cout << TXT(cars.size()) << TXT(entering_city.size()) << TXT(in_isects.size()) << TXT(num_on_conn_road) << endl; // TESTING
 }
 
+void car_manager_t::build_block_draw(block_draw_t &bd, vector3d const &xlate, bool only_parked, bool is_dlight_shadows) const {
+	bd.draw_cars.clear();
+	bd.inst_ixs.clear();
+	bd.insts.clear();
+	bd.vfc_spheres.clear();
+	// use fast upper bound approx for radius
+	for (unsigned c = bd.start; c != bd.end; ++c) {bd.vfc_spheres.add((cars[c].get_center() + xlate), 0.5f*(cars[c].bcube.dx() + cars[c].bcube.dy() + cars[c].bcube.dz()));}
+	camera_pdu.spheres_visible_test(bd.vfc_spheres, bd.in_view); // batch VFC
+	city_model_inst_t inst;
+
+	for (unsigned c = bd.start; c != bd.end; ++c) {
+		if (only_parked && !cars[c].is_parked()) continue; // skip non-parked cars
+		if (!bd.in_view.is_visible(c - bd.start)) continue; // not in view
+		bool draw_model(0);
+		if (!dstate.setup_car_draw(cars[c], is_dlight_shadows, draw_model, inst)) continue; // culled
+		bd.draw_cars.push_back(c);
+		bd.inst_ixs.push_back(draw_model ? (int)bd.insts.size() : -1);
+		if (draw_model) {bd.insts.push_back(inst);}
+	}
+}
+
 void car_manager_t::draw(int trans_op_mask, vector3d const &xlate, bool use_dlights, bool shadow_only, bool is_dlight_shadows, bool garages_pass) {
 	if (cars.empty()) return;
 	if ( garages_pass && first_garage_car == cars.size()) return; // no cars in garages
@@ -844,17 +882,38 @@ void car_manager_t::draw(int trans_op_mask, vector3d const &xlate, bool use_dlig
 		dstate.pre_draw(xlate, use_dlights, shadow_only);
 		if (!shadow_only) {dstate.s.add_uniform_float("hemi_lighting_normal_scale", 0.0);} // disable hemispherical lighting normal because the transforms make it incorrect
 
+		if (car_model_loader.num_models() > 0) {car_model_loader.ensure_models_loaded();} // must be done before the parallel section below
+		unsigned num_block_draws(0);
+
 		for (auto cb = car_blocks.begin(); cb+1 < car_blocks.end(); ++cb) {
 			if (cb->is_in_building() != garages_pass) continue; // wrong pass
 			if (!camera_pdu.cube_visible(get_cb_bcube(*cb) + xlate)) continue; // city not visible - skip
-			unsigned const end((cb+1)->start);
-			assert(end <= cars.size());
-
-			for (unsigned c = cb->start; c != end; ++c) {
-				if (only_parked && !cars[c].is_parked()) continue; // skip non-parked cars
-				dstate.draw_car(cars[c], is_dlight_shadows);
-			}
+			if (num_block_draws == block_draws.size()) {block_draws.emplace_back();}
+			block_draw_t &bd(block_draws[num_block_draws++]);
+			bd.start = cb->start;
+			bd.end   = (cb+1)->start;
+			assert(bd.end <= cars.size());
 		} // for cb
+		// cull cars, select models, and compute model transforms for all visible car blocks in parallel
+#pragma omp parallel for schedule(dynamic) if (num_block_draws > 1)
+		for (int b = 0; b < (int)num_block_draws; ++b) {build_block_draw(block_draws[b], xlate, only_parked, is_dlight_shadows);}
+
+		for (unsigned b = 0; b < num_block_draws; ++b) { // serial part: occlusion culling and drawing
+			block_draw_t const &bd(block_draws[b]);
+			if (bd.draw_cars.empty()) continue; // no visible cars
+
+			if (!shadow_only) { // batch occlusion test of all cars in this block
+				car_bcubes.clear();
+				for (unsigned c = bd.start; c != bd.end; ++c) {car_bcubes.push_back(cars[c].bcube + xlate);}
+				check_cubes_hiz_visible(camera_pdu.pos, car_bcubes.data(), car_bcubes.size(), car_visible);
+			}
+			for (unsigned n = 0; n < bd.draw_cars.size(); ++n) {
+				unsigned const c(bd.draw_cars[n]);
+				if (!shadow_only && !car_visible[c - bd.start]) continue; // occluded
+				dstate.draw_car(cars[c], ((bd.inst_ixs[n] < 0) ? nullptr : &bd.insts[bd.inst_ixs[n]]));
+			}
+		} // for b
+		dstate.draw_model_batch(); // draw any remaining car models; must be done before the shader is ended in post_draw()
 		if (!shadow_only) {dstate.s.add_uniform_float("hemi_lighting_normal_scale", 1.0);} // restore
 		dstate.post_draw();
 		fgPopMatrix();
@@ -551,15 +551,20 @@ class car_draw_state_t : public ao_draw_state_t {
 
 	quad_batch_draw qbds[2]; // unshadowed, shadowed
 	car_model_loader_t &car_model_loader;
+	city_model_batch_t model_batch; // car models to draw, all in the tile model_tile_id
+	uint64_t model_tile_id;
 public:
-	car_draw_state_t(car_model_loader_t &car_model_loader_) : car_model_loader(car_model_loader_) {}
+	car_draw_state_t(car_model_loader_t &car_model_loader_) : car_model_loader(car_model_loader_), model_tile_id(0) {}
+	void draw_model_batch() {model_batch.draw_and_clear(s, car_model_loader, xlate, shadow_only, 0);}
+	void free_context() {model_batch.free_context();}
 	static float get_headlight_dist();
 	colorRGBA get_headlight_color(car_t const &car) const;
 	void pre_draw(vector3d const &xlate_, bool use_dlights_, bool shadow_only_);
 	virtual void draw_unshadowed();
 	void add_car_headlights(vector<car_t> const &cars, vector3d const &xlate_, cube_t &lights_bcube);
 	void gen_car_pts(car_t const &car, bool include_top, point pb[8], point pt[8]) const;
-	void draw_car(car_t const &car, bool is_dlight_shadows);
+	bool setup_car_draw(car_t const &car, bool is_dlight_shadows, bool &draw_model, city_model_inst_t &inst) const; // culling and model xform; thread safe
+	void draw_car(car_t const &car, city_model_inst_t const *inst); // Note: camera VFC is done by the caller; inst is nullptr for simple cube cars
 	void add_car_headlights(car_t const &car, cube_t &lights_bcube);
 }; // car_draw_state_t
 
@@ -592,6 +597,18 @@ class car_manager_t {
 	car_draw_state_t dstate;
 	rand_gen_t rgen;
 	vector<unsigned> entering_city;
+	struct block_draw_t { // visible cars of one car block, filled in parallel each frame
+		unsigned start, end; // range of cars
+		vector<unsigned> draw_cars; // indices into cars
+		vector<int> inst_ixs; // parallel to draw_cars; index into insts, or -1 for simple cube cars
+		vector<city_model_inst_t> insts;
+		vfc_sphere_batch_t vfc_spheres; // for batch VFC
+		vis_mask_t in_view;
+		block_draw_t() : start(0), end(0) {}
+	};
+	vector<block_draw_t> block_draws; // reused across draw calls
+	vect_cube_t car_bcubes; // reused across draw calls for batch occlusion queries
+	vector<unsigned char> car_visible;
 	cube_t garages_bcube;
 	unsigned first_parked_car, first_garage_car;
 	bool car_destroyed;
@@ -605,6 +622,7 @@ class car_manager_t {
 	void remove_destroyed_cars();
 	void update_cars();
 	int find_next_car_after_turn(car_t &car);
+	void build_block_draw(block_draw_t &bd, vector3d const &xlate, bool only_parked, bool is_dlight_shadows) const;
 public:
 	car_manager_t(city_road_gen_t const &road_gen_) : road_gen(road_gen_), dstate(car_model_loader), first_parked_car(0), first_garage_car(0), car_destroyed(0) {}
 	bool empty() const {return cars.empty();}
@@ -626,7 +644,7 @@ public:
 	void next_frame(ped_manager_t const &ped_manager, float car_speed);
 	void draw(int trans_op_mask, vector3d const &xlate, bool use_dlights, bool shadow_only, bool is_dlight_shadows, bool garages_pass);
 	void add_car_headlights(vector3d const &xlate, cube_t &lights_bcube) {dstate.add_car_headlights(cars, xlate, lights_bcube);}
-	void free_context() {car_model_loader.free_context();}
+	void free_context() {car_model_loader.free_context(); dstate.free_context();}
 }; // car_manager_t
 
 
@@ -714,6 +732,15 @@ class ped_manager_t { // pedestrians
 		city_ixs_t() : ped_ix(0), plot_ix(0) {}
 		void assign(unsigned ped_ix_, unsigned plot_ix_) {ped_ix = ped_ix_; plot_ix = plot_ix_;}
 	};
+	struct plot_draw_t { // visible peds of one plot, filled in parallel each frame
+		unsigned city, plot;
+		point tile_pos; // selects the tile shadow map
+		vector<unsigned> sphere_peds, model_peds; // indices into peds; model_peds is parallel to insts
+		vector<city_model_inst_t> insts;
+		vfc_sphere_batch_t vfc_spheres; // for batch VFC
+		vis_mask_t in_view;
+		plot_draw_t() : city(0), plot(0) {}
+	};
 	city_road_gen_t const &road_gen;
 	car_manager_t const &car_manager; // used for ped road crossing safety and dest car selection
 	ped_model_loader_t ped_model_loader;
@@ -723,6 +750,8 @@ class ped_manager_t { // pedestrians
 	vector<unsigned char> need_to_sort_city;
 	vector<car_city_vect_t> cars_by_city;
 	vector<point> bldg_ppl_pos;
+	vector<plot_draw_t> plot_draws; // reused across draw calls
+	city_model_batch_t model_batch;
 	rand_gen_t rgen;
 	ao_draw_state_t dstate;
 	int selected_ped_ssn;
@@ -737,6 +766,13 @@ class ped_manager_t { // pedestrians
 	road_isec_t const &get_car_isec(car_base_t const &car) const;
 	void register_ped_new_plot(pedestrian_t const &ped);
 	int get_road_ix_for_ped_crossing(pedestrian_t const &ped, bool road_dim) const;
+	bool ped_has_model(pedestrian_t const &ped) const {return (ped_model_loader.num_models() > 0 && ped_model_loader.is_loaded_model_valid(ped.model_id));}
+	cube_t get_ped_model_bcube(pedestrian_t const &ped) const;
+	void get_ped_vfc_sphere(pedestrian_t const &ped, point &center, float &radius) const;
+	unsigned setup_ped_draw(pedestrian_t const &ped, pos_dir_up const &pdu, float def_draw_dist, float draw_dist_sq, bool shadow_only, bool is_dlight_shadows,
+		bool skip_vfc, city_model_inst_t &inst) const;
+	void build_plot_draw(plot_draw_t &pd, pos_dir_up const &pdu, float def_draw_dist, float draw_dist_sq, bool shadow_only, bool is_dlight_shadows) const;
+	void add_ped_ao_shadow(pedestrian_t const &ped);
 	bool draw_ped(pedestrian_t const &ped, shader_t &s, pos_dir_up const &pdu, vector3d const &xlate, float def_draw_dist, float draw_dist_sq,
 		bool &in_sphere_draw, bool shadow_only, bool is_dlight_shadows, bool enable_animations);
 public:
@@ -776,7 +812,7 @@ public:
 	void draw(vector3d const &xlate, bool use_dlights, bool shadow_only, bool is_dlight_shadows);
 	void draw_peds_in_building(int first_ped_ix, unsigned bix, shader_t &s, vector3d const &xlate, bool dlight_shadow_only);
 	void get_ped_bcubes_for_building(int first_ped_ix, unsigned bix, vect_cube_t &bcubes) const;
-	void free_context() {ped_model_loader.free_context();}
+	void free_context() {ped_model_loader.free_context(); model_batch.free_context();}
 	//vector3d get_dest_move_dir(point const &pos) const;
 }; // end ped_manager_t
 
@@ -3,6 +3,7 @@
 // 6/5/2020
 #include "city.h"
 #include "file_utils.h"
+#include <glm/gtc/matrix_transform.hpp>
 
 extern city_params_t city_params;
 
@@ -66,58 +67,166 @@ void city_model_loader_t::load_models() {
 	} // for i
 }
 
-void city_model_loader_t::draw_model(shader_t &s, vector3d const &pos, cube_t const &obj_bcube, vector3d const &dir, colorRGBA const &color,
-	vector3d const &xlate, unsigned model_id, bool is_shadow_pass, bool low_detail, bool enable_animations)
+static void xf_rotate(xform_matrix &xf, float angle, vector3d const &axis) { // angle is in radians; matches fgRotateRadians()
+	if (angle == 0.0 || axis == zero_vector) return;
+	xf = glm::rotate((glm::mat4 const &)xf, angle, vec3_from_vector3d(axis));
+}
+
+void city_model_loader_t::setup_model_inst(city_model_inst_t &inst, point const &pos, cube_t const &obj_bcube, vector3d const &dir, colorRGBA const &color,
+	unsigned model_id, bool low_detail, float anim_time) const
 {
+	assert(model_id < size()); // must be loaded
+	city_model_t const &model_file(get_model(model_id));
+	cube_t const &bcube(at(model_id).get_bcube());
+	// Note: in model space, front-back=z, left-right=x, top-bot=y (for model_file.swap_yz=1)
+	float const sz_scale(obj_bcube.get_size().sum() / bcube.get_size().sum());
+	float const height(model_file.swap_yz ? bcube.dy() : bcube.dz());
+	float const z_offset(0.5*height - (pos.z - obj_bcube.z1())/sz_scale); // translate required to map bottom of model to bottom of obj_bcube post transform
+	inst.pos        = pos;
+	inst.color      = color;
+	inst.anim_time  = anim_time;
+	inst.anim_scale = model_file.scale/sz_scale; // Note: determined somewhat experimentally
+	inst.model_id   = model_id;
+	inst.low_detail = low_detail;
+	// same transform sequence as the fgTranslate()/fgRotate()/fgScale() calls this replaced, but built without the (non thread safe) matrix stack
+	xform_matrix &xf(inst.xf);
+	xf = glm::translate(glm::mat4(1.0), vec3_from_vector3d(pos + vector3d(0.0, 0.0, z_offset*sz_scale))); // z_offset is in model space, scale to world space
+	if (fabs(dir.y) > 0.001) {xf_rotate(xf, safe_acosf(dir.get_norm().x), vector3d(0.0, 0.0, dir.y));} // orient facing front
+	else if (dir.x < 0.0) {xf_rotate(xf, PI, plus_z);}
+	if (dir.z != 0.0) {xf_rotate(xf, asinf(-dir.z), plus_y);} // handle cars on a slope
+	if (model_file.xy_rot != 0.0) {xf_rotate(xf, TO_RADIANS*model_file.xy_rot, plus_z);} // apply model rotation about z/up axis (in degrees)
+	if (model_file.swap_yz) {xf_rotate(xf, 0.5*PI, plus_x);} // swap Y and Z dirs; models have up=Y, but we want up=Z
+	// scale from model space to the world space size of our target cube, using a uniform scale based on the averages of the x,y,z sizes,
+	// then cancel out model local translate
+	xf = glm::scale((glm::mat4 const &)xf, glm::vec3(sz_scale));
+	xf = glm::translate((glm::mat4 const &)xf, -vec3_from_vector3d(bcube.get_cube_center()));
+}
+
+// draws num instances, which must all use the same model; per-model state is set once, and each instance only applies its transform
+void city_model_loader_t::draw_model_insts(shader_t &s, city_model_inst_t const *const insts, unsigned num, vector3d const &xlate, bool is_shadow_pass, bool enable_animations) {
+	if (num == 0) return;
+	unsigned const model_id(insts[0].model_id);
 	assert(is_model_valid(model_id));
 	assert(size() == num_models()); // must be loaded
 	city_model_t const &model_file(get_model(model_id));
 	model3d &model(at(model_id));
-
-	if (!is_shadow_pass && model_file.body_mat_id >= 0 && color.A != 0.0) { // use custom color for body material
-		material_t &body_mat(model.get_material(model_file.body_mat_id));
-		body_mat.ka = body_mat.kd = color;
-	}
+	material_t *const body_mat((!is_shadow_pass && model_file.body_mat_id >= 0) ? &model.get_material(model_file.body_mat_id) : nullptr);
 	model.bind_all_used_tids();
 	cube_t const &bcube(model.get_bcube());
-	point const orig_camera_pos(camera_pdu.pos);
-	camera_pdu.pos += bcube.get_cube_center() - pos - xlate; // required for distance based LOD
+	point const orig_camera_pos(camera_pdu.pos), model_center(bcube.get_cube_center());
 	bool const camera_pdu_valid(camera_pdu.valid);
 	camera_pdu.valid = 0; // disable VFC, since we're doing custom transforms here
-	// Note: in model space, front-back=z, left-right=x, top-bot=y (for model_file.swap_yz=1)
-	float const sz_scale(obj_bcube.get_size().sum() / bcube.get_size().sum());
-	float const height(model_file.swap_yz ? bcube.dy() : bcube.dz());
-	float const z_offset(0.5*height - (pos.z - obj_bcube.z1())/sz_scale); // translate required to map bottom of model to bottom of obj_bcube post transform
-	
+
 	if (enable_animations) {
-		s.add_uniform_float("animation_scale",    model_file.scale/sz_scale); // Note: determined somewhat experimentally
+		float const height(model_file.swap_yz ? bcube.dy() : bcube.dz());
 		s.add_uniform_float("model_delta_height", (0.1*height + (model_file.swap_yz ? bcube.y1() : bcube.z1())));
 	}
-	fgPushMatrix();
-	translate_to(pos + vector3d(0.0, 0.0, z_offset*sz_scale)); // z_offset is in model space, scale to world space
-	if (fabs(dir.y) > 0.001) {rotate_to_plus_x(dir);} // orient facing front
-	else if (dir.x < 0.0) {fgRotate(180.0, 0.0, 0.0, 1.0);}
-	if (dir.z != 0.0) {fgRotate(TO_DEG*asinf(-dir.z), 0.0, 1.0, 0.0);} // handle cars on a slope
-	if (model_file.xy_rot != 0.0) {fgRotate(model_file.xy_rot, 0.0, 0.0, 1.0);} // apply model rotation about z/up axis (in degrees)
-	if (model_file.swap_yz) {fgRotate(90.0, 1.0, 0.0, 0.0);} // swap Y and Z dirs; models have up=Y, but we want up=Z
-	uniform_scale(sz_scale); // scale from model space to the world space size of our target cube, using a uniform scale based on the averages of the x,y,z sizes
-	translate_to(-bcube.get_cube_center()); // cancel out model local translate
-
-	if ((low_detail || is_shadow_pass) && !model_file.shadow_mat_ids.empty()) { // low detail pass, normal maps disabled
-		if (!is_shadow_pass && use_model3d_bump_maps()) {model3d::bind_default_flat_normal_map();} // still need to set the default here in case the shader is using it
-		// TODO: combine shadow materials into a single VBO and draw with one call when is_shadow_pass==1; this is complex and may not yield a significant improvement
-		for (auto i = model_file.shadow_mat_ids.begin(); i != model_file.shadow_mat_ids.end(); ++i) {model.render_material(s, *i, is_shadow_pass, 0, 2, 0);}
+	for (unsigned i = 0; i < num; ++i) {
+		city_model_inst_t const &inst(insts[i]);
+		assert(inst.model_id == model_id);
+		if (body_mat && inst.color.A != 0.0) {body_mat->ka = body_mat->kd = inst.color;} // use custom color for body material
+		camera_pdu.pos = orig_camera_pos + model_center - inst.pos - xlate; // required for distance based LOD
+
+		if (enable_animations) {
+			s.add_uniform_float("animation_scale", inst.anim_scale);
+			s.add_uniform_float("animation_time",  inst.anim_time);
+		}
+		fgPushMatrix();
+		fgMultMatrix(inst.xf);
+
+		if ((inst.low_detail || is_shadow_pass) && !model_file.shadow_mat_ids.empty()) { // low detail pass, normal maps disabled
+			if (!is_shadow_pass && use_model3d_bump_maps()) {model3d::bind_default_flat_normal_map();} // still need to set the default here in case the shader is using it
+			// TODO: combine shadow materials into a single VBO and draw with one call when is_shadow_pass==1; this is complex and may not yield a significant improvement
+			for (auto m = model_file.shadow_mat_ids.begin(); m != model_file.shadow_mat_ids.end(); ++m) {model.render_material(s, *m, is_shadow_pass, 0, 2, 0);}
+		}
+		else {
+			model.render_materials(s, is_shadow_pass, 0, 0, 2, 3, 3, model.get_unbound_material(), rotation_t(),
+				nullptr, nullptr, is_shadow_pass, model_file.lod_mult, (is_shadow_pass ? 10.0 : 0.0)); // enable_alpha_mask=2 (both)
+		}
+		fgPopMatrix();
+	} // for i
+	camera_pdu.valid = camera_pdu_valid;
+	camera_pdu.pos   = orig_camera_pos;
+	select_texture(WHITE_TEX); // reset back to default/untextured
+}
+
+void city_model_loader_t::draw_model(shader_t &s, vector3d const &pos, cube_t const &obj_bcube, vector3d const &dir, colorRGBA const &color,
+	vector3d const &xlate, unsigned model_id, bool is_shadow_pass, bool low_detail, bool enable_animations, float anim_time)
+{
+	assert(is_model_valid(model_id)); // loads models if needed
+	city_model_inst_t inst;
+	setup_model_inst(inst, pos, obj_bcube, dir, color, model_id, low_detail, anim_time);
+	draw_model_insts(s, &inst, 1, xlate, is_shadow_pass, enable_animations);
+}
+
+// shadow pass only: draws num instances of a model, using the per-instance transforms in xf_vbo bound to the mat4 attribute at xf_loc;
+// the shadow materials are used if specified, otherwise all materials; animations aren't supported by the shadow shader
+void city_model_loader_t::draw_model_insts_instanced_shadow(shader_t &s, unsigned model_id, unsigned num, int xf_loc, unsigned xf_vbo) {
+	if (num == 0) return;
+	assert(is_model_valid(model_id));
+	city_model_t const &model_file(get_model(model_id));
+	model3d &model(at(model_id));
+	model.bind_all_used_tids();
+	bool const camera_pdu_valid(camera_pdu.valid);
+	camera_pdu.valid = 0; // disable VFC, since we're doing custom transforms here
+	model3d::set_instancing(xf_loc, xf_vbo, num);
+
+	if (!model_file.shadow_mat_ids.empty()) {
+		for (auto m = model_file.shadow_mat_ids.begin(); m != model_file.shadow_mat_ids.end(); ++m) {model.render_material(s, *m, 1, 0, 2, 0);}
 	}
 	else {
-		model.render_materials(s, is_shadow_pass, 0, 0, 2, 3, 3, model.get_unbound_material(), rotation_t(),
-			nullptr, nullptr, is_shadow_pass, model_file.lod_mult, (is_shadow_pass ? 10.0 : 0.0)); // enable_alpha_mask=2 (both)
+		model.render_materials(s, 1, 0, 0, 2, 3, 3, model.get_unbound_material(), rotation_t(), nullptr, nullptr, 1, model_file.lod_mult, 10.0); // enable_alpha_mask=2 (both)
 	}
-	fgPopMatrix();
+	model3d::clear_instancing();
 	camera_pdu.valid = camera_pdu_valid;
-	camera_pdu.pos   = orig_camera_pos;
 	select_texture(WHITE_TEX); // reset back to default/untextured
 }
 
+// switches to the instanced version of the shadow shader, draws each model's instances from sorted/model_start, then restores shader s
+void city_model_batch_t::draw_sorted_instanced_shadow(shader_t &s, city_model_loader_t &loader) {
+	shader_t is;
+	is.set_prefix("#define USE_CUSTOM_XFORM", 0); // VS
+	is.begin_simple_textured_shader(); // same as the shader used for the city shadow pass
+	int const xf_loc(is.get_attrib_loc("inst_xform_matrix"));
+	if (!inst_vbo) {inst_vbo = create_vbo();}
+
+	for (unsigned m = 0; m+1 < model_start.size(); ++m) {
+		unsigned const start(model_start[m]), num(model_start[m+1] - start);
+		if (num == 0) continue;
+		inst_xfs.resize(num);
+		for (unsigned i = 0; i < num; ++i) {inst_xfs[i] = sorted[start+i].xf;} // xlate is already in the MVM
+		upload_to_vbo(inst_vbo, inst_xfs, 0, 1, 2); // end_with_bind0=1, dynamic_level=2 (stream)
+		loader.draw_model_insts_instanced_shadow(is, m, num, xf_loc, inst_vbo);
+	}
+	is.end_shader();
+	s.enable();
+}
+
+void city_model_batch_t::draw_and_clear(shader_t &s, city_model_loader_t &loader, vector3d const &xlate, bool is_shadow_pass, bool enable_animations) {
+	if (insts.empty()) return;
+	unsigned const num_models(loader.num_models());
+	// counting sort by model_id, stable so that instances of the same model are drawn in the order they were added
+	model_start.clear();
+	model_start.resize(num_models+1, 0);
+
+	for (auto i = insts.begin(); i != insts.end(); ++i) {
+		assert(i->model_id < num_models);
+		++model_start[i->model_id+1];
+	}
+	for (unsigned m = 0; m < num_models; ++m) {model_start[m+1] += model_start[m];}
+	model_pos.assign(model_start.begin(), model_start.end()-1);
+	sorted.resize(insts.size());
+	for (auto i = insts.begin(); i != insts.end(); ++i) {sorted[model_pos[i->model_id]++] = *i;}
+
+	if (is_shadow_pass) {draw_sorted_instanced_shadow(s, loader);}
+	else {
+		for (unsigned m = 0; m < num_models; ++m) { // one group per model
+			loader.draw_model_insts(s, (sorted.data() + model_start[m]), (model_start[m+1] - model_start[m]), xlate, is_shadow_pass, enable_animations);
+		}
+	}
+	insts.clear();
+}
+
 unsigned car_model_loader_t::num_models() const {return city_params.car_model_files.size();}
 
 city_model_t const &car_model_loader_t::get_model(unsigned id) const {
@@ -24,19 +24,51 @@ struct city_model_t {
 };
 
 
+struct city_model_inst_t { // one placed model, with its transform precomputed so that it can be built in parallel; size = 108
+	xform_matrix xf; // model space => world space, excluding xlate
+	point pos; // used for distance based LOD
+	colorRGBA color; // body material color; ignored if alpha is zero
+	float anim_time, anim_scale;
+	unsigned model_id;
+	bool low_detail;
+};
+
 class city_model_loader_t : public model3ds {
 protected:
 	vector<int> models_valid;
-	void ensure_models_loaded() {if (empty()) {load_models();}}
 public:
 	virtual ~city_model_loader_t() {}
 	virtual unsigned num_models() const = 0;
 	virtual city_model_t const &get_model(unsigned id) const = 0;
+	void ensure_models_loaded() {if (empty()) {load_models();}}
 	vector3d get_model_world_space_size(unsigned id);
 	bool is_model_valid(unsigned id);
+	bool is_loaded_model_valid(unsigned id) const {assert(id < models_valid.size()); return (models_valid[id] != 0);} // thread safe; models must be loaded
 	void load_models();
+	void setup_model_inst(city_model_inst_t &inst, point const &pos, cube_t const &obj_bcube, vector3d const &dir, colorRGBA const &color,
+		unsigned model_id, bool low_detail, float anim_time=0.0) const; // thread safe; models must be loaded
+	void draw_model_insts(shader_t &s, city_model_inst_t const *const insts, unsigned num, vector3d const &xlate, bool is_shadow_pass, bool enable_animations);
+	void draw_model_insts_instanced_shadow(shader_t &s, unsigned model_id, unsigned num, int xf_loc, unsigned xf_vbo);
 	void draw_model(shader_t &s, vector3d const &pos, cube_t const &obj_bcube, vector3d const &dir, colorRGBA const &color,
-		vector3d const &xlate, unsigned model_id, bool is_shadow_pass, bool low_detail, bool enable_animations=0);
+		vector3d const &xlate, unsigned model_id, bool is_shadow_pass, bool low_detail, bool enable_animations=0, float anim_time=0.0);
+};
+
+// instances grouped by model so that textures and per-model state are set up once per model rather than once per instance;
+// the shadow pass uses hardware instancing with one draw call per model geometry block
+class city_model_batch_t {
+	vector<city_model_inst_t> insts, sorted;
+	vector<unsigned> model_start, model_pos;
+	vector<xform_matrix> inst_xfs;
+	unsigned inst_vbo;
+
+	void draw_sorted_instanced_shadow(shader_t &s, city_model_loader_t &loader);
+public:
+	city_model_batch_t() : inst_vbo(0) {}
+	bool empty() const {return insts.empty();}
+	unsigned size() const {return insts.size();}
+	void add(city_model_inst_t const &inst) {insts.push_back(inst);}
+	void draw_and_clear(shader_t &s, city_model_loader_t &loader, vector3d const &xlate, bool is_shadow_pass, bool enable_animations);
+	void free_context() {delete_and_zero_vbo(inst_vbo);}
 };
 
 class car_model_loader_t : public city_model_loader_t {
@@ -526,6 +526,28 @@ void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned>
 }
 
 
+void cobj_bvh_tree::get_big_cube_cobjs_in_view(pos_dir_up const &pdu, vector<unsigned> &cobjs) const {
+
+	unsigned const num_nodes((unsigned)nodes.size());
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+
+		if (!pdu.cube_visible(n)) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // failed the VFC test
+			continue;
+		}
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			coll_obj const &c(get_cobj(i));
+			if (c.type != COLL_CUBE || !c.is_big_occluder() || !obj_ok(c)) continue;
+			if (pdu.cube_visible(c)) {cobjs.push_back(cixs[i]);}
+		}
+		++nix;
+	}
+}
+
+
 bool cobj_bvh_tree::is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const {
 
 	assert(npts > 0);
@@ -853,6 +875,11 @@ bool check_point_contained_tree(point const &p, int &cindex, bool dynamic) { //
 }
 
 
+// used in update_occlusion_buffer()
+void get_occluder_cobjs_in_view(pos_dir_up const &pdu, vector<unsigned> &cobjs) {
+	cobj_tree_occlude.get_big_cube_cobjs_in_view(pdu, cobjs);
+}
+
 bool have_occluders() {
 	return !cobj_tree_occlude.is_empty();
 }
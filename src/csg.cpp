@@ -834,46 +834,91 @@ void coll_obj_group::check_cubes() {
 }
 
 
+// sorts cubes by their extents in the two dims other than dim, then by their start along dim, so that mergeable cubes are adjacent
+unsigned sweep_merge_cubes(coll_obj_group &cobjs, vector<unsigned> &bucket, unsigned dim) {
+
+	assert(dim < 3);
+	if (bucket.size() < 2) return 0;
+	unsigned const d1((dim+1)%3), d2((dim+2)%3);
+
+	sort(bucket.begin(), bucket.end(), [&cobjs, dim, d1, d2](unsigned a, unsigned b) {
+		cube_t const &A(cobjs[a]), &B(cobjs[b]);
+		if (A.d[d1][0]  != B.d[d1][0])  return (A.d[d1][0]  < B.d[d1][0]);
+		if (A.d[d1][1]  != B.d[d1][1])  return (A.d[d1][1]  < B.d[d1][1]);
+		if (A.d[d2][0]  != B.d[d2][0])  return (A.d[d2][0]  < B.d[d2][0]);
+		if (A.d[d2][1]  != B.d[d2][1])  return (A.d[d2][1]  < B.d[d2][1]);
+		if (A.d[dim][0] != B.d[dim][0]) return (A.d[dim][0] < B.d[dim][0]);
+		return (a < b); // stable ordering for reproducible results
+	});
+	unsigned merged(0), cur(bucket.front());
+	csg_cube cube(cobjs[cur]);
+	bool changed(0);
+
+	for (auto i = bucket.begin()+1; i != bucket.end(); ++i) { // merge runs of abutting cubes into the first cube of each run
+		csg_cube cube2(cobjs[*i]);
+
+		if (cube.cube_merge(cube2)) {
+			cobjs[*i].type = COLL_INVALID; // remove old coll obj
+			changed = 1;
+			++merged;
+			continue;
+		}
+		if (changed) {cube.write_to_cobj(cobjs[cur]);}
+		cur     = *i;
+		cube    = cube2;
+		changed = 0;
+	}
+	if (changed) {cube.write_to_cobj(cobjs[cur]);}
+	if (merged > 0) {bucket.erase(std::remove_if(bucket.begin(), bucket.end(), [&cobjs](unsigned i) {return (cobjs[i].type == COLL_INVALID);}), bucket.end());}
+	return merged;
+}
+
 // Note: also sorts by alpha so that transparency works correctly
 void coll_obj_group::merge_cubes() { // only merge compatible cubes
 
 	if (!MERGE_COBJS) return;
 	RESET_TIME;
-	float const tolerance(-X_SCENE_SIZE*1.0E-6); // tiny negative tolerance to include adjacencies
 	unsigned const ncobjs((unsigned)size());
-	unsigned merged(0);
-	cobj_bvh_tree cube_tree(this, 0, 0, 0, 1, 0); // cubes only
-	cube_tree.add_cobjs(0);
 	vector<unsigned> cids;
 
-	for (unsigned i = 0; i < ncobjs; ++i) { // choose merge candidates
-		if ((*this)[i].type != COLL_CUBE) continue;
-		csg_cube cube((*this)[i]);
-		if (cube.is_zero_area()) continue;
-		cids.resize(0);
-		cube_tree.get_intersecting_cobjs(cube, cids, i, tolerance, 0, -1);
-		unsigned mi(0);
-
-		for (vector<unsigned>::const_iterator it = cids.begin(); it != cids.end(); ++it) {
-			unsigned const j(*it);
-			assert(j < ncobjs && j != i);
-			assert((*this)[j].type == COLL_CUBE);
-			if (!(*this)[i].equal_params((*this)[j])) continue; // not compatible
-			csg_cube cube2((*this)[j]);
-
-			if (cube.cube_merge(cube2)) {
-				(*this)[j].type = COLL_INVALID; // remove old coll obj
-				++mi;
-			}
-		}
-		if (mi > 0) { // cube has changed
-			cube.write_to_cobj((*this)[i]);
-			merged += mi;
-			--i; // force this cube to be processed again
+	for (unsigned i = 0; i < ncobjs; ++i) {
+		if ((*this)[i].type == COLL_CUBE && !(*this)[i].is_zero_area()) {cids.push_back(i);}
+	}
+	// group cubes into buckets of compatible (equal_params) cubes; the order here must be consistent with equal_params()
+	coll_obj_group const &cobjs(*this);
+
+	sort(cids.begin(), cids.end(), [&cobjs](unsigned a, unsigned b) {
+		coll_obj const &A(cobjs[a]), &B(cobjs[b]);
+		if (A.status      != B.status)      return (A.status      < B.status);
+		if (A.platform_id != B.platform_id) return (A.platform_id < B.platform_id);
+		if (A.group_id    != B.group_id)    return (A.group_id    < B.group_id);
+		if (A.cp          != B.cp)          return (A.cp          < B.cp);
+		return (a < b);
+	});
+	vector<vector<unsigned>> buckets;
+
+	for (unsigned i = 0; i < cids.size(); ++i) {
+		if (i == 0 || !cobjs[cids[i]].equal_params(cobjs[cids[i-1]])) {buckets.push_back(vector<unsigned>());}
+		buckets.back().push_back(cids[i]);
+	}
+	unsigned merged(0);
+	vector<unsigned> num_sweeps(buckets.size(), 0);
+
+	// buckets share no cobjs, so they can be merged in parallel; largest buckets first for better load balancing
+	sort(buckets.begin(), buckets.end(), [](vector<unsigned> const &a, vector<unsigned> const &b) {return (a.size() > b.size());});
+#pragma omp parallel for schedule(dynamic) reduction(+:merged)
+	for (int b = 0; b < (int)buckets.size(); ++b) {
+		vector<unsigned> &bucket(buckets[b]);
+
+		for (unsigned dim = 0, num_idle = 0; bucket.size() > 1 && num_idle < 3; dim = (dim+1)%3) { // sweep x/y/z until a full cycle makes no progress
+			unsigned const num_merged(sweep_merge_cubes(*this, bucket, dim));
+			merged  += num_merged;
+			num_idle = ((num_merged > 0) ? 0 : num_idle+1);
+			++num_sweeps[b];
 		}
 	}
 	if (merged > 0) remove_invalid_cobjs();
-	cout << ncobjs << " => " << size() << endl;
+	cout << ncobjs << " => " << size() << " (" << buckets.size() << " material buckets, " << (num_sweeps.empty() ? 0 : *max_element(num_sweeps.begin(), num_sweeps.end())) << " max sweeps)" << endl;
 	PRINT_TIME("Cube Merge");
 }
 
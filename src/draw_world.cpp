@@ -541,6 +541,8 @@ void setup_object_render_data() {
 	if (TIMETEST) {PRINT_TIME("4 Dlights Textures");}
 	get_occluders();
 	if (TIMETEST) {PRINT_TIME("5 Get Occluders");}
+	update_occlusion_buffer();
+	if (TIMETEST) {PRINT_TIME("6 Occlusion Buffer");}
 	//scene_smap_vbo_invalid = 0; // needs to be after dlights update
 }
 
@@ -1505,8 +1507,8 @@ void physics_particle_manager::draw(float radius, int tid, bool emissive) const
 	psd.reserve_pts(parts.size());
 
 	for (unsigned i = 0; i < parts.size(); ++i) {
-		//psd.add_pt(vert_norm_color(parts[i].p, (camera - parts[i].p).get_norm(), parts[i].c.c), radius); // normal faces camera
-		psd.add_pt(sized_vert_t<vert_norm_color>(vert_norm_color(parts[i].p, (camera - parts[i].p).get_norm(), parts[i].c.c), radius)); // normal faces camera
+		point const pos(parts.get_pos(i));
+		psd.add_pt(sized_vert_t<vert_norm_color>(vert_norm_color(pos, (camera - pos).get_norm(), parts.c[i].c), radius)); // normal faces camera
 	}
 	if (tid >= 0) {psd.sort_back_to_front();} // if we have an alpha texture, sort back to front
 	psd.draw(tid, 0.0, !emissive); // draw with lighting
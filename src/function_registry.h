@@ -9,6 +9,7 @@ struct xform_matrix;
 struct cube_with_zval_t;
 
 int omp_get_thread_num_3dw();
+int omp_get_max_threads_3dw();
 
 // function prototypes - main (3DWorld.cpp, etc.)
 bool get_gl_error(unsigned loc_id=0);
@@ -57,6 +58,11 @@ bool light_valid(unsigned light_sources, int l, point &lpos);
 bool light_valid_and_enabled(int l, point &lpos);
 bool light_valid_and_enabled(int l);
 
+// function prototypes - occlusion_buffer
+void update_occlusion_buffer();
+bool cube_hiz_occluded(point const &viewer, cube_t const &cube);
+void check_cubes_hiz_visible(point const &viewer, cube_t const *const cubes, unsigned num, vector<unsigned char> &visible);
+
 // function prototypes - mesh_intersect
 bool sphere_visible_to_pt(point const &pt, point const &center, float radius);
 bool is_visible_from_light(point const &pos, point const &lpos, int fast);
@@ -260,6 +266,7 @@ float get_tiled_terrain_height_tex(float xval, float yval, bool nearest_texel=0)
 vector3d get_tiled_terrain_height_tex_norm(int x, int y);
 bool write_default_hmap_modmap();
 float update_tiled_terrain(float &min_camera_dist);
+void gen_tiled_terrain_buildings();
 void pre_draw_tiled_terrain(bool reflection_pass);
 void render_tt_models(bool reflection_pass, bool transparent_pass);
 void draw_tiled_terrain(bool reflection_pass);
@@ -456,6 +463,7 @@ void get_coll_line_cobjs_tree(point const &pos1, point const &pos2, int ignore_c
 void get_coll_sphere_cobjs_tree(point const &center, float radius, int cobj, vert_coll_detector &vcd, bool dynamic);
 bool check_point_contained_tree(point const &p, int &cindex, bool dynamic);
 bool have_occluders();
+void get_occluder_cobjs_in_view(pos_dir_up const &pdu, vector<unsigned> &cobjs);
 void get_intersecting_cobjs_tree(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler,
 	bool dynamic, bool check_ccounter, int id_for_cobj_int=-1);
 bool check_coll_line(point const &pos1, point const &pos2, int &cindex, int c_obj, int skip_dynamic, int test_alpha,
@@ -575,6 +583,7 @@ void select_water_ice_texture(shader_t &shader, colorRGBA &color);
 void set_tt_water_specular(shader_t &shader);
 colorRGBA get_tt_water_color();
 void draw_water(bool no_update=0, bool draw_fast=0);
+void update_water_no_draw();
 void add_splash(point const &pos, int xpos, int ypos, float energy, float radius, bool add_sound, vector3d const &vadd=zero_vector, bool add_droplets=1);
 bool add_water_section(float x1, float y1, float x2, float y2, float zval, float wvol);
 void float_downstream(point &pos, float radius);
@@ -1006,6 +1015,7 @@ int get_building_bcube_contains_pos(point const &pos);
 bool check_buildings_ped_coll(point const &pos, float radius, unsigned plot_id, unsigned &building_id);
 bool select_building_in_plot(unsigned plot_id, unsigned rand_val, unsigned &building_id);
 void get_building_bcubes(cube_t const &xy_range, vect_cube_t &bcubes);
+void get_building_occluder_cubes(pos_dir_up const &pdu, vect_cube_t &cubes);
 bool get_buildings_line_hit_color(point const &p1, point const &p2, colorRGBA &color);
 bool have_buildings();
 unsigned get_buildings_gpu_mem_usage();
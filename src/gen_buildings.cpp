@@ -2278,7 +2278,10 @@ public:
 			set_interior_lighting(s, have_indir);
 			if (have_indir) {setup_indir_lighting(bcs, s);}
 			vector<point> points; // reused temporary
-			vect_cube_t ped_bcubes; // reused temporary
+			vect_cube_t ped_bcubes, bldg_bcubes; // reused temporaries
+			vector<unsigned char> bldg_visible; // reused temporary
+			vfc_cube_batch_t bldg_vfc_cubes; // reused temporary
+			vis_mask_t bldg_in_view; // reused temporary
 			int indir_bcs_ix(-1), indir_bix(-1);
 
 			if (transparent_windows) {
@@ -2302,14 +2305,21 @@ public:
 					(*i)->building_draw_interior.draw_tile(s, (g - (*i)->grid_by_tile.begin()));
 					// iterate over nearby buildings in this tile and draw interior room geom, generating it if needed
 					if (!g->bcube.closest_dist_less_than(camera_xlated, room_geom_draw_dist)) continue; // too far
+					bldg_bcubes.clear();
+					bldg_vfc_cubes.clear();
+					for (auto bi = g->bc_ixs.begin(); bi != g->bc_ixs.end(); ++bi) {bldg_bcubes.push_back((*i)->get_building(bi->ix).bcube + xlate);}
+					for (auto c = bldg_bcubes.begin(); c != bldg_bcubes.end(); ++c) {bldg_vfc_cubes.add(*c);}
+					camera_pdu.cubes_visible(bldg_vfc_cubes, bldg_in_view); // batch VFC
+					check_cubes_hiz_visible(camera_pdu.pos, bldg_bcubes.data(), bldg_bcubes.size(), bldg_visible); // batch occlusion query
 					
 					for (auto bi = g->bc_ixs.begin(); bi != g->bc_ixs.end(); ++bi) {
 						building_t &b((*i)->get_building(bi->ix));
 						if (!b.interior) continue; // no interior, skip
 						if (!b.bcube.closest_dist_less_than(camera_xlated, room_geom_draw_dist)) continue; // too far away
-						if (!camera_pdu.cube_visible(b.bcube + xlate)) continue; // VFC
+						if (!bldg_in_view.is_visible(bi - g->bc_ixs.begin())) continue; // VFC
 						int const ped_ix((*i)->get_ped_ix_for_bix(bi->ix)); // Note: assumes only one building_draw has people
 						bool const camera_near_building(b.bcube.contains_pt_xy_exp(camera_xlated, door_open_dist));
+						if (!camera_near_building && !bldg_visible[bi - g->bc_ixs.begin()]) continue; // occluded
 						bool const inc_small(b.bcube.closest_dist_less_than(camera_xlated, room_geom_sm_draw_dist));
 						b.gen_and_draw_room_geom(s, xlate, ped_bcubes, bi->ix, ped_ix, 0, inc_small); // shadow_only=0
 						g->has_room_geom = 1;
@@ -2851,6 +2861,28 @@ public:
 			}
 		}
 	}
+	// returns the exterior cubes of visible, solid buildings in camera space for use as occluders in the occlusion buffer
+	void get_occluder_cubes(pos_dir_up const &pdu, vect_cube_t &cubes) const {
+		if (empty()) return;
+		vector3d const xlate(get_camera_coord_space_xlate());
+		if (!pdu.cube_visible(buildings_bcube + xlate)) return;
+
+		for (auto g = grid.begin(); g != grid.end(); ++g) {
+			if (g->bc_ixs.empty()) continue;
+			point const pos(g->bcube.get_cube_center() + xlate);
+			if (!pdu.sphere_and_cube_visible_test(pos, g->bcube.get_bsphere_radius(), (g->bcube + xlate))) continue; // VFC
+
+			for (auto b = g->bc_ixs.begin(); b != g->bc_ixs.end(); ++b) {
+				if (!pdu.cube_visible(*b + xlate)) continue;
+				building_t const &building(get_building(b->ix));
+				// skip buildings that may be seen into or through (interiors with windows) and non-cube shapes
+				if (building.interior || !building.is_simple_cube() || building.is_rotated()) continue;
+				if (get_grid_ix(building.bcube.get_llc()) != unsigned(g - grid.begin())) continue; // add only if in home grid (to avoid duplicates)
+
+				for (auto p = building.parts.begin(); p != building.get_real_parts_end(); ++p) {cubes.push_back(*p + xlate);}
+			}
+		}
+	}
 	bool check_pts_occluded(point const *const pts, unsigned npts, building_occlusion_state_t &state) const {
 		for (vector<unsigned>::const_iterator b = state.building_ids.begin(); b != state.building_ids.end(); ++b) {
 			building_t const &building(get_building(*b));
@@ -3017,6 +3049,11 @@ void get_building_bcubes(cube_t const &xy_range, vect_cube_t &bcubes) {building_
 void add_building_interior_lights(point const &xlate, cube_t &lights_bcube) {building_creator.add_interior_lights(xlate, lights_bcube);} // secondary buildings only for now
 // cars + peds
 void get_building_occluders(pos_dir_up const &pdu, building_occlusion_state_t &state) {building_creator_city.get_occluders(pdu, state);}
+
+void get_building_occluder_cubes(pos_dir_up const &pdu, vect_cube_t &cubes) {
+	building_creator     .get_occluder_cubes(pdu, cubes);
+	building_creator_city.get_occluder_cubes(pdu, cubes);
+}
 bool check_pts_occluded(point const *const pts, unsigned npts, building_occlusion_state_t &state) {return building_creator_city.check_pts_occluded(pts, npts, state);}
 cube_t get_building_lights_bcube() {return building_lights_manager.get_lights_bcube();}
 // used for pedestrians
@@ -23,7 +23,8 @@ obj_vector_t<particle_cloud> part_clouds(MAX_PART_CLOUDS);
 obj_vector_t<fire> fires(MAX_FIRES);
 obj_vector_t<decal_obj> decals(MAX_DECALS);
 water_particle_manager water_part_man;
-physics_particle_manager explosion_part_man[2]; // {lit, emissive}
+// {lit, emissive}, up to 1M particles each; lit debris drifts with the wind, and emissive sparks burn out after 2s
+physics_particle_manager explosion_part_man[2] = {physics_particle_manager(1000000, 0.5), physics_particle_manager(1000000, 0.25, 2.0*TICKS_PER_SECOND)};
 float gauss_rand_arr[N_RAND_DIST+2];
 rand_gen_t global_rand_gen;
 
@@ -358,16 +359,16 @@ void gen_leaf_at(point const *const points, vector3d const &normal, int type, co
 void physics_particle_manager::gen_particles(point const &pos, vector3d const &vadd, float vmag, float gen_radius, colorRGBA const &color, unsigned num) {
 
 	if (!is_pos_valid(pos)) return; // origin invalid
-	unsigned const MAX_PARTS = 100000; // limit of 100K particles
-	if (parts.size() >= MAX_PARTS) return; // too may particles
-	num = min(num, unsigned(parts.size() - MAX_PARTS));
+	if (parts.size() >= max_parts) return; // too may particles
+	num = min(num, unsigned(max_parts - parts.size()));
+	parts.reserve(parts.size() + num);
 
 	for (unsigned i = 0; i < num; ++i) {
 		point ppos;
 		do {ppos = pos + signed_rand_vector_spherical(gen_radius);} while (!is_pos_valid(ppos)); // find a valid particle starting pos
 		vector3d pvel(vadd + signed_rand_vector_spherical(vmag));
 		if (pvel.z < 0.0) {pvel.z *= -1.0;} // make sure it's going up
-		parts.push_back(part_t(ppos, pvel, color));
+		parts.push_back(ppos, pvel, color);
 	}
 }
 
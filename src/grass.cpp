@@ -9,7 +9,14 @@
 #include "lightmap.h"
 #include "shaders.h"
 #include "draw_utils.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
 
+bool const USE_BKG_GRASS_GEN = 1; // generate TT grass blocks and flowers in a background thread; the main thread only uploads
 
 bool grass_enabled(1), use_grass_tess(0);
 unsigned grass_density(0), num_rnd_grass_blocks(16);
@@ -27,6 +34,58 @@ extern coll_obj_group coll_objects;
 bool is_grass_enabled();
 
 
+// *** background generation queue (shared with grass and flowers)
+
+// single worker thread that runs CPU-only generation jobs in FIFO order;
+// jobs hold a weak_ptr to their results and are skipped if the tile has discarded them (cleared, regenerated, or freed) before they run
+class detail_gen_queue_t {
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<std::function<void()>> jobs;
+	bool kill_thread;
+
+	void run() {
+		while (1) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this] {return (kill_thread || !jobs.empty());});
+				if (kill_thread) return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+public:
+	detail_gen_queue_t() : kill_thread(0) {}
+	~detail_gen_queue_t() {stop();}
+
+	void add_job(std::function<void()> const &job) {
+		if (!USE_BKG_GRASS_GEN) {job(); return;} // run synchronously
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!worker.joinable()) {worker = std::thread(&detail_gen_queue_t::run, this);} // start on first use
+			jobs.push_back(job);
+		}
+		cv.notify_one();
+	}
+	void stop() { // Note: unfinished jobs are dropped; their results are owned by shared_ptrs and never read
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			kill_thread = 1;
+			jobs.clear();
+		}
+		cv.notify_one();
+		if (worker.joinable()) {worker.join();}
+	}
+};
+
+detail_gen_queue_t detail_gen_queue;
+
+
 // *** detail scenery (shared with grass and flowers)
 
 void detail_scenery_t::setup_shaders_pre(shader_t &s) { // used for grass and flowers
@@ -200,21 +259,31 @@ void grass_tile_manager_t::clear() {
 
 	grass_manager_t::clear();
 	for (unsigned lod = 0; lod < NUM_GRASS_LODS; ++lod) {vbo_offsets[lod].clear();}
+	vbo_data.clear();
+	pending_gen.reset(); // discard any in-progress generation
+	generated = 0;
 }
 
 
-void grass_tile_manager_t::upload_data() {
+void grass_tile_manager_t::create_vbo_data(vector<grass_data_t> &data) const {
 
-	if (empty()) return;
-	RESET_TIME;
-	vector<grass_data_t> data(3*size()); // 3 vertices per grass blade
+	data.resize(3*size()); // 3 vertices per grass blade
 
 	for (unsigned i = 0, ix = 0; i < size(); ++i) {
 		vector3d const &norm(plus_z); // use grass normal? 2-sided lighting? generate normals in vertex shader?
 		//vector3d const &norm(grass[i].n);
 		add_to_vbo_data(grass[i], data, ix, norm);
 	}
-	upload_to_vbo(vbo, data, 0, 1);
+}
+
+
+void grass_tile_manager_t::upload_data() {
+
+	if (empty()) return;
+	RESET_TIME;
+	if (vbo_data.empty()) {create_vbo_data(vbo_data);} // not generated in the background
+	upload_to_vbo(vbo, vbo_data, 0, 1);
+	clear_cont(vbo_data);
 	data_valid = 1;
 	PRINT_TIME("Grass Tile Upload");
 }
@@ -238,10 +307,44 @@ void grass_tile_manager_t::gen_grass() {
 }
 
 
+struct grass_tile_gen_job_t {
+	grass_tile_manager_t mgr; // CPU-side data only; never has a VBO
+	vector<vert_norm_comp_color> vbo_data; // grass_data_t
+	std::atomic<bool> done;
+	grass_tile_gen_job_t() : done(0) {}
+};
+
+bool grass_tile_manager_t::check_pending_gen() { // returns true if grass has been generated
+
+	if (generated) return !empty(); // may have generated no grass
+
+	if (!pending_gen) { // start a new generation job
+		std::shared_ptr<grass_tile_gen_job_t> job(new grass_tile_gen_job_t);
+		std::weak_ptr<grass_tile_gen_job_t> const wjob(job);
+		pending_gen = job;
+
+		detail_gen_queue.add_job([wjob]() {
+			std::shared_ptr<grass_tile_gen_job_t> const job(wjob.lock());
+			if (!job) return; // discarded
+			job->mgr.gen_grass();
+			job->mgr.create_vbo_data(job->vbo_data);
+			job->done = 1;
+		});
+	}
+	if (!pending_gen->done) return 0; // still generating
+	grass.swap(pending_gen->mgr.grass);
+	for (unsigned lod = 0; lod < NUM_GRASS_LODS; ++lod) {vbo_offsets[lod].swap(pending_gen->mgr.vbo_offsets[lod]);}
+	vbo_data.swap(pending_gen->vbo_data);
+	pending_gen.reset();
+	data_valid = 0; // needs to be uploaded
+	generated  = 1;
+	return !empty();
+}
+
 void grass_tile_manager_t::update() { // to be called once per frame
 
 	if (!is_grass_enabled()) {clear(); return;}
-	if (empty()    ) {gen_grass();}
+	if (!check_pending_gen()) return; // grass isn't drawn until generation completes
 	if (vbo == 0   ) {create_new_vbo();}
 	if (!data_valid) {upload_data();}
 }
@@ -774,9 +877,9 @@ void flower_manager_t::check_vbo() {
 		create_vbo_and_upload(vbo, verts);
 	}
 	else {
-		vector<vert_norm_comp_color> verts;
-		create_verts_range(verts, 0, size());
-		create_vbo_and_upload(vbo, verts);
+		if (vbo_data.size() != 4*size()) {create_verts_range(vbo_data, 0, size());} // not generated in the background
+		create_vbo_and_upload(vbo, vbo_data);
+		clear_cont(vbo_data);
 	}
 	//PRINT_TIME("Flowers VBO");
 }
@@ -864,10 +967,10 @@ void flower_manager_t::add_flowers(mesh_xy_grid_cache_t const density_gen[2],
 	}
 }
 
-void flower_manager_t::gen_density_cache(mesh_xy_grid_cache_t density_gen[2], int x1, int y1) {
+void flower_manager_t::gen_density_cache(mesh_xy_grid_cache_t density_gen[2], int abs_x1, int abs_y1) { // abs_x1/abs_y1 include xoff2/yoff2
 	for (unsigned i = 0; i < 2; ++i) {
 		float const fds(500.0*(1.0 + 0.3*i)), xscale(fds*DX_VAL*DX_VAL), yscale(fds*DY_VAL*DY_VAL);
-		density_gen[i].build_arrays(xscale*(x1 + xoff2), yscale*(y1 + yoff2), xscale, yscale, MESH_X_SIZE, MESH_Y_SIZE, 0, 1); // force_sine_mode=1
+		density_gen[i].build_arrays(xscale*abs_x1, yscale*abs_y1, xscale, yscale, MESH_X_SIZE, MESH_Y_SIZE, 0, 1); // force_sine_mode=1
 	}
 }
 
@@ -886,13 +989,18 @@ void flower_manager_t::scale_flowers(float lscale, float wscale) {
 void flower_tile_manager_t::gen_flowers(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1) {
 
 	if (skip_generate()) return;
+	gen_flowers_abs(weight_data, wd_stride, x1+xoff2, y1+yoff2, get_median_height(FLOWER_DIST_THRESH));
+}
+
+// doesn't read any global mesh state, so it can be called from the background thread
+void flower_tile_manager_t::gen_flowers_abs(vector<unsigned char> const &weight_data, unsigned wd_stride, int abs_x1, int abs_y1, float hthresh) {
+
 	//RESET_TIME;
 	assert(empty()); // or call clear()?
-	rgen.set_state(x1+xoff2+123, y1+yoff2+456); // deterministic for each tile
+	rgen.set_state(abs_x1+123, abs_y1+456); // deterministic for each tile
 	mesh_xy_grid_cache_t density_gen[2]; // density thresh, color selection
-	gen_density_cache(density_gen, x1, y1);
+	gen_density_cache(density_gen, abs_x1, abs_y1);
 	assert(wd_stride >= (unsigned)MESH_X_SIZE && wd_stride >= (unsigned)MESH_Y_SIZE);
-	float const hthresh(get_median_height(FLOWER_DIST_THRESH));
 
 	for (unsigned y = 0; y < (unsigned)MESH_Y_SIZE; ++y) {
 		for (unsigned x = 0; x < (unsigned)MESH_X_SIZE; ++x) {
@@ -905,8 +1013,48 @@ void flower_tile_manager_t::gen_flowers(vector<unsigned char> const &weight_data
 	//PRINT_TIME("Gen Flowers TT");
 }
 
+struct flower_gen_job_t {
+	flower_tile_manager_t mgr; // CPU-side data only; never has a VBO
+	vector<unsigned char> weight_data; // copied, since the tile may update or free its weights while the job is running
+	vector<vert_norm_comp_color> vbo_data;
+	std::atomic<bool> done;
+	flower_gen_job_t() : done(0) {}
+};
+
+// returns true when flowers are ready to be drawn; the first call starts generation in the background thread
+bool flower_tile_manager_t::gen_flowers_async(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1) {
+
+	if (skip_generate()) return 1; // already generated, or no flowers
+
+	if (!pending_gen) {
+		std::shared_ptr<flower_gen_job_t> job(new flower_gen_job_t);
+		std::weak_ptr<flower_gen_job_t> const wjob(job);
+		job->weight_data = weight_data;
+		pending_gen = job;
+		int const abs_x1(x1+xoff2), abs_y1(y1+yoff2); // capture mesh offsets and height thresh now, since they may change before the job runs
+		float const hthresh(get_median_height(FLOWER_DIST_THRESH));
+
+		detail_gen_queue.add_job([wjob, wd_stride, abs_x1, abs_y1, hthresh]() {
+			std::shared_ptr<flower_gen_job_t> const job(wjob.lock());
+			if (!job) return; // discarded
+			job->mgr.gen_flowers_abs(job->weight_data, wd_stride, abs_x1, abs_y1, hthresh);
+			if (!job->mgr.empty()) {job->mgr.create_verts_range(job->vbo_data, 0, job->mgr.size());}
+			job->done = 1;
+		});
+	}
+	if (!pending_gen->done) return 0; // still generating
+	assert(empty());
+	flowers.swap(pending_gen->mgr.flowers);
+	vbo_data.swap(pending_gen->vbo_data);
+	rgen      = pending_gen->mgr.rgen; // for consistency with gen_flowers()
+	generated = 1;
+	pending_gen.reset();
+	return 1;
+}
+
 void flower_tile_manager_t::update_subrange(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1, int xl, int yl, int xh, int yh) {
 	
+	if (pending_gen) {pending_gen.reset(); return;} // discard in-progress generation, which used the old weights, and start over
 	if (!generated || xh <= xl || yh <= yl) return; // only update if already generated and nonempty range
 
 	for (unsigned i = 0; i < flowers.size(); ++i) { // remove existing flowers
@@ -915,7 +1063,7 @@ void flower_tile_manager_t::update_subrange(vector<unsigned char> const &weight_
 	}
 	rgen.set_state(x1+xl+xoff2+123, y1+yl+yoff2+456); // deterministic for each tile
 	mesh_xy_grid_cache_t density_gen[2]; // density thresh, color selection
-	gen_density_cache(density_gen, x1, y1);
+	gen_density_cache(density_gen, x1+xoff2, y1+yoff2);
 	float const hthresh(get_median_height(FLOWER_DIST_THRESH));
 	unsigned const nx(xh - xl), ny(yh - yl);
 
@@ -932,6 +1080,7 @@ void flower_tile_manager_t::update_subrange(vector<unsigned char> const &weight_
 void flower_tile_manager_t::clear_within(point const &pos, float radius, bool is_square) {
 
 	bool updated(0);
+	pending_gen.reset(); // discard in-progress generation, since it won't include this removal; it will be restarted
 	
 	for (unsigned i = 0; i < flowers.size(); ++i) {
 		point const &fpos(flowers[i].pos);
@@ -950,7 +1099,7 @@ public:
 		if (skip_generate()) return;
 		assert(empty()); // or call clear()?
 		mesh_xy_grid_cache_t density_gen[2]; // density thresh, color selection
-		gen_density_cache(density_gen, 0, 0);
+		gen_density_cache(density_gen, xoff2, yoff2);
 		float const hthresh(get_median_height(FLOWER_DIST_THRESH));
 
 		for (unsigned y = 0; y < (unsigned)MESH_Y_SIZE; ++y) {
@@ -5,6 +5,7 @@
 
 #include "3DWorld.h"
 #include "gl_ext_arb.h"
+#include <memory>
 
 unsigned const NUM_GRASS_LODS    = 6;
 unsigned const GRASS_BLOCK_SZ    = 4;
@@ -57,18 +58,27 @@ public:
 };
 
 
+struct grass_tile_gen_job_t;
+struct flower_gen_job_t;
+
 class grass_tile_manager_t : public grass_manager_t {
 
 	vector<unsigned> vbo_offsets[NUM_GRASS_LODS];
+	vector<grass_data_t> vbo_data; // generated in the background thread; empty if it needs to be created from grass
+	std::shared_ptr<grass_tile_gen_job_t> pending_gen;
 	unsigned start_render_ix, end_render_ix;
+	bool generated; // set even if no grass was generated, so that generation isn't restarted
 
 	void gen_block(unsigned bix);
 	void gen_lod_block(unsigned bix, unsigned lod);
+	bool check_pending_gen();
 
 public:
-	grass_tile_manager_t() : start_render_ix(0), end_render_ix(0) {}
+	grass_tile_manager_t() : start_render_ix(0), end_render_ix(0), generated(0) {}
 	void clear();
 	unsigned get_gpu_mem() const {return (vbo ? 3*size()*sizeof(grass_data_t) : 0);}
+	bool is_ready() const {return (!empty() && data_valid);}
+	void create_vbo_data(vector<grass_data_t> &data) const;
 	void upload_data();
 	void gen_grass();
 	void update();
@@ -92,6 +102,7 @@ protected:
 	};
 
 	vector<flower_t> flowers;
+	vector<vert_norm_comp_color> vbo_data; // generated in the background thread; empty if it needs to be created from flowers
 	rand_gen_t rgen;
 	bool generated;
 
@@ -103,20 +114,26 @@ public:
 	size_t size() const {return flowers.size ();}
 	bool empty () const {return flowers.empty();}
 	bool skip_generate() const;
-	void clear() {clear_vbo(); flowers.clear(); generated = 0;}
+	void clear() {clear_vbo(); flowers.clear(); vbo_data.clear(); generated = 0;}
 	void check_vbo();
 	static void setup_flower_shader_post(shader_t &shader);
 	void draw_triangles(shader_t &shader) const;
 	void add_flowers(mesh_xy_grid_cache_t const density_gen[2], float grass_den, float hthresh, float dx, float dy, int xpos, int ypos, bool gen_zval);
-	void gen_density_cache(mesh_xy_grid_cache_t density_gen[2], int x1, int y1);
+	void gen_density_cache(mesh_xy_grid_cache_t density_gen[2], int abs_x1, int abs_y1);
 	void scale_flowers(float lscale, float wscale);
 	unsigned get_gpu_mem() const {return (vbo_valid() ? flowers.size()*sizeof(vert_norm_comp_color) : 0);}
 };
 
 
 class flower_tile_manager_t : public flower_manager_t {
+
+	std::shared_ptr<flower_gen_job_t> pending_gen;
+
+	void gen_flowers_abs(vector<unsigned char> const &weight_data, unsigned wd_stride, int abs_x1, int abs_y1, float hthresh);
 public:
+	void clear() {flower_manager_t::clear(); pending_gen.reset();}
 	void gen_flowers(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1);
+	bool gen_flowers_async(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1);
 	void update_subrange(vector<unsigned char> const &weight_data, unsigned wd_stride, int x1, int y1, int xl, int yl, int xh, int yh);
 	void clear_within(point const &pos, float radius, bool is_square);
 };
@@ -0,0 +1,132 @@
+// 3D World - Headless Simulation and Benchmark Mode
+// 10/19/2026
+
+#include "3DWorld.h"
+#include "mesh.h"
+#include "tree_3dw.h"
+#include "u_event.h"
+#include <chrono>
+
+using std::string;
+using std::cerr;
+
+
+extern bool headless_mode, enable_grass_fire;
+extern int world_mode, animate2, universe_only, num_trees, iticks, game_mode;
+extern unsigned headless_frames, headless_bird_benchmark, headless_vfc_benchmark;
+extern float fticks, tstep, TIMESTEP;
+extern double tfticks, sim_ticks;
+extern string headless_report_fn;
+extern tree_cont_t t_trees;
+
+void init_lights();
+void run_bird_flock_benchmark(unsigned num_birds);
+void run_vfc_benchmark(unsigned num_objs);
+
+
+// registers sub-ms resolution times with the timing profiler
+class headless_timer_t {
+	char const *const name;
+	std::chrono::steady_clock::time_point const start;
+public:
+	headless_timer_t(char const *const name_) : name(name_), start(std::chrono::steady_clock::now()) {}
+	~headless_timer_t() {register_timing_value_ms(name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());}
+};
+
+
+// CPU-only scene generation, the same as in main() but without any textures, shaders, or drawing
+void headless_gen_scene() {
+
+	{
+		headless_timer_t timer("Headless Init Objects and Models");
+		init_objects();
+		alloc_matrices();
+		t_trees.resize(num_trees);
+		init_models();
+		init_terrain_mesh();
+		init_lights();
+	}
+	{
+		headless_timer_t timer("Headless Scene Generation");
+		gen_scene(1, (world_mode == WMODE_GROUND), 0, 0, 0);
+	}
+	if (world_mode == WMODE_INF_TERRAIN) { // normally done on the first tiled terrain update
+		headless_timer_t timer("Headless Buildings and Cities");
+		gen_tiled_terrain_buildings();
+	}
+	if (world_mode == WMODE_GROUND) {
+		{
+			headless_timer_t timer("Headless Snow Coverage");
+			gen_snow_coverage();
+		}
+		if (enable_grass_fire) {init_ground_fire();}
+		create_object_groups();
+		init_game_state();
+		headless_timer_t timer("Headless Lightmap");
+		build_lightmap(1);
+	}
+}
+
+void headless_next_frame() {
+
+	uevent_advance_frame(); // replays the event list, if one was specified
+	fticks  = 1.0; // fixed timestep for reproducible results
+	iticks  = 1;
+	tstep   = TIMESTEP*fticks;
+	tfticks += fticks;
+	if (animate2) {sim_ticks = tfticks;}
+	auto_advance_time();
+
+	if (world_mode == WMODE_GROUND) {
+		{
+			headless_timer_t timer("Headless Frame Physics and Objects");
+			process_groups();
+			if (game_mode) {update_blasts(); update_game_frame();}
+		}
+		{
+			headless_timer_t timer("Headless Frame Water");
+			update_water_no_draw();
+		}
+		{
+			headless_timer_t timer("Headless Frame Smoke");
+			distribute_smoke();
+		}
+	}
+	else if (world_mode == WMODE_INF_TERRAIN) {
+		headless_timer_t timer("Headless Frame Physics and Objects");
+		process_groups();
+	}
+	if (have_cities()) {
+		headless_timer_t timer("Headless Frame Cars and Pedestrians");
+		next_city_frame(0);
+	}
+}
+
+// runs scene generation and headless_frames frames of simulation without a window or GL context, then writes a JSON timing report
+int run_headless_benchmark() {
+
+	headless_mode = 1;
+	toggle_timing_profiler(); // accumulate timing values in the profiler rather than printing them
+	cout << "Running headless benchmark for " << headless_frames << " frames" << endl;
+
+	if (universe_only || world_mode == WMODE_UNIVERSE) { // universe generation requires a GL context for procedural textures
+		cerr << "Error: Universe mode is not supported in headless mode" << endl;
+		return 1;
+	}
+	auto const start(std::chrono::steady_clock::now());
+	headless_gen_scene();
+
+	for (unsigned n = 0; n < headless_frames; ++n) {
+		headless_timer_t timer("Headless Frame Total");
+		headless_next_frame();
+	}
+	if (headless_bird_benchmark > 0) {run_bird_flock_benchmark(headless_bird_benchmark);}
+	if (headless_vfc_benchmark  > 0) {run_vfc_benchmark(headless_vfc_benchmark);}
+	register_timing_value_ms("Headless Total", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	bool const write_ok(write_timing_profiler_json(headless_report_fn, headless_frames));
+	timing_profiler_stats(); // print and clear
+	if (!write_ok) return 1;
+	cout << "Wrote timing report to " << headless_report_fn << endl;
+	return 0;
+}
+
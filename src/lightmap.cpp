@@ -19,13 +19,12 @@ float const FLASHLIGHT_RAD   = 4.0;
 colorRGBA const flashlight_colors[2] = {colorRGBA(1.0, 0.8, 0.5, 1.0), colorRGBA(0.8, 0.8, 1.0, 1.0)}; // incandescent, LED
 
 
-bool using_lightmap(0), lm_alloc(0), has_dl_sources(0), has_spotlights(0), has_line_lights(0), use_dense_voxels(0), has_indir_lighting(0), dl_smap_enabled(0), flashlight_on(0);
-unsigned dl_tid(0), elem_tid(0), gb_tid(0), DL_GRID_BS(0), flashlight_color_id(0);
+bool using_lightmap(0), lm_alloc(0), has_dl_sources(0), has_spotlights(0), has_line_lights(0), use_dense_voxels(0), compact_lightmap(0), has_indir_lighting(0), dl_smap_enabled(0), flashlight_on(0);
+unsigned dl_tid(0), elem_tid(0), gb_tid(0), DL_GRID_BS(0), DL_GRID_ZSLICES(4), flashlight_color_id(0);
 float DZ_VAL2(0.0), DZ_VAL_INV2(0.0);
 float czmin0(0.0), lm_dz_adj(0.0);
 cube_t dlight_bcube(all_zeros_cube);
-vector<dls_cell> ldynamic;
-vector<unsigned char> ldynamic_enabled;
+dlight_cluster_grid_t dlight_clusters;
 vector<light_source> light_sources_a, /* light_sources_d, */ dl_sources, dl_sources2; // static ambient, static diffuse, dynamic {cur frame, next frame}
 vector<light_source_trig> light_sources_d;
 lmap_manager_t lmap_manager;
@@ -33,6 +32,7 @@ llv_vect local_light_volumes;
 indir_dlight_group_manager_t indir_dlight_group_manager;
 
 
+extern bool global_lighting_update;
 extern int animate2, display_mode, frame_counter, camera_coll_id, scrolling, read_light_files[], write_light_files[];
 extern unsigned create_voxel_landscape;
 extern float czmin, czmax, fticks, zbottom, ztop, XY_SCENE_SIZE, FAR_CLIP, CAMERA_RADIUS, indir_light_exp, light_int_scale[], force_czmin, force_czmax;
@@ -203,19 +203,45 @@ void lmcell::set_outside_colors() {
 
 
 inline bool is_inside_lmap(int x, int y, int z) {return (z >= 0 && z < MESH_SIZE[2] && !point_outside_mesh(x, y));}
-bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && vlmap[y][x] != NULL);}
+bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && has_column(x, y));}
 
 // Note: only intended to work in ground mode where sizes are MESH_X_SIZE and MESH_Y_SIZE
 lmcell *lmap_manager_t::get_lmcell_round_down(point const &p) { // round down
+	assert(!compacted);
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y)), z(get_zpos(p.z));
 	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
 }
 lmcell *lmap_manager_t::get_lmcell(point const &p) { // round to center
+	assert(!compacted);
 	int const x(get_xpos(p.x)), y(get_ypos(p.y)), z(get_zpos(p.z));
 	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
 }
 
+lmcell const *lmap_manager_t::get_column_ro(int x, int y, vector<lmcell> &buf) const {
+	if (!compacted) {return vlmap[y][x];}
+	unsigned const ix(get_col_ix(x, y));
+	if (ix == EMPTY_COL) return nullptr;
+	buf.resize(lm_zsize);
+	for (unsigned z = 0; z < lm_zsize; ++z) {packed.decode(ix+z, buf[z]);}
+	return buf.data();
+}
+lmcell lmap_manager_t::get_cell(int x, int y, int z) const {
+	if (!compacted) {return vlmap[y][x][z];}
+	lmcell lmc;
+	packed.decode(get_col_ix(x, y)+z, lmc);
+	return lmc;
+}
+unsigned char lmap_manager_t::get_flow(int x, int y, int z, unsigned dim) const {
+	assert(dim < 3);
+	return (compacted ? packed.flow[3*(get_col_ix(x, y) + z) + dim] : vlmap[y][x][z].pflow[dim]);
+}
+void lmap_manager_t::set_flow(int x, int y, int z, unsigned char const flow[3]) {
+	unsigned char *dest(compacted ? &packed.flow[3*(get_col_ix(x, y) + z)] : vlmap[y][x][z].pflow);
+	UNROLL_3X(dest[i_] = flow[i_];)
+}
+
 void lmap_manager_t::reset_all(lmcell const &init_lmcell) {
+	assert(!compacted);
 	for (auto i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {*i = init_lmcell;}
 }
 
@@ -223,7 +249,10 @@ template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize,
 
 	lm_xsize = xsize; lm_ysize = ysize; lm_zsize = zsize;
 	if (vlmap == NULL) {matrix_gen_2d(vlmap, lm_xsize, lm_ysize);} // create column headers once
+	packed.clear();
+	compacted = 0;
 	vldata_alloc.resize(max(nbins, 1U), init_lmcell); // make size at least 1, even if there are no bins, so we can test on emptiness
+	col_ix.resize(lm_xsize*lm_ysize);
 	unsigned cur_v(0);
 
 	// initialize light volume
@@ -231,10 +260,12 @@ template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize,
 		for (unsigned j = 0; j < lm_xsize; ++j) {
 			if (nonempty_bins != nullptr && !nonempty_bins[i][j]) { // nonempty_bins is used for sparse mode
 				vlmap[i][j] = NULL;
+				col_ix[i*lm_xsize + j] = EMPTY_COL;
 				continue;
 			}
 			assert(cur_v + lm_zsize <= vldata_alloc.size());
 			vlmap[i][j] = &vldata_alloc[cur_v];
+			col_ix[i*lm_xsize + j] = cur_v;
 			cur_v      += lm_zsize;
 		}
 	}
@@ -248,6 +279,7 @@ void lmap_manager_t::init_from(lmap_manager_t const &src) {
 
 	//assert(!is_allocated());
 	//clear_cells(); // probably unnecessary
+	assert(!src.compacted);
 	alloc(src.vldata_alloc.size(), src.lm_xsize, src.lm_ysize, src.lm_zsize, src.vlmap, lmcell());
 	copy_data(src);
 }
@@ -257,6 +289,7 @@ void lmap_manager_t::init_from(lmap_manager_t const &src) {
 void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 
 	assert(vlmap && src.vlmap);
+	assert(!compacted && !src.compacted);
 	assert(src.lm_xsize == lm_xsize && src.lm_ysize == lm_ysize && src.lm_zsize == lm_zsize);
 	assert(src.vldata_alloc.size() == vldata_alloc.size());
 	assert(blend_weight >= 0.0);
@@ -282,7 +315,7 @@ void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 // *this = val*lmc + (1.0 - val)*(*this)
 void lmcell::mix_lighting_with(lmcell const &lmc, float val) {
 
-	float const omv(1.0 - val); // Note: we ignore the flow values and smoke for now
+	float const omv(1.0 - val); // Note: we ignore the flow values for now
 	sv = val*lmc.sv + omv*sv;
 	gv = val*lmc.gv + omv*gv;
 	UNROLL_3X(sc[i_] = val*lmc.sc[i_] + omv*sc[i_];)
@@ -291,6 +324,133 @@ void lmcell::mix_lighting_with(lmcell const &lmc, float val) {
 }
 
 
+// IEEE 754 half float conversion; values are clamped to the largest finite half rather than converted to inf
+unsigned short float_to_half(float v) {
+
+	unsigned bits(0);
+	memcpy(&bits, &v, sizeof(float));
+	unsigned short const sign((bits >> 16) & 0x8000);
+	int exp(int((bits >> 23) & 0xFF) - 127 + 15);
+	unsigned mant(bits & 0x7FFFFF);
+	if (exp >= 31) return (sign | 0x7BFF); // too large, or inf/NaN
+
+	if (exp <= 0) { // denormal or zero
+		if (exp < -10) return sign;
+		mant |= 0x800000; // add the implicit leading one
+		unsigned const shift(14 - exp);
+		return (sign | ((mant + (1U << (shift - 1))) >> shift));
+	}
+	mant += 0x1000; // round to nearest
+
+	if (mant & 0x800000) { // mantissa overflow
+		mant = 0;
+		if (++exp >= 31) return (sign | 0x7BFF);
+	}
+	return (sign | (exp << 10) | (mant >> 13));
+}
+
+float half_to_float(unsigned short h) {
+
+	unsigned const sign((h & 0x8000) << 16), exp((h >> 10) & 0x1F), mant(h & 0x3FF);
+	if (exp == 0) {float const v(ldexp(float(mant), -24)); return (sign ? -v : v);} // denormal or zero
+	unsigned const bits(sign | ((exp + 112) << 23) | (mant << 13));
+	float v(0.0);
+	memcpy(&v, &bits, sizeof(float));
+	return v;
+}
+
+// shared exponent format with 9-bit mantissas and a 5-bit exponent, as in EXT_texture_shared_exponent; negative values are clamped to zero
+unsigned float3_to_rgb9e5(float const c[3]) {
+
+	float const max_val(65408.0); // (511/512)*2^16
+	float cc[3];
+	UNROLL_3X(cc[i_] = max(0.0f, min(max_val, c[i_]));)
+	float const maxc(max(cc[0], max(cc[1], cc[2])));
+	if (!(maxc > 0.0)) return 0;
+	int e(0);
+	frexp(maxc, &e); // maxc = m*2^e, with m in [0.5, 1)
+	int exp_shared(max(-16, e-1) + 16);
+	float scale(ldexp(1.0f, (24 - exp_shared)));
+	if (unsigned(maxc*scale + 0.5f) == 512) {scale *= 0.5; ++exp_shared;} // rounding overflowed the mantissa
+	unsigned m[3];
+	UNROLL_3X(m[i_] = min(511U, unsigned(cc[i_]*scale + 0.5f));)
+	return (m[0] | (m[1] << 9) | (m[2] << 18) | (unsigned(exp_shared) << 27));
+}
+
+void rgb9e5_to_float3(unsigned v, float c[3]) {
+	float const scale(ldexp(1.0f, (int(v >> 27) - 24)));
+	UNROLL_3X(c[i_] = scale*((v >> (9*i_)) & 511);)
+}
+
+
+void lmcell_planes_t::clear() {
+	vector<unsigned>().swap(sky); vector<unsigned>().swap(global); vector<unsigned>().swap(local);
+	vector<unsigned short>().swap(sky_v); vector<unsigned short>().swap(global_v);
+	vector<unsigned char>().swap(flow);
+}
+
+void lmcell_planes_t::resize(size_t num) {
+	sky.resize(num); global.resize(num); local.resize(num);
+	sky_v.resize(num); global_v.resize(num);
+	flow.resize(3*num);
+}
+
+void lmcell_planes_t::encode(size_t ix, lmcell const &lmc) {
+	sky     [ix] = float3_to_rgb9e5(lmc.sc);
+	global  [ix] = float3_to_rgb9e5(lmc.gc);
+	local   [ix] = float3_to_rgb9e5(lmc.lc);
+	sky_v   [ix] = float_to_half(lmc.sv);
+	global_v[ix] = float_to_half(lmc.gv);
+	UNROLL_3X(flow[3*ix+i_] = lmc.pflow[i_];)
+}
+
+void lmcell_planes_t::decode(size_t ix, lmcell &lmc) const {
+	rgb9e5_to_float3(sky   [ix], lmc.sc);
+	rgb9e5_to_float3(global[ix], lmc.gc);
+	rgb9e5_to_float3(local [ix], lmc.lc);
+	lmc.sv = half_to_float(sky_v   [ix]);
+	lmc.gv = half_to_float(global_v[ix]);
+	UNROLL_3X(lmc.pflow[i_] = flow[3*ix+i_];)
+}
+
+
+// converts lmcell data to the compact format; this is lossy, and the float format must be restored with expand() before ray tracing into it
+void lmap_manager_t::compact() {
+
+	if (compacted || vldata_alloc.empty()) return;
+	size_t const prev_mem(get_mem_usage());
+	packed.resize(vldata_alloc.size());
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)vldata_alloc.size(); ++i) {packed.encode(i, vldata_alloc[i]);}
+	vector<lmcell>().swap(vldata_alloc); // free the memory
+	
+	for (unsigned i = 0; i < lm_ysize; ++i) {
+		for (unsigned j = 0; j < lm_xsize; ++j) {vlmap[i][j] = NULL;} // column pointers are no longer valid; col_ix is used instead
+	}
+	compacted = 1;
+	cout << "Compacted lightmap from " << prev_mem/1024 << "KB to " << get_mem_usage()/1024 << "KB" << endl;
+}
+
+void lmap_manager_t::expand() {
+
+	if (!compacted) return;
+	vldata_alloc.resize(packed.size());
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)vldata_alloc.size(); ++i) {packed.decode(i, vldata_alloc[i]);}
+	packed.clear();
+
+	for (unsigned i = 0; i < lm_ysize; ++i) {
+		for (unsigned j = 0; j < lm_xsize; ++j) {
+			unsigned const ix(get_col_ix(j, i));
+			vlmap[i][j] = ((ix == EMPTY_COL) ? NULL : &vldata_alloc[ix]);
+		}
+	}
+	compacted = 0;
+}
+
+
 int light_grid_base::check_lmap_get_grid_index(point const &p) const {
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y)), z(get_zpos(p.z));
 	if (!lmap_manager.is_valid_cell(x, y, z)) return -1; // the global lightmap doesn't have this cell
@@ -535,8 +695,7 @@ void clear_lightmap() {
 void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, float zstep) {
 
 	assert(zstep > 0.0);
-	lmcell *vldata(lmap_manager.get_column(j, i));
-	if (vldata == NULL) return;
+	if (!lmap_manager.has_column(j, i)) return;
 	float const bbz[2][2] = {{get_xval(j), get_xval(j+1)}, {get_yval(i), get_yval(i+1)}}; // X x Y
 	vector<pair<float, unsigned> > cobj_z;
 
@@ -565,12 +724,13 @@ void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, fl
 
 	for (int v = MESH_SIZE[2]-1; v >= 0; --v) { // top to bottom
 		float zb(czmin0 + v*zstep), zt(zb + zstep); // cell Z bounds
+		unsigned char flow[3];
 		
 		if (zt < mesh_height[i][j]) { // under mesh
-			UNROLL_3X(vldata[v].pflow[i_] = 0;) // all zeros
+			UNROLL_3X(flow[i_] = 0;) // all zeros
 		}
 		else if (!proc_cobjs /*|| ncv2 == 0*/) { // ignore cobjs or no cobjs
-			UNROLL_3X(vldata[v].pflow[i_] = 255;) // all ones
+			UNROLL_3X(flow[i_] = 255;) // all ones
 		}
 		else { // above mesh case
 			float const bb[3][2]  = {{bbz[0][0], bbz[0][1]}, {bbz[1][0], bbz[1][1]}, {zb, zt}};
@@ -596,9 +756,10 @@ void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, fl
 			for (unsigned e = 0; e < 3; ++e) {
 				float const fv(flow_prof[e].den_inv());
 				assert(fv > -TOLER);
-				vldata[v].pflow[e] = (unsigned char)(255.5*CLIP_TO_01(fv));
+				flow[e] = (unsigned char)(255.5*CLIP_TO_01(fv));
 			}
 		} // if above mesh
+		lmap_manager.set_flow(j, i, v, flow);
 	} // for v
 }
 
@@ -609,7 +770,7 @@ float calc_czspan() {return max(0.0f, ((czmax + lm_dz_adj) - czmin0 + TOLER));}
 
 unsigned get_grid_xsize() {return max((MESH_X_SIZE >> DL_GRID_BS), 1);}
 unsigned get_grid_ysize() {return max((MESH_Y_SIZE >> DL_GRID_BS), 1);}
-unsigned get_ldynamic_ix(unsigned x, unsigned y) {return (y >> DL_GRID_BS)*get_grid_xsize() + (x >> DL_GRID_BS);}
+unsigned get_grid_zsize() {return max(min(DL_GRID_ZSLICES, 64U), 1U);}
 
 
 void build_lightmap(bool verbose) {
@@ -634,8 +795,6 @@ void build_lightmap(bool verbose) {
 	DZ_VAL_INV2 = 1.0/DZ_VAL2;
 	czmin0      = czmin;//max(czmin, zbottom);
 	assert(lm_dz_adj >= 0.0);
-	ldynamic.resize(get_grid_xsize()*get_grid_ysize());
-	ldynamic_enabled.resize(ldynamic.size(), 0);
 	if (MESH_Z_SIZE == 0) return;
 
 	RESET_TIME;
@@ -696,7 +855,7 @@ void build_lightmap(bool verbose) {
 		UNROLL_3X(init_lmcell.sc[i_] = init_lmcell.gc[i_] = 1.0;)
 	}
 	lmap_manager.alloc(nbins, MESH_X_SIZE, MESH_Y_SIZE, zsize, need_lmcell, init_lmcell);
-	assert(!ldynamic.empty() && lmap_manager.is_allocated());
+	assert(lmap_manager.is_allocated());
 	using_lightmap = (nonempty > 0);
 	lm_alloc       = 1;
 
@@ -766,6 +925,7 @@ void build_lightmap(bool verbose) {
 	}
 	reset_cobj_counters();
 	matrix_delete_2d(need_lmcell);
+	if (compact_lightmap && !global_lighting_update) {lmap_manager.compact();} // lighting is static, so we can use the compact format
 	if (!scrolling) {PRINT_TIME(" Lighting Total");}
 }
 
@@ -815,9 +975,11 @@ void update_indir_light_tex_range(lmap_manager_t const &lmap, vector<unsigned ch
 
 #pragma omp parallel for schedule(static) if (mt)
 	for (int y = y1; y < (int)y2; ++y) {
+		vector<lmcell> col_buf; // used for decoding compact lightmaps
+
 		for (unsigned x = 0; x < xsize; ++x) {
 			unsigned const off(zsize*(y*xsize + x));
-			lmcell const *const vlm(lmap.get_column(x, y));
+			lmcell const *const vlm(lmap.get_column_ro(x, y, col_buf));
 			assert(vlm != nullptr); // not supported in this flow
 			colorRGB color;
 
@@ -907,36 +1069,34 @@ void upload_dlights_textures(cube_t const &bounds, float &dlight_add_thresh) { /
 		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ysz, ndl, GL_RGBA, GL_FLOAT, dl_data_ptr);
 	}
 
-	// step 2: grid bag entries
+	// step 2: cluster grid bag entries
 	static unsigned num_warnings(0);
 	static vector<unsigned> gb_data;
 	static vector<unsigned short> elem_data;
+	static unsigned elem_tex_sz(0);
+	unsigned const gbx(max(1U, dlight_clusters.get_size(0))), gby(max(1U, dlight_clusters.get_size(1))), gbz(max(1U, dlight_clusters.get_size(2)));
 	unsigned const elem_tex_x = (1<<8); // must agree with value in shader
-	unsigned const elem_tex_y = (1<<10); // larger = slower, but more lights/higher quality
-	unsigned const max_gb_entries(elem_tex_x*elem_tex_y), gbx(get_grid_xsize()), gby(get_grid_ysize());
+	// larger = slower, but more lights/higher quality; a light spans several Z slices, so scale with gbz to keep the same capacity per slice as the 2D grid
+	unsigned const elem_tex_y(min((1U<<10)*gbz, (1U<<14))); // limited to the minimum GL_MAX_TEXTURE_SIZE
+	unsigned const max_gb_entries(elem_tex_x*elem_tex_y);
 	assert(max_gb_entries <= (1<<24)); // gb_data low bits allocation
 	elem_data.resize(0);
-	gb_data.resize(gbx*gby, 0);
-
-	for (unsigned y = 0; y < gby && elem_data.size() < max_gb_entries; ++y) {
-		for (unsigned x = 0; x < gbx && elem_data.size() < max_gb_entries; ++x) {
-			unsigned const gb_ix(x + y*gbx); // {start, end, unused}
-			gb_data[gb_ix] = elem_data.size(); // 24 low bits = start_ix
-			if (!ldynamic_enabled[gb_ix]) continue; // no lights for this grid
-			dls_cell const &dlsc(ldynamic[gb_ix]);
-			unsigned num_ixs(dlsc.size());
-			if (num_ixs == 0) continue; // no lights for this grid
-			unsigned short const *const ixs(dlsc.get_src_ixs());
-			assert(num_ixs < 256);
-			num_ixs = min(num_ixs, unsigned(max_gb_entries - elem_data.size())); // enforce max_gb_entries limit
+	gb_data.resize(gbx*gby*gbz, 0);
+
+	for (unsigned cix = 0; cix < gb_data.size(); ++cix) { // {start, end, unused}
+		gb_data[cix] = elem_data.size(); // 24 low bits = start_ix
+		unsigned short const *ixs(nullptr);
+		unsigned num_ixs(dlight_clusters.get_cluster_lights(cix, ixs));
+		if (num_ixs == 0) continue; // no lights for this cluster
+		assert(num_ixs < MAX_LSRC);
+		num_ixs = min(num_ixs, unsigned(max_gb_entries - elem_data.size())); // enforce max_gb_entries limit
 			
-			for (unsigned i = 0; i < num_ixs; ++i) {
-				if (ixs[i] < ndl) {elem_data.push_back((unsigned short)ixs[i]);} // if dlight index is too high, skip
-			}
-			unsigned const num_ix(elem_data.size() - gb_data[gb_ix]);
-			assert(num_ix < (1<<8));
-			gb_data[gb_ix] += (num_ix << 24); // 8 high bits = num_ix
+		for (unsigned i = 0; i < num_ixs; ++i) {
+			if (ixs[i] < ndl) {elem_data.push_back(ixs[i]);} // if dlight index is too high, skip
 		}
+		unsigned const num_ix(elem_data.size() - gb_data[cix]);
+		assert(num_ix < (1<<8));
+		gb_data[cix] += (num_ix << 24); // 8 high bits = num_ix
 	}
 	if (elem_data.size() > 0.9*max_gb_entries) {
 		if (elem_data.size() >= max_gb_entries && num_warnings < 100) {
@@ -945,23 +1105,30 @@ void upload_dlights_textures(cube_t const &bounds, float &dlight_add_thresh) { /
 		}
 		dlight_add_thresh = min(0.25f, (dlight_add_thresh + 0.005f)); // increase thresh to clip the dynamic lights to a smaller radius
 	}
+	if (elem_tid != 0 && elem_tex_sz != elem_tex_y) {free_texture(elem_tid);} // Z slice count changed
+
 	if (elem_tid == 0) {
 		setup_2d_texture(elem_tid);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, elem_tex_x, elem_tex_y, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+		elem_tex_sz = elem_tex_y;
 	}
 	bind_2d_texture(elem_tid);
 	unsigned const height(min(elem_tex_y, unsigned(elem_data.size()/elem_tex_x+1U))); // approximate ceiling
 	elem_data.reserve(elem_tex_x*height); // ensure it's large enough for the padded upload
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, elem_tex_x, height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &elem_data.front());
 
-	// step 3: grid bag(s)
+	// step 3: cluster grid bag(s)
+	static unsigned gb_tex_sz[3] = {0};
+	if (gb_tid != 0 && (gb_tex_sz[0] != gbx || gb_tex_sz[1] != gby || gb_tex_sz[2] != gbz)) {free_texture(gb_tid);} // grid size changed
+
 	if (gb_tid == 0) {
-		setup_2d_texture(gb_tid);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, gbx, gby, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &gb_data.front()); // Nx x Ny
+		setup_3d_texture(gb_tid, GL_NEAREST, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, gbx, gby, gbz, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &gb_data.front()); // Nx x Ny x Nz
+		gb_tex_sz[0] = gbx; gb_tex_sz[1] = gby; gb_tex_sz[2] = gbz;
 	}
 	else {
-		bind_2d_texture(gb_tid);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gbx, gby, GL_RED_INTEGER, GL_UNSIGNED_INT, &gb_data.front());
+		bind_3d_texture(gb_tid);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, gbx, gby, gbz, GL_RED_INTEGER, GL_UNSIGNED_INT, &gb_data.front());
 	}
 	check_gl_error(440);
 	//PRINT_TIME("Dlight Texture Upload");
@@ -981,7 +1148,9 @@ void setup_dlight_textures(shader_t &s, bool enable_dlights_smap) {
 	assert(dl_tid > 0 && elem_tid > 0 && gb_tid > 0 );
 	set_one_texture(s, dl_tid,   2, "dlight_tex");
 	set_one_texture(s, elem_tid, 3, "dlelm_tex");
-	set_one_texture(s, gb_tid,   4, "dlgb_tex");
+	set_active_texture(4);
+	bind_3d_texture(gb_tid); // 3D cluster grid
+	s.add_uniform_int("dlgb_tex", 4);
 	set_active_texture(0);
 	if (enable_dlights_smap && shadow_map_enabled()) {setup_dlight_shadow_maps(s);}
 	s.add_uniform_float("LT_DIR_FALLOFF", LT_DIR_FALLOFF);
@@ -1090,35 +1259,11 @@ void add_line_light(point const &p1, point const &p2, colorRGBA const &color, fl
 }
 
 
-bool dls_cell::check_add_light(unsigned ix) const {
-
-	if (empty()) return 1;
-	assert(ix < dl_sources.size());
-	light_source const &ls(dl_sources[ix]);
-
-	for (unsigned i = 0; i < sz; ++i) {
-		unsigned const ix2(lsrc[i]);
-		assert(ix2 < dl_sources.size());
-		assert(ix2 != ix);
-		if (ls.try_merge_into(dl_sources[ix2])) return 0;
-	}
-	return 1;
-}
-
-void dls_cell::add_light_range(unsigned six, unsigned eix, unsigned char &enabled_flag) {
-	if (!enabled_flag) {sz = 0; enabled_flag = 1;} // clear if marked as disabled, then enable
-	
-	for (unsigned ix = six; ix < eix; ++ix) {
-		if (sz+1 < MAX_LSRC) {lsrc[sz++] = ix;}
-	}
-}
-
-
 void clear_dynamic_lights() {
 
 	//if (!animate2) return;
 	if (dl_sources.empty()) return; // only clear if light pos/size has changed?
-	for (auto i = ldynamic_enabled.begin(); i != ldynamic_enabled.end(); ++i) {*i = 0;} // 0.015ms
+	dlight_clusters.clear();
 	dl_sources.clear();
 }
 
@@ -1134,13 +1279,159 @@ void calc_spotlight_pdu(light_source const &ls, pos_dir_up &pdu) {
 }
 
 
+// *** dynamic light clusters ***
+
+void dlight_cluster_grid_t::clear() {
+	light_ixs.clear();
+	cluster_start.assign(cluster_start.size(), 0);
+	lights_bcube.set_to_zeros();
+	num_clipped = 0;
+}
+
+// adds the light to each cluster within its bcube that intersects the light's volume (sphere, line capsule, or spotlight cone);
+// the x terms are computed once per light, so that the per-row sphere and capsule test loops have no branches and are vectorized by gcc -O3
+void dlight_cluster_grid_t::bin_light(light_source const &ls, unsigned ix, float sqrt_thresh, bool clip_to_scene, thread_data_t &td) const {
+
+	if (ls.get_radius() == 0.0) { // global light source, add to all clusters
+		td.bcube.assign_or_union_with_cube(bounds);
+		for (unsigned cix = 0; cix < get_num_clusters(); ++cix) {td.pairs.emplace_back(cix, ix);}
+		return;
+	}
+	cube_t const bcube(ls.calc_bcube(1, sqrt_thresh, clip_to_scene)); // padded for spotlights
+	td.bcube.assign_or_union_with_cube(bcube);
+	int bnds[3][2];
+	for (unsigned d = 0; d < 3; ++d) {UNROLL_2X(bnds[d][i_] = get_cell(bcube.d[d][i_], d);)}
+	bool const line_light(ls.is_line_light());
+	point const &p1(ls.get_pos()), &p2(ls.get_pos2());
+	float const radius(ls.get_radius()*(1.0 - sqrt_thresh)), r_sq(radius*radius);
+	pos_dir_up pdu;
+	calc_spotlight_pdu(ls, pdu);
+	int const nx(bnds[0][1] - bnds[0][0] + 1);
+	td.hits.resize(nx);
+	td.col_a.resize(nx);
+	td.col_b.resize(nx);
+	unsigned char *const hits(td.hits.data());
+	float *const col_a(td.col_a.data()), *const col_b(td.col_b.data());
+	vector3d const L(p2 - p1);
+	float const L_mag_sq_inv(1.0/max(L.mag_sq(), TOLERANCE)), r_sq4(4.0f*r_sq);
+
+	for (int n = 0; n < nx; ++n) { // per-column terms
+		int const x(bnds[0][0] + n);
+
+		if (line_light) { // edge clusters are clipped to the light bcube to give them a finite size
+			float const lo(max(get_cell_lo(x, 0), bcube.x1())), hi(min(get_cell_hi(x, 0), bcube.x2()));
+			col_a[n] = 0.5f*(lo + hi) - p1.x; // center relative to p1
+			col_b[n] = (hi - lo)*(hi - lo);
+		}
+		else {
+			float const dx(max(0.0f, max((get_cell_lo(x, 0) - p1.x), (p1.x - get_cell_hi(x, 0)))));
+			col_a[n] = dx*dx;
+		}
+	}
+	for (int z = bnds[2][0]; z <= bnds[2][1]; ++z) {
+		float const dz(max(0.0f, max((get_cell_lo(z, 2) - p1.z), (p1.z - get_cell_hi(z, 2)))));
+		float const zlo(max(get_cell_lo(z, 2), bcube.z1())), zhi(min(get_cell_hi(z, 2), bcube.z2()));
+
+		for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) {
+			float const dy(max(0.0f, max((get_cell_lo(y, 1) - p1.y), (p1.y - get_cell_hi(y, 1))))), dyz_sq(dy*dy + dz*dz);
+			if (!line_light && dyz_sq > r_sq) continue; // row is outside the sphere
+			unsigned const row_ix(sz[0]*(y + sz[1]*z));
+
+			if (line_light) { // test the clipped cluster against the line capsule, using its center and half diagonal
+				float const ylo(max(get_cell_lo(y, 1), bcube.y1())), yhi(min(get_cell_hi(y, 1), bcube.y2()));
+				float const vy(0.5f*(ylo + yhi) - p1.y), vz(0.5f*(zlo + zhi) - p1.z), syz_sq((yhi - ylo)*(yhi - ylo) + (zhi - zlo)*(zhi - zlo));
+				float const vyz_dot(vy*L.y + vz*L.z);
+
+				for (int n = 0; n < nx; ++n) {
+					float const vx(col_a[n]), t(max(0.0f, min(1.0f, (vx*L.x + vyz_dot)*L_mag_sq_inv))); // closest point on the line is p1 + t*L
+					float const ex(vx - t*L.x), ey(vy - t*L.y), ez(vz - t*L.z), d_sq(ex*ex + ey*ey + ez*ez), h_sq(0.25f*(col_b[n] + syz_sq));
+					// dist <= radius + half_diag, without a sqrt: e = d_sq - r_sq - h_sq <= 2*radius*half_diag
+					float const e(d_sq - r_sq - h_sq);
+					hits[n] = ((e <= 0.0f) | (e*e <= r_sq4*h_sq));
+				}
+			}
+			else {
+				for (int n = 0; n < nx; ++n) {hits[n] = ((col_a[n] + dyz_sq) <= r_sq);} // sphere vs. AABB distance
+			}
+			for (int n = 0; n < nx; ++n) {
+				if (!hits[n]) continue;
+				int const x(bnds[0][0] + n);
+
+				if (pdu.valid) { // spotlight cone test, with the cluster clipped to the light bcube
+					cube_t cc(get_cell_cube(x, y, z));
+					cc.intersect_with_cube(bcube); // clip edge clusters to a finite size
+					if (!pdu.cube_visible_for_light_cone(cc)) continue;
+				}
+				td.pairs.emplace_back((row_ix + x), ix);
+			} // for n
+		} // for y
+	} // for z
+}
+
+// bins the lights in ixs into clusters in parallel, then builds the per-cluster light lists with a counting sort;
+// per-cluster lists keep the order of ixs, and are limited to MAX_LSRC-1 lights
+void dlight_cluster_grid_t::build(vector<light_source> const &lights, vector<unsigned> const &ixs, cube_t const &bounds_,
+	unsigned nx, unsigned ny, unsigned nz, float sqrt_thresh, bool clip_to_scene)
+{
+	//RESET_TIME;
+	assert(nx > 0 && ny > 0 && nz > 0);
+	bounds = bounds_;
+	sz[0] = nx; sz[1] = ny; sz[2] = nz;
+
+	for (unsigned d = 0; d < 3; ++d) {
+		float const dsz(bounds.get_sz_dim(d));
+		if (!(dsz > 0.0)) {sz[d] = 1;} // zero area or denormalized: use a single slice
+		cell_sz[d]     = ((dsz > 0.0) ? dsz/sz[d] : 1.0);
+		inv_cell_sz[d] = ((dsz > 0.0) ? 1.0/cell_sz[d] : 0.0);
+	}
+	unsigned const num_clusters(get_num_clusters()), num_lights(ixs.size());
+	unsigned const num_threads(max(1, omp_get_max_threads_3dw()));
+	thread_data.resize(num_threads);
+
+	for (auto i = thread_data.begin(); i != thread_data.end(); ++i) {
+		i->pairs.clear();
+		i->bcube.set_to_zeros();
+	}
+	// Note: with a static schedule, each thread bins a contiguous range of lights in increasing thread order
+#pragma omp parallel for schedule(static) if (num_lights > 16)
+	for (int i = 0; i < (int)num_lights; ++i) {
+		unsigned const ix(ixs[i]);
+		assert(ix < lights.size());
+		if (ix >= 0xFFFF) continue; // index doesn't fit in 16 bits
+		bin_light(lights[ix], ix, sqrt_thresh, clip_to_scene, thread_data[omp_get_thread_num_3dw()]);
+	}
+	// counting sort of (cluster, light) pairs by cluster
+	cluster_start.assign(num_clusters+1, 0);
+	lights_bcube.set_to_zeros();
+	num_clipped = 0;
+
+	for (auto i = thread_data.begin(); i != thread_data.end(); ++i) {
+		if (!i->bcube.is_all_zeros()) {lights_bcube.assign_or_union_with_cube(i->bcube);}
+
+		for (auto p = i->pairs.begin(); p != i->pairs.end(); ++p) {
+			unsigned &count(cluster_start[p->cix+1]);
+			if (count+1 < MAX_LSRC) {++count;} else {++num_clipped;}
+		}
+	}
+	for (unsigned cix = 0; cix < num_clusters; ++cix) {cluster_start[cix+1] += cluster_start[cix];}
+	light_ixs.resize(cluster_start.back());
+	cluster_fill.assign(cluster_start.begin(), cluster_start.end()-1);
+
+	for (auto i = thread_data.begin(); i != thread_data.end(); ++i) {
+		for (auto p = i->pairs.begin(); p != i->pairs.end(); ++p) {
+			unsigned &pos(cluster_fill[p->cix]);
+			if (pos < cluster_start[p->cix+1]) {light_ixs[pos++] = p->lix;}
+		}
+	}
+	//PRINT_TIME("Dlight Cluster Build");
+}
+
+
 void add_dynamic_lights_ground(float &dlight_add_thresh) {
 
 	//RESET_TIME;
 	sync_flashlight();
 	if (!animate2) return;
-	assert(!ldynamic.empty());
-	assert(ldynamic_enabled.size() == ldynamic.size());
 	clear_dynamic_lights();
 	dl_sources.swap(dl_sources2);
 	dl_smap_enabled = 0;
@@ -1163,55 +1454,30 @@ void add_dynamic_lights_ground(float &dlight_add_thresh) {
 	unsigned const ndl((unsigned)dl_sources.size()), gbx(get_grid_xsize()), gby(get_grid_ysize());
 	has_dl_sources     = (ndl > 0);
 	dlight_add_thresh *= 0.99f;
-	bool first(1);
-	float const sqrt_dlight_add_thresh(sqrt(dlight_add_thresh));
-	point const dlight_shift(-0.5*DX_VAL, -0.5*DY_VAL, 0.0);
-	float const grid_dx(DX_VAL*(1 << DL_GRID_BS)), grid_dy(DY_VAL*(1 << DL_GRID_BS));
-	float const z1(min(czmin, zbottom)), z2(max(czmax, ztop));
+	static vector<unsigned> light_ixs;
+	static vector<int> cell_heads, next_ix; // linked lists of lights centered in each XY grid cell, for merging
+	light_ixs.clear();
+	cell_heads.assign(gbx*gby, -1);
+	next_ix.resize(ndl);
 
-	for (unsigned ix = 0; ix < ndl; ++ix) {
+	for (unsigned ix = 0; ix < ndl; ++ix) { // serial visibility and merge pass; visibility tests aren't thread safe
 		light_source const &ls(dl_sources[ix]);
 		if (!ls.is_user_placed() && !ls.is_visible()) continue; // view culling (user placed lights are culled above as light_sources_d)
-		float const ls_radius(ls.get_radius());
-		if ((min(ls.get_pos().z, ls.get_pos2().z) - ls_radius) > max(ztop, czmax)) continue; // above everything, rarely occurs
-		point const &lpos(ls.get_pos()), &lpos2(ls.get_pos2());
-		bool const line_light(ls.is_line_light());
-		int const xcent(get_xpos(lpos.x) >> DL_GRID_BS), ycent(get_ypos(lpos.y) >> DL_GRID_BS);
+		if ((min(ls.get_pos().z, ls.get_pos2().z) - ls.get_radius()) > max(ztop, czmax)) continue; // above everything, rarely occurs
+		int const xcent(get_xpos(ls.get_pos().x) >> DL_GRID_BS), ycent(get_ypos(ls.get_pos().y) >> DL_GRID_BS);
 		
-		if (!line_light && xcent >= 0 && ycent >= 0 && xcent < (int)gbx && ycent < (int)gby) {
-			unsigned const gb_ix(ycent*gbx + xcent);
-			if (ldynamic_enabled[gb_ix] && !ldynamic[gb_ix].check_add_light(ix)) continue; // merged into existing light, skip
+		if (!ls.is_line_light() && xcent >= 0 && ycent >= 0 && xcent < (int)gbx && ycent < (int)gby) {
+			int &head(cell_heads[ycent*gbx + xcent]);
+			bool merged(0);
+			for (int j = head; j >= 0 && !merged; j = next_ix[j]) {merged = ls.try_merge_into(dl_sources[j]);}
+			if (merged) continue; // merged into existing light, skip
+			next_ix[ix] = head;
+			head = ix;
 		}
-		cube_t bcube;
-		int bnds[3][2];
-		ls.get_bounds(bcube, bnds, sqrt_dlight_add_thresh, 1, dlight_shift); // clip_to_scene_bcube=1
-		if (first) {dlight_bcube = bcube;} else {dlight_bcube.union_with_cube(bcube);}
-		first = 0;
-		int const radius(((int(ls_radius*max(DX_VAL_INV, DY_VAL_INV)) + 1) >> DL_GRID_BS) + 1), rsq(radius*radius);
-		float const line_rsq((ls_radius + HALF_DXY)*(ls_radius + HALF_DXY));
-		if (DL_GRID_BS > 0) {for (unsigned d = 0; d < 4; ++d) {bnds[d>>1][d&1] >>= DL_GRID_BS;}}
-		pos_dir_up pdu;
-		calc_spotlight_pdu(ls, pdu);
-
-		for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) { // add lights to ldynamic
-			int const y_sq((y-ycent)*(y-ycent)), offset(y*gbx);
-
-			for (int x = bnds[0][0]; x <= bnds[0][1]; ++x) {
-				if (line_light) {
-					float const px(get_xval(x << DL_GRID_BS)), py(get_yval(y << DL_GRID_BS)), lx(lpos2.x - lpos.x), ly(lpos2.y - lpos.y);
-					float const cp_mag(lx*(lpos.y - py) - ly*(lpos.x - px));
-					if (cp_mag*cp_mag > line_rsq*(lx*lx + ly*ly)) continue;
-				} else if (((x-xcent)*(x-xcent) + y_sq) > rsq) continue; // skip
-
-				if (pdu.valid) {
-					float const px(get_xval(x << DL_GRID_BS)), py(get_yval(y << DL_GRID_BS));
-					if (!pdu.cube_visible_for_light_cone(cube_t(px-grid_dx, px+grid_dx, py-grid_dy, py+grid_dy, z1, z2))) continue; // tile not in spotlight cylinder
-				}
-				//if (DL_GRID_BS == 0 && bcube.z1() > v_collision_matrix[y << DL_GRID_BS][x << DL_GRID_BS].zmax) continue; // should be legal, but doesn't seem to help
-				ldynamic[offset + x].add_light(ix, ldynamic_enabled[offset + x]); // could do flow clipping here?
-			} // for x
-		} // for y
+		light_ixs.push_back(ix);
 	} // for ix (light index)
+	dlight_clusters.build(dl_sources, light_ixs, get_scene_bounds_bcube(), gbx, gby, get_grid_zsize(), sqrt(dlight_add_thresh), 1); // clip_to_scene=1
+	dlight_bcube = dlight_clusters.get_lights_bcube();
 	//PRINT_TIME("Dynamic Light Add");
 }
 
@@ -1219,62 +1485,16 @@ void add_dynamic_lights_ground(float &dlight_add_thresh) {
 void add_dynamic_lights_city(cube_t const &scene_bcube, float &dlight_add_thresh) {
 
 	//RESET_TIME;
-	assert(DL_GRID_BS == 0); // not supported
-	unsigned const ndl((unsigned)dl_sources.size()), gbx(MESH_X_SIZE), gby(MESH_Y_SIZE);
+	unsigned const ndl((unsigned)dl_sources.size());
 	has_dl_sources     = (ndl > 0);
 	if (!has_dl_sources) return; // nothing else to do
 	dlight_add_thresh *= 0.99;
 	if (!scene_bcube.is_strictly_normalized()) {cerr << "Invalid scene_bcube: " << scene_bcube.str() << endl;}
 	assert(scene_bcube.dx() > 0.0 && scene_bcube.dy() > 0.0);
-	point const scene_llc(scene_bcube.get_llc()); // Note: zval ignored
-	vector3d const scene_sz(scene_bcube.get_size()); // Note: zval ignored
-	float const sqrt_dlight_add_thresh(sqrt(dlight_add_thresh));
-	float const grid_dx(scene_sz.x/gbx), grid_dy(scene_sz.y/gby), grid_dx_inv(1.0/grid_dx), grid_dy_inv(1.0/grid_dy);
-
-	for (unsigned ix = 0; ix < ndl;) { // Note: no increment
-		light_source const &ls(dl_sources[ix]); // Note: should always be visible
-		point const &lpos(ls.get_pos());
-		unsigned const start_ix(ix);
-
-		for (++ix; ix < ndl; ++ix) {
-			light_source const &ls2(dl_sources[ix]);
-			if (ls2.get_pos().x != lpos.x || ls2.get_pos().y != lpos.y || ls2.get_radius() != ls.get_radius()) break;
-		}
-		int const xcent((lpos.x - scene_llc.x)*grid_dx_inv + 0.5f), ycent((lpos.y - scene_llc.y)*grid_dy_inv + 0.5f);
-		cube_t bcube(ls.calc_bcube(0, sqrt_dlight_add_thresh)); // padded below
-
-		if (ls.is_very_directional() && (ls.get_dir().x != 0.0 || ls.get_dir().y != 0.0)) {
-			bcube.expand_by(vector3d(grid_dx, grid_dy, 0.0)); // add one grid unit for spotlights not pointed up/down
-		}
-		int bnds[2][2];
-
-		for (unsigned e = 0; e < 2; ++e) {
-			bnds[0][e] = max(0, min((int)gbx-1, int((bcube.d[0][e] - scene_llc.x)*grid_dx_inv)));
-			bnds[1][e] = max(0, min((int)gby-1, int((bcube.d[1][e] - scene_llc.y)*grid_dy_inv)));
-		}
-		int const radius(ls.get_radius()*max(grid_dx_inv, grid_dy_inv) + 2), rsq(radius*radius);
-
-		if (ix - start_ix == 1) {
-			for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) { // add lights to ldynamic
-				int const y_sq((y-ycent)*(y-ycent)), offset(y*gbx);
-
-				for (int x = bnds[0][0]; x <= bnds[0][1]; ++x) {
-					if (((x-xcent)*(x-xcent) + y_sq) > rsq) continue; // skip
-					ldynamic[offset + x].add_light(start_ix, ldynamic_enabled[offset + x]);
-				} // for x
-			} // for y
-		}
-		else {
-			for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) { // add lights to ldynamic
-				int const y_sq((y-ycent)*(y-ycent)), offset(y*gbx);
-
-				for (int x = bnds[0][0]; x <= bnds[0][1]; ++x) {
-					if (((x-xcent)*(x-xcent) + y_sq) > rsq) continue; // skip
-					ldynamic[offset + x].add_light_range(start_ix, ix, ldynamic_enabled[offset + x]);
-				} // for x
-			} // for y
-		}
-	} // for ix (light index)
+	static vector<unsigned> light_ixs;
+	light_ixs.resize(ndl);
+	for (unsigned ix = 0; ix < ndl; ++ix) {light_ixs[ix] = ix;} // all lights should be visible
+	dlight_clusters.build(dl_sources, light_ixs, scene_bcube, MESH_X_SIZE, MESH_Y_SIZE, get_grid_zsize(), sqrt(dlight_add_thresh), 0); // clip_to_scene=0
 	//PRINT_TIME("Dynamic Light Add");
 }
 
@@ -1304,29 +1524,26 @@ void get_indir_light(colorRGBA &a, point const &p) { // used for particle clouds
 	if (!point_outside_mesh(x, y) && p.z > czmin0) { // inside the mesh range and above the lowest cobj
 		float val(get_voxel_terrain_ao_lighting_val(p));
 		
-		if (using_lightmap && p.z < czmax && lmap_manager.get_column(x, y) != NULL) { // not above all collision objects and not empty cell
-			lmap_manager.get_lmcell(x, y, z).get_final_color(cscale, 0.5, val);
+		if (using_lightmap && p.z < czmax && lmap_manager.has_column(x, y)) { // not above all collision objects and not empty cell
+			lmap_manager.get_cell(x, y, z).get_final_color(cscale, 0.5, val);
 		}
 		else if (val < 1.0) {
 			cscale *= val;
 		}
 		if (!dl_sources.empty() && dlight_bcube.contains_pt(p)) {
-			unsigned const gb_ix(get_ldynamic_ix(x, y));
-
-			if (ldynamic_enabled[gb_ix]) {
-				dls_cell const &ldv(ldynamic[gb_ix]);
-
-				for (unsigned l = 0; l < (unsigned)ldv.size(); ++l) {
-					unsigned const ls_ix(ldv.get(l));
-					assert(ls_ix < dl_sources.size());
-					light_source const &lsrc(dl_sources[ls_ix]);
-					point lpos;
-					float color_scale(lsrc.get_intensity_at(p, lpos));
-					if (color_scale < CTHRESH) continue;
-					if (lsrc.is_directional()) {color_scale *= lsrc.get_dir_intensity(lpos - p);}
-					cscale += lsrc.get_color()*color_scale;
-				} // for l
-			}
+			unsigned short const *ixs(nullptr);
+			unsigned const num_lights(dlight_clusters.get_lights_at(p, ixs));
+
+			for (unsigned l = 0; l < num_lights; ++l) {
+				unsigned const ls_ix(ixs[l]);
+				assert(ls_ix < dl_sources.size());
+				light_source const &lsrc(dl_sources[ls_ix]);
+				point lpos;
+				float color_scale(lsrc.get_intensity_at(p, lpos));
+				if (color_scale < CTHRESH) continue;
+				if (lsrc.is_directional()) {color_scale *= lsrc.get_dir_intensity(lpos - p);}
+				cscale += lsrc.get_color()*color_scale;
+			} // for l
 		}
 	}
 	UNROLL_3X(a[i_] *= min(1.0f, cscale[i_]);)
@@ -1337,12 +1554,11 @@ bool is_any_dlight_visible(point const &p) {
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y));
 	if (point_outside_mesh(x, y)) return 0; // outside the mesh range
 	if (dl_sources.empty() || !dlight_bcube.contains_pt(p)) return 0;
-	unsigned const gb_ix(get_ldynamic_ix(x, y));
-	if (!ldynamic_enabled[gb_ix]) return 0;
-	dls_cell const &ldv(ldynamic[gb_ix]);
+	unsigned short const *ixs(nullptr);
+	unsigned const num_lights(dlight_clusters.get_lights_at(p, ixs));
 
-	for (unsigned l = 0; l < (unsigned)ldv.size(); ++l) {
-		unsigned const ls_ix(ldv.get(l));
+	for (unsigned l = 0; l < num_lights; ++l) {
+		unsigned const ls_ix(ixs[l]);
 		assert(ls_ix < dl_sources.size());
 		light_source const &lsrc(dl_sources[ls_ix]);
 		point lpos;
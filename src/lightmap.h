@@ -6,6 +6,7 @@
 
 #include "3DWorld.h"
 #include "trigger.h"
+#include <cfloat>
 
 extern int MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[3];
 
@@ -28,12 +29,12 @@ protected:
 
 unsigned const lmcell_ltype_off[NUM_LIGHTING_TYPES] = {0, 4, 8, 0}; // sky, global, local, sky cobj accum, dynamic
 
-struct lmcell { // size = 52
+struct lmcell { // size = 48
 
-	float sc[3], sv, gc[3], gv, lc[3], smoke; // *c[3]: RGB sky, global, local colors
+	float sc[3], sv, gc[3], gv, lc[3]; // *c[3]: RGB sky, global, local colors; smoke is stored separately in smoke.cpp
 	unsigned char pflow[3]; // flow: x, y, z
 	
-	lmcell() : sv(0.0), gv(0.0), smoke(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
+	lmcell() : sv(0.0), gv(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
 	float       *get_offset(int ltype)       {return (sc + lmcell_ltype_off[ltype]);}
 	float const *get_offset(int ltype) const {return (sc + lmcell_ltype_off[ltype]);}
 	static unsigned get_dsz(int ltype)       {return ((ltype == LIGHTING_LOCAL) ? 3 : 4);}
@@ -44,12 +45,33 @@ struct lmcell { // size = 52
 };
 
 
+// compact read-only storage for lmcell data with one plane per lighting type; 19 bytes per cell rather than 48
+struct lmcell_planes_t {
+	vector<unsigned> sky, global, local; // RGB colors in shared exponent RGB9E5 format
+	vector<unsigned short> sky_v, global_v; // half float
+	vector<unsigned char> flow; // 3 per cell
+
+	void clear();
+	void resize(size_t num);
+	size_t size() const {return local.size();}
+	size_t get_mem_usage() const {return size()*(3*sizeof(unsigned) + 2*sizeof(unsigned short) + 3*sizeof(unsigned char));}
+	void encode(size_t ix, lmcell const &lmc);
+	void decode(size_t ix, lmcell &lmc) const;
+};
+
+
 class lmap_manager_t {
 
 	vector<lmcell> vldata_alloc;
+	lmcell_planes_t packed; // used in place of vldata_alloc when compacted
+	vector<unsigned> col_ix; // offset of each column into vldata_alloc/packed, or EMPTY_COL
 	unsigned lm_xsize, lm_ysize, lm_zsize;
+	bool compacted;
 	lmcell ***vlmap; // y, x, z (size is determined by {MESH_Y_SIZE, MESH_X_SIZE, MESH_Z_SIZE}
 
+	static unsigned const EMPTY_COL = ~0U;
+	unsigned get_col_ix(int x, int y) const {return col_ix[y*lm_xsize + x];}
+
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
 
@@ -57,17 +79,30 @@ public:
 	bool was_updated;
 	cube_t update_bcube;
 
-	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), vlmap(NULL), was_updated(0) {update_bcube.set_to_zeros();}
-	void clear_cells() {vldata_alloc.clear();} // vlmap matrix headers are not cleared
-	bool is_allocated() const {return (vlmap != NULL && !vldata_alloc.empty());}
-	size_t size() const {return vldata_alloc.size();}
+	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), compacted(0), vlmap(NULL), was_updated(0) {update_bcube.set_to_zeros();}
+	void clear_cells() {vldata_alloc.clear(); packed.clear(); compacted = 0;} // vlmap matrix headers are not cleared
+	void free_cells() {clear_cells(); vector<lmcell>().swap(vldata_alloc);} // same as above, but also releases the memory
+	bool is_allocated() const {return (vlmap != NULL && (compacted ? (packed.size() > 0) : !vldata_alloc.empty()));}
+	bool is_compact() const {return compacted;}
+	size_t size() const {return (compacted ? packed.size() : vldata_alloc.size());}
+	size_t get_mem_usage() const {return (compacted ? packed.get_mem_usage() : vldata_alloc.capacity()*sizeof(lmcell));}
+	void compact();
+	void expand();
 	bool read_data_from_file(char const *const fn, int ltype);
 	bool write_data_to_file(char const *const fn, int ltype) const;
 	void clear_lighting_values(int ltype);
+	void get_lighting_values(int ltype, vector<float> &vals) const;
+	void set_lighting_values(int ltype, vector<float> const &vals);
+	void scale_lighting_values(int ltype, float scale);
 	bool is_valid_cell(int x, int y, int z) const;
-	lmcell const *get_column(int x, int y) const {return vlmap[y][x];} // Note: no bounds checking
-	lmcell *get_column(int x, int y) {return vlmap[y][x];} // Note: no bounds checking
+	bool has_column(int x, int y) const {return (get_col_ix(x, y) != EMPTY_COL);} // Note: no bounds checking
+	lmcell const *get_column(int x, int y) const {assert(!compacted); return vlmap[y][x];} // Note: no bounds checking
+	lmcell *get_column(int x, int y) {assert(!compacted); return vlmap[y][x];} // Note: no bounds checking
+	lmcell const *get_column_ro(int x, int y, vector<lmcell> &buf) const; // works for both storage formats; buf is used for decoding
 	lmcell &get_lmcell(int x, int y, int z) {return get_column(x, y)[z];} // Note: no bounds checking
+	lmcell get_cell(int x, int y, int z) const; // works for both storage formats
+	unsigned char get_flow(int x, int y, int z, unsigned dim) const;
+	void set_flow(int x, int y, int z, unsigned char const flow[3]);
 	lmcell *get_lmcell_round_down(point const &p);
 	lmcell *get_lmcell(point const &p);
 	void reset_all(lmcell const &init_lmcell=lmcell());
@@ -286,27 +321,56 @@ public:
 };
 
 
-unsigned const MAX_LSRC = 256; // max of 255 lights per bin
-
-class dls_cell {
+unsigned const MAX_LSRC = 256; // max of 255 lights per cluster (8 bits in the shader grid bag)
 
-	unsigned short lsrc[MAX_LSRC] = {0};
-	unsigned sz;
+// 3D XYZ grid of dynamic light clusters covering the scene bounds, with each cluster storing a contiguous list of light indices;
+// cluster lookup uses the same normalized [0,1] position as the dynamic lighting shader, and points outside the bounds map to the edge clusters
+class dlight_cluster_grid_t {
 
+	struct light_pair_t { // size = 8
+		unsigned cix; // cluster index
+		unsigned short lix; // light index
+		light_pair_t(unsigned cix_, unsigned short lix_) : cix(cix_), lix(lix_) {}
+	};
+	struct thread_data_t {
+		vector<light_pair_t> pairs;
+		vector<unsigned char> hits; // per-row test results
+		vector<float> col_a, col_b; // per-column terms; sphere: x distance squared; line light: clipped cluster center x, size x squared
+		cube_t bcube;
+	};
+	cube_t bounds, lights_bcube;
+	unsigned sz[3] = {0};
+	vector3d cell_sz, inv_cell_sz;
+	vector<unsigned> cluster_start; // offsets into light_ixs, one per cluster + end
+	vector<unsigned short> light_ixs; // light indices for each cluster, in input (largest to smallest radius) order
+	vector<unsigned> cluster_fill; // temporary, reused across frames
+	vector<thread_data_t> thread_data; // temporary, reused across frames
+	unsigned num_clipped;
+
+	int get_cell(float v, unsigned d) const {return max(0, min(int(sz[d])-1, int((v - bounds.d[d][0])*inv_cell_sz[d])));}
+	float get_cell_lo(int i, unsigned d) const {return ((i == 0)            ? -FLT_MAX : (bounds.d[d][0] + i*cell_sz[d]));} // edge clusters extend to infinity
+	float get_cell_hi(int i, unsigned d) const {return ((i == int(sz[d])-1) ?  FLT_MAX : (bounds.d[d][0] + (i+1)*cell_sz[d]));}
+	cube_t get_cell_cube(int x, int y, int z) const {return cube_t(get_cell_lo(x, 0), get_cell_hi(x, 0), get_cell_lo(y, 1), get_cell_hi(y, 1), get_cell_lo(z, 2), get_cell_hi(z, 2));}
+	void bin_light(light_source const &ls, unsigned ix, float sqrt_thresh, bool clip_to_scene, thread_data_t &td) const;
 public:
-	dls_cell() : sz(0) {}
-	void clear() {sz = 0;}
+	dlight_cluster_grid_t() : num_clipped(0) {}
+	void clear();
+	void build(vector<light_source> const &lights, vector<unsigned> const &ixs, cube_t const &bounds_,
+		unsigned nx, unsigned ny, unsigned nz, float sqrt_thresh, bool clip_to_scene);
+	bool empty() const {return light_ixs.empty();}
+	unsigned get_size(unsigned d) const {return sz[d];}
+	unsigned get_num_clusters() const {return sz[0]*sz[1]*sz[2];}
+	unsigned get_num_clipped () const {return num_clipped;}
+	cube_t const &get_lights_bcube() const {return lights_bcube;}
+	unsigned get_cluster_ix(point const &p) const {return (get_cell(p.x, 0) + sz[0]*(get_cell(p.y, 1) + sz[1]*get_cell(p.z, 2)));}
 	
-	void add_light(unsigned ix, unsigned char &enabled_flag) {
-		if (!enabled_flag) {sz = 0; enabled_flag = 1;} // clear if marked as disabled, then enable
-		if (sz+1 < MAX_LSRC) {lsrc[sz++] = ix;}
+	unsigned get_cluster_lights(unsigned cix, unsigned short const *&ixs) const { // returns the number of lights
+		if (empty()) return 0;
+		assert(cix+1 < cluster_start.size());
+		ixs = light_ixs.data() + cluster_start[cix];
+		return (cluster_start[cix+1] - cluster_start[cix]);
 	}
-	void add_light_range(unsigned six, unsigned eix, unsigned char &enabled_flag);
-	bool check_add_light(unsigned ix) const;
-	size_t size() const {return sz;}
-	bool empty()  const {return (sz == 0);}
-	unsigned get(unsigned i) const {return lsrc[i];} // no bounds checking
-	unsigned short const *get_src_ixs() const {return lsrc;}
+	unsigned get_lights_at(point const &p, unsigned short const *&ixs) const {return (empty() ? 0 : get_cluster_lights(get_cluster_ix(p), ixs));}
 };
 
 
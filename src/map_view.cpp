@@ -87,6 +87,271 @@ void colorize(float val, unsigned char *rgb) {
 }
 
 
+// *** tiled map view cache ***
+
+int const MAP_TILE_SZ              = 64;  // in pixels
+unsigned const MAP_TILE_REFRESH    = 30;  // frames before a tile is recomputed, to pick up dynamic objects
+unsigned const MAP_TILE_EVICT      = 300; // frames since last use before a tile is freed
+unsigned const MAP_MAX_REFRESH_DIV = 8;   // refresh at most 1/N of the visible tiles per frame
+
+inline int get_map_tile_ix(int v) {return ((v >= 0) ? v : (v - MAP_TILE_SZ + 1))/MAP_TILE_SZ;} // rounds toward -inf
+
+struct map_tile_key_t {
+	float xscale, yscale; // zoom level
+	int tx, ty; // tile position in map pixel space
+
+	map_tile_key_t(float xs, float ys, int tx_, int ty_) : xscale(xs), yscale(ys), tx(tx_), ty(ty_) {}
+	bool operator<(map_tile_key_t const &k) const {
+		if (xscale != k.xscale) return (xscale < k.xscale);
+		if (yscale != k.yscale) return (yscale < k.yscale);
+		if (tx     != k.tx    ) return (tx     < k.tx    );
+		return (ty < k.ty);
+	}
+};
+
+struct map_tile_t {
+	vector<unsigned char> rgb; // MAP_TILE_SZ x MAP_TILE_SZ RGB
+	unsigned frame_computed, frame_used;
+	map_tile_t() : frame_computed(0), frame_used(0) {}
+};
+
+// per-frame values used to calculate map pixels
+struct map_view_params_t {
+	bool uses_hmap, no_water, nearest_texel, do_lighting;
+	int hg_x0, hg_y0; // map pixel space origin of height_gen, including a one pixel border
+	float xscale, yscale, hscale, zmax2, max_building_dz, xoff, yoff, map_heights[6];
+	colorRGBA ground_color, map_colors[6];
+	point lpos;
+	vector3d light_dir;
+	mesh_xy_grid_cache_t height_gen;
+
+	float get_height(int gx, int gy) const { // gx/gy in map pixel space
+		return get_mesh_height(height_gen, hg_x0*xscale, hg_y0*yscale, xscale, yscale, (gy - hg_y0), (gx - hg_x0), nearest_texel);
+	}
+};
+
+struct map_shadow_query_t { // size = 44
+	point pos;
+	vector3d norm;
+	unsigned pix_ix;
+	colorRGBA shadow_color;
+	map_shadow_query_t(point const &p, vector3d const &n, unsigned ix, colorRGBA const &sc) : pos(p), norm(n), pix_ix(ix), shadow_color(sc) {}
+};
+
+// calculates the colors of one tile in map pixel space; shadow rays are queued and cast together at the end to reuse the last shadowing cobj
+void calc_map_tile(map_view_params_t const &p, int tx, int ty, vector<unsigned char> &rgb_out) {
+
+	rgb_out.resize(3*MAP_TILE_SZ*MAP_TILE_SZ);
+	vector<map_shadow_query_t> shadow_queries;
+	point cpos;
+	vector3d cnorm;
+	int cindex(-1);
+
+	for (int i = 0; i < MAP_TILE_SZ; ++i) {
+		int const gy(ty*MAP_TILE_SZ + i);
+		float const yval(gy*p.yscale - p.yoff);
+
+		for (int j = 0; j < MAP_TILE_SZ; ++j) {
+			unsigned const pix_ix(i*MAP_TILE_SZ + j);
+			unsigned char *rgb(&rgb_out[3*pix_ix]);
+			int const gx(tx*MAP_TILE_SZ + j);
+			float const xval(gx*p.xscale - p.xoff);
+			float mh(0.0);
+			bool mh_set(0), need_shadow(0);
+
+			if (world_mode == WMODE_GROUND) {
+				point p1(xval, yval, czmax);
+				bool const over_mesh(is_over_mesh(p1));
+				colorRGBA building_color;
+				
+				if (over_mesh || p.uses_hmap) { // if using a heightmap, clamp values to scene bounds
+					mh = interpolate_mesh_zval(max(-X_SCENE_SIZE, min(X_SCENE_SIZE-DX_VAL, xval)), max(-Y_SCENE_SIZE, min(Y_SCENE_SIZE-DY_VAL, yval)), 0.0, 0, 1);
+					mh_set = 1;
+				}
+				if (over_mesh && get_buildings_line_hit_color(point(xval, yval, mh+p.max_building_dz), point(xval, yval, mh), building_color)) {
+					unpack_color(rgb, building_color); // no shadows
+					continue;
+				}
+				if (over_mesh && czmin < czmax) { // check cobjs
+					point p2(xval, yval, max(mh, czmin));
+					float t;
+					int cindex0(-1);
+					if (cindex >= 0 && coll_objects.get_cobj(cindex).line_int_exact(p1, p2, t, cnorm)) {cpos = p1 + t*(p2 - p1); p2 = cpos;} // previous cobj int
+					else {cindex = -1;} // else reset
+					if (check_coll_line_exact(p1, p2, cpos, cnorm, cindex0, 0.0, cindex, 1, 0, 0, 0, 0)) {cindex = cindex0;} // cobj intersection
+
+					if (cindex >= 0) {
+						colorRGBA const color(get_cobj_color_at_point(cindex, cpos, cnorm, 0));
+						unpack_color(rgb, color);
+						if (MAP_VIEW_SHADOWS && !(display_mode & 0x20)) {shadow_queries.emplace_back(cpos, cnorm, pix_ix, color*0.5);}
+						continue;
+					}
+					need_shadow = (mh_set && MAP_VIEW_SHADOWS && !(display_mode & 0x20));
+				}
+			} // end ground mode
+			else if (world_mode == WMODE_INF_TERRAIN && (have_cities() || have_buildings())) { // show cities and road networks
+				colorRGBA city_color(BLACK);
+
+				if (get_buildings_line_hit_color(point(xval, yval, zmax+p.max_building_dz), point(xval, yval, zmin), city_color)) {
+					unpack_color(rgb, city_color); // no shadows
+					continue;
+				}
+				if (get_city_color_at_xy(xval, yval, city_color)) {
+					unpack_color(rgb, city_color); // no shadows
+					continue;
+				}
+			}
+			colorRGBA lit_color, shadow_color;
+
+			if (default_ground_tex >= 0 && map_color) {
+				lit_color    = p.ground_color;
+				shadow_color = p.ground_color*0.5;
+			}
+			else {
+				if (!mh_set) {mh = p.get_height(gx, gy);} // calculate mesh height here if not yet set
+				float height(min(1.0f, p.hscale*(mh + p.zmax2))); // can be negative
+
+				if (!map_color) { // grayscale
+					float const val(pow(height, glaciate_exp_inv)); // un-glaciate: slow
+					// http://c0de517e.blogspot.com/2017/11/coder-color-palettes-for-data.html
+					rgb[0] = (unsigned char)(255.0*(-0.121 + 0.893 * val + 0.276 * sin (1.94 - 5.69 * val)));
+					rgb[1] = (unsigned char)(255.0*(0.07 + 0.947 * val));
+					rgb[2] = (unsigned char)(255.0*(0.107 + (1.5 - 1.22 * val) * val));
+					continue; // no shadows
+				}
+				height += relh_adj_tex;
+				float const *const map_heights(p.map_heights);
+				colorRGBA const *const map_colors(p.map_colors);
+				colorRGBA color;
+				if      (height <= map_heights[5]) {color = map_colors[5];} // deep water
+				else if (height <= map_heights[3]) {color = map_colors[3];} // sand
+				else if (height >= map_heights[0]) {color = map_colors[0];} // snow
+				else {
+					color = BLACK;
+					for (unsigned k = 0; k < 4; ++k) { // mixed
+						if (height > map_heights[k+1]) {
+							float const h((height - map_heights[k+1])/(map_heights[k] - map_heights[k+1])), v(cubic_interpolate(h));
+							blend_color(color, map_colors[k], map_colors[k+1], v);
+							break;
+						}
+					}
+				}
+				if (height <= map_heights[4] && height > map_heights[5]) { // shallow water
+					float const h(0.5f*(height - map_heights[5])/(map_heights[4] - map_heights[5])), v(cubic_interpolate(h));
+					blend_color(color, color, map_colors[5], v);
+				}
+				if (p.do_lighting) {
+					vector3d normal(plus_z);
+
+					if (height > map_heights[4]) {
+						float const hx(min(1.0f, p.hscale*(p.get_height(gx-1, gy) + p.zmax2)) + relh_adj_tex);
+						float const hy(CLIP_TO_01(p.hscale*(p.get_height(gx, gy-1) + p.zmax2)));
+						normal = vector3d(DY_VAL*(hx - height), DX_VAL*(hy - height), dxdy).get_norm();
+					}
+					float const ndotl(max(0.0f, dot_product(p.light_dir, normal)));
+					lit_color    = color*(0.2 + 0.8*ndotl);
+					shadow_color = color*0.2; // handled here rather than with the 0.5 scale below
+				}
+				else {
+					lit_color    = color;
+					shadow_color = color*0.5;
+				}
+			}
+			unpack_color(rgb, lit_color);
+			if (need_shadow) {shadow_queries.emplace_back(point(xval, yval, mh), plus_z, pix_ix, shadow_color);}
+		} // for j
+	} // for i
+	int cindex2(-1); // last shadowing cobj, shared across the batch
+
+	for (auto q = shadow_queries.begin(); q != shadow_queries.end(); ++q) {
+		if (is_shadowed(q->pos, q->norm, p.lpos, cindex2)) {unpack_color(&rgb_out[3*q->pix_ix], q->shadow_color);}
+	}
+}
+
+class map_tile_cache_t {
+
+	map<map_tile_key_t, map_tile_t> tiles;
+	vector<float> scene_state; // values that invalidate all tiles when changed
+	unsigned frame;
+
+public:
+	map_tile_cache_t() : frame(0) {}
+	void clear() {tiles.clear();}
+	void next_frame() {++frame;}
+
+	void check_scene_state(vector<float> const &state) {
+		if (state == scene_state) return;
+		clear();
+		scene_state = state;
+	}
+	// computes any missing or out-of-date tiles in the map pixel space range [gx0,gx0+nx)x[gy0,gy0+ny), then copies them into buf
+	void draw(map_view_params_t &p, int gx0, int gy0, int nx, int ny, vector<unsigned char> &buf) {
+		int const tx1(get_map_tile_ix(gx0)), ty1(get_map_tile_ix(gy0)), tx2(get_map_tile_ix(gx0+nx-1)), ty2(get_map_tile_ix(gy0+ny-1));
+		unsigned const num_vis((tx2 - tx1 + 1)*(ty2 - ty1 + 1)), max_refresh(max(1U, num_vis/MAP_MAX_REFRESH_DIV));
+		vector<map_tile_t *> to_calc;
+		vector<pair<int, int>> calc_pos;
+		vector<pair<unsigned, unsigned>> to_refresh; // {frame_computed, to_calc index}
+
+		for (int ty = ty1; ty <= ty2; ++ty) {
+			for (int tx = tx1; tx <= tx2; ++tx) {
+				map_tile_t &tile(tiles[map_tile_key_t(p.xscale, p.yscale, tx, ty)]);
+				tile.frame_used = frame;
+				bool const is_stale(!tile.rgb.empty() && tile.frame_computed + MAP_TILE_REFRESH < frame);
+				if (is_stale) {to_refresh.emplace_back(tile.frame_computed, to_calc.size());}
+				if (tile.rgb.empty() || is_stale) {to_calc.push_back(&tile); calc_pos.emplace_back(tx, ty);}
+			}
+		}
+		if (to_refresh.size() > max_refresh) { // incremental refresh: only update the oldest stale tiles this frame
+			sort(to_refresh.begin(), to_refresh.end());
+			vector<unsigned char> skip(to_calc.size(), 0);
+			for (auto i = to_refresh.begin()+max_refresh; i != to_refresh.end(); ++i) {skip[i->second] = 1;}
+			unsigned num(0);
+
+			for (unsigned i = 0; i < to_calc.size(); ++i) {
+				if (skip[i]) continue;
+				to_calc[num] = to_calc[i];
+				calc_pos[num++] = calc_pos[i];
+			}
+			to_calc.resize(num);
+			calc_pos.resize(num);
+		}
+		if (!to_calc.empty()) {
+			//timer_t timer("Map Tiles");
+			int x1(calc_pos.front().first), y1(calc_pos.front().second), x2(x1), y2(y1);
+
+			for (auto i = calc_pos.begin(); i != calc_pos.end(); ++i) {
+				x1 = min(x1, i->first); x2 = max(x2, i->first); y1 = min(y1, i->second); y2 = max(y2, i->second);
+			}
+			p.hg_x0 = x1*MAP_TILE_SZ - 1; // one pixel border for normals
+			p.hg_y0 = y1*MAP_TILE_SZ - 1;
+			unsigned const hg_nx((x2 - x1 + 1)*MAP_TILE_SZ + 1), hg_ny((y2 - y1 + 1)*MAP_TILE_SZ + 1);
+			if (!p.uses_hmap) {setup_height_gen(p.height_gen, p.hg_x0*p.xscale, p.hg_y0*p.yscale, p.xscale, p.yscale, hg_nx, hg_ny, 1);} // cache_values=1
+
+#pragma omp parallel for schedule(dynamic,1)
+			for (int i = 0; i < (int)to_calc.size(); ++i) {
+				calc_map_tile(p, calc_pos[i].first, calc_pos[i].second, to_calc[i]->rgb);
+				to_calc[i]->frame_computed = frame;
+			}
+		}
+		for (int i = 0; i < ny; ++i) { // copy visible tile rows into the output image
+			int const gy(gy0 + i), ty(get_map_tile_ix(gy)), ti(gy - ty*MAP_TILE_SZ);
+
+			for (int tx = tx1; tx <= tx2; ++tx) {
+				map_tile_t const &tile(tiles[map_tile_key_t(p.xscale, p.yscale, tx, ty)]);
+				int const jstart(max(0, tx*MAP_TILE_SZ - gx0)), jend(min(nx, (tx+1)*MAP_TILE_SZ - gx0));
+				assert(!tile.rgb.empty());
+				memcpy(&buf[3*(i*nx + jstart)], &tile.rgb[3*(ti*MAP_TILE_SZ + (gx0 + jstart - tx*MAP_TILE_SZ))], 3*(jend - jstart));
+			}
+		}
+		for (auto i = tiles.begin(); i != tiles.end();) { // free tiles that haven't been used recently
+			if (i->second.frame_used + MAP_TILE_EVICT < frame) {i = tiles.erase(i);} else {++i;}
+		}
+	}
+};
+
+map_tile_cache_t map_tile_cache;
+
+
 void draw_overhead_map() {
 
 	unsigned tid(0);
@@ -133,10 +398,14 @@ void draw_overhead_map() {
 		}
 	}
 	else {
-		float x0((float)map_x + xoff2*DX_VAL), y0((float)map_y + yoff2*DY_VAL);
-		float const relh_water(get_rel_height_no_clamp(water_plane_z, -zmax_est, zmax_est));
 		point const camera(get_camera_pos());
-		float map_heights[6];
+		float const x0((float)map_x + xoff2*DX_VAL + camera.x), y0((float)map_y + yoff2*DY_VAL + camera.y); // map center in global coordinates
+		// map pixel size; ground mode uses the mesh-relative scale of the scene, which the overlays below also use
+		bool const gmode(world_mode == WMODE_GROUND);
+		float const pxs(gmode ? xscale_val*(X_SCENE_SIZE/DX_VAL) : xscale), pys(gmode ? yscale_val*(Y_SCENE_SIZE/DY_VAL) : yscale);
+		float const relh_water(get_rel_height_no_clamp(water_plane_z, -zmax_est, zmax_est));
+		map_view_params_t p;
+		float *const map_heights(p.map_heights);
 		map_heights[0] = 0.9f*lttex_dirt[3].zval  + 0.1f*lttex_dirt[4].zval;
 		map_heights[1] = 0.5f*(lttex_dirt[2].zval + lttex_dirt[3].zval);
 		map_heights[2] = 0.5f*(lttex_dirt[1].zval + lttex_dirt[2].zval);
@@ -147,177 +416,74 @@ void draw_overhead_map() {
 		for (unsigned i = 0; i < 6; ++i) {
 			if (map_heights[i] > 0.0) {map_heights[i] = pow(map_heights[i], glaciate_exp);} // handle negative case
 		}
-		colorRGBA ground_color(BLACK);
-		if (default_ground_tex >= 0) {ground_color = texture_color(default_ground_tex);}
-
-		colorRGBA const map_colors[6] = {
-			((water_is_lava || DISABLE_WATER == 2) ? DK_GRAY : WHITE),
-			GRAY,
-			((vegetation == 0.0) ? colorRGBA(0.55,0.45,0.35,1.0) : GREEN),
-			LT_BROWN,
-			(no_water ? BROWN    : (water_is_lava ? RED        : colorRGBA(0.3,0.2,0.6))),
-			(no_water ? DK_BROWN : (water_is_lava ? LAVA_COLOR : (is_ice ? LT_BLUE : BLUE)))};
-
-		if (world_mode == WMODE_GROUND) {
-			float const xv(-(camera.x + map_x)/X_SCENE_SIZE), yv(-(camera.y + map_y)/Y_SCENE_SIZE);
-			float const xs(DX_VAL/xscale_val), ys(DY_VAL/yscale_val);
-			x0 += camera.x;
-			y0 += camera.y;
-			bx1 = int(nx2 + xs*(xv - 1.0));
-			by1 = int(ny2 + ys*(yv - 1.0));
-			bx2 = int(nx2 + xs*(xv + 1.0));
-			by2 = int(ny2 + ys*(yv + 1.0));
+		p.ground_color = BLACK;
+		if (default_ground_tex >= 0) {p.ground_color = texture_color(default_ground_tex);}
+		p.map_colors[0] = ((water_is_lava || DISABLE_WATER == 2) ? DK_GRAY : WHITE);
+		p.map_colors[1] = GRAY;
+		p.map_colors[2] = ((vegetation == 0.0) ? colorRGBA(0.55,0.45,0.35,1.0) : GREEN);
+		p.map_colors[3] = LT_BROWN;
+		p.map_colors[4] = (no_water ? BROWN    : (water_is_lava ? RED        : colorRGBA(0.3,0.2,0.6)));
+		p.map_colors[5] = (no_water ? DK_BROWN : (water_is_lava ? LAVA_COLOR : (is_ice ? LT_BLUE : BLUE)));
+
+		if (gmode) { // world boundary in map pixels
+			bx1 = int(nx2 + (-X_SCENE_SIZE - camera.x - map_x)/pxs);
+			by1 = int(ny2 + (-Y_SCENE_SIZE - camera.y - map_y)/pys);
+			bx2 = int(nx2 + ( X_SCENE_SIZE - camera.x - map_x)/pxs);
+			by2 = int(ny2 + ( Y_SCENE_SIZE - camera.y - map_y)/pys);
 		}
+		float const xstart(x0 - nx2*pxs), ystart(y0 - ny2*pys);
+		float const texels_per_pixel(mesh_scale*0.5f*(pxs*DX_VAL_INV + pys*DY_VAL_INV));
+		p.uses_hmap       = (gmode && (read_landscape || read_heightmap || do_read_mesh));
+		p.no_water        = no_water;
+		p.nearest_texel   = (texels_per_pixel >= 1.0);
+		p.do_lighting     = (MAP_VIEW_LIGHTING && !p.uses_hmap && !(display_mode & 0x20));
+		p.hg_x0 = p.hg_y0 = 0; // set later
+		p.xscale          = pxs;
+		p.yscale          = pys;
+		p.hscale          = hscale;
+		p.zmax2           = zmax2;
+		p.max_building_dz = 2.0*get_buildings_max_extent().z; // pad by 2x
+		p.xoff            = xoff2*DX_VAL; // map pixel space is in global coordinates; cobjs, buildings, and cities are in local coordinates
+		p.yoff            = yoff2*DY_VAL;
+		p.lpos            = get_light_pos();
+		p.light_dir       = p.lpos.get_norm(); // assume directional lighting to origin
+		// map pixels are snapped to a global grid so that cached tiles can be reused when panning
+		int const gx0(round_fp(xstart/pxs)), gy0(round_fp(ystart/pys));
+		float const scene_state[] = {p.lpos.x, p.lpos.y, p.lpos.z, water_plane_z, zmax_est, relh_adj_tex, glaciate_exp, vegetation, float(map_color), float(world_mode),
+			float(no_water), float(is_ice), float(water_is_lava), float(DISABLE_WATER), float(display_mode & 0x24), float(cache_counter), float(default_ground_tex),
+			czmin, czmax, float(coll_objects.size()), mesh_scale};
+		map_tile_cache.check_scene_state(vector<float>(scene_state, scene_state+sizeof(scene_state)/sizeof(float)));
+		map_tile_cache.next_frame();
+		map_tile_cache.draw(p, gx0, gy0, nx, ny, buf);
+
+		// draw the camera and world boundary overlays, which aren't cached
 		vector3d const dir(vector3d(cview_dir.x, cview_dir.y, 0.0).get_norm());
-		int const cx(int(nx2 - map_x/xscale)), cy(int(ny2 - map_y/yscale));
+		int const cx(int(nx2 - map_x/pxs)), cy(int(ny2 - map_y/pys));
 		int const xx(cx + int(4*dir.x)), yy(cy + int(4*dir.y));
-		float const xstart(x0 - nx2*xscale), ystart(y0 - ny2*yscale);
-		float const xsv(xscale_val*(X_SCENE_SIZE/DX_VAL)), ysv(yscale_val*(Y_SCENE_SIZE/DY_VAL));
-		float const max_building_dz(2.0*get_buildings_max_extent().z); // pad by 2x
-
-		bool const uses_hmap(world_mode == WMODE_GROUND && (read_landscape || read_heightmap || do_read_mesh));
-		mesh_xy_grid_cache_t height_gen;
-		if (!uses_hmap && !show_map_view_mandelbrot) {setup_height_gen(height_gen, xstart, ystart, xscale, yscale, nx, ny, 1);} // cache_values=1
-		point const lpos(get_light_pos());
-		vector3d const light_dir(lpos.get_norm()); // assume directional lighting to origin
-		float const texels_per_pixel(mesh_scale*0.5f*(xscale*DX_VAL_INV + yscale*DY_VAL_INV));
-		bool const nearest_texel(texels_per_pixel >= 1.0);
-
-#pragma omp parallel for schedule(static,1)
-		for (int i = 0; i < ny; ++i) {
-			int const inx(i*nx);
-			int64_t const iyy(((int64_t)i - (int64_t)yy)*((int64_t)i - (int64_t)yy)), icy(((int64_t)i - (int64_t)cy)*((int64_t)i - (int64_t)cy));
-			float last_height(0.0);
-			point cpos;
-			vector3d cnorm;
-			int cindex(-1), cindex2(-1);
-
-			for (int j = 0; j < nx; ++j) {
-				int const offset(3*(inx + j));
-				unsigned char *rgb(&buf[offset]);
-				int64_t const jxx((int64_t)j - (int64_t)xx), jcx((int64_t)j - (int64_t)cx);
-
-				if (iyy + jxx*jxx <= 4) {
-					rgb[0] = rgb[1] = rgb[2] = 0; // camera direction
-				}
-				else if (icy + jcx*jcx <= 9) {
-					rgb[0] = 255;
-					rgb[1] = rgb[2] = 0; // camera position
-				}
-				else if (world_mode == WMODE_GROUND &&
-					(((i == by1 || i == by2) && j >= bx1 && j < bx2) || ((j == bx1 || j == bx2) && i >= by1 && i < by2)))
-				{
-					rgb[0] = rgb[1] = rgb[2] = 0; // world boundary
-				}
-				else {
-					float mh(0.0);
-					bool mh_set(0), shadowed(0);
-					float const xval((j - nx2)*xsv + camera.x + map_x), yval((i - ny2)*ysv + camera.y + map_y);
-
-					if (world_mode == WMODE_GROUND) {
-						point p1(xval, yval, czmax);
-						bool const over_mesh(is_over_mesh(p1));
-						colorRGBA building_color;
-					
-						if (over_mesh || uses_hmap) { // if using a heightmap, clamp values to scene bounds
-							mh = interpolate_mesh_zval(max(-X_SCENE_SIZE, min(X_SCENE_SIZE-DX_VAL, xval)), max(-Y_SCENE_SIZE, min(Y_SCENE_SIZE-DY_VAL, yval)), 0.0, 0, 1);
-							mh_set = 1;
-						}
-						if (over_mesh && get_buildings_line_hit_color(point(xval, yval, mh+max_building_dz), point(xval, yval, mh), building_color)) {
-							//unpack_color(rgb, building_color*(is_shadowed(cpos, plus_z, lpos, cindex2) ? 0.5 : 1.0));
-							unpack_color(rgb, building_color); // no shadows
-							continue;
-						}
-						if (over_mesh && czmin < czmax) { // check cobjs
-							// Note: as an optimization, can skip the cobj test if no cobjs at this pos, but it makes little difference and will miss dynamic objects
-							//int const xpos(get_xpos(xval)), ypos(get_ypos(yval));
-							//if (point_outside_mesh(xpos, ypos) || v_collision_matrix[ypos][xpos].zmin == v_collision_matrix[ypos][xpos].zmax) {}
-							point p2(xval, yval, max(mh, czmin));
-							float t;
-							int cindex0(-1);
-							if (cindex >= 0 && coll_objects.get_cobj(cindex).line_int_exact(p1, p2, t, cnorm)) {cpos = p1 + t*(p2 - p1); p2 = cpos;} // previous cobj int
-							else {cindex = -1;} // else reset
-							if (check_coll_line_exact(p1, p2, cpos, cnorm, cindex0, 0.0, cindex, 1, 0, 0, 0, 0)) {cindex = cindex0;} // cobj intersection
-
-							if (cindex >= 0) {
-								colorRGBA const color(get_cobj_color_at_point(cindex, cpos, cnorm, 0));
-								unpack_color(rgb, color*(is_shadowed(cpos, cnorm, lpos, cindex2) ? 0.5 : 1.0));
-								continue;
-							}
-							if (mh_set) {shadowed = is_shadowed(point(xval, yval, mh), plus_z, lpos, cindex2);}
-						}
-					} // end ground mode
-					else if (world_mode == WMODE_INF_TERRAIN && (have_cities() || have_buildings())) { // show cities and road networks
-						colorRGBA city_color(BLACK);
 
-						if (get_buildings_line_hit_color(point(xval, yval, zmax+max_building_dz), point(xval, yval, zmin), city_color)) {
-							unpack_color(rgb, city_color); // no shadows
-							continue;
-						}
-						if (get_city_color_at_xy(xval, yval, city_color)) {
-							unpack_color(rgb, city_color); // no shadows
-							continue;
-						}
-					}
-					if (default_ground_tex >= 0 && map_color) {
-						unpack_color(rgb, ground_color*(shadowed ? 0.5 : 1.0));
-						continue;
-					}
-					if (!mh_set) {mh = get_mesh_height(height_gen, xstart, ystart, xscale, yscale, i, j, nearest_texel);} // calculate mesh height here if not yet set
-					float height(min(1.0f, hscale*(mh + zmax2))); // can be negative
-
-					if (!map_color) { // grayscale
-						float const val(pow(height, glaciate_exp_inv)); // un-glaciate: slow
-						//rgb[0] = rgb[1] = rgb[2] = (unsigned char)(255.0*val);
-						// http://c0de517e.blogspot.com/2017/11/coder-color-palettes-for-data.html
-						rgb[0] = (unsigned char)(255.0*(-0.121 + 0.893 * val + 0.276 * sin (1.94 - 5.69 * val)));
-						rgb[1] = (unsigned char)(255.0*(0.07 + 0.947 * val));
-						rgb[2] = (unsigned char)(255.0*(0.107 + (1.5 - 1.22 * val) * val));
-					}
-					else {
-						height += relh_adj_tex;
-						colorRGBA color;
-						if      (height <= map_heights[5]) {color = map_colors[5];} // deep water
-						else if (height <= map_heights[3]) {color = map_colors[3];} // sand
-						else if (height >= map_heights[0]) {color = map_colors[0];} // snow
-						else {
-							color = BLACK;
-							for (unsigned k = 0; k < 4; ++k) { // mixed
-								if (height > map_heights[k+1]) {
-									float const h((height - map_heights[k+1])/(map_heights[k] - map_heights[k+1])), v(cubic_interpolate(h));
-									blend_color(color, map_colors[k], map_colors[k+1], v);
-									break;
-								}
-							}
-						}
-						if (height <= map_heights[4] && height > map_heights[5]) { // shallow water
-							float const h(0.5f*(height - map_heights[5])/(map_heights[4] - map_heights[5])), v(cubic_interpolate(h));
-							blend_color(color, color, map_colors[5], v);
-						}
-						if (MAP_VIEW_LIGHTING && !uses_hmap && !(display_mode & 0x20)) {
-							vector3d normal(plus_z);
-
-							if (height > map_heights[4]) {
-								float const hx((j == 0) ? height : last_height);
-								float const hy(CLIP_TO_01(hscale*(get_mesh_height(height_gen, xstart, ystart, xscale, yscale, max(i-1, 0), j, nearest_texel) + zmax2)));
-								normal = vector3d(DY_VAL*(hx - height), DX_VAL*(hy - height), dxdy).get_norm();
-							}
-							last_height = height;
-							color *= (0.2 + (shadowed ? 0.0 : 0.8)*max(0.0f, dot_product(light_dir, normal)));
-							shadowed = 0; // handled correctly above
-						}
-						unpack_color(rgb, color*(shadowed ? 0.5 : 1.0));
+		for (int i = max(0, cy-6); i <= min(ny-1, cy+6); ++i) { // direction marker extends up to 6 pixels from the camera
+			for (int j = max(0, cx-6); j <= min(nx-1, cx+6); ++j) {
+				int const iyy((i - yy)*(i - yy)), icy((i - cy)*(i - cy)), jxx(j - xx), jcx(j - cx);
+				unsigned char *rgb(&buf[3*(i*nx + j)]);
+				if (iyy + jxx*jxx <= 4) {rgb[0] = rgb[1] = rgb[2] = 0;} // camera direction
+				else if (icy + jcx*jcx <= 9) {rgb[0] = 255; rgb[1] = rgb[2] = 0;} // camera position
+			}
+		}
+		if (gmode) {
+			for (int i = 0; i < ny; ++i) {
+				for (int j = 0; j < nx; ++j) {
+					if (((i == by1 || i == by2) && j >= bx1 && j < bx2) || ((j == bx1 || j == bx2) && i >= by1 && i < by2)) {
+						unsigned char *rgb(&buf[3*(i*nx + j)]);
+						rgb[0] = rgb[1] = rgb[2] = 0; // world boundary
 					}
 				}
-			} // for j
-		} // for i
+			}
+		}
 		if (begin_motion && obj_groups[coll_id[SMILEY]].enabled) { // game_mode?
-			float const camx((world_mode == WMODE_GROUND) ? camera.x : 0.0), camy((world_mode == WMODE_GROUND) ? camera.y : 0.0);
-
 			for (int s = 0; s < num_smileys; ++s) { // add in smiley markers
 				point const spos(obj_groups[coll_id[SMILEY]].get_obj(s).pos);
-				int const xpos(int(nx2 + ((-camx - map_x + spos.x)/X_SCENE_SIZE)*DX_VAL/xscale_val));
-				int const ypos(int(ny2 + ((-camy - map_y + spos.y)/Y_SCENE_SIZE)*DY_VAL/yscale_val));
+				int const xpos(int(nx2 + (spos.x - camera.x - map_x)/pxs));
+				int const ypos(int(ny2 + (spos.y - camera.y - map_y)/pys));
 				colorRGBA const color(get_smiley_team_color(s));
 
 				for (int i = max(0, ypos-1); i < min(ny, ypos+1); ++i) {
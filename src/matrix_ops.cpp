@@ -47,6 +47,7 @@ unsigned char **water_enabled = NULL;
 unsigned char **flower_weight = NULL;
 
 extern bool last_int, mesh_invalidated;
+extern unsigned static_smap_gen;
 extern int world_mode, MAX_RUN_DIST, xoff, yoff, I_TIMESCALE2, DISABLE_WATER;
 extern float zmax, zmin, water_plane_z, def_water_level, temperature, max_obj_radius;
 
@@ -233,6 +234,7 @@ void update_mesh_height(int xpos, int ypos, int rad, float scale, float offset,
 	if (mode == 0) {update_smoke_indir_tex_range(x1, x2+1, y1, y2+1);} // update lmap lighting for crater
 	// update waypoints?
 	mesh_invalidated = 1;
+	++static_smap_gen; // mesh and tree/scenery zvals have changed
 	//PRINT_TIME("Mesh Height Update");
 }
 
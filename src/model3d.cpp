@@ -18,17 +18,29 @@ bool const ENABLE_BUMP_MAPS  = 1;
 bool const ENABLE_SPEC_MAPS  = 1;
 bool const ENABLE_INTER_REFLECTIONS = 1;
 unsigned const MAGIC_NUMBER  = 42987143; // arbitrary file signature
+unsigned const MAGIC_NUMBER_LODS = 42987144; // file signature for files that include LOD chains
 unsigned const BLOCK_SIZE    = 32768; // in vertex indices
+unsigned const MIN_LOD_CHAIN_IXS = 3*256; // don't generate LODs for small meshes
+float const LOD_BASE_ERROR   = 0.005; // max simplification error of the first LOD level, relative to the mesh size; doubles for each level
 
 bool model_calc_tan_vect(1); // slower and more memory but sometimes better quality/smoother transitions
+bool model3d_file_has_lods(1); // set when reading a model3d file
+float model_lod_err_per_dist(0.0); // allowed LOD error per unit distance from the camera for the current render pass; 0 = full detail
+vert_opt_stats_t model_vert_opt_stats; // accumulated across the vertex blocks of the model being finalized
+
+struct model_inst_draw_t { // hardware instancing state set with model3d::set_instancing()
+	int loc;
+	unsigned vbo, num;
+	model_inst_draw_t() : loc(-1), vbo(0), num(0) {}
+} model_inst_draw;
 
 extern bool group_back_face_cull, enable_model3d_tex_comp, disable_shader_effects, texture_alpha_in_red_comp, use_model2d_tex_mipmaps, enable_model3d_bump_maps;
 extern bool two_sided_lighting, have_indir_smoke_tex, use_core_context, model3d_wn_normal, invert_model_nmap_bscale, use_z_prepass, all_model3d_ref_update;
 extern bool use_interior_cube_map_refl, enable_model3d_custom_mipmaps, enable_tt_model_indir, no_subdiv_model, auto_calc_tt_model_zvals, use_model_lod_blocks;
 extern bool flatten_tt_mesh_under_models, no_store_model_textures_in_memory, disable_model_textures, allow_model3d_quads, merge_model_objects;
-extern unsigned shadow_map_sz, reflection_tid;
-extern int display_mode;
-extern float model3d_alpha_thresh, model3d_texture_anisotropy, model_triplanar_tc_scale, model_mat_lod_thresh, cobj_z_bias, model_hemi_lighting_scale, light_int_scale[];
+extern unsigned shadow_map_sz, reflection_tid, model_lod_levels;
+extern int display_mode, window_height;
+extern float perspective_fovy, model_lod_pixel_error, model3d_alpha_thresh, model3d_texture_anisotropy, model_triplanar_tc_scale, model_mat_lod_thresh, cobj_z_bias, model_hemi_lighting_scale, light_int_scale[];
 extern pos_dir_up orig_camera_pdu;
 extern bool vert_opt_flags[3];
 extern vector<texture_t> textures;
@@ -246,7 +258,15 @@ template<typename T> void indexed_vntc_vect_t<T>::optimize(unsigned npts) {
 	optimized = 1;
 	vntc_vect_t<T>::optimize(npts);
 
-	if (vert_opt_flags[0]) { // only if not subdivided?
+	if (!vert_opt_flags[0]) return; // only if not subdivided?
+
+	if (npts == 3 && vert_opt_flags[1]) { // full opt of triangles: vertex cache, overdraw, and vertex fetch
+		vert_opt_stats_t stats;
+		optimize_indexed_tris_and_verts(*this, indices, &stats);
+#pragma omp critical(model_vert_opt_stats)
+		model_vert_opt_stats.add(stats);
+	}
+	else {
 		vert_optimizer optimizer(indices, size(), npts);
 		optimizer.run(vert_opt_flags[1], vert_opt_flags[2]);
 	}
@@ -326,6 +346,7 @@ template<typename T> void indexed_vntc_vect_t<T>::finalize(unsigned npts) { // N
 	finalized = 1;
 	assert((num_verts() % npts) == 0); // triangles or quads
 	assert(blocks.empty() && lod_blocks.empty());
+	if (npts == 3 && model_lod_levels > 0) {gen_lod_chain(model_lod_levels);}
 
 	if (use_model_lod_blocks && indices.size() > 1024) {
 		gen_lod_blocks(npts);
@@ -499,6 +520,46 @@ template<typename T> void indexed_vntc_vect_t<T>::simplify_indices(float reduce_
 	vector<unsigned> simplified_indices;
 	simplify_meshoptimizer(simplified_indices, reduce_target);
 	indices.swap(simplified_indices);
+	clear_lod_chain(); // no longer valid
+}
+
+// generates up to max_levels simplified index buffers, each with about half the triangles of the previous level;
+// each level is simplified from the full detail mesh so that its error bound doesn't accumulate
+template<typename T> void indexed_vntc_vect_t<T>::gen_lod_chain(unsigned max_levels) { // triangles only
+
+	clear_lod_chain();
+	unsigned const num_ixs(indices.size());
+	if (max_levels == 0 || num_ixs < MIN_LOD_CHAIN_IXS) return;
+	assert((num_ixs % 3) == 0);
+	this->ensure_bounding_volumes();
+	float const mesh_size(max(bcube.dx(), max(bcube.dy(), bcube.dz()))); // meshoptimizer errors are relative to the max extent
+	vector<unsigned> simplified(num_ixs), optimized(num_ixs);
+	unsigned prev_num(num_ixs);
+
+	for (unsigned level = 0; level < max_levels; ++level) {
+		float const rel_error(LOD_BASE_ERROR*(1 << level));
+		size_t const target_num_ixs(max<size_t>(3, 3*((num_ixs >> (level+1))/3)));
+		size_t const num_out(meshopt_simplify(simplified.data(), indices.data(), num_ixs, &this->front().v.x, size(), sizeof(T), target_num_ixs, rel_error));
+		if (num_out < 3 || 10*num_out > 9*prev_num) break; // no significant reduction within the error bound; done
+		meshopt_optimizeVertexCache(optimized.data(), simplified.data(), num_out, size());
+		lod_levels.emplace_back((unsigned)lod_indices.size(), (unsigned)num_out, rel_error*mesh_size);
+		lod_indices.insert(lod_indices.end(), optimized.begin(), optimized.begin()+num_out);
+		prev_num = (unsigned)num_out;
+	}
+}
+
+// returns the coarsest LOD level with an error that's small enough for the current camera distance, or null for full detail
+template<typename T> typename indexed_vntc_vect_t<T>::lod_level_t const *indexed_vntc_vect_t<T>::select_lod_level() const {
+
+	if (lod_levels.empty() || model_lod_err_per_dist <= 0.0) return nullptr;
+	float const dist(p2p_dist(camera_pdu.pos, bsphere.pos) - bsphere.radius); // distance to the closest point
+	if (dist <= 0.0) return nullptr; // camera inside the bounding sphere
+	float const max_error(dist*model_lod_err_per_dist);
+
+	for (auto l = lod_levels.rbegin(); l != lod_levels.rend(); ++l) {
+		if (l->error <= max_error) return &(*l);
+	}
+	return nullptr;
 }
 
 template<typename T> void indexed_vntc_vect_t<T>::clear() {
@@ -507,6 +568,7 @@ template<typename T> void indexed_vntc_vect_t<T>::clear() {
 	indices.clear();
 	blocks.clear();
 	lod_blocks.clear();
+	clear_lod_chain();
 	need_normalize = 0;
 }
 
@@ -562,8 +624,9 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 	if (empty()) return;
 	assert(npts == 3 || npts == 4);
 	//if (is_shadow_pass && this->vbo == 0 && world_mode == WMODE_GROUND) return; // don't create the vbo on the shadow pass (voxel terrain problems - works now?)
+	bool const instanced(model_inst_draw.num > 0); // bcube and LOD are in model space, so no culling or LOD for instances
 
-	if (no_vfc) {
+	if (no_vfc || instanced) {
 		// do nothing
 	}
 	else if (is_shadow_pass) { // Note: makes shadow map caching more difficult
@@ -579,8 +642,9 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 	assert(!indices.empty()); // now always using indexed drawing
 	int prim_type(GL_TRIANGLES);
 	unsigned ixn(1), ixd(1), end_ix(indices.size());
+	lod_level_t const *const lod((is_shadow_pass || instanced) ? nullptr : select_lod_level());
 
-	if (!is_shadow_pass && !lod_blocks.empty()) { // block LOD
+	if (!is_shadow_pass && !instanced && !lod_blocks.empty() && lod == nullptr) { // block LOD
 		float const dmin(2.0*bsphere.radius), dist(p2p_dist(camera_pdu.pos, bsphere.pos));
 
 		if (dist > dmin) { // no LOD if within the bounding sphere
@@ -602,14 +666,29 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 		}
 		ixn = 6; ixd = 4; // convert quads to 2 triangles
 	}
+	else if (!lod_indices.empty() && !this->ivbo) { // upload the LOD chain after the full detail indices
+		vector<unsigned> all_ixs(indices);
+		vector_add_to(lod_indices, all_ixs);
+		this->create_and_upload(*this, all_ixs, is_shadow_pass, 0, 1); // dynamic_level=0, setup_pointers=1
+	}
 	else {
 		if (npts == 4) {prim_type = GL_QUADS;}
 		this->create_and_upload(*this, indices, is_shadow_pass, 0, 1); // dynamic_level=0, setup_pointers=1
 	}
 	this->pre_render(is_shadow_pass);
 	check_mvm_update();
-	
-	if (is_shadow_pass || blocks.empty() || no_vfc || camera_pdu.sphere_completely_visible_test(bsphere.pos, bsphere.radius)) { // draw the entire range
+
+	if (instanced) { // instance attributes are VAO state, so enable them after binding our VAO and disable them after the draw
+		bind_vbo(model_inst_draw.vbo);
+		shader_float_matrix_uploader<4,4>::enable(model_inst_draw.loc, 1); // transforms start at offset 0 in the VBO
+		glDrawElementsInstanced(prim_type, (unsigned)(ixn*end_ix/ixd), GL_UNSIGNED_INT, 0, model_inst_draw.num);
+		shader_float_matrix_uploader<4,4>::disable(model_inst_draw.loc);
+	}
+	else if (lod != nullptr) { // draw the selected LOD level
+		assert(npts == 3 && lod->start_ix + lod->num <= lod_indices.size());
+		glDrawRangeElements(prim_type, 0, (unsigned)size(), lod->num, GL_UNSIGNED_INT, (void *)((indices.size() + lod->start_ix)*sizeof(unsigned)));
+	}
+	else if (is_shadow_pass || blocks.empty() || no_vfc || camera_pdu.sphere_completely_visible_test(bsphere.pos, bsphere.radius)) { // draw the entire range
 		glDrawRangeElements(prim_type, 0, (unsigned)size(), (unsigned)(ixn*end_ix/ixd), GL_UNSIGNED_INT, 0);
 	}
 	else { // draw each block independently
@@ -766,11 +845,15 @@ template<typename T> void indexed_vntc_vect_t<T>::invert_tcy() {
 template<typename T> void indexed_vntc_vect_t<T>::write(ostream &out) const {
 	vntc_vect_t<T>::write(out);
 	write_vector(out, indices);
+	write_vector(out, lod_indices);
+	write_vector(out, lod_levels);
 }
 
 template<typename T> void indexed_vntc_vect_t<T>::read(istream &in) {
 	vntc_vect_t<T>::read(in);
 	read_vector(in, indices);
+	clear_lod_chain();
+	if (model3d_file_has_lods) {read_vector(in, lod_indices); read_vector(in, lod_levels);}
 }
 
 
@@ -901,6 +984,12 @@ template<typename T> void vntc_vect_block_t<T>::simplify_indices(float reduce_ta
 	for (auto i = begin(); i != end(); ++i) {i->simplify_indices(reduce_target);}
 }
 
+template<typename T> void vntc_vect_block_t<T>::gen_lod_chains(unsigned max_levels, bool only_if_missing) {
+	for (auto i = begin(); i != end(); ++i) {
+		if (!only_if_missing || !i->has_lod_chain()) {i->gen_lod_chain(max_levels);}
+	}
+}
+
 template<typename T> void vntc_vect_block_t<T>::merge_into_single_vector() {
 	if (this->size() <= 1) return; // nothing to merge
 	unsigned tot_verts(0), tot_ixs(0);
@@ -911,6 +1000,7 @@ template<typename T> void vntc_vect_block_t<T>::merge_into_single_vector() {
 		tot_ixs   += i->indices.size();
 	}
 	auto &dest(this->front());
+	dest.clear_lod_chain(); // LOD indices aren't merged; they can be regenerated for the merged vector
 	dest.reserve(tot_verts);
 	dest.indices.reserve(tot_ixs);
 
@@ -1557,6 +1647,8 @@ void model3d::finalize() {
 #pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < (int)materials.size(); ++i) {materials[i].finalize();}
 	unbound_geom.finalize();
+	if (vert_opt_flags[2] && model_vert_opt_stats.num_tris > 0) {model_vert_opt_stats.print("Model3d vertex optimization");}
+	model_vert_opt_stats = vert_opt_stats_t(); // reset for the next model
 }
 
 
@@ -1647,6 +1739,12 @@ void model3d::simplify_indices(float reduce_target) {
 	unbound_geom.simplify_indices(reduce_target);
 }
 
+void model3d::gen_lod_chains(unsigned max_levels, bool only_if_missing) {
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)materials.size(); ++i) {materials[i].gen_lod_chains(max_levels, only_if_missing);}
+	unbound_geom.gen_lod_chains(max_levels, only_if_missing);
+}
+
 
 void set_def_spec_map() {
 	if (enable_spec_map()) {select_multitex(WHITE_TEX, 8);} // all white/specular (no specular map texture)
@@ -1658,6 +1756,13 @@ void model3d::render_materials(shader_t &shader, bool is_shadow_pass, int reflec
 {
 	bool const is_normal_pass(!is_shadow_pass && !is_z_prepass), is_bmap_pass((bmap_pass_mask & 2) != 0);
 	if (is_normal_pass) {smap_data[rot].set_for_all_lights(shader, mvm);} // choose correct shadow map based on rotation
+	// LOD level selection: allowed geometric error per unit distance so that it projects to at most model_lod_pixel_error pixels;
+	// the distance is computed per vertex block in model space from camera_pdu, so it's correct for each instance
+	float const prev_lod_err_per_dist(model_lod_err_per_dist);
+	
+	if (model_lod_levels > 0 && !is_shadow_pass && window_height > 0) {
+		model_lod_err_per_dist = model_lod_pixel_error*2.0*tan(0.5*TO_RADIANS*perspective_fovy)/(max(model_lod_mult, 0.01f)*window_height);
+	}
 
 	if (group_back_face_cull && reflection_pass != 2 && !skip_cull_face) { // okay enable culling if is_shadow_pass on some scenes
 		if (reflection_pass == 1) {glCullFace(GL_FRONT);} // the reflection pass uses a mirror, which changes the winding direction, so we cull the front faces instead
@@ -1716,6 +1821,14 @@ void model3d::render_materials(shader_t &shader, bool is_shadow_pass, int reflec
 		if (reflection_pass == 1) {glCullFace(GL_BACK);} // restore the default
 		glDisable(GL_CULL_FACE);
 	}
+	model_lod_err_per_dist = prev_lod_err_per_dist;
+}
+
+/*static*/ void model3d::set_instancing(int loc, unsigned vbo, unsigned num) {
+	assert(num == 0 || (loc >= 0 && vbo > 0));
+	model_inst_draw.loc = loc;
+	model_inst_draw.vbo = vbo;
+	model_inst_draw.num = num;
 }
 
 void model3d::render_material(shader_t &shader, unsigned mat_id, bool is_shadow_pass, bool is_z_prepass,
@@ -2154,7 +2267,7 @@ bool model3d::write_to_disk(string const &fn) const { // Note: transforms not wr
 		return 0;
 	}
 	cout << "Writing model3d file " << fn << endl;
-	write_uint(out, MAGIC_NUMBER);
+	write_uint(out, MAGIC_NUMBER_LODS);
 	out.write((char const *)&bcube, sizeof(cube_t));
 	if (!unbound_geom.write(out)) return 0;
 	write_uint(out, (unsigned)materials.size());
@@ -2180,12 +2293,13 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	clear(); // ???
 	unsigned const magic_number_comp(read_uint(in));
 
-	if (magic_number_comp != MAGIC_NUMBER) {
+	if (magic_number_comp != MAGIC_NUMBER && magic_number_comp != MAGIC_NUMBER_LODS) {
 		cerr << "Error reading model3d file " << fn << ": Invalid file format (magic number check failed)." << endl;
 		return 0;
 	}
 	cout << "Reading model3d file " << fn << endl;
 	from_model3d_file = 1;
+	model3d_file_has_lods = (magic_number_comp == MAGIC_NUMBER_LODS);
 	in.read((char *)&bcube, sizeof(cube_t));
 	if (!unbound_geom.read(in)) return 0;
 	materials.resize(read_uint(in));
@@ -2198,6 +2312,7 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 		mat_map[m->name] = (m - materials.begin());
 	}
 	//simplify_indices(0.1); // TESTING
+	if (model_lod_levels > 0 && in.good()) {gen_lod_chains(model_lod_levels, 1);} // older files, or files with merged objects, may not have LODs
 	return in.good();
 }
 
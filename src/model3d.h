@@ -277,6 +277,15 @@ private:
 	vector<lod_block_t> lod_blocks;
 	unsigned get_block_ix(float area) const;
 
+	struct lod_level_t { // simplified triangles, stored after the full detail indices in the index buffer
+		unsigned start_ix, num;
+		float error; // max geometric error in model space
+		lod_level_t(unsigned s=0, unsigned n=0, float e=0.0) : start_ix(s), num(n), error(e) {}
+	};
+	vector<unsigned> lod_indices; // all LOD levels, concatenated
+	vector<lod_level_t> lod_levels; // from finest to coarsest
+	lod_level_t const *select_lod_level() const;
+
 public:
 	using vntc_vect_t<T>::size;
 	using vntc_vect_t<T>::empty;
@@ -303,6 +312,9 @@ public:
 	void simplify(vector<unsigned> &out, float target) const;
 	void simplify_meshoptimizer(vector<unsigned> &out, float target) const;
 	void simplify_indices(float reduce_target);
+	void gen_lod_chain(unsigned max_levels);
+	void clear_lod_chain() {lod_indices.clear(); lod_levels.clear();}
+	bool has_lod_chain() const {return !lod_levels.empty();}
 	void clear();
 	unsigned num_verts() const {return unsigned(indices.empty() ? size() : indices.size());}
 	T       &get_vert(unsigned i)       {return (*this)[indices.empty() ? i : indices[i]];}
@@ -311,7 +323,7 @@ public:
 	float get_prim_area(unsigned i, unsigned npts) const;
 	float calc_area(unsigned npts);
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
-	unsigned get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? indices.size()*sizeof(unsigned) : 0));}
+	unsigned get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? (indices.size() + lod_indices.size())*sizeof(unsigned) : 0));}
 	void invert_tcy();
 	void write(ostream &out) const;
 	void read(istream &in);
@@ -338,6 +350,7 @@ template<typename T> struct vntc_vect_block_t : public deque<indexed_vntc_vect_t
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
 	void invert_tcy();
 	void simplify_indices(float reduce_target);
+	void gen_lod_chains(unsigned max_levels, bool only_if_missing);
 	void merge_into_single_vector();
 	bool write(ostream &out) const;
 	bool read(istream &in);
@@ -365,6 +378,7 @@ template<typename T> struct geometry_t {
 	void get_stats(model3d_stats_t &stats) const;
 	void calc_area(float &area, unsigned &ntris);
 	void simplify_indices(float reduce_target);
+	void gen_lod_chains(unsigned max_levels, bool only_if_missing) {triangles.gen_lod_chains(max_levels, only_if_missing);} // triangles only, not quads
 	bool write(ostream &out) const {return (triangles.write(out) && quads.write(out));}
 	bool read(istream &in)         {return (triangles.read (in ) && quads.read (in ));}
 };
@@ -437,6 +451,7 @@ struct material_t : public material_params_t {
 	bool is_partial_transparent() const {return (alpha < 1.0 || get_needs_alpha_test());}
 	void compute_area_per_tri();
 	void simplify_indices(float reduce_target);
+	void gen_lod_chains(unsigned max_levels, bool only_if_missing) {geom.gen_lod_chains(max_levels, only_if_missing); geom_tan.gen_lod_chains(max_levels, only_if_missing);}
 	void ensure_textures_loaded(texture_manager &tmgr);
 	void init_textures(texture_manager &tmgr);
 	void check_for_tc_invert_y(texture_manager &tmgr);
@@ -543,7 +558,11 @@ public:
 	void bind_all_used_tids();
 	void calc_tangent_vectors();
 	void simplify_indices(float reduce_target);
+	void gen_lod_chains(unsigned max_levels, bool only_if_missing);
 	static void bind_default_flat_normal_map() {select_multitex(FLAT_NMAP_TEX, 5);}
+	// while num > 0, geometry is drawn as num instances using the per-instance model transforms in vbo, bound to the shader's mat4 attribute at loc
+	static void set_instancing(int loc, unsigned vbo, unsigned num);
+	static void clear_instancing() {set_instancing(-1, 0, 0);}
 	void set_sky_lighting_file(string const &fn, float weight, unsigned sz[3]);
 	void set_occlusion_cube(cube_t const &cube) {occlusion_cube = cube;}
 	void set_target_translate_scale(point const &target_pos, float target_radius, geom_xform_t &xf) const;
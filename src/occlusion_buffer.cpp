@@ -0,0 +1,294 @@
+// 3D World - Software Rasterized Hierarchical Occlusion Culling
+// 10/19/2026
+
+#include "3DWorld.h"
+#include "mesh.h"
+#include "collision_detect.h"
+#include <cfloat> // for FLT_MAX
+
+
+unsigned const OCC_BUF_XSIZE    = 256; // level 0 resolution; must be a multiple of (1 << (OCC_BUF_LEVELS-1))
+unsigned const OCC_BUF_YSIZE    = 128;
+unsigned const OCC_BUF_LEVELS   = 6;   // 256x128 => 8x4
+unsigned const OCC_MAX_OCCLUDERS= 400; // largest N occluders in screen space are rasterized
+unsigned const OCC_MESH_BLOCK   = 8;   // mesh cells per terrain occluder block in each dim
+float    const OCC_MIN_SCREEN_AREA = 0.001; // as a fraction of the screen
+
+extern int display_mode, world_mode;
+extern coll_obj_group coll_objects;
+
+
+class occlusion_buffer_t {
+
+	struct occluder_t {
+		cube_t c;
+		float area; // fraction of screen covered by the projected bounds
+		occluder_t() : area(0.0) {}
+		occluder_t(cube_t const &c_, float area_) : c(c_), area(area_) {}
+		bool operator<(occluder_t const &o) const {return (area > o.area);} // sort largest first
+	};
+	struct screen_pt_t {
+		float x, y, z; // x and y are in pixels, z is linear view space depth
+	};
+
+	pos_dir_up pdu;
+	float xscale, yscale;
+	bool valid;
+	vector<float> depth[OCC_BUF_LEVELS]; // level 0 is the full resolution buffer; higher levels store the max (farthest) depth of their 2x2 children
+	vector<occluder_t> occluders;
+	unsigned num_rasterized;
+
+	unsigned get_xsize(unsigned level) const {return (OCC_BUF_XSIZE >> level);}
+	unsigned get_ysize(unsigned level) const {return (OCC_BUF_YSIZE >> level);}
+
+	bool project_pt(point const &p, screen_pt_t &sp) const { // returns false if the point is in front of the near plane
+		vector3d const v(p - pdu.pos);
+		sp.z = dot_product(v, pdu.dir);
+		if (sp.z < pdu.near_) return 0;
+		float const zinv(1.0f/sp.z);
+		sp.x = (0.5f + xscale*dot_product(v, pdu.cp  )*zinv)*OCC_BUF_XSIZE;
+		sp.y = (0.5f + yscale*dot_product(v, pdu.upv_)*zinv)*OCC_BUF_YSIZE;
+		return 1;
+	}
+	bool project_cube(cube_t const &c, screen_pt_t sp[8], float bounds[2][2], float &zmin, float &zmax) const {
+		zmin = FLT_MAX; zmax = 0.0;
+		bounds[0][0] = bounds[1][0] = FLT_MAX; bounds[0][1] = bounds[1][1] = -FLT_MAX;
+
+		for (unsigned n = 0; n < 8; ++n) {
+			point const p(c.d[0][n&1], c.d[1][(n>>1)&1], c.d[2][n>>2]);
+			if (!project_pt(p, sp[n])) return 0;
+			min_eq(bounds[0][0], sp[n].x); max_eq(bounds[0][1], sp[n].x);
+			min_eq(bounds[1][0], sp[n].y); max_eq(bounds[1][1], sp[n].y);
+			min_eq(zmin, sp[n].z); max_eq(zmax, sp[n].z);
+		}
+		return 1;
+	}
+	void rasterize_quad(screen_pt_t const pts[4], float z);
+	void rasterize_cube(cube_t const &c);
+	void build_hierarchy();
+
+public:
+	occlusion_buffer_t() : xscale(0.0), yscale(0.0), valid(0), num_rasterized(0) {}
+	bool is_valid() const {return valid;}
+	bool matches_view(point const &viewer) const {return (valid && camera_pdu.dir == pdu.dir && dist_less_than(viewer, pdu.pos, 0.01*pdu.near_));}
+	void invalidate() {valid = 0;}
+	void begin_frame(pos_dir_up const &pdu_);
+	void add_occluder(cube_t const &c);
+	void end_frame();
+	bool is_cube_occluded(cube_t const &c) const;
+	void check_cubes_visible(cube_t const *const cubes, unsigned num, unsigned char *visible) const;
+};
+
+
+void occlusion_buffer_t::begin_frame(pos_dir_up const &pdu_) {
+
+	pdu     = pdu_;
+	valid   = 0;
+	assert(pdu.valid && pdu.tterm > 0.0 && pdu.A > 0.0 && pdu.near_ > 0.0);
+	yscale  = 0.5f/pdu.tterm;
+	xscale  = 0.5f/(pdu.tterm*pdu.A);
+	occluders.clear();
+	num_rasterized = 0;
+
+	for (unsigned level = 0; level < OCC_BUF_LEVELS; ++level) {
+		depth[level].resize(get_xsize(level)*get_ysize(level));
+		std::fill(depth[level].begin(), depth[level].end(), FLT_MAX); // nothing rasterized = infinitely far
+	}
+}
+
+void occlusion_buffer_t::add_occluder(cube_t const &c) {
+
+	if (c.contains_pt(pdu.pos) || !pdu.cube_visible(c)) return;
+	screen_pt_t sp[8];
+	float bounds[2][2], zmin, zmax;
+	if (!project_cube(c, sp, bounds, zmin, zmax)) return; // crosses the near plane - skip
+	float const area((bounds[0][1] - bounds[0][0])*(bounds[1][1] - bounds[1][0])/(OCC_BUF_XSIZE*OCC_BUF_YSIZE));
+	if (area < OCC_MIN_SCREEN_AREA) return; // too small to occlude much
+	occluders.emplace_back(c, area);
+}
+
+// rasterizes a convex quad at constant depth z; a pixel is only written if it's entirely inside the quad (conservative)
+void occlusion_buffer_t::rasterize_quad(screen_pt_t const pts[4], float z) {
+
+	float ea[4], eb[4], ec[4], area(0.0);
+
+	for (unsigned i = 0; i < 4; ++i) {
+		screen_pt_t const &a(pts[i]), &b(pts[(i+1)&3]);
+		ea[i] = a.y - b.y;
+		eb[i] = b.x - a.x;
+		ec[i] = a.x*b.y - a.y*b.x;
+		area += ec[i];
+	}
+	if (fabs(area) < 1.0) return; // degenerate/edge-on
+
+	if (area < 0.0) { // flip winding so that the interior is positive
+		for (unsigned i = 0; i < 4; ++i) {ea[i] = -ea[i]; eb[i] = -eb[i]; ec[i] = -ec[i];}
+	}
+	float x1(pts[0].x), x2(x1), y1(pts[0].y), y2(y1);
+	for (unsigned i = 1; i < 4; ++i) {min_eq(x1, pts[i].x); max_eq(x2, pts[i].x); min_eq(y1, pts[i].y); max_eq(y2, pts[i].y);}
+	int const px1(max(0, int(x1))), px2(min(int(OCC_BUF_XSIZE)-1, int(x2)));
+	int const py1(max(0, int(y1))), py2(min(int(OCC_BUF_YSIZE)-1, int(y2)));
+	float emin[4];
+	for (unsigned i = 0; i < 4; ++i) {emin[i] = 0.5f*(fabs(ea[i]) + fabs(eb[i]));} // offset from pixel center to the most outside pixel corner
+	vector<float> &d(depth[0]);
+
+	for (int y = py1; y <= py2; ++y) {
+		float const py(y + 0.5f);
+		float *row(d.data() + y*OCC_BUF_XSIZE);
+
+		for (int x = px1; x <= px2; ++x) {
+			float const px(x + 0.5f);
+			bool inside(1);
+			for (unsigned i = 0; i < 4 && inside; ++i) {inside = ((ea[i]*px + eb[i]*py + ec[i]) >= emin[i]);}
+			if (inside) {min_eq(row[x], z);}
+		}
+	}
+}
+
+void occlusion_buffer_t::rasterize_cube(cube_t const &c) {
+
+	screen_pt_t sp[8];
+	float bounds[2][2], zmin, zmax;
+	if (!project_cube(c, sp, bounds, zmin, zmax)) return;
+	unsigned const face_verts[3][4] = {{0,2,6,4}, {0,1,5,4}, {0,1,3,2}}; // corner indices of the low face in each dim; bit d selects the high face
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		bool dir(0);
+		if      (pdu.pos[dim] < c.d[dim][0]) {dir = 0;}
+		else if (pdu.pos[dim] > c.d[dim][1]) {dir = 1;}
+		else {continue;} // face not visible
+		screen_pt_t face[4];
+		float fz(0.0);
+
+		for (unsigned i = 0; i < 4; ++i) {
+			face[i] = sp[face_verts[dim][i] | (unsigned(dir) << dim)];
+			max_eq(fz, face[i].z); // use the farthest depth of the face
+		}
+		rasterize_quad(face, fz);
+	}
+}
+
+void occlusion_buffer_t::build_hierarchy() {
+
+	for (unsigned level = 1; level < OCC_BUF_LEVELS; ++level) {
+		vector<float> const &src(depth[level-1]);
+		vector<float> &dest(depth[level]);
+		unsigned const xs(get_xsize(level)), ys(get_ysize(level)), src_xs(get_xsize(level-1));
+
+		for (unsigned y = 0; y < ys; ++y) {
+			float const *r0(src.data() + 2*y*src_xs), *r1(r0 + src_xs);
+
+			for (unsigned x = 0; x < xs; ++x) {
+				dest[y*xs + x] = max(max(r0[2*x], r0[2*x+1]), max(r1[2*x], r1[2*x+1]));
+			}
+		}
+	}
+}
+
+void occlusion_buffer_t::end_frame() {
+
+	if (occluders.size() > OCC_MAX_OCCLUDERS) {
+		std::nth_element(occluders.begin(), occluders.begin()+OCC_MAX_OCCLUDERS, occluders.end());
+		occluders.resize(OCC_MAX_OCCLUDERS);
+	}
+	for (auto i = occluders.begin(); i != occluders.end(); ++i) {rasterize_cube(i->c);}
+	num_rasterized = occluders.size();
+	build_hierarchy();
+	valid = !occluders.empty();
+}
+
+bool occlusion_buffer_t::is_cube_occluded(cube_t const &c) const {
+
+	if (!valid || c.contains_pt(pdu.pos)) return 0;
+	screen_pt_t sp[8];
+	float bounds[2][2], zmin, zmax;
+	if (!project_cube(c, sp, bounds, zmin, zmax)) return 0; // crosses the near plane - assume visible
+	if (bounds[0][1] < 0.0 || bounds[1][1] < 0.0 || bounds[0][0] >= OCC_BUF_XSIZE || bounds[1][0] >= OCC_BUF_YSIZE) return 0; // off screen; leave it to VFC
+	int x1(max(0, int(bounds[0][0]))), x2(min(int(OCC_BUF_XSIZE)-1, int(bounds[0][1])));
+	int y1(max(0, int(bounds[1][0]))), y2(min(int(OCC_BUF_YSIZE)-1, int(bounds[1][1])));
+	unsigned level(0);
+
+	// select the level where the projected bounds cover at most 2x2 texels
+	while (level+1 < OCC_BUF_LEVELS && ((x2 - x1) > 1 || (y2 - y1) > 1)) {
+		x1 >>= 1; x2 >>= 1; y1 >>= 1; y2 >>= 1;
+		++level;
+	}
+	vector<float> const &d(depth[level]);
+	unsigned const xs(get_xsize(level));
+
+	for (int y = y1; y <= y2; ++y) {
+		for (int x = x1; x <= x2; ++x) {
+			if (d[y*xs + x] >= zmin) return 0; // some part of the cube may be in front of the occluders
+		}
+	}
+	return 1;
+}
+
+void occlusion_buffer_t::check_cubes_visible(cube_t const *const cubes, unsigned num, unsigned char *visible) const {
+
+	if (!valid) {
+		for (unsigned i = 0; i < num; ++i) {visible[i] = 1;}
+		return;
+	}
+#pragma omp parallel for schedule(static) if (num > 1024)
+	for (int i = 0; i < (int)num; ++i) {visible[i] = !is_cube_occluded(cubes[i]);}
+}
+
+
+occlusion_buffer_t occlusion_buffer;
+
+
+void add_terrain_occluders() { // mesh blocks from zbottom up to the min height of the block
+
+	if (world_mode != WMODE_GROUND || !is_over_mesh(camera_pdu.pos)) return;
+
+	for (int y1 = 0; y1 < MESH_Y_SIZE; y1 += OCC_MESH_BLOCK) {
+		int const y2(min(MESH_Y_SIZE-1, y1+(int)OCC_MESH_BLOCK));
+
+		for (int x1 = 0; x1 < MESH_X_SIZE; x1 += OCC_MESH_BLOCK) {
+			int const x2(min(MESH_X_SIZE-1, x1+(int)OCC_MESH_BLOCK));
+			float mzmin(FLT_MAX);
+
+			for (int y = y1; y <= y2; ++y) {
+				for (int x = x1; x <= x2; ++x) {min_eq(mzmin, mesh_height[y][x]);}
+			}
+			if (mzmin <= zbottom) continue;
+			occlusion_buffer.add_occluder(cube_t(get_xval(x1), get_xval(x2), get_yval(y1), get_yval(y2), zbottom, mzmin));
+		}
+	}
+}
+
+// called once per frame with the camera frustum; rasterizes large cobjs, building exteriors, and terrain
+void update_occlusion_buffer() {
+
+	if (!(display_mode & 0x08) || !camera_pdu.valid) {occlusion_buffer.invalidate(); return;} // occlusion culling disabled
+	//timer_t timer("Update Occlusion Buffer");
+	occlusion_buffer.begin_frame(camera_pdu);
+
+	if (world_mode == WMODE_GROUND && have_occluders()) {
+		static vector<unsigned> cobjs;
+		cobjs.clear();
+		get_occluder_cobjs_in_view(camera_pdu, cobjs);
+		for (auto i = cobjs.begin(); i != cobjs.end(); ++i) {occlusion_buffer.add_occluder(coll_objects.get_cobj(*i));}
+	}
+	static vect_cube_t bcubes;
+	bcubes.clear();
+	get_building_occluder_cubes(camera_pdu, bcubes);
+	for (auto i = bcubes.begin(); i != bcubes.end(); ++i) {occlusion_buffer.add_occluder(*i);}
+	add_terrain_occluders();
+	occlusion_buffer.end_frame();
+}
+
+// viewer is used to reject queries from other views (shadow maps, reflections, etc.)
+bool cube_hiz_occluded(point const &viewer, cube_t const &cube) {
+	return (occlusion_buffer.matches_view(viewer) && occlusion_buffer.is_cube_occluded(cube));
+}
+
+void check_cubes_hiz_visible(point const &viewer, cube_t const *const cubes, unsigned num, vector<unsigned char> &visible) {
+
+	visible.resize(num);
+	if (num == 0) return;
+	if (occlusion_buffer.matches_view(viewer)) {occlusion_buffer.check_cubes_visible(cubes, num, visible.data());}
+	else {std::fill(visible.begin(), visible.end(), 1);}
+}
+
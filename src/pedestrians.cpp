@@ -947,6 +947,12 @@ void end_sphere_draw(bool &in_sphere_draw) {
 	end_sphere_draw();
 	in_sphere_draw = 0;
 }
+void draw_ped_sphere(pedestrian_t const &ped, shader_t &s, bool &in_sphere_draw, bool enable_animations) { // used when there's no valid ped model
+	if (enable_animations) {s.add_uniform_float("animation_time", 0.0);}
+	begin_ped_sphere_draw(s, YELLOW, in_sphere_draw, 0);
+	int const ndiv = 16; // currently hard-coded
+	draw_sphere_vbo(ped.pos, ped.radius, ndiv, 0);
+}
 
 void pedestrian_t::debug_draw(ped_manager_t &ped_mgr) const {
 	cube_t const &plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, plot));
@@ -1032,7 +1038,10 @@ void ped_manager_t::draw(vector3d const &xlate, bool use_dlights, bool shadow_on
 	dstate.pre_draw(xlate, use_dlights, shadow_only);
 	if (enable_animations) {dstate.s.add_uniform_int("animation_id", animation_id);}
 	if (!shadow_only) {dstate.s.add_uniform_float("hemi_lighting_normal_scale", 0.0);} // disable hemispherical lighting normal because the transforms make it incorrect
-	bool in_sphere_draw(0);
+	if (use_models) {ped_model_loader.ensure_models_loaded();} // must be done before the parallel section below
+	bool in_sphere_draw(0), tile_bound(0);
+	unsigned num_plot_draws(0);
+	uint64_t prev_tile_id(0);
 
 	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
 		if (!pdu.cube_visible(get_expanded_city_bcube_for_peds(city))) continue; // city not visible - skip
@@ -1044,35 +1053,47 @@ void ped_manager_t::draw(vector3d const &xlate, bool use_dlights, bool shadow_on
 			cube_t const plot_bcube(get_expanded_city_plot_bcube_for_peds(city, plot));
 			if (is_dlight_shadows && !plot_bcube.closest_dist_less_than(pdu.pos, draw_dist)) continue; // plot is too far away
 			if (!pdu.cube_visible(plot_bcube)) continue; // plot not visible - skip
-			unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
-			assert(ped_start <= ped_end);
-			if (ped_start == ped_end) continue; // no peds on this plot
-			dstate.ensure_shader_active(); // needed for use_smap=0 case
-			if (!shadow_only) {dstate.begin_tile(plot_bcube.get_cube_center(), 1);} // use the plot's tile's shadow map
-
-			for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
-				assert(i < peds.size());
-				pedestrian_t const &ped(peds[i]);
-				assert(ped.city == city && ped.plot == plot);
-				if (!draw_ped(ped, dstate.s, pdu, xlate, def_draw_dist, draw_dist_sq, in_sphere_draw, shadow_only, is_dlight_shadows, enable_animations)) continue;
-
-				if (dist_less_than(pdu.pos, ped.pos, 0.5*draw_dist)) { // fake AO shadow at below half draw distance
-					float const ao_radius(0.6*ped.radius);
-					float const zval(get_city_plot_bcube_for_peds(ped.city, ped.plot).z2() + 0.02*ped.radius); // at the feet
-					point pao[4];
-					
-					for (unsigned n = 0; n < 4; ++n) {
-						point &v(pao[n]);
-						v.x = ped.pos.x + (((n&1)^(n>>1)) ? -ao_radius : ao_radius);
-						v.y = ped.pos.y + ((n>>1)         ? -ao_radius : ao_radius);
-						v.z = zval;
-					}
-					dstate.ao_qbd.add_quad_pts(pao, colorRGBA(0, 0, 0, 0.4), plus_z);
-				}
-			} // for i
+			if (by_plot[plot] == by_plot[plot+1]) continue; // no peds on this plot
+			if (num_plot_draws == plot_draws.size()) {plot_draws.emplace_back();}
+			plot_draw_t &pd(plot_draws[num_plot_draws++]);
+			pd.city     = city;
+			pd.plot     = plot;
+			pd.tile_pos = plot_bcube.get_cube_center();
 		} // for plot
 	} // for city
+	// cull peds, select model LOD, and compute model transforms for all visible plots in parallel
+#pragma omp parallel for schedule(dynamic) if (num_plot_draws > 1)
+	for (int p = 0; p < (int)num_plot_draws; ++p) {build_plot_draw(plot_draws[p], pdu, def_draw_dist, draw_dist_sq, shadow_only, is_dlight_shadows);}
+
+	for (unsigned p = 0; p < num_plot_draws; ++p) { // serial part: occlusion culling and drawing
+		plot_draw_t const &pd(plot_draws[p]);
+		if (pd.sphere_peds.empty() && pd.model_peds.empty()) continue; // no visible peds
+		dstate.ensure_shader_active(); // needed for use_smap=0 case
+
+		if (!shadow_only) { // use the plot's tile's shadow map
+			uint64_t const tile_id(get_tile_id_containing_point(pd.tile_pos + xlate));
+
+			if (!tile_bound || tile_id != prev_tile_id) { // batched models must be drawn with the shadow map of their tile, so flush when the tile changes
+				end_sphere_draw(in_sphere_draw);
+				model_batch.draw_and_clear(dstate.s, ped_model_loader, xlate, shadow_only, enable_animations);
+				dstate.begin_tile(pd.tile_pos, 1);
+				prev_tile_id = tile_id;
+				tile_bound   = 1;
+			}
+		}
+		for (auto i = pd.sphere_peds.begin(); i != pd.sphere_peds.end(); ++i) {
+			draw_ped_sphere(peds[*i], dstate.s, in_sphere_draw, enable_animations);
+			if (dist_less_than(pdu.pos, peds[*i].pos, 0.5*draw_dist)) {add_ped_ao_shadow(peds[*i]);} // fake AO shadow at below half draw distance
+		}
+		for (unsigned n = 0; n < pd.model_peds.size(); ++n) {
+			pedestrian_t const &ped(peds[pd.model_peds[n]]);
+			if (dstate.is_occluded(get_ped_model_bcube(ped))) continue; // only check occlusion for expensive ped models
+			model_batch.add(pd.insts[n]);
+			if (dist_less_than(pdu.pos, ped.pos, 0.5*draw_dist)) {add_ped_ao_shadow(ped);} // fake AO shadow at below half draw distance
+		}
+	} // for p
 	end_sphere_draw(in_sphere_draw);
+	model_batch.draw_and_clear(dstate.s, ped_model_loader, xlate, shadow_only, enable_animations); // draw remaining models; in the shadow pass, this is all of them
 	if (!shadow_only) {dstate.s.add_uniform_float("hemi_lighting_normal_scale", 1.0);} // restore
 	pedestrian_t const *selected_ped(nullptr);
 
@@ -1104,6 +1125,7 @@ void ped_manager_t::draw_peds_in_building(int first_ped_ix, unsigned bix, shader
 	pdu.pos -= xlate; // adjust for local translate
 	bool const enable_animations(enable_building_people_ai());
 	bool in_sphere_draw(0);
+	if (ped_model_loader.num_models() > 0) {ped_model_loader.ensure_models_loaded();}
 	if (enable_animations) {s.add_uniform_int("animation_id", animation_id);}
 
 	// Note: no far clip adjustment or draw dist scale
@@ -1127,8 +1149,29 @@ void ped_manager_t::get_ped_bcubes_for_building(int first_ped_ix, unsigned bix,
 	}
 }
 
-bool ped_manager_t::draw_ped(pedestrian_t const &ped, shader_t &s, pos_dir_up const &pdu, vector3d const &xlate, float def_draw_dist, float draw_dist_sq,
-	bool &in_sphere_draw, bool shadow_only, bool is_dlight_shadows, bool enable_animations)
+cube_t ped_manager_t::get_ped_model_bcube(pedestrian_t const &ped) const {
+	cube_t bcube;
+	bcube.set_from_sphere(ped.pos, PED_WIDTH_SCALE*ped.radius);
+	bcube.z1() = ped.pos.z - ped.radius;
+	bcube.z2() = bcube.z1() + PED_HEIGHT_SCALE*ped.radius;
+	return bcube;
+}
+
+void ped_manager_t::get_ped_vfc_sphere(pedestrian_t const &ped, point &center, float &radius) const { // must agree with the draw_ped() geometry
+	center = ped.pos;
+
+	if (!ped_has_model(ped)) {radius = ped.radius;} // sphere
+	else { // bsphere of model bcube height
+		float const height(PED_HEIGHT_SCALE*ped.radius);
+		center.z += 0.5*height - ped.radius;
+		radius     = 0.5*height;
+	}
+}
+
+// returns 0 if the ped is culled, 1 if it should be drawn as a sphere, or 2 if it should be drawn as a model, in which case inst is filled in;
+// thread safe, but models must be loaded; occlusion culling is left to the caller
+unsigned ped_manager_t::setup_ped_draw(pedestrian_t const &ped, pos_dir_up const &pdu, float def_draw_dist, float draw_dist_sq, bool shadow_only, bool is_dlight_shadows,
+	bool skip_vfc, city_model_inst_t &inst) const
 {
 	if (ped.destroyed) return 0; // skip
 	float const dist_sq(p2p_dist_sq(pdu.pos, ped.pos));
@@ -1136,29 +1179,71 @@ bool ped_manager_t::draw_ped(pedestrian_t const &ped, shader_t &s, pos_dir_up co
 	if (is_dlight_shadows && !dist_less_than(pre_smap_player_pos, ped.pos, 0.4*def_draw_dist)) return 0; // too far from the player
 	if (is_dlight_shadows && !sphere_in_light_cone_approx(pdu, ped.pos, 0.5*PED_HEIGHT_SCALE*ped.radius)) return 0;
 
-	if (ped_model_loader.num_models() == 0 || !ped_model_loader.is_model_valid(ped.model_id)) {
-		if (!pdu.sphere_visible_test(ped.pos, ped.radius)) return 0; // not visible - skip
-		if (enable_animations) {s.add_uniform_float("animation_time", 0.0);}
-		begin_ped_sphere_draw(s, YELLOW, in_sphere_draw, 0);
-		int const ndiv = 16; // currently hard-coded
-		draw_sphere_vbo(ped.pos, ped.radius, ndiv, 0);
+	if (!ped_has_model(ped)) {
+		if (!skip_vfc && !pdu.sphere_visible_test(ped.pos, ped.radius)) return 0; // not visible - skip
+		return 1;
 	}
-	else {
-		float const width(PED_WIDTH_SCALE*ped.radius), height(PED_HEIGHT_SCALE*ped.radius);
-		cube_t bcube;
-		bcube.set_from_sphere(ped.pos, width);
-		bcube.z1() = ped.pos.z - ped.radius;
-		bcube.z2() = bcube.z1() + height;
-		if (!pdu.sphere_visible_test(bcube.get_cube_center(), 0.5*height)) return 0; // not visible - skip
-		if (dstate.is_occluded(bcube)) return 0; // only check occlusion for expensive ped models
-		end_sphere_draw(in_sphere_draw);
-		bool const low_detail(!shadow_only && dist_sq > 0.25*draw_dist_sq); // low detail for non-shadow pass at half draw dist
-		if (enable_animations) {s.add_uniform_float("animation_time", ped.anim_time);}
-		vector3d dir_horiz(ped.dir);
-		dir_horiz.z = 0.0; // always face a horizontal direction, even if walking on a slope
-		dir_horiz.normalize();
-		ped_model_loader.draw_model(s, ped.pos, bcube, dir_horiz, ALPHA0, xlate, ped.model_id, shadow_only, low_detail, enable_animations);
+	cube_t const bcube(get_ped_model_bcube(ped));
+	if (!skip_vfc && !pdu.sphere_visible_test(bcube.get_cube_center(), 0.5*bcube.dz())) return 0; // not visible - skip
+	bool const low_detail(!shadow_only && dist_sq > 0.25*draw_dist_sq); // low detail for non-shadow pass at half draw dist
+	vector3d dir_horiz(ped.dir);
+	dir_horiz.z = 0.0; // always face a horizontal direction, even if walking on a slope
+	dir_horiz.normalize();
+	ped_model_loader.setup_model_inst(inst, ped.pos, bcube, dir_horiz, ALPHA0, ped.model_id, low_detail, ped.anim_time);
+	return 2;
+}
+
+void ped_manager_t::build_plot_draw(plot_draw_t &pd, pos_dir_up const &pdu, float def_draw_dist, float draw_dist_sq, bool shadow_only, bool is_dlight_shadows) const {
+	unsigned const ped_start(by_plot[pd.plot]), ped_end(by_plot[pd.plot+1]);
+	assert(ped_start <= ped_end && ped_end <= peds.size());
+	pd.sphere_peds.clear();
+	pd.model_peds.clear();
+	pd.insts.clear();
+	pd.vfc_spheres.clear();
+
+	for (unsigned i = ped_start; i < ped_end; ++i) {
+		point center;
+		float radius(0.0);
+		get_ped_vfc_sphere(peds[i], center, radius);
+		pd.vfc_spheres.add(center, radius);
+	}
+	pdu.spheres_visible_test(pd.vfc_spheres, pd.in_view); // batch VFC
+	city_model_inst_t inst;
+
+	for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
+		pedestrian_t const &ped(peds[i]);
+		assert(ped.city == pd.city && ped.plot == pd.plot);
+		if (!pd.in_view.is_visible(i - ped_start)) continue; // not visible - skip
+		unsigned const draw_type(setup_ped_draw(ped, pdu, def_draw_dist, draw_dist_sq, shadow_only, is_dlight_shadows, 1, inst)); // skip_vfc=1
+		if      (draw_type == 1) {pd.sphere_peds.push_back(i);}
+		else if (draw_type == 2) {pd.model_peds.push_back(i); pd.insts.push_back(inst);}
 	}
+}
+
+void ped_manager_t::add_ped_ao_shadow(pedestrian_t const &ped) {
+	float const ao_radius(0.6*ped.radius);
+	float const zval(get_city_plot_bcube_for_peds(ped.city, ped.plot).z2() + 0.02*ped.radius); // at the feet
+	point pao[4];
+
+	for (unsigned n = 0; n < 4; ++n) {
+		point &v(pao[n]);
+		v.x = ped.pos.x + (((n&1)^(n>>1)) ? -ao_radius : ao_radius);
+		v.y = ped.pos.y + ((n>>1)         ? -ao_radius : ao_radius);
+		v.z = zval;
+	}
+	dstate.ao_qbd.add_quad_pts(pao, colorRGBA(0, 0, 0, 0.4), plus_z);
+}
+
+bool ped_manager_t::draw_ped(pedestrian_t const &ped, shader_t &s, pos_dir_up const &pdu, vector3d const &xlate, float def_draw_dist, float draw_dist_sq,
+	bool &in_sphere_draw, bool shadow_only, bool is_dlight_shadows, bool enable_animations)
+{
+	city_model_inst_t inst;
+	unsigned const draw_type(setup_ped_draw(ped, pdu, def_draw_dist, draw_dist_sq, shadow_only, is_dlight_shadows, 0, inst)); // skip_vfc=0
+	if (draw_type == 0) return 0; // culled
+	if (draw_type == 1) {draw_ped_sphere(ped, s, in_sphere_draw, enable_animations); return 1;}
+	if (dstate.is_occluded(get_ped_model_bcube(ped))) return 0; // only check occlusion for expensive ped models
+	end_sphere_draw(in_sphere_draw);
+	ped_model_loader.draw_model_insts(s, &inst, 1, xlate, shadow_only, enable_animations);
 	return 1;
 }
 
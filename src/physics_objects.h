@@ -157,18 +157,36 @@ private:
 class physics_particle_manager {
 
 protected:
-	struct part_t { // size = 28
-		point p; // position
-		vector3d v; // velocity
-		color_wrapper c;
-
-		part_t() {}
-		part_t(point const &p_, vector3d const &v_, colorRGBA const &c_) : p(p_), v(v_) {c.set_c4(c_);}
+	// particles are stored as a structure of arrays so that the integration loops over contiguous floats can be vectorized and split across threads
+	struct part_soa_t {
+		vector<float> px, py, pz, vx, vy, vz, age; // position, velocity, age in ticks
+		vector<color_wrapper> c;
+
+		size_t size() const {return px.size();}
+		bool empty() const {return px.empty();}
+		void clear();
+		void reserve(size_t sz);
+		void resize(size_t sz);
+		void push_back(point const &p, vector3d const &v, colorRGBA const &color);
+		void move_elem(size_t from, size_t to);
+		point    get_pos(size_t i) const {return point   (px[i], py[i], pz[i]);}
+		vector3d get_vel(size_t i) const {return vector3d(vx[i], vy[i], vz[i]);}
 	};
-	vector<part_t> parts;
-
+	part_soa_t parts;
+	vector<unsigned char> keep; // per-particle valid flags, reused across frames
+	unsigned max_parts;
+	float wind_scale, lifetime; // lifetime is in ticks; 0 = unlimited
+
+	void integrate(float g_acc, float xy_damp, float terminal_velocity, bool emissive);
+	void add_wind_forces();
+	void cull_invalid();
 public:
+	physics_particle_manager(unsigned max_parts_=100000, float wind_scale_=0.0, float lifetime_=0.0) : max_parts(max_parts_), wind_scale(wind_scale_), lifetime(lifetime_) {}
 	void clear() {parts.clear();}
+	size_t size() const {return parts.size();}
+	void set_max_parts (unsigned num) {max_parts  = num;}
+	void set_wind_scale(float scale)  {wind_scale = scale;}
+	void set_lifetime  (float lt)     {lifetime   = lt;}
 	void gen_particles(point const &pos, vector3d const &vadd, float vmag, float gen_radius, colorRGBA const &color, unsigned num);
 	void apply_physics(float gravity, float terminal_velocity, bool emissive=0);
 	void draw(float radius, int tid, bool emissive=0) const;
@@ -179,6 +197,7 @@ public:
 class water_particle_manager : public physics_particle_manager {
 
 public:
+	water_particle_manager() : physics_particle_manager(100000, 1.0) {} // droplets are light and blown by the wind
 	static colorRGBA calc_color(float mud_mix, float blood_mix) {
 		return blend_color(BLOOD_C, blend_color(MUD_C, WATER_C, mud_mix, 1), blood_mix, 1);
 	}
@@ -53,9 +53,8 @@ typedef vector<wpt_ix_t> waypt_adj_vect;
 
 struct waypoint_t {
 
-	bool user_placed, placed_item, goal, temp, visited, disabled, next_valid;
-	int came_from, item_group, item_ix, coll_id, connected_to;
-	float g_score, h_score, f_score;
+	bool user_placed, placed_item, goal, temp, visited, disabled;
+	int item_group, item_ix, coll_id, connected_to;
 	point pos;
 	double last_smiley_time;
 	waypt_adj_vect next_wpts, prev_wpts;
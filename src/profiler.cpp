@@ -3,6 +3,7 @@
 // 4/20/13
 
 #include "3DWorld.h"
+#include <fstream>
 
 using std::string;
 
@@ -11,9 +12,9 @@ class timing_profiler {
 
 	struct entry_t {
 		unsigned count;
-		int time, tmax;
-		entry_t() : count(0), time(0), tmax(0) {}
-		void add(int t) {++count; time += t; tmax = max(tmax, t);}
+		double time, tmax; // in ms
+		entry_t() : count(0), time(0.0), tmax(0.0) {}
+		void add(double t) {++count; time += t; tmax = max(tmax, t);}
 	};
 
 	map<string, entry_t> entries;
@@ -24,7 +25,7 @@ public:
 	timing_profiler() : enabled(0) {}
 	void clear() {entries.clear();}
 
-	void register_time(const char *str, int delta_time) {
+	void register_time(const char *str, double delta_time) {
 		if (enabled) {
 			entries[str].add(delta_time);
 		}
@@ -43,6 +44,24 @@ public:
 					<< i->second.tmax << "\t" << float(i->second.time)/float(i->second.count) << endl;
 		}
 	}
+	bool write_json(string const &fn, unsigned num_frames) const {
+		std::ofstream out(fn);
+		if (!out.good()) {std::cerr << "Error: Failed to open timing report file " << fn << " for writing" << endl; return 0;}
+		out << "{\n  \"frames\": " << num_frames << ",\n  \"timings\": [";
+
+		for (auto i = entries.begin(); i != entries.end(); ++i) {
+			string name;
+
+			for (auto c = i->first.begin(); c != i->first.end(); ++c) { // escape for JSON
+				if (*c == '"' || *c == '\\') {name.push_back('\\');}
+				if (*c >= ' ') {name.push_back(*c);}
+			}
+			out << ((i == entries.begin()) ? "\n" : ",\n") << "    {\"name\": \"" << name << "\", \"count\": " << i->second.count << ", \"total_ms\": " << i->second.time
+				<< ", \"max_ms\": " << i->second.tmax << ", \"avg_ms\": " << i->second.time/max(i->second.count, 1U) << "}";
+		}
+		out << "\n  ]\n}" << endl;
+		return out.good();
+	}
 };
 
 timing_profiler global_profiler;
@@ -56,6 +75,14 @@ void register_timing_value(const char *str, int delta_time) {
 	global_profiler.register_time(str, delta_time);
 }
 
+void register_timing_value_ms(const char *str, double delta_time) {
+	global_profiler.register_time(str, delta_time);
+}
+
+bool write_timing_profiler_json(string const &fn, unsigned num_frames) {
+	return global_profiler.write_json(fn, num_frames);
+}
+
 void timing_profiler_stats() {
 	global_profiler.stats();
 	global_profiler.clear();
@@ -22,6 +22,8 @@ bool keep_beams(0); // debugging mode
 bool kill_raytrace(0);
 bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame; also, wrong to cache lighting for moving cobjs
 unsigned NPTS(50000), NRAYS(40000), LOCAL_RAYS(1000000), GLOBAL_RAYS(1000000), DYNAMIC_RAYS(1000000), NUM_THREADS(1), MAX_RAY_BOUNCES(20);
+unsigned lighting_bake_passes(0), lighting_checkpoint_passes(1); // 0 passes = single non-progressive pass
+float lighting_bake_target_noise(0.0); // stop progressive baking when the relative change per pass drops below this value; 0 = disabled
 std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
@@ -588,7 +590,7 @@ void check_for_lighting_finished() { // to be called about once per frame
 
 
 // see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using std::thread)
-void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype, unsigned job_id=0) {
+void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype, unsigned job_id=0, unsigned seed_offset=0) {
 
 	kill_current_raytrace_threads();
 	assert(num_threads > 0 && num_threads < 100);
@@ -597,11 +599,14 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 	if (verbose) {cout << "Computing lighting on " << num_threads << " threads." << endl;}
 	thread_manager.create(num_threads);
 	vector<rt_data> &data(thread_manager.data);
+	// dynamic light volume jobs don't write into lmap_manager; other jobs accumulate into float lmcells, so the compact format must be expanded
+	bool const writes_lmap(!is_ltype_dynamic(ltype)), was_compact(writes_lmap && lmap_manager.is_compact());
+	if (writes_lmap) {lmap_manager.expand();}
 	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager);}
 
 	for (unsigned t = 0; t < data.size(); ++t) {
 		// create a custom lmap_manager_t for each thread then merge them together?
-		data[t] = rt_data(t, num_threads, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
+		data[t] = rt_data(t, num_threads, 234323*(t+1)+seed_offset, !single_thread, (verbose && t == 0), randomized, ltype, job_id);
 		data[t].lmgr = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
 	}
 	if (single_thread && blocking) { // threads disabled
@@ -623,6 +628,7 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 			}
 		}
 		thread_manager.clear();
+		if (was_compact) {lmap_manager.compact();} // restore the compact format
 	}
 	//cout << "total rays: " << tot_rays << ", hits: " << num_hits << ", cells touched: " << cells_touched << endl;
 	//tot_rays = num_hits = cells_touched = 0;
@@ -1044,6 +1050,139 @@ typedef void (*ray_trace_func)(rt_data *);
 ray_trace_func const rt_funcs[NUM_LIGHTING_TYPES] = {trace_ray_block_sky, trace_ray_block_global, trace_ray_block_local, trace_ray_block_cobj_accum, trace_ray_block_dynamic};
 
 
+// hash of the scene state that the baked lighting depends on: scene bounds, sun/moon, mesh, static cobjs, and light sources
+unsigned get_lighting_scene_hash() {
+
+	vector<float> vals;
+	vals.push_back(X_SCENE_SIZE); vals.push_back(Y_SCENE_SIZE); vals.push_back(Z_SCENE_SIZE); vals.push_back(czmin); vals.push_back(czmax);
+	UNROLL_3X(vals.push_back(sun_pos[i_]); vals.push_back(moon_pos[i_]);)
+
+	for (int y = 0; y < MESH_Y_SIZE; ++y) {
+		for (int x = 0; x < MESH_X_SIZE; ++x) {vals.push_back(mesh_height[y][x]);}
+	}
+	for (auto i = coll_objects.begin(); i != coll_objects.end(); ++i) {
+		if (i->status != COLL_STATIC) continue;
+		for (unsigned d = 0; d < 6; ++d) {vals.push_back(i->d[d>>1][d&1]);}
+		vals.push_back(i->type);
+		UNROLL_4X(vals.push_back(i->cp.color[i_]);)
+	}
+	for (auto i = light_sources_a.begin(); i != light_sources_a.end(); ++i) {
+		UNROLL_3X(vals.push_back(i->get_pos()[i_]);)
+		vals.push_back(i->get_radius());
+		UNROLL_4X(vals.push_back(i->get_color()[i_]);)
+	}
+	return jenkins_one_at_a_time_hash((uint8_t const *)vals.data(), vals.size()*sizeof(float));
+}
+
+// progressive lighting checkpoint file: header followed by the per-cell sums of all passes for one lighting type
+struct lighting_checkpoint_header_t { // size = 44
+	unsigned magic, version, ltype, data_size, scene_hash, passes_done, rays[4];
+	float last_change;
+
+	lighting_checkpoint_header_t(unsigned ltype_=0, unsigned data_size_=0, unsigned scene_hash_=0, unsigned passes_done_=0, float last_change_=0.0) :
+		magic(0x504B434C), version(2), ltype(ltype_), data_size(data_size_), scene_hash(scene_hash_), passes_done(passes_done_), last_change(last_change_)
+	{
+		rays[0] = NPTS; rays[1] = NRAYS; rays[2] = LOCAL_RAYS; rays[3] = GLOBAL_RAYS; // must match for a checkpoint to be resumed
+	}
+	bool matches(lighting_checkpoint_header_t const &h) const {
+		return (magic == h.magic && version == h.version && ltype == h.ltype && data_size == h.data_size && scene_hash == h.scene_hash && !memcmp(rays, h.rays, sizeof(rays)));
+	}
+};
+
+string get_lighting_checkpoint_fn(unsigned ltype) {return (string(lighting_file[ltype]) + ".ckpt");}
+
+bool read_lighting_checkpoint(unsigned ltype, unsigned scene_hash, unsigned &passes_done) {
+
+	string const fn(get_lighting_checkpoint_fn(ltype));
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == nullptr) return 0; // no checkpoint, not an error
+	lighting_checkpoint_header_t const expected(ltype, (unsigned)lmap_manager.size(), scene_hash);
+	lighting_checkpoint_header_t header;
+	vector<float> vals;
+	bool ok(fread(&header, sizeof(header), 1, fp) == 1 && header.matches(expected));
+
+	if (ok) {
+		vals.resize(size_t(header.data_size)*lmcell::get_dsz(ltype));
+		ok = (fread(vals.data(), sizeof(float), vals.size(), fp) == vals.size());
+	}
+	checked_fclose(fp);
+
+	if (!ok) {
+		cerr << "Warning: Ignoring lighting checkpoint file " << fn << ", which is invalid or from a different scene or ray count." << endl;
+		return 0;
+	}
+	lmap_manager.set_lighting_values(ltype, vals);
+	passes_done = header.passes_done;
+	cout << "Resuming lighting from checkpoint " << fn << " after " << passes_done << " passes, last relative change " << header.last_change << endl;
+	return 1;
+}
+
+bool write_lighting_checkpoint(unsigned ltype, unsigned scene_hash, unsigned passes_done, float last_change) {
+
+	string const fn(get_lighting_checkpoint_fn(ltype)), tmp_fn(fn + ".tmp");
+	FILE *fp(fopen(tmp_fn.c_str(), "wb"));
+	if (fp == nullptr) {cerr << "Error: Failed to open lighting checkpoint file " << tmp_fn << " for writing" << endl; return 0;}
+	vector<float> vals;
+	lmap_manager.get_lighting_values(ltype, vals);
+	lighting_checkpoint_header_t const header(ltype, (unsigned)lmap_manager.size(), scene_hash, passes_done, last_change);
+	bool const ok(fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(vals.data(), sizeof(float), vals.size(), fp) == vals.size());
+	checked_fclose(fp);
+	if (!ok) {cerr << "Error writing lighting checkpoint file " << tmp_fn << endl; return 0;}
+	// write then rename so that a crash while writing doesn't destroy the previous checkpoint
+	remove(fn.c_str()); // rename() fails on Windows if the target exists
+	if (rename(tmp_fn.c_str(), fn.c_str()) != 0) {cerr << "Error renaming lighting checkpoint file " << tmp_fn << " to " << fn << endl; return 0;}
+	return 1;
+}
+
+// returns the sum of absolute differences between the mean after num_passes and the mean after num_passes-1, relative to the sum of the current mean
+float calc_lighting_pass_change(vector<float> const &prev_sums, vector<float> const &cur_sums, unsigned num_passes) {
+
+	assert(prev_sums.size() == cur_sums.size());
+	if (num_passes < 2) return 1.0; // unknown
+	float const cur_scale(1.0/num_passes), prev_scale(1.0/(num_passes - 1));
+	double diff(0.0), total(0.0);
+
+#pragma omp parallel for schedule(static) reduction(+:diff, total)
+	for (int i = 0; i < (int)cur_sums.size(); ++i) {
+		float const cur(cur_scale*cur_sums[i]);
+		diff  += fabs(cur - prev_scale*prev_sums[i]);
+		total += fabs(cur);
+	}
+	return ((total > 0.0) ? float(diff/total) : 0.0);
+}
+
+bool use_progressive_lighting(unsigned ltype) {
+	return (lighting_bake_passes > 0 && ltype <= LIGHTING_LOCAL && !is_ltype_dynamic(ltype) && !enable_platform_lights(ltype));
+}
+
+// each pass traces the full set of rays with a different seed and adds into the lightmap, which is divided by the number of passes at the end;
+// the sums are checkpointed to disk every lighting_checkpoint_passes passes so that a long bake can be resumed after a crash or interruption
+void progressive_ray_trace_lighting(unsigned ltype, bool verbose) {
+
+	assert(use_progressive_lighting(ltype));
+	unsigned pass(0);
+	unsigned const scene_hash(get_lighting_scene_hash());
+	if (!read_lighting_checkpoint(ltype, scene_hash, pass)) {lmap_manager.clear_lighting_values(ltype);} // start from zero
+	vector<float> prev_sums, cur_sums;
+	float change(1.0);
+
+	while (pass < lighting_bake_passes) {
+		timer_t timer("Lighting Bake Pass");
+		lmap_manager.get_lighting_values(ltype, prev_sums);
+		launch_threaded_job(NUM_THREADS, rt_funcs[ltype], (verbose && pass == 0), 1, 0, 0, ltype, 0, 98731*pass); // pass 0 is the same as non-progressive
+		++pass;
+		lmap_manager.get_lighting_values(ltype, cur_sums);
+		change = calc_lighting_pass_change(prev_sums, cur_sums, pass);
+		bool const converged(pass > 1 && change < lighting_bake_target_noise);
+		cout << "Lighting pass " << pass << " of " << lighting_bake_passes << ", relative change: " << change << (converged ? " (converged)" : "") << endl;
+		if (converged) break;
+		if (pass < lighting_bake_passes && lighting_checkpoint_passes > 0 && (pass % lighting_checkpoint_passes) == 0) {write_lighting_checkpoint(ltype, scene_hash, pass, change);}
+	}
+	if (pass > 1) {lmap_manager.scale_lighting_values(ltype, 1.0/pass);} // convert sum to average
+	remove(get_lighting_checkpoint_fn(ltype).c_str()); // bake is complete, so the checkpoint is no longer needed
+}
+
+
 void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 
 	bool const dynamic(is_ltype_dynamic(ltype));
@@ -1066,7 +1205,8 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 		if (c_ltype != LIGHTING_LOCAL && !dynamic) {cout << X_SCENE_SIZE << " " << Y_SCENE_SIZE << " " << Z_SCENE_SIZE << " " << czmin << " " << czmax << endl;}
 		all_models.build_cobj_trees(1);
 		if (enable_platform_lights(ltype)) {pre_rt_bvh_build_hook();}
-		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);
+		if (use_progressive_lighting(ltype)) {progressive_ray_trace_lighting(ltype, verbose);}
+		else {launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);}
 		if (enable_platform_lights(ltype)) {post_rt_bvh_build_hook();}
 	}
 	if (!dynamic && write_light_files[c_ltype]) {
@@ -1139,6 +1279,7 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 	cout << "Reading lighting file from " << fn << endl;
 	unsigned data_size(0);
 	if (!reader.read(&data_size, sizeof(unsigned), 1)) return 0;
+	expand();
 
 	if (data_size != vldata_alloc.size()) {
 		cerr << "Error: Lighting file " << fn << " data size of " << data_size
@@ -1168,12 +1309,16 @@ bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
-	unsigned const data_size((unsigned)vldata_alloc.size()); // should be size_t?
+	unsigned const data_size((unsigned)size()); // should be size_t?
 	if (!writer.write(&data_size, sizeof(unsigned), 1)) return 0;
 	unsigned const sz(lmcell::get_dsz(ltype));
+	lmcell decoded;
 
-	for (vector<lmcell>::const_iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) { // const_iterator?
-		if (!writer.write(i->get_offset(ltype), sizeof(float), sz)) {
+	for (unsigned i = 0; i < data_size; ++i) {
+		if (compacted) {packed.decode(i, decoded);} // Note: written values have the reduced precision of the compact format
+		lmcell const &lmc(compacted ? decoded : vldata_alloc[i]);
+
+		if (!writer.write(lmc.get_offset(ltype), sizeof(float), sz)) {
 			cerr << "Error writing data to ligthing file " << fn << endl;
 			return 0;
 		}
@@ -1182,10 +1327,47 @@ bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 }
 
 
+void lmap_manager_t::get_lighting_values(int ltype, vector<float> &vals) const {
+
+	assert(!compacted);
+	unsigned const sz(lmcell::get_dsz(ltype));
+	vals.resize(vldata_alloc.size()*sz);
+
+	for (unsigned i = 0; i < vldata_alloc.size(); ++i) {
+		float const *ptr(vldata_alloc[i].get_offset(ltype));
+		for (unsigned n = 0; n < sz; ++n) {vals[i*sz + n] = ptr[n];}
+	}
+}
+
+void lmap_manager_t::set_lighting_values(int ltype, vector<float> const &vals) {
+
+	expand();
+	unsigned const sz(lmcell::get_dsz(ltype));
+	assert(vals.size() == vldata_alloc.size()*sz);
+
+	for (unsigned i = 0; i < vldata_alloc.size(); ++i) {
+		float *ptr(vldata_alloc[i].get_offset(ltype));
+		for (unsigned n = 0; n < sz; ++n) {ptr[n] = vals[i*sz + n];}
+	}
+}
+
+void lmap_manager_t::scale_lighting_values(int ltype, float scale) {
+
+	assert(!compacted);
+	unsigned const sz(lmcell::get_dsz(ltype));
+
+	for (auto i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
+		float *ptr(i->get_offset(ltype));
+		for (unsigned n = 0; n < sz; ++n) {ptr[n] *= scale;}
+	}
+}
+
+
 void lmap_manager_t::clear_lighting_values(int ltype) {
 
 	assert(ltype < NUM_LIGHTING_TYPES && !is_ltype_dynamic(ltype));
 	unsigned const num(lmcell::get_dsz(ltype));
+	expand(); // values will be written by ray tracing
 
 	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
 		float *color(i->get_offset(ltype));
@@ -42,6 +42,7 @@ int DISABLE_SCENERY(0), has_scenery(0), has_scenery2(0);
 extern bool underwater, has_snow;
 extern int num_trees, xoff2, yoff2, rand_gen_index, window_width, do_zoom, display_mode, tree_mode, draw_model, DISABLE_WATER, animate2, frame_counter, use_voxel_rocks;
 extern float zmin, zmax_est, water_plane_z, tree_scale, vegetation, fticks, ocean_wave_height;
+extern unsigned static_smap_gen;
 extern pt_line_drawer tree_scenery_pld; // we can use this for plant trunks
 extern voxel_params_t global_voxel_params;
 
@@ -554,7 +555,9 @@ void voxel_rock::draw(float sscale, bool shadow_only, bool reflection_pass, vect
 void burnable_scenery_obj::next_frame() {
 	if (!animate2 || world_mode != WMODE_GROUND || burn_amt == 1.0) return;
 	fire_amt = get_ground_fire_intensity(pos, 2.0*radius);
-	if (fire_amt > 0.0) {burn_amt = min(1.0, (burn_amt + 0.003*fticks*fire_amt));}
+	if (fire_amt <= 0.0) return;
+	burn_amt = min(1.0, (burn_amt + 0.003*fticks*fire_amt));
+	if (burn_amt == 1.0) {++static_smap_gen;} // burned out objects are no longer drawn
 }
 void burnable_scenery_obj::draw_fire(fire_drawer_t &fire_drawer, float rscale, unsigned ix) const {
 	if (fire_amt == 0.0 || burn_amt >= 1.0) return; // no fire, or all burned out
@@ -1217,7 +1220,7 @@ bool scenery_group::update_zvals(int x1, int y1, int x2, int y2) { // inefficien
 void scenery_group::do_rock_damage(point const &pos, float radius, float damage) {
 
 	for (unsigned i = 0; i < rock_shapes.size(); ++i) {
-		if (rock_shapes[i].do_impact_damage(pos, radius)) rock_collision(0, -1, zero_vector, pos, damage, IMPACT);
+		if (rock_shapes[i].do_impact_damage(pos, radius)) {rock_collision(0, -1, zero_vector, pos, damage, IMPACT); ++static_smap_gen;}
 	}
 }
 
@@ -20,6 +20,7 @@ int const SHADOW_MAP_DATATYPE = GL_UNSIGNED_SHORT; // 16-bit shadow maps
 
 bool voxel_shadows_updated(0);
 unsigned shadow_map_sz(0), scene_smap_vbo_invalid(0), empty_smap_tid(0);
+unsigned static_smap_gen(0); // incremented when static shadow casters that aren't cobjs (mesh, tree leaves, scenery) are modified
 pos_dir_up orig_camera_pdu;
 
 extern bool snow_shadows, enable_depth_clamp, flashlight_on, interior_shadow_maps;
@@ -53,9 +54,16 @@ int get_def_smap_ndiv(float radius) {return get_smap_ndiv(radius, shadow_map_sz)
 
 struct ground_mode_smap_data_t : public cached_dynamic_smap_data_t {
 
-	ground_mode_smap_data_t(unsigned tu_id_) : cached_dynamic_smap_data_t(tu_id_, shadow_map_sz) {}
+	// static casters are rendered into a separate depth texture once per light position, then copied into the shadow map
+	// each time it's updated so that only dynamic casters need to be drawn when the light and static scene are unchanged
+	unsigned static_tid, static_fbo_id, static_flags, static_gen;
+	point static_lpos;
+
+	ground_mode_smap_data_t(unsigned tu_id_) : cached_dynamic_smap_data_t(tu_id_, shadow_map_sz), static_tid(0), static_fbo_id(0), static_flags(0), static_gen(0), static_lpos(all_zeros) {}
 	virtual void render_scene_shadow_pass(point const &lpos);
 	virtual bool needs_update(point const &lpos);
+	bool update_static_layer(point const &lpos, bool trees_are_dynamic);
+	void free_static_layer() {free_texture(static_tid); free_fbo(static_fbo_id);}
 };
 
 vector<ground_mode_smap_data_t> smap_data;
@@ -439,11 +447,12 @@ void set_shadow_tex_params(unsigned &tid, bool is_array) {
 }
 
 
+bool has_leaf_wind() {return (num_trees > 0 && (display_mode & 0x0100) != 0 && (tree_mode & 1) != 0 && tree_deadness < 1.0 && vegetation > 0.0);}
+
 bool no_sparse_smap_update() {
 
 	if (world_mode != WMODE_GROUND) return 0;
-	bool const leaf_wind(num_trees > 0 && (display_mode & 0x0100) != 0 && (tree_mode & 1) != 0 && tree_deadness < 1.0 && vegetation > 0.0);
-	if (leaf_wind || !shadow_objs.empty() || platforms.any_active()) return 1;
+	if (has_leaf_wind() || !shadow_objs.empty() || platforms.any_active()) return 1;
 	//return !coll_objects.drawn_ids.empty();
 	//return !coll_objects.dynamic_ids.empty();
 	return 0;
@@ -460,7 +469,7 @@ bool smap_data_t::needs_update(point const &lpos) {
 bool ground_mode_smap_data_t::needs_update(point const &lpos) {
 
 	bool const has_dynamic(!is_allocated() || scene_smap_vbo_invalid || no_sparse_smap_update()); // Note: force two frames of updates the first time the smap is created by setting has_dynamic
-	bool const ret(smap_data_t::needs_update(lpos) || has_dynamic || last_has_dynamic || voxel_shadows_updated); // Note: see view clipping in indexed_vntc_vect_t<T>::render()
+	bool const ret(smap_data_t::needs_update(lpos) || has_dynamic || last_has_dynamic || voxel_shadows_updated || static_gen != static_smap_gen); // Note: see view clipping in indexed_vntc_vect_t<T>::render()
 	last_has_dynamic = has_dynamic;
 	return ret;
 }
@@ -547,28 +556,58 @@ void draw_mesh_shadow_pass(point const &lpos, unsigned smap_sz) {
 	fgPopMatrix();
 }
 
-void draw_outdoor_shadow_pass(point const &lpos, unsigned smap_sz) {
+void draw_outdoor_shadow_pass(point const &lpos, unsigned smap_sz, bool inc_trees=1) {
 
 	render_voxel_data(1);
 	if (snow_shadows) {draw_snow(1);} // slow
-	draw_trees(1); // shadow_only=1
+	if (inc_trees) {draw_trees(1);} // shadow_only=1
 	draw_scenery(1); // shadow_only=1
 	draw_mesh_shadow_pass(lpos, smap_sz);
 }
 
-void ground_mode_smap_data_t::render_scene_shadow_pass(point const &lpos) {
+// returns true if the static layer was re-rendered; must be called with the shadow map FBO bound
+bool ground_mode_smap_data_t::update_static_layer(point const &lpos, bool trees_are_dynamic) {
 
-	point const camera_pos_(camera_pos);
-	camera_pos = lpos;
-	vector3d const light_dir(-pdu.pos.get_norm()); // approximate as directional light; should be close enough for culling cube faces
+	// anything that changes which static casters are drawn or how they're drawn
+	unsigned const flags((trees_are_dynamic ? 1 : 0) | (snow_shadows ? 2 : 0) | ((display_mode & 0x01) ? 4 : 0) | ((ground_effects_level > 0) ? 8 : 0) | (tree_mode << 4));
+	// moving platforms update their cobjs in place, so treat them as invalidating the static layer every frame
+	bool const is_valid(static_tid != 0 && lpos == static_lpos && flags == static_flags && static_gen == static_smap_gen &&
+		!scene_smap_vbo_invalid && !voxel_shadows_updated && !platforms.any_active());
+	if (is_valid) return 0;
 
-	// add static objects
+	if (static_tid == 0) {
+		set_shadow_tex_params(static_tid, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, smap_sz, smap_sz, 0, GL_DEPTH_COMPONENT, SHADOW_MAP_DATATYPE, NULL);
+		free_fbo(static_fbo_id); // must be recreated for the new texture
+	}
+	enable_fbo(static_fbo_id, static_tid, 1, 0);
+	glClear(GL_DEPTH_BUFFER_BIT);
 	smap_vertex_cache.add_cobjs(smap_sz, 0, 0); // no VFC for static cobjs
 	smap_vertex_cache.render();
 	render_models(1, 0);
-	smap_vertex_cache.add_draw_dynamic(pdu, smap_sz, 0, camera_pos_, light_dir, 0.01);
-	draw_outdoor_shadow_pass(lpos, smap_sz); // add snow, trees, scenery, and mesh
+	draw_outdoor_shadow_pass(lpos, smap_sz, !trees_are_dynamic); // add snow, trees, scenery, and mesh
+	static_lpos  = lpos;
+	static_flags = flags;
+	static_gen   = static_smap_gen;
 	voxel_shadows_updated = 0;
+	return 1;
+}
+
+void ground_mode_smap_data_t::render_scene_shadow_pass(point const &lpos) {
+
+	point const camera_pos_(camera_pos);
+	camera_pos = lpos;
+	vector3d const light_dir(-pdu.pos.get_norm()); // approximate as directional light; should be close enough for culling cube faces
+	bool const trees_are_dynamic(has_leaf_wind());
+	update_static_layer(lpos, trees_are_dynamic);
+
+	// copy the static depth layer into the shadow map, then composite dynamic casters on top of it
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, static_fbo_id);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_id);
+	glBlitFramebuffer(0, 0, smap_sz, smap_sz, 0, 0, smap_sz, smap_sz, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	bind_fbo(fbo_id);
+	smap_vertex_cache.add_draw_dynamic(pdu, smap_sz, 0, camera_pos_, light_dir, 0.01);
+	if (trees_are_dynamic) {draw_trees(1);} // shadow_only=1
 	camera_pos = camera_pos_;
 }
 
@@ -684,7 +723,10 @@ void update_shadow_matrices() {
 
 void free_shadow_map_textures() {
 
-	for (unsigned l = 0; l < smap_data.size(); ++l) {smap_data[l].free_gl_state();}
+	for (unsigned l = 0; l < smap_data.size(); ++l) {
+		smap_data[l].free_gl_state();
+		smap_data[l].free_static_layer();
+	}
 	free_smap_vbo();
 	free_light_source_gl_state(); // free any shadow maps within light sources
 }
@@ -8,6 +8,7 @@
 #include "shaders.h"
 #include "draw_utils.h"
 #include "physics_objects.h" // for fire_elem_t
+#include <climits> // for INT_MAX
 
 
 bool const DYNAMIC_SMOKE     = 1; // looks cool
@@ -60,25 +61,71 @@ struct smoke_entry_t {
 	void update(short zval) {zmin = min(zmin, zval); zmax = max(zmax, short(zval+1));}
 };
 
-class smoke_grid_t {
-	vector<smoke_entry_t> zrng; // z smoke ranges for each xy grid element
+struct smoke_col_t {
+	smoke_entry_t zrng; // z range of cells with smoke
+	unsigned data_ix; // index of first z value in data; 0 = unallocated
+	smoke_col_t() : data_ix(0) {}
+};
+
+// sparse smoke volume stored separately from the lightmap; columns are allocated on first use and tracked with an active xy bounding rect
+class smoke_volume_t {
+	vector<smoke_col_t> cols; // one per xy grid element
+	vector<float> data; // MESH_SIZE[2] values per allocated column; data[0..zsize) is unused so that data_ix=0 can mean unallocated
+	int active[2][2]; // {x,y}x{lo,hi} range of columns with smoke, hi is exclusive
+	unsigned num_alloc_cols;
+
+	smoke_col_t &get_col(int x, int y) {assert(!point_outside_mesh(x, y)); return cols[y*MESH_X_SIZE + x];}
 public:
-	void ensure_zrng() {
-		if (zrng.empty()) {zrng.resize(XY_MULT_SIZE);} else {assert((int)zrng.size() == XY_MULT_SIZE);}
+	smoke_volume_t() : num_alloc_cols(0) {clear_active();}
+	void ensure_cols() {
+		if (cols.empty()) {cols.resize(XY_MULT_SIZE); data.resize(MESH_SIZE[2], 0.0);} else {assert((int)cols.size() == XY_MULT_SIZE);}
+	}
+	void clear() {cols.clear(); data.clear(); num_alloc_cols = 0; clear_active();}
+	void clear_active() {active[0][0] = active[1][0] = INT_MAX; active[0][1] = active[1][1] = 0;}
+	bool has_active() const {return (active[0][0] < active[0][1] && active[1][0] < active[1][1]);}
+	int get_active(unsigned dim, unsigned hi) const {return active[dim][hi];}
+	unsigned get_num_alloc_cols() const {return num_alloc_cols;}
+	size_t get_mem_usage() const {return (cols.capacity()*sizeof(smoke_col_t) + data.capacity()*sizeof(float));}
+
+	void expand_active(int const bnds[2][2]) {
+		for (unsigned d = 0; d < 2; ++d) {active[d][0] = min(active[d][0], bnds[d][0]); active[d][1] = max(active[d][1], bnds[d][1]);}
+	}
+	// Note: not thread safe, since data may be reallocated; must only be called from the main thread outside of distribute_smoke()
+	float *alloc_column(int x, int y) {
+		ensure_cols();
+		if (!lmap_manager.has_column(x, y)) return nullptr; // no smoke where there's no lightmap (and no flow)
+		smoke_col_t &col(get_col(x, y));
+
+		if (col.data_ix == 0) {
+			col.data_ix = (unsigned)data.size();
+			data.resize(data.size() + MESH_SIZE[2], 0.0);
+			++num_alloc_cols;
+		}
+		return &data[col.data_ix];
+	}
+	float *get_column(int x, int y) {
+		if (cols.empty()) return nullptr;
+		unsigned const ix(get_col(x, y).data_ix);
+		return (ix ? &data[ix] : nullptr);
 	}
-	void register_smoke(int x, int y, int z) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		zrng[y*MESH_X_SIZE + x].update(z);
+	float const *get_column(int x, int y) const {return const_cast<smoke_volume_t *>(this)->get_column(x, y);}
+	smoke_entry_t &get_z_range(int x, int y) {ensure_cols(); return get_col(x, y).zrng;}
+
+	void register_smoke(int x, int y, int z, int bnds[2][2]) { // thread safe if bnds is thread local and x,y rows are partitioned across threads
+		get_z_range(x, y).update(z);
+		bnds[0][0] = min(bnds[0][0], x); bnds[0][1] = max(bnds[0][1], x+1);
+		bnds[1][0] = min(bnds[1][0], y); bnds[1][1] = max(bnds[1][1], y+1);
 	}
-	smoke_entry_t &get_z_range(int x, int y) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		return zrng[y*MESH_X_SIZE + x];
+	void register_smoke(int x, int y, int z) {register_smoke(x, y, z, active);}
+
+	void alloc_border(int x1, int y1, int x2, int y2) { // allocate columns that smoke can diffuse into before the parallel step
+		for (int y = max(y1, 0); y < min(y2, MESH_Y_SIZE); ++y) {
+			for (int x = max(x1, 0); x < min(x2, MESH_X_SIZE); ++x) {alloc_column(x, y);}
+		}
 	}
 };
 
-smoke_grid_t smoke_grid;
+smoke_volume_t smoke_vol;
 
 
 struct smoke_manager {
@@ -104,12 +151,16 @@ struct smoke_manager {
 
 		if (is_smoke_visible(pos) && check_smoke_bounds(pos)) {
 			bbox.union_with_pt(pos);
-			cur_smoke_bb.union_with_pt(pos);
 			smoke_vis = 1;
 		}
 		tot_smoke += smoke_amt;
 		enabled    = 1;
 	}
+	void merge_with(smoke_manager const &sm) {
+		if (sm.smoke_vis) {bbox.union_with_cube(sm.bbox); smoke_vis = 1;}
+		tot_smoke += sm.tot_smoke;
+		enabled   |= sm.enabled;
+	}
 	void adj_bbox() {
 		for (unsigned i = 0; i < 3; ++i) {
 			float const dval(SCENE_SIZE[i]/MESH_SIZE[i]);
@@ -127,58 +178,112 @@ inline void adjust_smoke_val(float &val, float delta) {val = max(0.0f, min(SMOKE
 void add_smoke(point const &pos, float val) {
 
 	if (!DYNAMIC_SMOKE || (display_mode & 0x80) || !game_mode || val == 0.0 || pos.z >= czmax) return;
-	lmcell *const lmc(lmap_manager.get_lmcell(pos));
-	if (!lmc) return;
-	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y));
+	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y)), zpos(get_zpos(pos.z));
+	if (!lmap_manager.is_valid_cell(xpos, ypos, zpos)) return;
 	if (point_outside_mesh(xpos, ypos) || pos.z >= v_collision_matrix[ypos][xpos].zmax || pos.z < mesh_height[ypos][xpos]) return; // above all cobjs/outside
 	if (no_smoke_over_mesh && !is_mesh_disabled(xpos, ypos)) return;
 	if (!check_smoke_bounds(pos)) return;
 	//if (!check_coll_line(pos, point(pos.x, pos.y, czmax), cindex, -1, 1, 0)) return; // too slow
-	adjust_smoke_val(lmc->smoke, SMOKE_DENSITY*val);
+	float *const col(smoke_vol.alloc_column(xpos, ypos));
+	if (!col) return;
+	adjust_smoke_val(col[zpos], SMOKE_DENSITY*val);
 	smoke_exists |= smoke_man.is_smoke_visible(pos);
-	smoke_grid.register_smoke(xpos, ypos, get_zpos(pos.z));
+	smoke_vol.register_smoke(xpos, ypos, zpos);
 }
 
-void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int dir) {
+
+struct smoke_thread_state_t {
+	int bnds[2][2]; // active columns written by this thread
+	smoke_manager sman;
+	smoke_thread_state_t() {bnds[0][0] = bnds[1][0] = INT_MAX; bnds[0][1] = bnds[1][1] = 0;}
+};
+
+void diffuse_smoke_xy(int x, int y, int z, float &adj_smoke, unsigned char const adj_flow[3], float rate, int dim, int dir, smoke_thread_state_t &ts) {
 
 	float delta(0.0); // Note: not using fticks due to instability
-	lmcell *vldata(point_outside_mesh(x, y) ? nullptr : lmap_manager.get_column(x, y));
+	bool const has_lmap(!point_outside_mesh(x, y) && lmap_manager.has_column(x, y));
+	float *const sdata(has_lmap ? smoke_vol.get_column(x, y) : nullptr); // allocated by alloc_border() if the lmap column is valid
 
-	if (vldata) {
-		lmcell &lmc(vldata[z]);
-		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
+	if (sdata) {
+		unsigned char const flow(dir ? adj_flow[dim] : lmap_manager.get_flow(x, y, z, dim));
 		if (flow == 0) return;
-		float const cur_smoke(lmc.smoke);
-		delta  = rate*(flow/255.0f)*(adj.smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
-		adjust_smoke_val(lmc.smoke, delta);
-		delta  = (lmc.smoke - cur_smoke); // actual change
-		if (lmc.smoke > 0.0) {smoke_grid.register_smoke(x, y, z);}
+		float &smoke(sdata[z]);
+		float const cur_smoke(smoke);
+		delta  = rate*(flow/255.0f)*(adj_smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
+		adjust_smoke_val(smoke, delta);
+		delta  = (smoke - cur_smoke); // actual change
+		if (smoke > 0.0) {smoke_vol.register_smoke(x, y, z, ts.bnds);}
 	}
 	else { // edge cell has infinite smoke capacity and zero total smoke
 		delta = rate;
 	}
-	adjust_smoke_val(adj.smoke, -delta);
+	adjust_smoke_val(adj_smoke, -delta);
 }
 
-void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell *vldata, float pos_rate, float neg_rate, int dim, int dir) {
+void diffuse_smoke_z(int x, int y, int z, float &adj_smoke, unsigned char const adj_flow[3], float *sdata, float pos_rate, float neg_rate, int dim, int dir, smoke_thread_state_t &ts) {
 
 	float delta(0.0); // Note: not using fticks due to instability
 
 	if (z >= 0 && z < MESH_SIZE[2]) {
-		lmcell &lmc(vldata[z]);
-		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
+		unsigned char const flow(dir ? adj_flow[dim] : lmap_manager.get_flow(x, y, z, dim));
 		if (flow == 0) return;
-		float const cur_smoke(lmc.smoke);
-		delta  = (flow/255.0f)*(adj.smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
+		float &smoke(sdata[z]);
+		float const cur_smoke(smoke);
+		delta  = (flow/255.0f)*(adj_smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
 		delta *= ((delta < 0.0) ? neg_rate : pos_rate);
-		adjust_smoke_val(lmc.smoke, delta);
-		delta  = (lmc.smoke - cur_smoke); // actual change
-		if (lmc.smoke > 0.0) {smoke_grid.register_smoke(x, y, z);}
+		adjust_smoke_val(smoke, delta);
+		delta  = (smoke - cur_smoke); // actual change
+		if (smoke > 0.0) {smoke_vol.register_smoke(x, y, z, ts.bnds);}
 	}
 	else { // edge cell has infinite smoke capacity and zero total smoke
 		delta = 0.5f*(pos_rate + neg_rate);
 	}
-	adjust_smoke_val(adj.smoke, -delta);
+	adjust_smoke_val(adj_smoke, -delta);
+}
+
+void distribute_smoke_row(int y, int x1, int x2, int dx, int dy, smoke_thread_state_t &ts) {
+
+	// rates are per frame, since every active row is now processed each frame (was once every SMOKE_SKIPVAL frames)
+	float const xy_rate(SMOKE_DIS_XY), zu_rate(SMOKE_DIS_ZU/SMOKE_SKIPVAL), zd_rate(SMOKE_DIS_ZD/SMOKE_SKIPVAL);
+
+	for (int x = x1; x < x2; ++x) {
+		if (!lmap_manager.has_column(x, y)) continue;
+		float *const sdata(smoke_vol.get_column(x, y));
+		if (sdata == nullptr) continue;
+		smoke_entry_t &zrange(smoke_vol.get_z_range(x, y));
+		if (!zrange.valid()) continue;
+		bool any_z_has_smoke(0);
+		int const zmin(zrange.zmin), zmax(zrange.zmax); // zrange may be expanded during iteration
+
+		for (int z = zmin; z < zmax; ++z) {
+			float &smoke(sdata[z]);
+			if (smoke < SMOKE_THRESH) {smoke = 0.0;}
+			if (smoke == 0.0) continue;
+			ts.sman.add_smoke(x, y, z, smoke);
+			unsigned char lmc[3]; // flow for this cell
+			UNROLL_3X(lmc[i_] = lmap_manager.get_flow(x, y, z, i_);)
+
+			if (dx) {
+				diffuse_smoke_xy(x+1, y, z, smoke, lmc, xy_rate, 0, 1, ts);
+				diffuse_smoke_xy(x-1, y, z, smoke, lmc, xy_rate, 0, 0, ts);
+			} else {
+				diffuse_smoke_xy(x-1, y, z, smoke, lmc, xy_rate, 0, 0, ts);
+				diffuse_smoke_xy(x+1, y, z, smoke, lmc, xy_rate, 0, 1, ts);
+			}
+			if (dy) {
+				diffuse_smoke_xy(x, y+1, z, smoke, lmc, xy_rate, 1, 1, ts);
+				diffuse_smoke_xy(x, y-1, z, smoke, lmc, xy_rate, 1, 0, ts);
+			} else {
+				diffuse_smoke_xy(x, y-1, z, smoke, lmc, xy_rate, 1, 0, ts);
+				diffuse_smoke_xy(x, y+1, z, smoke, lmc, xy_rate, 1, 1, ts);
+			}
+			diffuse_smoke_z(x, y, (z - 1), smoke, lmc, sdata, zd_rate, zu_rate, 2, 0, ts);
+			diffuse_smoke_z(x, y, (z + 1), smoke, lmc, sdata, zu_rate, zd_rate, 2, 1, ts);
+			if (smoke > 0.0) {smoke_vol.register_smoke(x, y, z, ts.bnds);}
+			any_z_has_smoke = 1;
+		} // for z
+		if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
+	} // for x
 }
 
 
@@ -186,64 +291,36 @@ void distribute_smoke() { // called at most once per frame
 
 	//RESET_TIME;
 	if (!DYNAMIC_SMOKE || !smoke_exists || !animate2) return;
-	assert(SMOKE_SKIPVAL > 0);
-	static int cur_skip(0);
 	static rand_gen_t rgen;
-	
-	if (cur_skip == 0) {
-		//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << endl;
-		smoke_man     = next_smoke_man;
-		smoke_man.adj_bbox();
-		smoke_visible = smoke_man.smoke_vis;
-		smoke_exists  = smoke_man.enabled;
-		next_smoke_man.reset();
-	}
-	/*if ((display_mode & 0x10) && !smoke_bounds.empty()) {
-		cur_smoke_bb = smoke_bounds[0];
-		for (vector<cube_t>::const_iterator i = smoke_bounds.begin()+1; i != smoke_bounds.end(); ++i) {cur_smoke_bb.union_with_cube(*i);}
-	}*/
-	float const xy_rate(SMOKE_DIS_XY*SMOKE_SKIPVAL);
+	//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << ", cols: " << smoke_vol.get_num_alloc_cols() << endl;
+	smoke_man     = next_smoke_man;
+	smoke_man.adj_bbox();
+	smoke_visible = smoke_man.smoke_vis;
+	smoke_exists  = smoke_man.enabled;
+	if (smoke_man.smoke_vis) {cur_smoke_bb.union_with_cube(smoke_man.bbox);}
+	next_smoke_man.reset();
+	if (!smoke_vol.has_active()) return;
+	// only process the active region, plus a border of one cell that smoke can diffuse into
+	int const x1(smoke_vol.get_active(0, 0)), x2(smoke_vol.get_active(0, 1)), y1(smoke_vol.get_active(1, 0)), y2(smoke_vol.get_active(1, 1));
+	smoke_vol.alloc_border(x1-1, y1-1, x2+1, y2+1);
+	smoke_vol.clear_active(); // will be recomputed during diffusion
 	int const dx(rgen.rand() & 1), dy(rgen.rand() & 1); // randomize the processing order
-	
-	// openmp doesn't really help here
-	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
-		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			lmcell *vldata(lmap_manager.get_column(x, y));
-			if (vldata == NULL) continue;
-			smoke_entry_t &zrange(smoke_grid.get_z_range(x, y));
-			//smoke_entry_t zrange; zrange.zmin = 0; zrange.zmax = MESH_Z_SIZE;
-			if (!zrange.valid()) continue;
-			bool any_z_has_smoke(0);
-			
-			for (int z = zrange.zmin; z < zrange.zmax; ++z) {
-				lmcell &lmc(vldata[z]);
-				if (lmc.smoke < SMOKE_THRESH) {lmc.smoke = 0.0;}
-				if (lmc.smoke == 0.0) continue;
-				//if (get_zval(z) > v_collision_matrix[y][x].zmax) {lmc.smoke = 0.0; continue;} // open space above - smoke goes up
-				next_smoke_man.add_smoke(x, y, z, lmc.smoke);
-
-				if (dx) {
-					diffuse_smoke_xy(x+1, y, z, lmc, xy_rate, 0, 1);
-					diffuse_smoke_xy(x-1, y, z, lmc, xy_rate, 0, 0);
-				} else {
-					diffuse_smoke_xy(x-1, y, z, lmc, xy_rate, 0, 0);
-					diffuse_smoke_xy(x+1, y, z, lmc, xy_rate, 0, 1);
-				}
-				if (dy) {
-					diffuse_smoke_xy(x, y+1, z, lmc, xy_rate, 1, 1);
-					diffuse_smoke_xy(x, y-1, z, lmc, xy_rate, 1, 0);
-				} else {
-					diffuse_smoke_xy(x, y-1, z, lmc, xy_rate, 1, 0);
-					diffuse_smoke_xy(x, y+1, z, lmc, xy_rate, 1, 1);
-				}
-				diffuse_smoke_z(x, y, (z - 1), lmc, vldata, SMOKE_DIS_ZD, SMOKE_DIS_ZU, 2, 0);
-				diffuse_smoke_z(x, y, (z + 1), lmc, vldata, SMOKE_DIS_ZU, SMOKE_DIS_ZD, 2, 1);
-				any_z_has_smoke = 1;
-			} // for z
-			if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
-		} // for x
-	} // for y
-	cur_skip = (cur_skip+1) % SMOKE_SKIPVAL;
+	// rows are partitioned into slabs, and even and odd slabs are processed in two passes so that no two threads update adjacent rows;
+	// slabs are along y rather than z because smoke columns are contiguous in z
+	int const slab_sz(4), num_slabs((y2 - y1 + slab_sz - 1)/slab_sz);
+	vector<smoke_thread_state_t> tstate(omp_get_max_threads_3dw());
+
+	for (int pass = 0; pass < 2; ++pass) {
+#pragma omp parallel for schedule(dynamic,1) if (num_slabs > 2)
+		for (int s = pass; s < num_slabs; s += 2) {
+			smoke_thread_state_t &ts(tstate[omp_get_thread_num_3dw()]);
+			for (int y = y1 + s*slab_sz; y < min(y2, y1 + (s+1)*slab_sz); ++y) {distribute_smoke_row(y, x1, x2, dx, dy, ts);}
+		}
+	}
+	for (auto i = tstate.begin(); i != tstate.end(); ++i) { // merge thread local state
+		smoke_vol.expand_active(i->bnds);
+		next_smoke_man.merge_with(i->sman);
+	}
 	//PRINT_TIME("Distribute Smoke");
 }
 
@@ -254,12 +331,13 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	if (!lmap_manager.has_column(x, y)) return 0.0;
+	float const *const sdata(smoke_vol.get_column(x, y));
+	return ((sdata == nullptr) ? 0.0 : sdata[z]);
 }
 
 
-void reset_smoke_tex_data() {smoke_tex_data.clear();}
+void reset_smoke_tex_data() {smoke_tex_data.clear(); smoke_vol.clear();}
 
 
 #define CLEAR_Z_RANGE(z1, z2) for (int z = z1; z < (int)z2; ++z) {data[4*(off + z)+3] = 0;}
@@ -272,10 +350,13 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 	bool const do_lighting(update_lighting || lmap_manager.was_updated);
 	colorRGB default_color;
 	default_lmc.get_final_color(default_color, 1.0);
+	vector<lmcell> col_buf; // used for decoding compact lightmaps
 
 	for (unsigned x = x_start; x < x_end; ++x) {
-		lmcell const *const vlm(lmap_manager.get_column(x, y));
-		if (vlm == NULL && !update_lighting) continue; // x/y pairs that get into here should also be constant
+		bool const has_col(lmap_manager.has_column(x, y));
+		if (!has_col && !update_lighting) continue; // x/y pairs that get into here should also be constant
+		float const *const sdata(has_col ? smoke_vol.get_column(x, y) : nullptr);
+		lmcell const *const vlm((has_col && do_lighting) ? lmap_manager.get_column_ro(x, y, col_buf) : nullptr);
 		unsigned const off(zsize*(y*MESH_X_SIZE + x));
 		bool const check_z_thresh((display_mode & 0x01) && !is_mesh_disabled(x, y));
 		float const mh(mesh_height[y][x]);
@@ -287,7 +368,7 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 			}
 		}
 		else { // update smoke only
-			smoke_entry_t const &zrange(smoke_grid.get_z_range(x, y));
+			smoke_entry_t const &zrange(smoke_vol.get_z_range(x, y));
 			
 			if (!zrange.valid()) { // no smoke in this row
 				CLEAR_Z_RANGE(z_start, z_end);
@@ -300,8 +381,8 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 		}
 		for (unsigned z = z_start; z < z_end; ++z) {
 			unsigned const off2(ncomp*(off + z));
-			if (vlm == NULL || vlm[z].smoke == 0.0) {data[off2+3] = 0;}
-			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*vlm[z].smoke));} // alpha: smoke
+			if (sdata == NULL || sdata[z] == 0.0) {data[off2+3] = 0;}
+			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*sdata[z]));} // alpha: smoke
 			if (!do_lighting) continue; // lighting not needed
 				
 			if (check_z_thresh && get_zval(z+1) < mh) { // adjust by one because GPU will interpolate the texel
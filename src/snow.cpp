@@ -6,6 +6,13 @@
 #include "gl_ext_arb.h"
 #include "shaders.h"
 #include "model3d.h"
+#include <unordered_map>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 unsigned const VOXELS_PER_DIV = 8; // 1024 for 128 vertex mesh
@@ -72,6 +79,7 @@ struct voxel_t {
 		return (p[2] < v.p[2]);
 	}
 	bool operator==(voxel_t const &v) const {return (p[0] == v.p[0] && p[1] == v.p[1] && p[2] == v.p[2]);}
+	unsigned long long get_key() const {return ((((unsigned long long)(unsigned short)p[0]) << 32) | (((unsigned long long)(unsigned short)p[1]) << 16) | (unsigned short)p[2]);}
 };
 
 
@@ -80,6 +88,7 @@ struct voxel_z_pair {
 	zval_avg z;
 	voxel_z_pair() {}
 	voxel_z_pair(voxel_t const &v_, zval_avg const &z_=zval_avg()) : v(v_), z(z_) {}
+	bool operator<(voxel_z_pair const &vz) const {return (v < vz.v);}
 };
 
 
@@ -230,8 +239,22 @@ public:
 };
 
 
-class voxel_map : public map<voxel_t, zval_avg> { // must be a sorted map
+// flat array of voxels sorted by {x, y, z}; removed entries are marked with a zero count rather than erased
+class voxel_map {
+	vector<voxel_z_pair> data;
+	size_t first_valid, num_valid;
+
+	void remove(size_t ix) {assert(data[ix].z.valid()); data[ix].z.c = 0; --num_valid;}
 public:
+	voxel_map() : first_valid(0), num_valid(0) {}
+	size_t size() const {return num_valid;}
+	bool  empty() const {return (num_valid == 0);}
+	void  clear() {data.clear(); first_valid = num_valid = 0;}
+	void swap(voxel_map &m) {data.swap(m.data); std::swap(first_valid, m.first_valid); std::swap(num_valid, m.num_valid);}
+	void reserve(size_t sz) {data.reserve(sz);}
+	void add_unsorted(voxel_t const &v, zval_avg const &z) {data.emplace_back(v, z); ++num_valid;} // must call sort_and_merge() before queries
+	void sort_and_merge();
+	voxel_z_pair pop_front();
 	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map=NULL);
 	bool read(char const *const fn);
 	bool write(char const *const fn) const;
@@ -243,18 +266,53 @@ struct data_block { // packed voxel_z_pair for read/write
 	count_type c;
 	float z;
 
-	void add_to_map(voxel_map &vmap) const {
-		voxel_t v;
-		for (unsigned i = 0; i < 3; ++i) v.p[i] = p[i];
-		vmap[v] = zval_avg(c, z);
-	}
-	void set_from_map_iter(voxel_map::const_iterator it) {
-		for (unsigned i = 0; i < 3; ++i) p[i] = it->first.p[i];
-		c = it->second.c;
-		z = it->second.z;
+	voxel_z_pair get_voxel_z_pair() const {return voxel_z_pair(voxel_t(p[0], p[1], p[2]), zval_avg(c, z));}
+
+	void set_from_voxel_z_pair(voxel_z_pair const &vz) {
+		for (unsigned i = 0; i < 3; ++i) p[i] = vz.v.p[i];
+		c = vz.z.c;
+		z = vz.z.z;
 	}
 };
 
+unsigned const SNOW_FILE_MAGIC   = 0x574F4E53; // "SNOW"
+unsigned const SNOW_FILE_VERSION = 2; // version 1 is the original unversioned format
+
+struct snow_file_header {
+	unsigned magic, version, elem_size, num_voxels;
+	float vox_delta[3];
+};
+
+
+void voxel_map::sort_and_merge() { // sort by voxel and combine the counts and zvals of duplicates
+
+	std::sort(data.begin(), data.end());
+	size_t o(0);
+
+	for (size_t i = 0; i < data.size(); ++i) {
+		if (!data[i].z.valid()) continue; // skip removed
+		if (o > 0 && data[o-1].v == data[i].v) { // merge
+			zval_avg &z(data[o-1].z);
+			unsigned const c(z.c + data[i].z.c);
+			float const zsum(z.z + data[i].z.z);
+			z.c = (count_type)min(c, MAX_COUNT);
+			z.z = ((c > MAX_COUNT) ? zsum*MAX_COUNT/c : zsum); // clamp while keeping the average
+		}
+		else {data[o++] = data[i];}
+	}
+	data.resize(o);
+	first_valid = 0;
+	num_valid   = o;
+}
+
+voxel_z_pair voxel_map::pop_front() {
+
+	assert(!empty());
+	while (!data[first_valid].z.valid()) {++first_valid; assert(first_valid < data.size());}
+	voxel_z_pair const ret(data[first_valid]);
+	remove(first_valid++);
+	return ret;
+}
 
 // this tends to take a large fraction of the preprocessing time
 zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map) {
@@ -264,17 +322,18 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 	voxel_t v2_s(v), v2_e(v);
 	v2_s.p[2] -= min(Z_CHECK_RANGE, (int)v2_s.p[2]);
 	v2_e.p[2] += Z_CHECK_RANGE+1; // one past the end
+	auto it(std::lower_bound(data.begin()+first_valid, data.end(), voxel_z_pair(v2_s)));
 
-	for (iterator it = lower_bound(v2_s); it != end() && it->first < v2_e;) { // Note: no increment of it
-		zval_avg const z2(it->second);
-		assert(z2.valid());
-		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) {++it; continue;} // delta z too large
-		voxel_t const v2(it->first);
+	for (; it != data.end() && it->v < v2_e; ++it) {
+		zval_avg const z2(it->z);
+		if (!z2.valid()) continue; // removed
+		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) continue; // delta z too large
+		voxel_t const v2(it->v);
 
 		if (cur_x_map) {
-			erase(it++);
-			(*cur_x_map)[v2] = z2;
-		} else {++it;}
+			remove(it - data.begin());
+			cur_x_map->add_unsorted(v2, z2);
+		}
 		coord_type const dz(v2.p[2] - v.p[2]);
 		if (!res.valid() || abs(dz) < abs(best_dz)) {best_dz = dz;}
 		res.c += z2.c;
@@ -291,19 +350,61 @@ bool voxel_map::read(char const *const fn) {
 	assert(fn != NULL);
 	if (!open_file(fp, fn, "snow map", "rb")) return 0;
 	cout << "Reading snow file from " << fn << endl;
-	size_t const n(fread(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
-	unsigned map_size(0);
-	size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
-	assert(sz_read == 1);
+	snow_file_header header;
+	size_t const nh(fread(&header, sizeof(snow_file_header), 1, fp));
+	clear();
+
+	if (nh != 1 || header.magic != SNOW_FILE_MAGIC) { // original unversioned format: {vox_delta, map_size, data_blocks}
+		fseek(fp, 0, SEEK_SET);
+		size_t const n(fread(&vox_delta, sizeof(float), 3, fp));
+		assert(n == 3);
+		unsigned map_size(0);
+		size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
+		assert(sz_read == 1);
+		data.resize(map_size);
 	
-	for (unsigned i = 0; i < map_size; ++i) {
-		data_block data;
-		size_t const nr(fread(&data, sizeof(data_block), 1, fp));
-		assert(nr == 1);
-		data.add_to_map(*this);
+		for (unsigned i = 0; i < map_size; ++i) {
+			data_block block;
+			size_t const nr(fread(&block, sizeof(data_block), 1, fp));
+			assert(nr == 1);
+			data[i] = block.get_voxel_z_pair();
+		}
+		checked_fclose(fp);
+		sort_and_merge();
+		return 1;
+	}
+	if (header.version != SNOW_FILE_VERSION || header.elem_size != sizeof(data_block)) {
+		cerr << "Error: Unsupported snow file version " << header.version << " in " << fn << endl;
+		checked_fclose(fp);
+		return 0;
+	}
+	vox_delta.assign(header.vox_delta[0], header.vox_delta[1], header.vox_delta[2]);
+	data.resize(header.num_voxels);
+	size_t const data_size(header.num_voxels*sizeof(data_block));
+	bool read_ok(0);
+#ifndef _WIN32
+	// map the file into memory rather than reading it in small blocks
+	size_t const file_size(sizeof(snow_file_header) + data_size);
+	struct stat fs;
+	bool const size_ok(fstat(fileno(fp), &fs) == 0 && size_t(fs.st_size) >= file_size); // don't map past the end of a truncated file
+	void const *const mem(size_ok ? mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0) : MAP_FAILED);
+
+	if (mem != MAP_FAILED) {
+		data_block const *const blocks((data_block const *)((char const *)mem + sizeof(snow_file_header)));
+		for (unsigned i = 0; i < header.num_voxels; ++i) {data[i] = blocks[i].get_voxel_z_pair();}
+		munmap((void *)mem, file_size);
+		read_ok = 1;
+	}
+#endif
+	if (!read_ok) { // read the data in a single block
+		vector<data_block> blocks(header.num_voxels);
+		size_t const nr(blocks.empty() ? 0 : fread(blocks.data(), data_size, 1, fp));
+		assert(blocks.empty() || nr == 1);
+		for (unsigned i = 0; i < header.num_voxels; ++i) {data[i] = blocks[i].get_voxel_z_pair();}
 	}
 	checked_fclose(fp);
+	num_valid = data.size(); // written in sorted order
+	first_valid = 0;
 	return 1;
 }
 
@@ -314,18 +415,24 @@ bool voxel_map::write(char const *const fn) const {
 	assert(fn != NULL);
 	if (!open_file(fp, fn, "snow map", "wb")) return 0;
 	cout << "Writing snow file to " << fn << endl;
-	size_t const n(fwrite(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
-	unsigned const map_size((unsigned)size()); // should be size_t?
-	size_t const sz_write(fwrite(&map_size, sizeof(map_size), 1, fp));
-	assert(sz_write == 1);
-
-	for (const_iterator i = begin(); i != end(); ++i) {
-		data_block data;
-		data.set_from_map_iter(i);
-		size_t const nw(fwrite(&data, sizeof(data_block), 1, fp));
-		assert(nw == 1);
+	snow_file_header header;
+	header.magic      = SNOW_FILE_MAGIC;
+	header.version    = SNOW_FILE_VERSION;
+	header.elem_size  = sizeof(data_block);
+	header.num_voxels = (unsigned)size();
+	UNROLL_3X(header.vox_delta[i_] = vox_delta[i_];)
+	size_t const nh(fwrite(&header, sizeof(snow_file_header), 1, fp));
+	assert(nh == 1);
+	vector<data_block> blocks;
+	blocks.reserve(size());
+
+	for (auto i = data.begin()+first_valid; i != data.end(); ++i) {
+		if (!i->z.valid()) continue; // removed
+		blocks.push_back(data_block());
+		blocks.back().set_from_voxel_z_pair(*i);
 	}
+	size_t const nw(blocks.empty() ? 1 : fwrite(blocks.data(), blocks.size()*sizeof(data_block), 1, fp));
+	assert(nw == 1);
 	checked_fclose(fp);
 	return 1;
 }
@@ -494,10 +601,14 @@ void create_snow_map(voxel_map &vmap) {
 	float const xscale(2.0*X_SCENE_SIZE/num_per_dim), yscale(2.0*Y_SCENE_SIZE/num_per_dim);
 	all_models.build_cobj_trees(1);
 	cout << "Snow accumulation progress (out of " << num_per_dim << "):     0";
+	// each thread accumulates snow hits into its own hash grid, which are merged at the end
+	typedef std::unordered_map<unsigned long long, voxel_z_pair> voxel_hash_map_t;
+	vector<voxel_hash_map_t> thread_maps(omp_get_max_threads_3dw());
 
 #pragma omp parallel for schedule(dynamic,1)
 	for (int y = 0; y < num_per_dim; ++y) {
 		if (omp_get_thread_num_3dw() == 0) {increment_printed_number(y);} // progress for thread 0
+		voxel_hash_map_t &tmap(thread_maps[omp_get_thread_num_3dw()]);
 		rand_gen_t rgen;
 		rgen.set_state(123, y);
 
@@ -537,12 +648,22 @@ void create_snow_map(voxel_map &vmap) {
 			} // end while
 			if (!invalid) {
 				voxel_t const voxel(pos2);
-#pragma omp critical(snow_map_update)
-				vmap[voxel].update(pos2.z);
+				auto it(tmap.find(voxel.get_key()));
+				if (it == tmap.end()) {it = tmap.insert(make_pair(voxel.get_key(), voxel_z_pair(voxel))).first;}
+				it->second.z.update(pos2.z);
 			}
 		} // for x
 	} // for y
 	cout << endl;
+	size_t num_entries(0);
+	for (auto m = thread_maps.begin(); m != thread_maps.end(); ++m) {num_entries += m->size();}
+	vmap.reserve(num_entries);
+
+	for (auto m = thread_maps.begin(); m != thread_maps.end(); ++m) {
+		for (auto i = m->begin(); i != m->end(); ++i) {vmap.add_unsorted(i->second.v, i->second.z);}
+		voxel_hash_map_t().swap(*m); // free memory
+	}
+	vmap.sort_and_merge();
 }
 
 
@@ -568,20 +689,20 @@ void create_snow_strips(voxel_map &vmap) {
 	snow_strips.reserve(8*num_xy_voxels/MAX_STRIP_LEN); // should be more than enough
 
 	while (!vmap.empty()) {
-		pair<voxel_t, zval_avg> start(*vmap.begin());
-		voxel_t v1(start.first);
-		zval_avg zv(start.second);
+		voxel_z_pair const start(vmap.pop_front());
+		voxel_t v1(start.v);
+		zval_avg zv(start.z);
 		assert(zv.valid());
 
 		if (v1.p[0] != last_x) { // we moved on to the next x-value, so update the x maps
 			last_x = v1.p[0];
 			last_x_map.clear();
 			cur_x_map.swap(last_x_map);
+			last_x_map.sort_and_merge(); // entries were added out of order
 			bool const did_ins(x_strip_map.insert(make_pair(last_x, (unsigned)snow_strips.size())).second);
-			assert(did_ins); // map should guarantee strictly increasing x
+			assert(did_ins); // sorted array should guarantee strictly increasing x
 		}
-		vmap.erase(vmap.begin());
-		cur_x_map[v1] = zv;
+		cur_x_map.add_unsorted(v1, zv);
 		vs.resize(0);
 		--v1.p[1];
 		vs.push_back(voxel_z_pair(v1)); // zero start
@@ -7,6 +7,7 @@
 #include "shaders.h"
 #include "openal_wrap.h"
 #include "heightmap.h"
+#include "vertex_opt.h"
 
 
 bool const DEBUG_TILES        = 0;
@@ -17,6 +18,7 @@ bool const USE_PARAMS_HSCALE  = 0;
 int  const DITHER_NOISE_TEX   = NOISE_GEN_TEX;//PS_NOISE_TEX
 unsigned const NORM_TEXELS    = 512;
 unsigned const TILE_SMAP_START_TU_ID = 13;
+unsigned const TILE_STRIP_BAND_CELLS = 16; // 34 verts per strip row, close to the size of a typical post-transform cache
 float const FOG_DIST_TILES    = 1.45;
 float const DRAW_DIST_TILES   = 1.5;
 float const CREATE_DIST_TILES = 1.6;
@@ -28,6 +30,8 @@ float const GRASS_THRESH      = 1.6;
 float const SMAP_NEW_THRESH   = 1.2;
 float const SMAP_DEL_THRESH   = 1.3;
 float const SMAP_FADE_THRESH  = 1.5;
+float const SMAP_ALWAYS_UPDATE_DIST = 0.5; // stale tile shadow maps closer than this are always updated
+unsigned const MAX_STALE_SMAP_UPDATES = 4; // max number of other stale tile shadow maps updated per frame
 float const OCCLUDER_DIST     = 0.2;
 float const FLOWER_REL_DIST   = 0.9; // flower view distance relative to grass view distance
 
@@ -51,8 +55,9 @@ tile_offset_t model3d_offset;
 
 extern bool inf_terrain_scenery, enable_tiled_mesh_ao, underwater, fog_enabled, volume_lighting, combined_gu, enable_depth_clamp, tt_triplanar_tex, use_grass_tess;
 extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, flashlight_on;
+extern bool vert_opt_flags[3];
 extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks;
-extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_effects_level, animate2, iticks, num_trees, window_width, window_height;
+extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_effects_level, animate2, iticks, num_trees, window_width, window_height, frame_counter;
 extern int invert_mh_image, is_cloudy, camera_surf_collide, show_fog, mesh_gen_mode, mesh_gen_shape, cloud_model, precip_mode, auto_time_adv;
 extern float zmax, zmin, water_plane_z, mesh_scale, mesh_scale_z, vegetation, relh_adj_tex, grass_length, grass_width, fticks, cloud_height_offset, clouds_per_tile;
 extern float ocean_wave_height, sm_tree_density, tree_density_thresh, atmosphere, cloud_cover, temperature, flower_density, FAR_CLIP, shadow_map_pcf_offset, biome_x_offset;
@@ -876,6 +881,16 @@ unsigned calc_max_smap_lod() {
 	return lod_level;
 }
 
+bool tile_shadow_map_manager::take_stale_update() { // limits the number of stale shadow maps updated per frame to avoid spikes when the sun moves
+	if (budget_frame != frame_counter) {
+		budget_frame       = frame_counter;
+		stale_updates_left = MAX_STALE_SMAP_UPDATES;
+	}
+	if (stale_updates_left == 0) return 0;
+	--stale_updates_left;
+	return 1;
+}
+
 tile_smap_data_t tile_shadow_map_manager::new_smap_data(unsigned tu_id, tile_t *tile, unsigned light, unsigned lod_level) {
 	assert(tile != nullptr);
 	assert(light < NUM_LIGHT_SRC);
@@ -954,7 +969,12 @@ void tile_t::setup_shadow_maps(tile_shadow_map_manager &smap_manager, bool clean
 	// FIXME: still not correct for low sun pos - need a more accurate way to determine which models can shadow this tile
 	cube_t const models_bcube(calc_and_return_all_models_bcube());
 	if (models_bcube != all_zeros_cube) {bcube.d[2][1] = max(bcube.d[2][1], models_bcube.d[2][1]);}
-	smap_data.create_if_needed(bcube);
+	bool const always_update(get_dist_to_camera_in_tiles(1) < SMAP_ALWAYS_UPDATE_DIST);
+
+	for (unsigned i = 0; i < smap_data.size(); ++i) {
+		point lpos;
+		if (light_valid_and_enabled(i, lpos)) {smap_data[i].create_or_reuse(lpos, bcube, smap_manager, always_update);}
+	}
 }
 
 bool tile_t::shadow_maps_allocated() const {
@@ -962,6 +982,12 @@ bool tile_t::shadow_maps_allocated() const {
 	return 0;
 }
 
+int tile_t::get_smap_render_frame() const { // returns the oldest frame, or 0 if not yet rendered
+	int frame(0);
+	for (unsigned i = 0; i < smap_data.size(); ++i) {frame = (i ? min(frame, smap_data[i].render_frame) : smap_data[i].render_frame);}
+	return frame;
+}
+
 void tile_t::clear_shadow_map(tile_shadow_map_manager *smap_manager) {
 	
 	if (smap_data.empty()) return;
@@ -1484,7 +1510,7 @@ unsigned tile_t::draw_flowers(shader_t &s, bool use_cloud_shadows) {
 	if (!has_grass()) return 0; // no grass, no flowers
 	float const flower_thresh(FLOWER_REL_DIST*get_grass_thresh_pad());
 	if (get_min_dist_to_pt(get_camera_pos()) > flower_thresh) return 0; // too far away to draw
-	flowers.gen_flowers(weight_data, stride, x1-xoff2, y1-yoff2); // mesh weight + tree dirt
+	if (!flowers.gen_flowers_async(weight_data, stride, x1-xoff2, y1-yoff2)) return 0; // mesh weight + tree dirt; not yet generated
 	if (flowers.empty()) return 0; // no flowers generated
 	pre_draw_grass_flowers(s, use_cloud_shadows);
 	flowers.check_vbo();
@@ -1683,8 +1709,7 @@ void tile_t::update_animals() {
 		range.d[2][1] = zmax + 0.50*z_range; // Note: may be in the clouds
 		birds.gen(num_birds_per_tile, range, this);
 	}
-	else {
-		birds.flock(this);
+	else { // Note: flocking is done for all tiles in tile_draw_t::flock_birds()
 		birds.update(this);
 		propagate_animals_to_neighbor_tiles(birds);
 	}
@@ -2086,13 +2111,8 @@ void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
-float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+void tile_draw_t::load_hmap_and_gen_buildings() { // Note: heightmap loading also generates cities
 
-	//timer_t timer("TT Update");
-	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
-	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
-	unsigned const max_defer_tiles        = 8; // 0 = disable
-	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
 	if (terrain_hmap_manager.maybe_load(mh_filename_tt, (invert_mh_image != 0))) {read_default_hmap_modmap();}
 	
 	if (!buildings_valid) {
@@ -2100,6 +2120,29 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		gen_city_details(); // after building generation
 		buildings_valid = 1;
 	}
+}
+
+void tile_draw_t::flock_birds() { // boids for all tiles at once, before any tile updates bird positions
+
+	if (!ENABLE_ANIMALS || !animate2 || atmosphere < 0.4 || vegetation < 0.2) return; // same conditions as tile_t::update_animals()
+	static vector<vect_bird_t *> groups; // reused across frames
+	groups.clear();
+
+	for (auto i = tiles.begin(); i != tiles.end(); ++i) {
+		vect_bird_t &birds(i->second->get_birds());
+		if (birds.was_generated() && !birds.empty()) {groups.push_back(&birds);}
+	}
+	flock_bird_groups(groups, 0.5*get_tile_width());
+}
+
+float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+
+	//timer_t timer("TT Update");
+	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
+	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
+	unsigned const max_defer_tiles        = 8; // 0 = disable
+	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
+	load_hmap_and_gen_buildings();
 	auto_calc_model_zvals(); // must be done after heightmap loading but before any tiles are created
 	to_draw.clear();
 	terrain_zmin = FAR_DISTANCE;
@@ -2126,6 +2169,8 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		}
 		to_gen_zvals.clear();
 	}
+	flock_birds();
+
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ) { // update tiles and free old tiles (Note: no ++i)
 		if (!i->second->update_range(smap_manager)) { // delete this tile
 			i->second->clear();
@@ -2457,6 +2502,33 @@ bool tile_draw_t::can_have_reflection(tile_t const *const tile, tile_set_t &tile
 }
 
 
+// generates triangle strip indices for each mesh LOD, in vertical bands of up to band_width cells; fills in ivbo_ixs
+void tile_draw_t::gen_tile_strip_indices(vector<unsigned> &indices, unsigned tile_size, unsigned band_width) {
+
+	unsigned const stride(tile_size+1);
+	assert(band_width > 0);
+
+	for (unsigned i = 0, step = 1; i < NUM_LODS; ++i, step <<= 1) {
+		ivbo_ixs[i] = indices.size();
+		unsigned const isz_ceil((tile_size + step - 1)/step);
+		if (isz_ceil < 2) continue; // too small, don't create LOD for this level (will never be used during rendering)
+
+		for (unsigned bx = 0; bx < isz_ceil; bx += band_width) {
+			unsigned const bx_end(min(bx+band_width, isz_ceil));
+
+			for (unsigned y = 0, ny = 0; ny < isz_ceil; y += step, ++ny) {
+				for (unsigned nx = bx; nx <= bx_end; ++nx) { // 2 extra to start the strip
+					unsigned const x(nx*step);
+					indices.push_back(y*stride + x);
+					indices.push_back(min(y+step, tile_size)*stride + x);
+				}
+				indices.push_back(PRIMITIVE_RESTART_IX); // restart the strip
+			}
+		} // for bx
+	} // for i
+	ivbo_ixs[NUM_LODS] = indices.size();
+}
+
 void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU uploads
 
 	//timer_t timer("TT Pre-Draw");
@@ -2473,20 +2545,27 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 				data[y*stride + x].assign(x*DX_VAL, y*DY_VAL, 0.0); // z=0.0
 			}
 		}
-		for (unsigned i = 0, step = 1; i < NUM_LODS; ++i, step <<= 1) {
-			ivbo_ixs[i] = indices.size();
-			unsigned const isz_ceil((tile_size + step - 1)/step);
-			if (isz_ceil < 2) continue; // too small, don't create LOD for this level (will never be used during rendering)
-
-			for (unsigned y = 0, ny = 0; ny < isz_ceil; y += step, ++ny) {
-				for (unsigned x = 0, nx = 0; nx <= isz_ceil; x += step, ++nx) { // 2 extra to start the strip
-					indices.push_back(y*stride + x);
-					indices.push_back(min(y+step, tile_size)*stride + x);
-				}
-				indices.push_back(PRIMITIVE_RESTART_IX); // restart the strip
-			}
-		} // for i
-		ivbo_ixs[NUM_LODS] = indices.size();
+		// when vertex optimization is enabled, split the strips into vertical bands so that the previous row's verts are still in the post-transform cache
+		bool use_bands(vert_opt_flags[0]);
+		gen_tile_strip_indices(indices, tile_size, (use_bands ? TILE_STRIP_BAND_CELLS : tile_size));
+		
+		if (use_bands && indices.size() > 0xFFFF) { // too many indices for 16-bit crack_ibuf offsets, fall back to full width strips
+			indices.clear();
+			gen_tile_strip_indices(indices, tile_size, tile_size);
+			use_bands = 0;
+		}
+		if (use_bands && vert_opt_flags[2] && ivbo_ixs[1] > ivbo_ixs[0]) { // verbose: print cache stats for LOD0 relative to full width strips
+			vert_opt_stats_t stats;
+			stats.num_tris      = 2*tile_size*tile_size;
+			stats.num_verts     = stride*stride;
+			stats.misses_after  = calc_vertex_cache_misses(indices, ivbo_ixs[0], ivbo_ixs[1], PRIMITIVE_RESTART_IX);
+			vector<unsigned> orig_indices;
+			gen_tile_strip_indices(orig_indices, tile_size, tile_size); // Note: overwrites ivbo_ixs, so regenerate below
+			stats.misses_before = calc_vertex_cache_misses(orig_indices, ivbo_ixs[0], ivbo_ixs[1], PRIMITIVE_RESTART_IX);
+			stats.print("Tiled mesh strips");
+			indices.clear();
+			gen_tile_strip_indices(indices, tile_size, TILE_STRIP_BAND_CELLS);
+		}
 		crack_ibuf.gen_offsets(indices, tile_size);
 		create_and_upload(data, indices, 0, 1); // unbind at end
 	}
@@ -2522,6 +2601,9 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 		}
 		(*i)->update_scenery();
 	}
+	// update the oldest shadow maps first so that stale shadow map updates are distributed across tiles over multiple frames
+	sort(to_update.begin(), to_update.end(), [](tile_t const *a, tile_t const *b) {return (a->get_smap_render_frame() < b->get_smap_render_frame());});
+
 	for (vector<tile_t *>::iterator i = to_update.begin(); i != to_update.end(); ++i) { // after everything has been setup
 		(*i)->setup_shadow_maps(smap_manager, 0); // cleanup_only=0
 	}
@@ -3093,7 +3175,7 @@ void tile_draw_t::draw_grass(bool reflection_pass) {
 	unsigned num_grass_drawn(0), num_flowers_drawn(0);
 	if (use_grass_tess && !check_for_tess_shader()) {use_grass_tess = 0;} // disable tess - not supported
 
-	for (unsigned wpass = 0; wpass < 2; ++wpass) { // wind, no wind
+	for (unsigned wpass = 0; wpass < 2 && grass_tile_manager.is_ready(); ++wpass) { // wind, no wind; skip if grass is still being generated
 		for (unsigned spass = 0; spass < 2; ++spass) { // shadow maps, no shadow maps
 			if (spass == 0 && !shadow_map_enabled()) continue;
 			shader_t s;
@@ -3322,19 +3404,35 @@ void tile_smap_data_t::render_scene_shadow_pass(point const &lpos) {
 	terrain_tile_draw.draw_shadow_pass(lpos, tile);
 }
 
-bool tile_smap_data_t::needs_update(point const &lpos) {
+// re-renders the shadow map if it has no content, or if it's stale and either always_update is set or there's budget left for this frame;
+// otherwise reuses the cached depth values, including after a scene shift, so that tile streaming and sun movement don't re-render every tile at once
+void tile_smap_data_t::create_or_reuse(point const &lpos, cube_t const &bcube, tile_shadow_map_manager &smap_manager, bool always_update) {
 
-	//return smap_data_t::needs_update(lpos);
-	// FIXME: it would be better if we could just translate the shadow map when the scene shifts, but this seems fairly complex to track and get right
 	int const new_dxoff(xoff - xoff2), new_dyoff(yoff - yoff2);
-	bool const new_off(new_dxoff != dxoff || new_dyoff != dyoff);
+
+	if (has_content && (new_dxoff != dxoff || new_dyoff != dyoff)) {
+		// the scene shifted: translate the light frustum along with the tile so that the cached depth values remain valid;
+		// this moves the light slightly relative to the tile, so mark as stale and re-render when there's budget
+		pdu.translate(vector3d((new_dxoff - dxoff)*DX_VAL, (new_dyoff - dyoff)*DY_VAL, 0.0));
+		is_stale = 1;
+	}
 	dxoff = new_dxoff; dyoff = new_dyoff;
-	return (smap_data_t::needs_update(lpos) || new_off);
+	is_stale |= (lpos != last_lpos);
+
+	if (!has_content || !is_allocated() || (is_stale && (always_update || smap_manager.take_stale_update()))) {
+		create_shadow_map_for_light(lpos, &bcube, 0, 0, 1); // force_update=1
+		last_lpos    = lpos;
+		render_frame = frame_counter;
+		has_content  = 1;
+		is_stale     = 0;
+	}
+	else {create_shadow_map_for_light(last_lpos, nullptr, 0, 1);} // no_update=1; keep the frustum of the cached depth values, but update the texture matrix
 }
 
 
 tile_t *get_tile_from_xy  (tile_xy_pair const &tp) {return terrain_tile_draw.get_tile_from_xy(tp);}
 float update_tiled_terrain(float &min_camera_dist) {return terrain_tile_draw.update(min_camera_dist);}
+void gen_tiled_terrain_buildings() {terrain_tile_draw.load_hmap_and_gen_buildings();}
 void pre_draw_tiled_terrain(bool reflection_pass) {terrain_tile_draw.pre_draw(reflection_pass);}
 
 
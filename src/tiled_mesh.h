@@ -67,24 +67,30 @@ public:
 
 
 class tile_t;
+class tile_shadow_map_manager;
 
 struct tile_smap_data_t : public smap_data_t {
 
-	int dxoff, dyoff;
+	int dxoff, dyoff, render_frame; // scene offset and frame of the last shadow pass
 	unsigned lod_level;
+	bool has_content, is_stale; // is_stale: the light or scene offset has changed since the last shadow pass
 	tile_t *tile;
 
 	tile_smap_data_t(unsigned tu_id_, unsigned smap_sz_, unsigned lod_level_, tile_t *tile_, smap_data_state_t const &init_state=smap_data_state_t())
-		: smap_data_t(tu_id_, smap_sz_, init_state), dxoff(0), dyoff(0), lod_level(lod_level_), tile(tile_) {}
+		: smap_data_t(tu_id_, smap_sz_, init_state), dxoff(0), dyoff(0), render_frame(0), lod_level(lod_level_), has_content(0), is_stale(0), tile(tile_) {}
 	virtual void render_scene_shadow_pass(point const &lpos);
-	virtual bool needs_update(point const &lpos);
+	void create_or_reuse(point const &lpos, cube_t const &bcube, tile_shadow_map_manager &smap_manager, bool always_update);
 };
 
 
 class tile_shadow_map_manager {
 
 	vector<smap_data_state_t> free_list[NUM_LIGHT_SRC][NUM_SMAP_LODS];
+	unsigned stale_updates_left;
+	int budget_frame;
 public:
+	tile_shadow_map_manager() : stale_updates_left(0), budget_frame(-1) {}
+	bool take_stale_update();
 	tile_smap_data_t new_smap_data(unsigned tu_id, tile_t *tile, unsigned light, unsigned lod_level);
 	void release_smap_data(tile_smap_data_t &smd, unsigned light);
 	void clear_context();
@@ -318,6 +324,7 @@ public:
 	void upload_shadow_map_texture(bool tid_is_valid);
 	void setup_shadow_maps(tile_shadow_map_manager &smap_manager, bool cleanup_only);
 	bool shadow_maps_allocated() const;
+	int get_smap_render_frame() const;
 	bool using_shadow_maps() const {return !smap_data.empty();}
 
 	// *** mesh creation ***
@@ -444,6 +451,7 @@ public:
 	void clear(bool no_regen_buildings);
 	void free_compute_shader();
 	float update(float &min_camera_dist);
+	void load_hmap_and_gen_buildings();
 private:
 	static void setup_terrain_textures(shader_t &s, unsigned start_tu_id);
 	static void add_texture_colors(shader_t &s, unsigned start_tu_id);
@@ -453,6 +461,8 @@ private:
 	bool can_have_reflection_recur(tile_t const *const tile, point const corners[3], tile_set_t &tile_set, unsigned dim_ix);
 	bool can_have_reflection(tile_t const *const tile, tile_set_t &tile_set);
 public:
+	void gen_tile_strip_indices(vector<unsigned> &indices, unsigned tile_size, unsigned band_width);
+	void flock_birds();
 	void pre_draw(bool reflection_pass);
 	void draw(bool reflection_pass);
 	void draw_shadow_pass(point const &lpos, tile_t *tile, bool decid_trees_only=0);
@@ -133,9 +133,10 @@ struct tree_xform_t {
 
 class tree_builder_t : public tree_xform_t {
 
-	static vector<tree_cylin >   cylin_cache;
-	static vector<tree_branch>   branch_cache;
-	static vector<tree_branch *> branch_ptr_cache;
+	// per-thread so that trees can be generated in parallel
+	static thread_local vector<tree_cylin >   cylin_cache;
+	static thread_local vector<tree_branch>   branch_cache;
+	static thread_local vector<tree_branch *> branch_ptr_cache;
 
 	tree_branch base, roots, *branches_34[2], **branches;
 	int base_num_cylins, root_num_cylins, ncib, num_1_branches, num_big_branches_min, num_big_branches_max;
@@ -178,6 +179,40 @@ public:
 };
 
 
+// per-leaf inputs of the leaf wind bend kernel in SoA layout; calc_bends() gathers the changed leaves into contiguous kernel arrays
+struct leaf_bend_soa_t {
+
+	enum {DX=0, DY, DZ, NX, NY, NZ, SX, SY, SZ, DMAG, ANGLE, NUM_ARRAYS};
+	// DX-DZ: base=>tip dir, NX-NZ: leaf normal, SX-SZ: base=>side dir, DMAG: base=>tip length, ANGLE: last applied bend angle
+	enum {COS_A=SZ+1, SIN_A, DDX, DDY, DDZ, CX, CY, CZ, NUM_KERNEL_ARRAYS};
+	// kernel arrays, indexed by changed leaf: DX-SZ as above, COS_A/SIN_A: bend angle terms, DDX-DDZ: output tip delta, CX-CZ: output unnormalized normal
+	vector<float> v[NUM_ARRAYS], k[NUM_KERNEL_ARRAYS];
+	vector<unsigned> changed; // leaves to update in calc_bends()
+
+	unsigned size() const {return (unsigned)v[0].size();}
+	void init(vector<tree_leaf> const &leaves);
+	void remove(unsigned i);
+	void clear();
+	bool set_angle(unsigned i, float angle);
+	void calc_bends();
+};
+
+class leaf_dirty_ranges_t { // leaf index ranges that need to be uploaded to the leaf VBO
+
+	vector<pair<unsigned, unsigned>> ranges; // [start, end)
+public:
+	bool empty() const {return ranges.empty();}
+	void clear() {ranges.clear();}
+	void add(unsigned ix) {
+		if (!ranges.empty() && ix+1 >= ranges.back().first && ix <= ranges.back().second) { // adjacent to or inside the last range
+			ranges.back().first = min(ranges.back().first, ix); ranges.back().second = max(ranges.back().second, ix+1);
+		}
+		else {ranges.emplace_back(ix, ix+1);}
+	}
+	void get_merged(unsigned max_ix, unsigned max_gap, vector<pair<unsigned, unsigned>> &merged);
+};
+
+
 //#define USE_TREE_BB_TEX_ATLAS
 
 #ifdef USE_TREE_BB_TEX_ATLAS
@@ -203,10 +238,14 @@ class tree_data_t {
 	vector<tree_leaf> leaves;
 	tree_bb_tex_t render_leaf_texture, render_branch_texture;
 	int last_update_frame;
-	unsigned leaf_change_start, leaf_change_end;
+	leaf_dirty_ranges_t leaf_dirty;
+	leaf_bend_soa_t leaf_bend;
 	bool reset_leaves, has_4th_branches;
 
 	void clear_vbo_ixs();
+	void calc_bounds();
+	bool read_from_cache(uint64_t key, rand_gen_t &rgen);
+	void write_to_cache (uint64_t key, rand_gen_t const &rgen) const;
 	template<typename branch_index_t> void create_branch_vbo();
 
 public:
@@ -216,7 +255,7 @@ public:
 
 	tree_data_t() : leaf_vbo(0), num_branch_quads(0), num_unique_pts(0), branch_index_bytes(0), tree_type(-1), base_color(WHITE), leaf_color(WHITE),
 		render_leaf_texture(TREE_BILLBOARD_MULTISAMPLE), render_branch_texture(TREE_BILLBOARD_MULTISAMPLE), last_update_frame(0),
-		leaf_change_start(0), leaf_change_end(0), reset_leaves(0), has_4th_branches(0), base_radius(0.0), sphere_radius(0.0), sphere_center_zoff(0.0),
+		reset_leaves(0), has_4th_branches(0), base_radius(0.0), sphere_radius(0.0), sphere_center_zoff(0.0),
 		br_scale(1.0), b_tex_scale(1.0), lr_z_cent(0.0), lr_x(0.0), lr_y(0.0), lr_z(0.0), br_x(0.0), br_y(0.0), br_z(0.0) {}
 	vector<draw_cylin> const &get_all_cylins() const {return all_cylins;}
 	vector<tree_leaf>  const &get_leaves    () const {return leaves;}
@@ -238,6 +277,8 @@ public:
 	void remove_leaf_ix(unsigned i, bool update_data);
 	bool spraypaint_leaves(point const &pos, float radius, colorRGBA const &color, bool check_only);
 	void bend_leaf(unsigned i, float angle);
+	leaf_bend_soa_t &get_leaf_bend_data();
+	void apply_leaf_bends();
 	void draw_leaf_quads_from_vbo(unsigned max_leaves) const;
 	void draw_leaves_shadow_only(float size_scale);
 	void ensure_branch_vbo();
@@ -359,6 +400,7 @@ public:
 	point sphere_center()     const {return (tree_center + tdata().get_center());}
 	point const &get_center() const {return tree_center;}
 	unsigned get_gpu_mem()    const {return (td_is_private() ? tdata().get_gpu_mem() : 0);}
+	tree_data_t const *get_shared_tree_data() const {return tree_data;}
 	unsigned get_num_leaves() const {return tdata().get_leaves().size();}
 	unsigned get_num_branch_cylins() const {return tdata().get_all_cylins().size();}
 	bool get_no_delete()      const {return no_delete;}
@@ -392,6 +434,14 @@ public:
 };
 
 
+struct tree_gen_job_t { // deferred call to tree::gen_tree() for the parallel generation path
+	point pos;
+	int ttype;
+	rand_gen_t rgen; // rgen state at the time the tree was placed
+	tree_gen_job_t(point const &pos_, int ttype_, rand_gen_t const &rgen_) : pos(pos_), ttype(ttype_), rgen(rgen_) {}
+};
+
+
 class tree_cont_t : public vector<tree> {
 
 	tree_data_manager_t &shared_tree_data;
@@ -415,6 +465,7 @@ public:
 	void post_scroll_remove();
 	void gen_deterministic(int x1, int y1, int x2, int y2, float vegetation_, float mesh_dz, tile_t const *const cur_tile=nullptr);
 	void add_new_tree(rand_gen_t &rgen, int &ttype);
+	void gen_trees_parallel(vector<tree_gen_job_t> const &jobs, unsigned start_ix);
 	void gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, point const &center, float radius, bool is_square=0,
 		float mesh_dz=-1.0, tile_t const *const cur_tile=nullptr, float vegetation_=1.0, bool use_density=0);
 	void shift_by(vector3d const &vd);
@@ -469,6 +520,7 @@ void regen_trees(bool keep_old);
 void shift_trees(vector3d const &vd);
 void add_tree_cobjs();
 void clear_tree_context();
+void print_tree_cache_stats();
 
 // function prototypes - small trees
 int add_small_tree(point const &pos, float height, float width, int tree_type, bool calc_z);
@@ -4,29 +4,36 @@
 
 #include "vertex_opt.h"
 #include "triListOpt.h"
+#include "meshoptimizer.h"
 
 unsigned const VBUF_SZ = 32;
+float const OVERDRAW_THRESH = 1.05; // allow this much ACMR increase for better overdraw
 
 
-float vert_optimizer::calc_acmr() const {
+// simulates a FIFO post-transform vertex cache of size VBUF_SZ; restart indices (for triangle strips) are skipped
+unsigned calc_vertex_cache_misses(vector<unsigned> const &indices, unsigned begin_ix, unsigned end_ix, unsigned restart_ix) {
 
-	vbuf_entry_t vbuf[VBUF_SZ];
-	unsigned num_cm(0); // cache misses
+	unsigned vbuf[VBUF_SZ], pos(0), num_cm(0); // ring buffer, cache misses
+	for (unsigned n = 0; n < VBUF_SZ; ++n) {vbuf[n] = 0xFFFFFFFF;}
+	if (end_ix == 0) {end_ix = (unsigned)indices.size();}
+	assert(begin_ix <= end_ix && end_ix <= indices.size());
 
-	for (unsigned i = 0; i < indices.size(); ++i) {
+	for (unsigned i = begin_ix; i < end_ix; ++i) {
+		unsigned const ix(indices[i]);
+		if (ix == restart_ix) continue;
 		bool found(0);
-		unsigned best_entry(0), oldest_pos((unsigned)-1);
-
-		for (unsigned n = 0; n < VBUF_SZ; ++n) {
-			if (vbuf[n].ix == indices[i]) {found = 1; break;}
-			if (vbuf[n].pos < oldest_pos) {best_entry = n; oldest_pos = vbuf[n].pos;}
-		}
+		for (unsigned n = 0; n < VBUF_SZ && !found; ++n) {found = (vbuf[n] == ix);}
 		if (found) continue;
-		vbuf[best_entry].ix  = indices[i];
-		vbuf[best_entry].pos = i;
+		vbuf[pos] = ix;
+		pos = (pos + 1) % VBUF_SZ;
 		++num_cm;
 	}
-	return float(num_cm)/float(indices.size());
+	return num_cm;
+}
+
+
+float vert_optimizer::calc_acmr() const {
+	return float(calc_vertex_cache_misses(indices))/float(indices.size());
 }
 
 
@@ -57,3 +64,38 @@ void vert_optimizer::run(bool full_opt, bool verbose) {
 }
 
 
+
+void vert_opt_stats_t::print(char const *const name) const {
+	cout << name << ": tris: " << num_tris << ", verts: " << num_verts << ", ACMR: " << get_acmr(0) << " => " << get_acmr(1)
+		 << ", ATVR: " << get_atvr(0) << " => " << get_atvr(1) << endl;
+}
+
+
+// reorders triangles for the vertex cache and then for reduced overdraw, keeping the ACMR within OVERDRAW_THRESH
+void optimize_indexed_tris(vector<unsigned> &indices, unsigned num_verts, float const *const vert_pos, unsigned vert_stride, vert_opt_stats_t *stats) {
+
+	assert((indices.size() % 3) == 0); // must be triangles
+	if (indices.empty()) return;
+	vert_opt_stats_t cur_stats;
+	cur_stats.num_tris      = unsigned(indices.size()/3);
+	cur_stats.num_verts     = num_verts;
+	cur_stats.misses_before = calc_vertex_cache_misses(indices);
+	vector<unsigned> temp(indices.size()), orig(indices);
+	meshopt_optimizeVertexCache(temp.data(), indices.data(), indices.size(), num_verts);
+	meshopt_optimizeOverdraw(indices.data(), temp.data(), temp.size(), vert_pos, num_verts, vert_stride, OVERDRAW_THRESH);
+	cur_stats.misses_after = calc_vertex_cache_misses(indices);
+
+	if (cur_stats.misses_after > cur_stats.misses_before) { // can happen for meshes that were already well ordered, such as generated cylinders; keep the original order
+		indices.swap(orig);
+		cur_stats.misses_after = cur_stats.misses_before;
+	}
+	if (stats) {stats->add(cur_stats);}
+}
+
+// reorders vertices into the order in which they're first used, for better memory locality; returns the new number of vertices
+unsigned optimize_vertex_fetch(void *verts, unsigned num_verts, unsigned vert_size, vector<unsigned> &indices) {
+
+	if (num_verts == 0 || indices.empty()) return num_verts;
+	vector<unsigned char> orig_verts((unsigned char const *)verts, (unsigned char const *)verts + size_t(num_verts)*vert_size);
+	return (unsigned)meshopt_optimizeVertexFetch(verts, indices.data(), indices.size(), orig_verts.data(), num_verts, vert_size);
+}
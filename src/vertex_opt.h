@@ -37,3 +37,27 @@ public:
 	void run(bool full_opt, bool verbose);
 };
 
+
+// vertex transform counts before and after optimization, for ACMR (per triangle) and ATVR (per unique vertex) stats
+struct vert_opt_stats_t {
+
+	unsigned num_tris, num_verts, misses_before, misses_after;
+
+	vert_opt_stats_t() : num_tris(0), num_verts(0), misses_before(0), misses_after(0) {}
+	void add(vert_opt_stats_t const &s) {num_tris += s.num_tris; num_verts += s.num_verts; misses_before += s.misses_before; misses_after += s.misses_after;}
+	float get_acmr(bool after) const {return (num_tris  ? float(after ? misses_after : misses_before)/num_tris  : 0.0f);}
+	float get_atvr(bool after) const {return (num_verts ? float(after ? misses_after : misses_before)/num_verts : 0.0f);}
+	void print(char const *const name) const;
+};
+
+unsigned calc_vertex_cache_misses(vector<unsigned> const &indices, unsigned begin_ix=0, unsigned end_ix=0, unsigned restart_ix=0xFFFFFFFF); // end_ix=0 => all
+void optimize_indexed_tris(vector<unsigned> &indices, unsigned num_verts, float const *const vert_pos, unsigned vert_stride, vert_opt_stats_t *stats=nullptr);
+unsigned optimize_vertex_fetch(void *verts, unsigned num_verts, unsigned vert_size, vector<unsigned> &indices);
+
+// vertex cache, overdraw, and vertex fetch optimization of indexed triangles; T must have a point v member
+template<typename T> void optimize_indexed_tris_and_verts(vector<T> &verts, vector<unsigned> &indices, vert_opt_stats_t *stats=nullptr) {
+	if (verts.empty() || indices.size() < 3) return;
+	optimize_indexed_tris(indices, (unsigned)verts.size(), &verts.front().v.x, sizeof(T), stats);
+	verts.resize(optimize_vertex_fetch(verts.data(), (unsigned)verts.size(), sizeof(T), indices)); // unused vertices are removed
+}
+
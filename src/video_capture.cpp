@@ -2,17 +2,21 @@
 // by Frank Gennari
 // 10/26/15
 #include "3DWorld.h"
-#include "openal_wrap.h" // for alut_sleep()
 #include <list>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <cstring> // for memcpy()
 
 using namespace std;
 
-unsigned const MAX_FRAMES_BUFFERED = 128;
+unsigned const NUM_VIDEO_PBOS = 6; // ring of readback buffers; frames are written directly from these when persistently mapped
+unsigned const END_OF_VIDEO   = ~0U; // sentinel slot index sent to the writer thread
 
+extern bool video_capture_yuv, video_capture_drop; // convert to YUV420 before sending to ffmpeg; drop frames rather than waiting for the writer
 extern int window_width, window_height;
 extern unsigned video_framerate; // Note: should probably be either 30 or 60
 extern unsigned num_video_threads; // defaults to 0 = max
@@ -50,74 +54,184 @@ public:
 	}
 };
 
-class video_capture_t {
+// converts a bottom-to-top RGBA image to top-to-bottom planar YUV420 (BT.601 limited range, which is what ffmpeg expects by default);
+// uses integer math; the row pointers are __restrict and the indices are signed so that gcc -O3 vectorizes both inner loops
+void rgba_to_yuv420_flip(unsigned char const *const rgba, unsigned char *const yuv, unsigned width, unsigned height) {
 
-	class video_buffer {
-		typedef vector<unsigned char> frame_t;
-		typedef shared_ptr<frame_t> p_frame_t;
-		thread_safe_queue<p_frame_t> frames, free_list; // queue of frames to compress
-
-	public:
-		void push_frame(void const *const data, unsigned data_sz) {
-			assert(data_sz > 0);
-			p_frame_t frame(free_list.empty() ? p_frame_t(new frame_t(data_sz)) : free_list.remove()); // take a frame from the free list if nonempty
-			memcpy(&frame->front(), data, data_sz);
-			frames.add(frame);
-		}
-		void pop_and_send_frame(FILE *fp) {
-			assert(fp != nullptr);
-			p_frame_t const frame(frames.remove());
-			fwrite(&frame->front(), frame->size(), 1, fp);
-			if (free_list.size() < MAX_FRAMES_BUFFERED/4) {free_list.add(frame);} // recycle it
+	assert(!(width & 1) && !(height & 1)); // must be even
+	unsigned const cw(width/2), ch(height/2);
+	unsigned char *const yp(yuv), *const up(yuv + width*height), *const vp(up + cw*ch);
+
+#pragma omp parallel for schedule(static)
+	for (int cy = 0; cy < (int)ch; ++cy) { // each iteration processes two rows
+		for (unsigned r = 0; r < 2; ++r) {
+			unsigned const y(2*cy + r);
+			unsigned char const *__restrict const src(rgba + 4*width*(height - y - 1)); // flip vertically
+			unsigned char *__restrict const dest(yp + width*y);
+
+			for (int x = 0; x < (int)width; ++x) {
+				int const R(src[4*x]), G(src[4*x+1]), B(src[4*x+2]);
+				dest[x] = (unsigned char)(((66*R + 129*G + 25*B + 128) >> 8) + 16);
+			}
 		}
-		void write_frames(FILE *fp) {
-			while (!frames.empty()) {pop_and_send_frame(fp);}
+		unsigned char const *__restrict const s0(rgba + 4*width*(height - 2*cy - 1));
+		unsigned char const *__restrict const s1(s0 - 4*width); // two source rows
+		unsigned char *__restrict const ud(up + cw*cy);
+		unsigned char *__restrict const vd(vp + cw*cy);
+
+		for (int x = 0; x < (int)cw; ++x) { // average 2x2 blocks
+			int const o(8*x);
+			int const R((s0[o  ] + s0[o+4] + s1[o  ] + s1[o+4] + 2) >> 2);
+			int const G((s0[o+1] + s0[o+5] + s1[o+1] + s1[o+5] + 2) >> 2);
+			int const B((s0[o+2] + s0[o+6] + s1[o+2] + s1[o+6] + 2) >> 2);
+			ud[x] = (unsigned char)(((-38*R -  74*G + 112*B + 128) >> 8) + 128);
+			vd[x] = (unsigned char)(((112*R -  94*G -  18*B + 128) >> 8) + 128);
 		}
-		size_t num_pending_frames() const {return frames.size();}
-		bool empty() const {return frames.empty();}
+	} // for cy
+}
+
+
+class video_capture_t {
+
+	typedef std::chrono::steady_clock steady_clock_t;
+
+	struct capture_slot_t {
+		unsigned pbo;
+		GLsync fence;
+		unsigned char *mapped; // persistently mapped PBO data, or nullptr if not supported
+		vector<unsigned char> copy; // frame data copied out of the PBO when not persistently mapped
+		steady_clock_t::time_point capture_time;
+
+		capture_slot_t() : pbo(0), fence(nullptr), mapped(nullptr) {}
+		unsigned char const *get_data() const {return (mapped ? mapped : copy.data());}
+	};
+	struct capture_stats_t {
+		unsigned captured, dropped, written, stalls;
+		double stall_ms, latency_ms, max_latency_ms;
+		capture_stats_t() : captured(0), dropped(0), written(0), stalls(0), stall_ms(0.0), latency_ms(0.0), max_latency_ms(0.0) {}
 	};
 
-	unsigned video_id, pbo, start_sz;
+	unsigned video_id, start_sz, width, height;
+	bool use_yuv;
 	string filename;
+	vector<capture_slot_t> slots;
+	deque<unsigned> in_flight; // slots with a readback in progress, oldest first; main thread only
+	capture_stats_t stats; // captured/dropped/stalls are written by the main thread; written/latency by the writer thread
 
 	// multithreaded writing support
-	bool is_recording, is_writing;
-	video_buffer buffer;
+	std::atomic<bool> is_recording, is_writing, write_failed;
+	thread_safe_queue<unsigned> free_slots, ready_slots; // slot indices: available for readback; ready to be written
 	unique_ptr<std::thread> write_thread;
 
+	static double get_ms_since(steady_clock_t::time_point const &t) {return std::chrono::duration<double, std::milli>(steady_clock_t::now() - t).count();}
+
+	void alloc_slots() {
+		bool const persistent(GLEW_ARB_buffer_storage != 0);
+		GLbitfield const map_flags(GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+		slots.resize(NUM_VIDEO_PBOS);
+
+		for (unsigned i = 0; i < slots.size(); ++i) {
+			capture_slot_t &s(slots[i]);
+			assert(s.pbo == 0);
+			glGenBuffers(1, &s.pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+
+			if (persistent) {
+				glBufferStorage(GL_PIXEL_PACK_BUFFER, start_sz, NULL, (map_flags | GL_CLIENT_STORAGE_BIT));
+				s.mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, start_sz, map_flags);
+				assert(s.mapped != nullptr);
+			}
+			else {glBufferData(GL_PIXEL_PACK_BUFFER, start_sz, NULL, GL_STREAM_READ);}
+			free_slots.add(i);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	void free_slots_data() { // must be called after the writer thread has finished
+		assert(in_flight.empty());
+
+		for (auto i = slots.begin(); i != slots.end(); ++i) {
+			if (i->fence) {glDeleteSync(i->fence);}
+			
+			if (i->mapped) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, i->pbo);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			}
+			glDeleteBuffers(1, &i->pbo);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slots.clear();
+		while (!free_slots.empty()) {free_slots.remove();}
+	}
+	// hands completed readbacks to the writer thread, oldest first; if wait_oldest is set, blocks until the oldest readback completes;
+	// returns true if the wait for the oldest readback timed out
+	bool check_readbacks(bool wait_oldest) {
+		while (!in_flight.empty()) {
+			unsigned const ix(in_flight.front());
+			capture_slot_t &s(slots[ix]);
+			assert(s.fence != nullptr);
+			GLenum const ret(glClientWaitSync(s.fence, (wait_oldest ? GL_SYNC_FLUSH_COMMANDS_BIT : 0), (wait_oldest ? 1000000000 : 0))); // 1s timeout
+			if (ret == GL_TIMEOUT_EXPIRED) return wait_oldest; // not yet complete
+			glDeleteSync(s.fence);
+			s.fence = nullptr;
+
+			if (!s.mapped) { // copy out of the PBO; fast since the transfer has completed
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+				void const *const ptr(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, start_sz, GL_MAP_READ_BIT));
+				s.copy.resize(start_sz);
+				memcpy(s.copy.data(), ptr, start_sz);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			}
+			ready_slots.add(ix);
+			in_flight.pop_front();
+			wait_oldest = 0;
+		}
+		return 0;
+	}
+	// drops the frame of the oldest readback and returns its slot for reuse; GL orders a new readback into its PBO after the old one
+	unsigned drop_oldest_readback() {
+		assert(!in_flight.empty());
+		unsigned const ix(in_flight.front());
+		in_flight.pop_front();
+		glDeleteSync(slots[ix].fence);
+		slots[ix].fence = nullptr;
+		++stats.dropped;
+		return ix;
+	}
 	void wait_for_write_complete() {
 		if (!write_thread) return;
 		is_recording = 0;
-		if (is_writing) {cout << "Wating for " << buffer.num_pending_frames() << " video frames to be written" << endl;}
+		while (!in_flight.empty()) {check_readbacks(1);} // flush all readbacks
+		if (is_writing) {cout << "Waiting for " << ready_slots.size() << " video frames to be written" << endl;}
+		ready_slots.add(END_OF_VIDEO);
 		write_thread->join();
 		write_thread.reset();
 		assert(!is_writing);
+		free_slots_data();
+		print_stats();
 	}
-	void queue_frame(void const *const data) {
-		buffer.push_frame(data, get_num_bytes());
-		
-		while (buffer.num_pending_frames() > MAX_FRAMES_BUFFERED) { // sleep for 10ms until buffer is partially emptied
-			cout << "Waiting for video write buffer to empty" << endl;
-			alut_sleep(0.01);
-		}
+	void print_stats() const {
+		cout << "Video capture: " << stats.captured << " frames captured, " << stats.written << " written, " << stats.dropped << " dropped, "
+			 << stats.stalls << " stalls (" << stats.stall_ms << " ms), latency avg " << (stats.written ? stats.latency_ms/stats.written : 0.0)
+			 << " ms, max " << stats.max_latency_ms << " ms" << endl;
 	}
-
 	static unsigned get_num_bytes() {return 4*window_width*window_height;}
 
 public:
-	video_capture_t() : video_id(0), pbo(0), start_sz(0), is_recording(0), is_writing(0) {}
+	video_capture_t() : video_id(0), start_sz(0), width(0), height(0), use_yuv(0), is_recording(0), is_writing(0), write_failed(0) {}
 
 	void start(string const &fn) {
 		assert(!is_recording); // must end() before calling start() again
 		wait_for_write_complete();
 		assert(!is_writing);
 		is_recording = 1;
+		write_failed = 0;
 		start_sz     = get_num_bytes();
-		assert(pbo == 0);
-		glGenBuffers(1, &pbo);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
-		glBufferData(GL_PIXEL_PACK_BUFFER, start_sz, NULL, GL_STREAM_READ);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		width        = window_width;
+		height       = window_height;
+		use_yuv      = (video_capture_yuv && !(width & 1) && !(height & 1)); // YUV420 requires even dimensions
+		stats        = capture_stats_t();
+		alloc_slots();
 		// start writing in a different thread
 		filename = fn;
 		assert(!write_thread);
@@ -125,13 +239,13 @@ public:
 	}
 	void write_buffer() {
 		assert(!filename.empty());
-		// start ffmpeg telling it to expect raw RGBA, 60 FPS
+		// start ffmpeg telling it to expect raw RGBA or YUV420, 60 FPS
 		// -i - tells it to read frames from stdin
 		// Note: 0 = max threads; the more threads the lower the frame rate, as video compression competes with 3DWorld for CPU cycles;
 		// however, more threads is less likely to fill the buffer and block, producing heavy lag
 		ostringstream oss;
-		oss << " -r " << video_framerate << " -f rawvideo -pix_fmt rgba -s " << window_width << "x" << window_height
-			<< " -i - -threads " << num_video_threads << " -preset fast -y -pix_fmt yuv420p -crf 21 -vf vflip " << filename;
+		oss << " -r " << video_framerate << " -f rawvideo -pix_fmt " << (use_yuv ? "yuv420p" : "rgba") << " -s " << width << "x" << height
+			<< " -i - -threads " << num_video_threads << " -preset fast -y -pix_fmt yuv420p -crf 21 " << (use_yuv ? "" : "-vf vflip ") << filename; // YUV is already flipped
 		// open pipe to ffmpeg's stdin in binary write mode
 #ifdef _WIN32
 		string const cmd(string("ffmpeg.exe.lnk") + oss.str());
@@ -142,23 +256,43 @@ public:
 #endif
 		if(ffmpeg == nullptr) {
 		  cerr << "Error running ffmpeg command: " << cmd << endl;
-		  is_writing = 0;
-		  end();
-		  return;
+		  write_failed = 1; // main thread will end recording; frames are still consumed below so that it doesn't block
 		}
-		is_writing   = 1;
-		while (is_recording || !buffer.empty()) {buffer.write_frames(ffmpeg); alut_sleep(0.001);} // 1ms sleep
+		is_writing = (ffmpeg != nullptr);
+		vector<unsigned char> yuv;
+
+		while (1) {
+			unsigned const ix(ready_slots.remove()); // blocks until a frame is ready
+			if (ix == END_OF_VIDEO) break;
+			assert(ix < slots.size());
+			capture_slot_t const &s(slots[ix]);
+
+			if (ffmpeg != nullptr) {
+				if (use_yuv) {
+					yuv.resize(width*height*3/2);
+					rgba_to_yuv420_flip(s.get_data(), yuv.data(), width, height);
+					fwrite(yuv.data(), yuv.size(), 1, ffmpeg);
+				}
+				else {fwrite(s.get_data(), start_sz, 1, ffmpeg);} // zero-copy when persistently mapped
+				double const latency(get_ms_since(s.capture_time));
+				++stats.written;
+				stats.latency_ms    += latency;
+				stats.max_latency_ms = max(stats.max_latency_ms, latency);
+			}
+			free_slots.add(ix); // recycle it
+		} // end while()
+		if (ffmpeg != nullptr) {
 #ifdef _WIN32
-		_pclose(ffmpeg);
+			_pclose(ffmpeg);
 #else
-		pclose(ffmpeg);
+			pclose(ffmpeg);
 #endif
-		is_writing   = 0;
+		}
+		is_writing = 0;
 	}
 	void end() {
 		is_recording = 0; // signal writer to finish
-		glDeleteBuffers(1, &pbo);
-		pbo = 0;
+		wait_for_write_complete(); // wait for at most NUM_VIDEO_PBOS frames to be written, then free the PBOs
 	}
 	void toggle_start_stop() {
 		if (is_recording) {end(); return;} // start=>end
@@ -168,20 +302,43 @@ public:
 	}
 	void end_frame() {
 		if (!is_recording) return;
-		assert(pbo != 0);
+		if (write_failed) {end(); return;}
+		assert(!slots.empty());
 		assert(start_sz == get_num_bytes()); // make sure the resolution hasn't changed since recording started
 		//timer_t timer("Video Capture Frame"); // 13.7ms for 1920x1024, 10.9ms with free list
+		check_readbacks(0); // non-blocking
+		++stats.captured;
+
+		bool const stall(free_slots.empty()); // all buffers are in use
+		if (stall && video_capture_drop) {++stats.dropped; return;} // skip this frame
+		auto const stall_start(steady_clock_t::now());
+		bool const timed_out(stall && !in_flight.empty() && check_readbacks(1)); // readbacks may be what's blocking
+		// if every slot is still in flight after a timeout, the writer thread has no slot to free, so recycle the oldest one rather than waiting forever
+		bool const recycle(timed_out && free_slots.empty() && in_flight.size() == slots.size());
+		unsigned const ix(recycle ? drop_oldest_readback() : free_slots.remove()); // blocks until the writer thread frees a slot
+
+		if (stall) {
+			++stats.stalls;
+			stats.stall_ms += get_ms_since(stall_start);
+		}
+		capture_slot_t &s(slots[ix]);
 		glReadBuffer(GL_FRONT);
 		glPixelStorei(GL_PACK_ALIGNMENT, 1);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
-		glReadPixels(0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // use PBO
-		void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, start_sz, GL_MAP_READ_BIT); // this line takes most of the time
-		queue_frame(ptr);
-		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // async readback into the PBO
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		assert(s.fence == nullptr);
+		s.fence        = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		s.capture_time = steady_clock_t::now();
+		in_flight.push_back(ix);
 	}
 	bool is_video_recording() const {return is_recording;}
-	~video_capture_t() {wait_for_write_complete();} // wait for write to complete; don't try to free the pbo
+	~video_capture_t() { // wait for write to complete; don't try to free the PBOs
+		if (!write_thread) return;
+		in_flight.clear(); // can't make GL calls here
+		ready_slots.add(END_OF_VIDEO);
+		write_thread->join();
+	}
 };
 
 video_capture_t video_capture;
@@ -5,6 +5,7 @@
 #include "3DWorld.h"
 #include "mesh.h"
 #include "physics_objects.h"
+#include <chrono>
 
 
 int const FAST_LIGHT_VIS    = 1;
@@ -173,6 +174,171 @@ bool pos_dir_up::cube_visible(cube_t const &c) const {
 	// Note: if the above call returns true, we could perform a further check for the frustum (all points) to the outside of each plane of the cube
 }
 
+// the batch tests below compute a block of 64 results at a time, then pack each block into one word of the bitmask;
+// the kernels have no branches or sqrt calls (distances are compared squared) and take __restrict parameters, so that gcc -O3 vectorizes them;
+// results match the single object versions, except for rare FP rounding differences
+unsigned const VFC_BLOCK_SZ = 64;
+
+void pack_vis_mask_block(unsigned char const *const vis, unsigned num, unsigned long long &bits) {
+	bits = 0;
+	for (unsigned k = 0; k < num; ++k) {bits |= ((unsigned long long)vis[k] << k);}
+}
+
+// returns true if a <= b*sqrt(c), where b >= 0 and c >= 0
+inline bool le_sqrt_mult(float a, float b_sq, float c) {return ((a <= 0.0f) | (a*a <= b_sq*c));}
+
+void sphere_vis_kernel(int num, float const *__restrict xv, float const *__restrict yv, float const *__restrict zv, float const *__restrict rv,
+	unsigned char *__restrict vis, pos_dir_up const &pdu)
+{
+	point const pos(pdu.pos);
+	vector3d const dir(pdu.dir), up(pdu.upv_), cp(pdu.cp);
+	float const ss(pdu.sterm*pdu.sterm), xss(pdu.x_sterm*pdu.x_sterm), near_(pdu.near_), far_(pdu.far_), bsm(pdu.behind_sphere_mult);
+
+	for (int i = 0; i < num; ++i) {
+		float const px(xv[i] - pos.x), py(yv[i] - pos.y), pz(zv[i] - pos.z), radius(rv[i]);
+		float const mag_sq(px*px + py*py + pz*pz), near_r(near_ - radius), far_r(far_ + radius);
+		float const dp_dir(dir.x*px + dir.y*py + dir.z*pz), dp_up(up.x*px + up.y*py + up.z*pz), dp_cp(cp.x*px + cp.y*py + cp.z*pz);
+		bool const behind((dp_dir < 0.0f)), behind_vis((radius > 0.0f) & (mag_sq < radius*radius*bsm)); // approximate/conservative
+		bool const up_vis(le_sqrt_mult((fabs(dp_up) - radius), ss, mag_sq)), cp_vis(le_sqrt_mult((fabs(dp_cp) - radius), xss, mag_sq)); // |dp| <= dist*sterm + radius
+		bool const near_vis((near_r < 0.0f) | (mag_sq > near_r*near_r)), far_vis((far_r > 0.0f) & (mag_sq < far_r*far_r)); // dist + radius > near, dist - radius < far
+		vis[i] = ((behind & behind_vis) | (!behind & up_vis & cp_vis & near_vis & far_vis));
+	}
+}
+
+void pos_dir_up::spheres_visible_test(vfc_sphere_batch_t const &spheres, vis_mask_t &vis) const {
+
+	unsigned const num(spheres.size());
+	vis.resize(num);
+	float const *const xv(spheres.x.data()), *const yv(spheres.y.data()), *const zv(spheres.z.data()), *const rv(spheres.r.data());
+	unsigned char block_vis[VFC_BLOCK_SZ];
+
+	for (unsigned n = 0; n < num; n += VFC_BLOCK_SZ) {
+		unsigned const block_sz(min(VFC_BLOCK_SZ, num-n));
+
+		if (!valid) { // invalid - the only reasonable thing to do is return true for safety
+			for (unsigned k = 0; k < block_sz; ++k) {block_vis[k] = (rv[n+k] >= 0.0f);}
+		}
+		else {sphere_vis_kernel(block_sz, xv+n, yv+n, zv+n, rv+n, block_vis, *this);}
+		pack_vis_mask_block(block_vis, block_sz, vis.bits[n/VFC_BLOCK_SZ]);
+	} // for n
+}
+
+// same as pt_set_visible<8>(), but with all tests combined per cube corner; each dot product is the sum of per-axis terms
+struct vfc_corner_flags_t {
+	bool up_pos=0, up_neg=0, cp_pos=0, cp_neg=0, npass=0, fpass=0;
+
+	void add(float const px, float const py, float const pz, float const d, float const u, float const c, float ss, float xss, float near_, float far_) {
+		float const mag_sq(px*px + py*py + pz*pz);
+		bool const up_in(u*u <= ss*mag_sq), cp_in(c*c <= xss*mag_sq);
+		up_pos |= ((u <= 0.0f) | up_in);
+		up_neg |= ((u >= 0.0f) | up_in);
+		cp_pos |= ((c <= 0.0f) | cp_in);
+		cp_neg |= ((c >= 0.0f) | cp_in);
+		npass  |= (d > near_);
+		fpass  |= (d < far_ );
+	}
+	bool all() const {return (up_pos & up_neg & cp_pos & cp_neg & npass & fpass);}
+};
+
+void cube_vis_kernel(int num, float const *__restrict x1v, float const *__restrict y1v, float const *__restrict z1v,
+	float const *__restrict x2v, float const *__restrict y2v, float const *__restrict z2v, unsigned char *__restrict vis, pos_dir_up const &pdu)
+{
+	point const pos(pdu.pos);
+	vector3d const dir(pdu.dir), up(pdu.upv_), cp(pdu.cp);
+	float const ss(pdu.sterm*pdu.sterm), xss(pdu.x_sterm*pdu.x_sterm), near_(pdu.near_), far_(pdu.far_), far_sq(far_*far_);
+
+	for (int i = 0; i < num; ++i) {
+		float const xa(x1v[i] - pos.x), ya(y1v[i] - pos.y), za(z1v[i] - pos.z), xb(x2v[i] - pos.x), yb(y2v[i] - pos.y), zb(z2v[i] - pos.z);
+		float const dxa(dir.x*xa), dxb(dir.x*xb), dya(dir.y*ya), dyb(dir.y*yb), dza(dir.z*za), dzb(dir.z*zb);
+		float const uxa(up.x *xa), uxb(up.x *xb), uya(up.y *ya), uyb(up.y *yb), uza(up.z *za), uzb(up.z *zb);
+		float const cxa(cp.x *xa), cxb(cp.x *xb), cya(cp.y *ya), cyb(cp.y *yb), cza(cp.z *za), czb(cp.z *zb);
+		vfc_corner_flags_t f;
+		f.add(xa, ya, za, (dxa + dya + dza), (uxa + uya + uza), (cxa + cya + cza), ss, xss, near_, far_);
+		f.add(xa, ya, zb, (dxa + dya + dzb), (uxa + uya + uzb), (cxa + cya + czb), ss, xss, near_, far_);
+		f.add(xa, yb, za, (dxa + dyb + dza), (uxa + uyb + uza), (cxa + cyb + cza), ss, xss, near_, far_);
+		f.add(xa, yb, zb, (dxa + dyb + dzb), (uxa + uyb + uzb), (cxa + cyb + czb), ss, xss, near_, far_);
+		f.add(xb, ya, za, (dxb + dya + dza), (uxb + uya + uza), (cxb + cya + cza), ss, xss, near_, far_);
+		f.add(xb, ya, zb, (dxb + dya + dzb), (uxb + uya + uzb), (cxb + cya + czb), ss, xss, near_, far_);
+		f.add(xb, yb, za, (dxb + dyb + dza), (uxb + uyb + uza), (cxb + cyb + cza), ss, xss, near_, far_);
+		f.add(xb, yb, zb, (dxb + dyb + dzb), (uxb + uyb + uzb), (cxb + cyb + czb), ss, xss, near_, far_);
+		// extra check for far clipping plane using the closest point on the cube
+		float const dx(max(0.0f, max(xa, -xb))), dy(max(0.0f, max(ya, -yb))), dz(max(0.0f, max(za, -zb)));
+		vis[i] = (f.all() & ((dx*dx + dy*dy + dz*dz) < far_sq));
+	}
+}
+
+void pos_dir_up::cubes_visible(vfc_cube_batch_t const &cubes, vis_mask_t &vis) const {
+
+	unsigned const num(cubes.size());
+	vis.resize(num);
+	unsigned char block_vis[VFC_BLOCK_SZ];
+
+	for (unsigned n = 0; n < num; n += VFC_BLOCK_SZ) {
+		unsigned const block_sz(min(VFC_BLOCK_SZ, num-n));
+
+		if (!valid) { // invalid - the only reasonable thing to do is return true for safety
+			for (unsigned k = 0; k < block_sz; ++k) {block_vis[k] = 1;}
+		}
+		else {
+			cube_vis_kernel(block_sz, (cubes.x1.data() + n), (cubes.y1.data() + n), (cubes.z1.data() + n),
+				(cubes.x2.data() + n), (cubes.y2.data() + n), (cubes.z2.data() + n), block_vis, *this);
+		}
+		pack_vis_mask_block(block_vis, block_sz, vis.bits[n/VFC_BLOCK_SZ]);
+	} // for n
+}
+
+void run_vfc_benchmark(unsigned num_objs) { // CPU only; compares per-object vs. batched VFC for random spheres and cubes around the viewer
+
+	unsigned const num_iters = 10;
+	pos_dir_up const pdu(all_zeros, plus_x, plus_z, 0.5*TO_RADIANS*PERSP_ANGLE, 0.01, 100.0, 1.6);
+	vfc_sphere_batch_t spheres;
+	vfc_cube_batch_t cubes;
+	vector<cube_t> cube_vect;
+	vis_mask_t vis;
+	rand_gen_t rgen;
+
+	for (unsigned i = 0; i < num_objs; ++i) {
+		point const pos(rgen.signed_rand_vector(100.0));
+		float const radius(rgen.rand_uniform(0.1, 2.0));
+		cube_t cube;
+		cube.set_from_sphere(pos, radius);
+		spheres.add(pos, radius);
+		cubes.add(cube);
+		cube_vect.push_back(cube);
+	}
+	vector<unsigned char> single_vis(num_objs);
+	unsigned num_vis[4] = {0}, num_mismatch(0);
+	double time_ms[4] = {0.0}; // {sphere single, sphere batch, cube single, cube batch}
+
+	for (unsigned n = 0; n < num_iters; ++n) {
+		for (unsigned test = 0; test < 4; ++test) {
+			auto const start(std::chrono::steady_clock::now());
+
+			switch (test) {
+			case 0: for (unsigned i = 0; i < num_objs; ++i) {single_vis[i] = pdu.sphere_visible_test(point(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.r[i]);} break;
+			case 1: pdu.spheres_visible_test(spheres, vis); break;
+			case 2: for (unsigned i = 0; i < num_objs; ++i) {single_vis[i] = pdu.cube_visible(cube_vect[i]);} break;
+			case 3: pdu.cubes_visible(cubes, vis); break;
+			}
+			time_ms[test] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/num_iters;
+
+			if (n == 0) { // count visible objects and check that the batch results agree with the per-object results
+				for (unsigned i = 0; i < num_objs; ++i) {
+					bool const v((test & 1) ? vis.is_visible(i) : (bool)single_vis[i]);
+					num_vis[test] += v;
+					if (test & 1) {num_mismatch += (v != (bool)single_vis[i]);} // should be zero, except for rare FP rounding differences
+				}
+			}
+		} // for test
+	} // for n
+	register_timing_value_ms("VFC Benchmark Spheres Single", time_ms[0]);
+	register_timing_value_ms("VFC Benchmark Spheres Batch",  time_ms[1]);
+	register_timing_value_ms("VFC Benchmark Cubes Single",   time_ms[2]);
+	register_timing_value_ms("VFC Benchmark Cubes Batch",    time_ms[3]);
+	cout << "VFC benchmark: " << num_objs << " objects, spheres: " << time_ms[0] << " ms single vs. " << time_ms[1] << " ms batch (" << num_vis[1] << " visible), cubes: "
+		 << time_ms[2] << " ms single vs. " << time_ms[3] << " ms batch (" << num_vis[3] << " visible), " << num_mismatch << " mismatches" << endl;
+}
+
 bool pos_dir_up::cube_visible_for_light_cone(cube_t const &c) const { // test only horizontal and far planes; ignores zval
 
 	if (!valid) return 1; // invalid - the only reasonable thing to do is return true for safety
@@ -228,7 +394,11 @@ void pos_dir_up::apply_z_mirror(float zval) {
 
 bool sphere_cobj_occluded(point const &viewer, point const &sc, float radius) {
 
-	if (!have_occluders() || dist_less_than(viewer, sc, radius)) return 0; // no occluders, or viewer is inside the sphere
+	if (dist_less_than(viewer, sc, radius)) return 0; // viewer is inside the sphere
+	cube_t sphere_bcube(sc);
+	sphere_bcube.expand_by(radius);
+	if (cube_hiz_occluded(viewer, sphere_bcube)) return 1; // check the software occlusion buffer first
+	if (!have_occluders()) return 0;
 	if (radius*radius < 1.0E-6f*p2p_dist_sq(viewer, sc)) {return cobj_contained(viewer, &sc, 1, -1);} // small and far away
 	vector3d const vdir(viewer - sc);
 	vector3d dirs[2];
@@ -288,7 +458,9 @@ public:
 
 bool cube_cobj_occluded(point const &viewer, cube_t const &cube) {
 
-	if (!have_occluders() || cube.contains_pt(viewer)) return 0; // no occluders, or viewer is inside the cube
+	if (cube.contains_pt(viewer)) return 0; // viewer is inside the cube
+	if (cube_hiz_occluded(viewer, cube)) return 1; // check the software occlusion buffer first
+	if (!have_occluders()) return 0;
 	//return cube_occlusion_query(viewer, cube).get_is_occluded(); // Note: slower, and makes very little difference
 	point pts[8];
 	unsigned const ncorners(get_cube_corners(cube.d, pts, viewer, 0)); // 8 corners allocated, but only 6 used
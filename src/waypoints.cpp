@@ -10,16 +10,21 @@
 #include "shaders.h"
 #include <queue>
 
+using std::string;
+using std::cerr;
+
 
 int const WP_RESET_FRAMES      = 100; // Note: in frames, not ticks, fix?
 int const WP_RECENT_FRAMES     = 200;
 float const MAX_FALL_DIST_MULT = 20.0;
 float const STEP_SIZE_MULT     = 0.25; // waypoint connectivity algorithm (relative to smiley radius)
 float const STEP_SIZE_MULT2    = 0.50; // reachability tests (relative to smiley radius)
+unsigned const MAX_REACH_STEPS = 10000; // max steps in one reachability test
 
 bool has_user_placed(0), has_item_placed(0), has_wpt_goal(0);
 int show_waypoints(0); // 0=none, 1=waypoints, 2=waypoints+edges
 waypoint_vector waypoints;
+string waypoint_cache_fn; // empty = disabled
 
 extern bool use_waypoints;
 extern int DISABLE_WATER, camera_change, frame_counter, num_smileys, num_groups, display_mode;
@@ -73,8 +78,8 @@ bool waypt_used_set::is_valid(unsigned wp) { // called to determine whether or n
 
 
 waypoint_t::waypoint_t(point const &p, int cid, bool up, bool i, bool g, bool t)
-	: user_placed(up), placed_item(i), goal(g), temp(t), visited(0), disabled(0), next_valid(0),
-	came_from(-1), item_group(-1), item_ix(-1), coll_id(cid), connected_to(-1), g_score(0), h_score(0), f_score(0), pos(p)
+	: user_placed(up), placed_item(i), goal(g), temp(t), visited(0), disabled(0),
+	item_group(-1), item_ix(-1), coll_id(cid), connected_to(-1), pos(p)
 {
 	clear();
 }
@@ -181,6 +186,166 @@ bool check_step_dz(point &cur, point const &lpos, float radius) {
 }
 
 
+// uniform grid in x/y of waypoint indices, used to limit connection candidates to nearby waypoints
+class waypoint_grid_t {
+
+	unsigned nx, ny;
+	float x0, y0, sx, sy; // origin and inverse cell size
+	vector<unsigned> cell_start, ixs; // waypoint indices grouped by cell
+
+	unsigned get_x(float x) const {return min(nx-1, unsigned(max(0.0f, (x - x0)*sx)));}
+	unsigned get_y(float y) const {return min(ny-1, unsigned(max(0.0f, (y - y0)*sy)));}
+public:
+	waypoint_grid_t() : nx(0), ny(0), x0(0.0), y0(0.0), sx(0.0), sy(0.0) {}
+
+	void build(unsigned start, unsigned end, float cell_sz) {
+		unsigned const max_cells_per_dim(256);
+		cube_t bcube;
+		bool first(1);
+
+		for (unsigned i = start; i < end; ++i) {
+			if (waypoints[i].disabled) continue;
+			if (first) {bcube.set_from_point(waypoints[i].pos); first = 0;} else {bcube.union_with_pt(waypoints[i].pos);}
+		}
+		nx = ny = 0;
+		cell_start.clear();
+		ixs.clear();
+		if (first) return; // no waypoints
+		x0 = bcube.x1(); y0 = bcube.y1();
+		nx = max(1U, min(max_cells_per_dim, unsigned(ceil((bcube.x2() - x0)/cell_sz))));
+		ny = max(1U, min(max_cells_per_dim, unsigned(ceil((bcube.y2() - y0)/cell_sz))));
+		sx = nx/max((bcube.x2() - x0), TOLERANCE);
+		sy = ny/max((bcube.y2() - y0), TOLERANCE);
+		cell_start.resize(nx*ny+1, 0);
+
+		for (unsigned i = start; i < end; ++i) { // count
+			if (!waypoints[i].disabled) {++cell_start[get_y(waypoints[i].pos.y)*nx + get_x(waypoints[i].pos.x) + 1];}
+		}
+		for (unsigned c = 0; c < nx*ny; ++c) {cell_start[c+1] += cell_start[c];} // prefix sum
+		vector<unsigned> pos(cell_start.begin(), cell_start.end()-1);
+		ixs.resize(cell_start.back());
+
+		for (unsigned i = start; i < end; ++i) { // fill, in increasing index order within each cell
+			if (!waypoints[i].disabled) {ixs[pos[get_y(waypoints[i].pos.y)*nx + get_x(waypoints[i].pos.x)]++] = i;}
+		}
+	}
+	// returns the waypoints in all cells within dist of pos in x/y, in increasing index order
+	void query(point const &pos, float dist, vector<unsigned> &out) const {
+		out.clear();
+		if (nx == 0) return;
+		unsigned const xa(get_x(pos.x - dist)), xb(get_x(pos.x + dist)), ya(get_y(pos.y - dist)), yb(get_y(pos.y + dist));
+
+		for (unsigned y = ya; y <= yb; ++y) {
+			for (unsigned x = xa; x <= xb; ++x) {
+				unsigned const c(y*nx + x);
+				out.insert(out.end(), ixs.begin()+cell_start[c], ixs.begin()+cell_start[c+1]);
+			}
+		}
+		sort(out.begin(), out.end()); // same order as a linear scan over waypoints
+	}
+};
+
+
+// ********** waypoint graph cache **********
+
+
+// hash of everything that waypoint connectivity depends on: waypoints, static cobjs, mesh, water, and player size/step parameters
+uint64_t get_waypoint_scene_hash() {
+
+	uint64_t hash(14695981039346656037ULL); // FNV-1a
+	auto add = [&hash](void const *data, size_t sz) {
+		for (size_t i = 0; i < sz; ++i) {hash ^= ((unsigned char const *)data)[i]; hash *= 1099511628211ULL;}
+	};
+	float const params[6] = {object_types[WAYPOINT].radius, C_STEP_HEIGHT, STEP_SIZE_MULT, MAX_FALL_DIST_MULT, water_plane_z, (float)(temperature <= W_FREEZE_POINT)};
+	int const mesh_params[3] = {MESH_X_SIZE, MESH_Y_SIZE, DISABLE_WATER};
+	add(params, sizeof(params));
+	add(mesh_params, sizeof(mesh_params));
+	for (int y = 0; y < MESH_Y_SIZE; ++y) {add(mesh_height[y], MESH_X_SIZE*sizeof(float));}
+	unsigned const num_waypoints((unsigned)waypoints.size());
+	add(&num_waypoints, sizeof(num_waypoints));
+
+	for (waypoint_t const &w : waypoints) {
+		add(&w.pos, sizeof(point));
+		add(&w.connected_to, sizeof(int));
+		add(&w.disabled, sizeof(bool));
+	}
+	for (coll_obj const &c : coll_objects) {
+		if (c.status != COLL_STATIC) continue;
+		add(&c.type, sizeof(c.type));
+		add(&c.platform_id, sizeof(c.platform_id));
+		add(&c.cp.flags, sizeof(c.cp.flags));
+		add(c.d, sizeof(c.d));
+		float const sizes[3] = {c.radius, c.radius2, c.thickness};
+		add(sizes, sizeof(sizes));
+		if (c.type == COLL_POLYGON) {add(c.points, c.npoints*sizeof(point));}
+	}
+	return hash;
+}
+
+// cache file: header followed by the number of next waypoints and then the next waypoint indices for each waypoint
+struct waypoint_cache_header_t { // size = 24
+	unsigned magic, version, num_waypoints, num_edges;
+	uint64_t scene_hash;
+	waypoint_cache_header_t(unsigned num_waypoints_=0, unsigned num_edges_=0, uint64_t scene_hash_=0) :
+		magic(0x43545057), version(1), num_waypoints(num_waypoints_), num_edges(num_edges_), scene_hash(scene_hash_) {}
+};
+
+bool read_waypoint_cache() {
+
+	FILE *fp(fopen(waypoint_cache_fn.c_str(), "rb"));
+	if (fp == nullptr) return 0; // no cache, not an error
+	waypoint_cache_header_t const expected((unsigned)waypoints.size(), 0, get_waypoint_scene_hash());
+	waypoint_cache_header_t header;
+	bool ok(fread(&header, sizeof(header), 1, fp) == 1 && header.magic == expected.magic && header.version == expected.version &&
+		header.num_waypoints == expected.num_waypoints && header.scene_hash == expected.scene_hash);
+	vector<waypt_adj_vect> next(header.num_waypoints);
+
+	for (unsigned i = 0; i < header.num_waypoints && ok; ++i) {
+		wpt_ix_t num(0);
+		ok = (fread(&num, sizeof(wpt_ix_t), 1, fp) == 1);
+		if (!ok || num == 0) continue;
+		next[i].resize(num);
+		ok = (fread(next[i].data(), sizeof(wpt_ix_t), num, fp) == num);
+		for (wpt_ix_t ix : next[i]) {ok &= (ix < header.num_waypoints && ix != i);}
+	}
+	checked_fclose(fp);
+
+	if (!ok) {
+		cout << "Waypoint cache file " << waypoint_cache_fn << " is invalid or from a different scene; regenerating waypoint graph" << endl;
+		return 0;
+	}
+	unsigned num_edges(0);
+
+	for (unsigned i = 0; i < waypoints.size(); ++i) {
+		waypoints[i].next_wpts.swap(next[i]);
+		waypoints[i].prev_wpts.clear();
+	}
+	for (unsigned i = 0; i < waypoints.size(); ++i) {
+		for (wpt_ix_t ix : waypoints[i].next_wpts) {waypoints[ix].prev_wpts.push_back(i); ++num_edges;}
+	}
+	cout << "Read " << waypoints.size() << " waypoints with " << num_edges << " edges from cache file " << waypoint_cache_fn << endl;
+	return 1;
+}
+
+bool write_waypoint_cache() {
+
+	unsigned num_edges(0);
+	for (waypoint_t const &w : waypoints) {num_edges += (unsigned)w.next_wpts.size();}
+	FILE *fp(fopen(waypoint_cache_fn.c_str(), "wb"));
+	if (fp == nullptr) {cerr << "Error: Failed to open waypoint cache file " << waypoint_cache_fn << " for writing" << endl; return 0;}
+	waypoint_cache_header_t const header((unsigned)waypoints.size(), num_edges, get_waypoint_scene_hash());
+	bool ok(fwrite(&header, sizeof(header), 1, fp) == 1);
+
+	for (auto w = waypoints.begin(); w != waypoints.end() && ok; ++w) {
+		wpt_ix_t const num((wpt_ix_t)w->next_wpts.size());
+		ok = (fwrite(&num, sizeof(wpt_ix_t), 1, fp) == 1 && fwrite(w->next_wpts.data(), sizeof(wpt_ix_t), num, fp) == num);
+	}
+	checked_fclose(fp);
+	if (!ok) {cerr << "Error writing waypoint cache file " << waypoint_cache_fn << endl; return 0;}
+	return 1;
+}
+
+
 class waypoint_builder {
 
 	float const radius, size_thresh;
@@ -421,48 +586,72 @@ public:
 	}
 
 	void connect_all_waypoints() {
-		connect_waypoints(0, (unsigned)waypoints.size(), 0, (unsigned)waypoints.size(), 1, 0);
+		unsigned const num((unsigned)waypoints.size());
+		if (!waypoint_cache_fn.empty() && read_waypoint_cache()) return; // graph loaded from cache
+		connect_waypoints(0, num, 0, num, 1, 0);
+		if (!waypoint_cache_fn.empty()) {write_waypoint_cache();}
 	}
 
+	// conservative upper bound on the length of an edge that can pass is_point_reachable() (2x for collision pushout)
+	float get_max_reach_dist() const {return 2.0f*((MAX_REACH_STEPS + 1)*STEP_SIZE_MULT + 1.0f)*radius;}
+
+	// Note: deterministic - each pass reads only state that isn't modified by that pass and writes only the output for its own waypoint
 	void connect_waypoints(unsigned from_start, unsigned from_end, unsigned to_start,
 		unsigned to_end, bool verbose, bool fast)
 	{
-		unsigned visible(0), cand_edges(0), num_edges(0), tot_steps(0);
-		float const fast_dmax(0.25f*(X_SCENE_SIZE + Y_SCENE_SIZE));
-		for (int i = from_start; i < (int)from_end; ++i) {waypoints[i].next_valid = 0;}
-		vector<pair<float, unsigned> > cands;
-
-		#pragma omp parallel for schedule(dynamic,1) private(cands) // is this fully thread safe? it's not determinstic across threads
-		for (int i = from_start; i < (int)from_end; ++i) {
-			assert(i < (int)waypoints.size());
-			if (waypoints[i].disabled) continue;
-			point const start(waypoints[i].pos);
+		unsigned visible(0), cand_edges(0), num_edges(0), num_pruned(0), tot_steps(0);
+		float const fast_dmax(0.25f*(X_SCENE_SIZE + Y_SCENE_SIZE)), dmax(fast ? min(fast_dmax, get_max_reach_dist()) : get_max_reach_dist());
+		unsigned const num_from((from_end > from_start) ? (from_end - from_start) : 0);
+		vector<vector<pair<float, unsigned> > > cands(num_from); // visible target waypoints, closest to furthest
+		vector<waypt_adj_vect> new_next(num_from), pruned_next(num_from); // selected edges, and the selected edges with redundant edges removed
+		vector<unsigned> grid_cands;
+		waypoint_grid_t grid;
+		grid.build(to_start, to_end, dmax);
+
+		// pass 1: find visible candidates using the grid to skip waypoints that are too far away to be reachable
+		#pragma omp parallel for schedule(dynamic,1) private(grid_cands) reduction(+:visible)
+		for (int n = 0; n < (int)num_from; ++n) {
+			unsigned const i(from_start + n);
+			assert(i < waypoints.size());
+			waypoint_t const &w(waypoints[i]);
+			if (w.disabled) continue;
+			point const start(w.pos);
 			int cindex(-1);
-			cands.clear();
+			vector<pair<float, unsigned> > &cand(cands[n]);
 
-			for (unsigned j = to_start; j < to_end; ++j) {
-				if (i == (int)j || waypoints[j].disabled) continue;
+			if (w.connected_to >= (int)to_start && w.connected_to < (int)to_end && w.connected_to != (int)i && !waypoints[w.connected_to].disabled) {
+				cand.push_back(make_pair(CAMERA_RADIUS, (unsigned)w.connected_to)); // connected by a teleporter: small but nonzero distance
+			}
+			grid.query(start, dmax, grid_cands);
 
-				if (waypoints[i].connected_to == (int)j) { // connected by a teleporter
-					cands.push_back(make_pair(CAMERA_RADIUS, j)); // small but nonzero distance
-					continue;
-				}
+			for (unsigned j : grid_cands) {
+				if (i == j || waypoints[j].disabled || w.connected_to == (int)j) continue; // teleporter connections were added above
 				point const end(waypoints[j].pos);
+				if (!dist_less_than(start, end, dmax)) continue; // too far away
 				if (cindex >= 0 && coll_objects.get_cobj(cindex).line_intersect(start, end)) continue; // hit last cobj
-				if (fast && !dist_less_than(start, end, fast_dmax)) continue; // too far away
 				if (check_coll_line(start, end, cindex, -1, 1, 0, 1, 0, 1)) continue; // no line of sight (skip dynamic/movable)
-				cands.push_back(make_pair(p2p_dist_sq(start, end), j));
+				cand.push_back(make_pair(p2p_dist_sq(start, end), j));
 				++visible;
 			}
-			sort(cands.begin(), cands.end()); // closest to furthest
-			waypt_adj_vect &next(waypoints[i].next_wpts);
-
-			for (unsigned j = 0; j < cands.size(); ++j) {
-				unsigned const k(cands[j].second);
+			sort(cand.begin(), cand.end()); // closest to furthest
+		} // for n
+
+		// pass 2: select reachable edges
+		#pragma omp parallel for schedule(dynamic,1) reduction(+:cand_edges, num_edges, tot_steps)
+		for (int n = 0; n < (int)num_from; ++n) {
+			unsigned const i(from_start + n);
+			waypoint_t const &w(waypoints[i]);
+			if (w.disabled) continue;
+			point const start(w.pos);
+			waypt_adj_vect next(w.next_wpts); // start with the existing edges
+			vector<pair<float, unsigned> > const &cand(cands[n]);
+
+			for (unsigned j = 0; j < cand.size(); ++j) {
+				unsigned const k(cand[j].second);
 				assert(k < waypoints.size());
 				point const end(waypoints[k].pos);
 				vector3d const dir(end - start), dir_xy(vector3d(dir.x, dir.y, 0.0).get_norm());
-				bool colinear(0), redundant(0);
+				bool colinear(0);
 
 				for (unsigned l = 0; l < next.size() && !colinear; ++l) {
 					assert(next[l] < waypoints.size());
@@ -472,31 +661,53 @@ public:
 				}
 				if (colinear) continue;
 
-				for (unsigned l = 0; l < next.size() && !redundant; ++l) {
-					assert(next[l] < waypoints.size());
-					if (!waypoints[next[l]].next_valid) continue; // another thread is working on this waypoint, so don't use it
-					waypt_adj_vect const &next_next(waypoints[next[l]].next_wpts);
-					point const &wl(waypoints[next[l]].pos);
-
-					for (unsigned m = 0; m < next_next.size() && !redundant; ++m) {
-						assert(next_next[m] < waypoints.size());
-						point const &wm(waypoints[next_next[m]].pos);
-						redundant = (next_next[m] == k && (p2p_dist(start, wl) + p2p_dist(wl, wm) < 1.02f*p2p_dist(start, wm)));
-					}
-				}
-				if (redundant) continue;
-
-				if (waypoints[i].connected_to == (int)k || is_point_reachable(start, end, tot_steps, STEP_SIZE_MULT, 1)) {
+				if (w.connected_to == (int)k || is_point_reachable(start, end, tot_steps, STEP_SIZE_MULT, 1)) {
 					next.push_back(k);
 					++num_edges;
 				}
 				++cand_edges;
 			} // for j
-			waypoints[i].next_valid = 1;
-		}
+			new_next[n].swap(next);
+		} // for n
+
+		// pass 3: remove new edges i=>k that are redundant with a path i=>l=>k of the selected edges from pass 2;
+		// both edges of the path must be shorter than i=>k, so that any removed edge can be replaced by a path of kept edges
+		#pragma omp parallel for schedule(dynamic,1) reduction(+:num_pruned)
+		for (int n = 0; n < (int)num_from; ++n) {
+			unsigned const i(from_start + n);
+			waypoint_t const &w(waypoints[i]);
+			if (w.disabled) continue;
+			point const start(w.pos);
+			waypt_adj_vect const &next(new_next[n]);
+			waypt_adj_vect &pruned(pruned_next[n]);
+
+			for (unsigned j = 0; j < next.size(); ++j) {
+				unsigned const k(next[j]);
+				bool redundant(0);
+
+				if (j >= w.next_wpts.size() && w.connected_to != (int)k) { // only new edges, and not teleporters
+					point const &end(waypoints[k].pos);
+					float const dist(p2p_dist(start, end));
+
+					for (unsigned l = 0; l < next.size() && !redundant; ++l) {
+						unsigned const nl(next[l]);
+						if (nl == k) continue;
+						waypt_adj_vect const &next_next((nl >= from_start && nl < from_end) ? new_next[nl - from_start] : waypoints[nl].next_wpts);
+						if (find(next_next.begin(), next_next.end(), k) == next_next.end()) continue; // no edge l=>k
+						point const &wl(waypoints[nl].pos);
+						float const d1(p2p_dist(start, wl)), d2(p2p_dist(wl, end));
+						redundant = (d1 < dist && d2 < dist && d1 + d2 < 1.02f*dist);
+					}
+				}
+				if (redundant) {++num_pruned;} else {pruned.push_back(k);}
+			} // for j
+		} // for n
+		num_edges -= num_pruned;
+
 		for (unsigned i = from_start; i < from_end; ++i) {
 			if (waypoints[i].disabled) continue;
-			waypt_adj_vect const &next(waypoints[i].next_wpts);
+			waypt_adj_vect &next(waypoints[i].next_wpts);
+			next.swap(pruned_next[i - from_start]);
 
 			for (unsigned j = 0; j < next.size(); ++j) {
 				assert(next[j] < waypoints.size());
@@ -540,7 +751,7 @@ public:
 			float const d(fabs((end.x - start.x)*(start.y - cur.y) - (end.y - start.y)*(start.x - cur.x))*dmag_inv); // point-line dist
 			if (d > 2.0*radius) return 0; // path deviation too long
 			++tot_steps;
-			if (tot_steps > init_steps + 10000) return 0; // too many steps
+			if (tot_steps > init_steps + MAX_REACH_STEPS) return 0; // too many steps
 			//waypoints.push_back(waypoint_t(cur)); // testing
 		}
 		return 1; // success
@@ -572,24 +783,138 @@ bool find_closest_waypoint(point const &pos, unsigned &closest, bool check_visib
 // ********** waypoint_search **********
 
 
-struct waypoint_cache {
+unsigned waypoint_search_budget(0); // max A* waypoint expansions per frame across all searches; 0 = unlimited
+unsigned const MAX_HEURISTIC_GOALS = 64; // for goal sets larger than this, the min-distance heuristic is too expensive and isn't used
+
+
+// reusable A* state for all waypoints: an indexed binary min-heap (with decrease-key) of open waypoints ordered by f_score;
+// node state is tagged with the search index so that nothing needs to be cleared between searches
+class waypoint_astar_engine_t {
+
+	struct node_t { // size = 24
+		unsigned search_ix, heap_pos;
+		int came_from;
+		float g_score, h_score, f_score;
+		node_t() : search_ix(0), heap_pos(0), came_from(-1), g_score(0.0), h_score(0.0), f_score(0.0) {}
+	};
+	static unsigned const CLOSED = ~0U; // heap_pos of closed nodes
+	vector<node_t> nodes;
+	vector<unsigned> heap; // waypoint indices
+	unsigned search_ix, frame_num, frame_expansions;
+
+	bool heap_less(unsigned a, unsigned b) const {return (nodes[heap[a]].f_score < nodes[heap[b]].f_score);}
+	void heap_swap(unsigned a, unsigned b) {swap(heap[a], heap[b]); nodes[heap[a]].heap_pos = a; nodes[heap[b]].heap_pos = b;}
 
-	vector<unsigned> open, closed; // tentative/already evaluated nodes
-	unsigned call_ix; // incremented each run_a_star() call
-	waypoint_cache() : call_ix(0) {}
+	void sift_up(unsigned pos) {
+		while (pos > 0) {
+			unsigned const parent((pos - 1) >> 1);
+			if (!heap_less(pos, parent)) break;
+			heap_swap(pos, parent);
+			pos = parent;
+		}
+	}
+	void sift_down(unsigned pos) {
+		while (1) {
+			unsigned const c1(2*pos + 1), c2(c1 + 1);
+			if (c1 >= heap.size()) break;
+			unsigned const c((c2 < heap.size() && heap_less(c2, c1)) ? c2 : c1);
+			if (!heap_less(c, pos)) break;
+			heap_swap(pos, c);
+			pos = c;
+		}
+	}
+public:
+	vector<point> goal_pts; // cached goal waypoint positions for goal modes 1-3
+	int goal_pts_mode, goal_pts_frame;
+
+	waypoint_astar_engine_t() : search_ix(0), frame_num(0), frame_expansions(0), goal_pts_mode(-1), goal_pts_frame(-1) {}
+
+	void begin_search() {
+		if (nodes.size() < waypoints.size()) {nodes.resize(waypoints.size());}
+		heap.clear();
+		++search_ix;
+	}
+	bool empty() const {return heap.empty();}
+	bool is_closed(unsigned i) const {return (nodes[i].search_ix == search_ix && nodes[i].heap_pos == CLOSED);}
+	node_t const &get_node(unsigned i) const {assert(i < nodes.size() && nodes[i].search_ix == search_ix); return nodes[i];}
+
+	// adds i to the open set, or updates its path if the new one is shorter; returns true if added or updated
+	bool update(unsigned i, float g_score, float h_score, int came_from) {
+		assert(i < nodes.size());
+		node_t &n(nodes[i]);
+
+		if (n.search_ix != search_ix) { // first visit in this search
+			n.search_ix = search_ix;
+			n.heap_pos  = (unsigned)heap.size();
+			heap.push_back(i);
+		}
+		else if (n.heap_pos == CLOSED || g_score >= n.g_score) return 0; // already closed or not better
+		n.came_from = came_from;
+		n.g_score   = g_score;
+		n.h_score   = h_score;
+		n.f_score   = g_score + h_score;
+		sift_up(n.heap_pos); // f_score can only decrease
+		return 1;
+	}
+	unsigned pop_min() { // moves the open node with the lowest f_score to the closed set
+		assert(!heap.empty());
+		unsigned const i(heap.front());
+		heap_swap(0, (unsigned)heap.size()-1);
+		heap.pop_back();
+		if (!heap.empty()) {sift_down(0);}
+		nodes[i].heap_pos = CLOSED;
+		return i;
+	}
+	void get_path(unsigned end, vector<unsigned> &path) const {
+		assert(path.empty());
+		for (int i = end; i >= 0; i = get_node(i).came_from) {path.push_back(i);}
+		reverse(path.begin(), path.end());
+	}
+	unsigned get_remaining_budget() {
+		if (waypoint_search_budget == 0) return ~0U; // unlimited
+		if (unsigned(frame_counter) != frame_num) {frame_num = frame_counter; frame_expansions = 0;} // new frame
+		return ((frame_expansions < waypoint_search_budget) ? (waypoint_search_budget - frame_expansions) : 0);
+	}
+	void add_expansions(unsigned num) {frame_expansions += num;}
 };
 
-waypoint_cache global_wpt_cache;
+waypoint_astar_engine_t global_astar_engine;
 
 
 class waypoint_search {
 
 	wpt_goal goal;
 	waypoint_builder wb;
-	waypoint_cache &wc;
-
-	float get_h_dist(unsigned cur) const {
-		return ((goal.mode >= 4) ? p2p_dist(waypoints[cur].pos, goal.pos) : 0.0);
+	waypoint_astar_engine_t &ae;
+	bool use_heuristic;
+
+	float get_h_dist(unsigned cur) const { // distance to the closest goal
+		if (!use_heuristic) return 0.0;
+		point const &pos(waypoints[cur].pos);
+		if (goal.mode >= 4) return p2p_dist(pos, waypoints[goal.wpt].pos);
+		float dmin_sq(0.0);
+
+		for (auto i = ae.goal_pts.begin(); i != ae.goal_pts.end(); ++i) {
+			float const dist_sq(p2p_dist_sq(pos, *i));
+			if (i == ae.goal_pts.begin() || dist_sq < dmin_sq) {dmin_sq = dist_sq;}
+		}
+		return sqrt(dmin_sq);
+	}
+	void update_goal_pts() { // goal set for modes 1-3, recomputed once per frame
+		// teleporter edges have a cost of only CAMERA_RADIUS, which would make the distance to the goal inadmissible
+		if (!teleporters[0].empty()) {use_heuristic = 0; return;}
+		if (goal.mode >= 4) {use_heuristic = 1; return;}
+
+		if (ae.goal_pts_mode != goal.mode || ae.goal_pts_frame != frame_counter) {
+			ae.goal_pts.clear();
+			ae.goal_pts_mode  = goal.mode;
+			ae.goal_pts_frame = frame_counter;
+
+			for (unsigned i = 0; i < waypoints.size(); ++i) {
+				if (!waypoints[i].disabled && is_goal(i)) {ae.goal_pts.push_back(waypoints[i].pos);}
+			}
+		}
+		use_heuristic = (!ae.goal_pts.empty() && ae.goal_pts.size() <= MAX_HEURISTIC_GOALS);
 	}
 	bool is_goal(unsigned cur) const {
 		waypoint_t const &w(waypoints[cur]);
@@ -610,11 +935,6 @@ class waypoint_search {
 		}
 		return 0;
 	}
-	void reconstruct_path(unsigned cur, vector<unsigned> &path) {
-		assert(cur < waypoints.size());
-		if (waypoints[cur].came_from >= 0) {reconstruct_path(waypoints[cur].came_from, path);}
-		path.push_back(cur);
-	}
 	void on_a_star_return(wpt_goal const &goal, bool orig_has_wpt_goal) {
 		if (goal.mode == 7) {
 			wb.remove_last_waypoint(); // goal position - remove temp waypoint
@@ -623,9 +943,10 @@ class waypoint_search {
 	}
 
 public:
-	waypoint_search(wpt_goal const &goal_, waypoint_cache &wc_) : goal(goal_), wc(wc_) {}
+	waypoint_search(wpt_goal const &goal_, waypoint_astar_engine_t &ae_) : goal(goal_), ae(ae_), use_heuristic(0) {}
 
-	// returns min distance to goal following connected waypoints along path
+	// returns min distance to goal following connected waypoints along path;
+	// if the per-frame search budget runs out, path is a partial path toward the waypoint closest to the goal
 	float run_a_star(vector<pair<unsigned, float> > const &start, vector<unsigned> &path, set<unsigned> const &wps_penalty) {
 		if (!goal.is_reachable()) return 0.0; // nothing to do
 		assert(path.empty());
@@ -645,65 +966,56 @@ public:
 		if (goal.mode == 7) {has_wpt_goal = 1;}
 		//cout << "start: " << start.size() << ", goal: mode: " << goal.mode << ", pos: " << goal.pos.str() << ", wpt: " << goal.wpt << endl;
 		if (int(goal.wpt) < 0) return 0.0; // no current waypoint, maybe none visible (this code may be unreachable)
-		std::priority_queue<pair<float, unsigned> > open_queue;
-		wc.open.resize(waypoints.size(), 0); // already resized after the first call
-		wc.closed.resize(waypoints.size(), 0);
-		++wc.call_ix;
+		update_goal_pts();
+		ae.begin_search();
 
 		for (vector<pair<unsigned, float> >::const_iterator i = start.begin(); i != start.end(); ++i) {
 			unsigned const ix(i->first);
 			assert(ix < waypoints.size());
-			waypoint_t &w(waypoints[ix]);
-			w.g_score   = i->second; // cost from start along best known path
-			w.h_score   = get_h_dist(ix);
-			//if (wps_penalty.find(ix) != wps_penalty.end()) {w.h_score *= 10.0;} // distance penalty for this waypoint
-			w.f_score   = w.h_score; // estimated total cost from start to goal through current
-			w.came_from = -1;
+			float const h_score(get_h_dist(ix));
 
 			if (is_goal(ix)) { // already at the goal
 				path.push_back(ix);
 				on_a_star_return(goal, orig_has_wpt_goal);
-				return w.f_score;
+				return h_score;
 			}
-			wc.open[ix] = wc.call_ix;
-			open_queue.push(make_pair(-w.f_score, ix));
+			ae.update(ix, i->second, h_score, -1); // g_score is the cost from the search start point
 		} // for i
 		if (goal.mode >= 4) {
 			assert(goal.wpt < waypoints.size());
 			if (waypoints[goal.wpt].unreachable()) {on_a_star_return(goal, orig_has_wpt_goal); return 0.0;} // goal has no incoming edges - unreachable
 		}
+		unsigned const budget(ae.get_remaining_budget());
+		unsigned num_expanded(0);
+		int closest(-1); // expanded waypoint with the lowest h_score, for partial paths
 		float min_dist(0.0);
 
-		while (!open_queue.empty()) {
-			unsigned const cur(open_queue.top().second);
-			open_queue.pop();
-			if (wc.closed[cur] == wc.call_ix) continue; // already closed (duplicate)
+		while (!ae.empty()) {
+			if (num_expanded >= budget) { // out of time for this frame; head toward the closest waypoint found and continue the search later
+				if (use_heuristic && closest >= 0 && ae.get_node(closest).came_from >= 0) {ae.get_path(closest, path);}
+				break;
+			}
+			unsigned const cur(ae.pop_min());
+			++num_expanded;
 			waypoint_t const &cw(waypoints[cur]);
+			float const g_score(ae.get_node(cur).g_score), h_score(ae.get_node(cur).h_score);
 
 			if (is_goal(cur)) {
-				reconstruct_path(cur, path);
-				min_dist = cw.f_score;
+				ae.get_path(cur, path);
+				min_dist = ae.get_node(cur).f_score;
 				break; // we're done
 			}
-			assert(wc.closed[cur] != wc.call_ix);
-			wc.closed[cur] = wc.call_ix;
-			wc.open[cur]   = 0;
+			if (closest < 0 || h_score < ae.get_node(closest).h_score) {closest = cur;}
 
 			for (waypt_adj_vect::const_iterator i = cw.next_wpts.begin(); i != cw.next_wpts.end(); ++i) {
 				assert(*i < waypoints.size());
-				if (wc.closed[*i] == wc.call_ix) continue; // already closed (duplicate)
-				waypoint_t &wn(waypoints[*i]);
+				if (ae.is_closed(*i)) continue; // already closed
 				// if not connected by a teleporter, use distance between the waypoints; otherswise, use a small but nonzero value
-				float const new_g_score(cw.g_score + ((cw.connected_to == *i) ? CAMERA_RADIUS : p2p_dist(cw.pos, wn.pos)));
-				if (wc.open[*i] != wc.call_ix) {wc.open[*i] = wc.call_ix;}
-				else if (new_g_score >= wn.g_score) continue; // not better
-				wn.came_from = cur;
-				wn.g_score   = new_g_score;
-				wn.h_score   = get_h_dist(*i);
-				wn.f_score   = wn.g_score + wn.h_score;
-				open_queue.push(make_pair(-wn.f_score, *i));
+				float const new_g_score(g_score + ((cw.connected_to == *i) ? CAMERA_RADIUS : p2p_dist(cw.pos, waypoints[*i].pos)));
+				ae.update(*i, new_g_score, get_h_dist(*i), cur);
 			} // for i
 		} // end while()
+		ae.add_expansions(num_expanded);
 		on_a_star_return(goal, orig_has_wpt_goal);
 		return min_dist;
 	}
@@ -745,7 +1057,7 @@ int find_optimal_next_waypoint(unsigned cur, wpt_goal const &goal, set<unsigned>
 	if (!goal.is_reachable()) return -1; // nothing to do
 	//RESET_TIME;
 	vector<unsigned> path;
-	waypoint_search ws(goal, global_wpt_cache);
+	waypoint_search ws(goal, global_astar_engine);
 	vector<pair<unsigned, float> > start;
 	start.push_back(make_pair(cur, 0.0));
 	ws.run_a_star(start, path, wps_penalty);
@@ -786,7 +1098,7 @@ void find_optimal_waypoint(point const &pos, vector<od_data> &oddatav, wpt_goal
 			start.push_back(make_pair(id, dist));
 		}
 	}
-	waypoint_search ws(goal, global_wpt_cache);
+	waypoint_search ws(goal, global_astar_engine);
 	vector<unsigned> path;
 	ws.run_a_star(start, path, set<unsigned>());
 	//PRINT_TIME("Find Optimal Waypoint");